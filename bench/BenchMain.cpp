@@ -0,0 +1,353 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#endif
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Assets.h"
+#include "Camera.h"
+#include "JobSystem.h"
+#include "MeshBvh.h"
+#include "MeshSimplifier.h"
+#include "ObjLoader.h"
+#include "VertexFormat.h"
+
+#include "Benchmark.h"
+
+//Portable microbenchmarks of the CPU side of loading and drawing: the targa and OBJ
+//loaders, what SetupObject does to a mesh before it reaches the GPU, mesh processing
+//and the camera math run every frame. Inputs are generated at a few sizes, nothing
+//from assets/ is needed.
+//
+//    bench [-filter text] [-seconds s] [-data dir] [-out results.csv] [-baseline old.csv] [-tolerance 0.1]
+//
+//With -baseline the run is compared against an earlier -out file and the exit code is 1
+//when anything got slower than the tolerance allows or allocates more than it did.
+
+static void MakeDirectory(const std::string &path)
+{
+#if defined(_WIN32)
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+static size_t FileSize(const std::string &path)
+{
+    struct stat info = {};
+    return stat(path.c_str(), &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+}
+
+//Uncompressed 32 bit targa with a gradient, stored bottom up like the files LoadTarga reads
+static bool WriteTarga(const std::string &path, unsigned int size)
+{
+    unsigned char header[18] = {};
+    header[2] = 2;
+    header[12] = static_cast<unsigned char>(size & 0xff);
+    header[13] = static_cast<unsigned char>(size >> 8);
+    header[14] = static_cast<unsigned char>(size & 0xff);
+    header[15] = static_cast<unsigned char>(size >> 8);
+    header[16] = 32;
+    header[17] = 8;
+
+    std::vector<unsigned char> pixels(size * size * 4);
+    for (unsigned int y = 0; y < size; y++)
+    {
+        for (unsigned int x = 0; x < size; x++)
+        {
+            unsigned char *pixel = &pixels[(y * size + x) * 4];
+            pixel[0] = static_cast<unsigned char>(x);
+            pixel[1] = static_cast<unsigned char>(y);
+            pixel[2] = static_cast<unsigned char>(x ^ y);
+            pixel[3] = 255;
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(pixels.data()), static_cast<std::streamsize>(pixels.size()));
+    return static_cast<bool>(file);
+}
+
+static float GridHeight(unsigned int x, unsigned int z)
+{
+    return 0.5f * sinf(x * 0.31f) * cosf(z * 0.17f) + 0.1f * sinf((x + z) * 1.3f);
+}
+
+//quads x quads grid of rolling hills as an OBJ file with positions, texcoords, normals and quad faces
+static bool WriteGridObj(const std::string &path, unsigned int quads)
+{
+    std::ofstream file(path);
+    const unsigned int side = quads + 1;
+    char line[128] = {};
+    for (unsigned int z = 0; z < side; z++)
+    {
+        for (unsigned int x = 0; x < side; x++)
+        {
+            snprintf(line, sizeof(line), "v %.5f %.5f %.5f\n", x * 0.1f, GridHeight(x, z), z * 0.1f);
+            file << line;
+        }
+    }
+    for (unsigned int z = 0; z < side; z++)
+    {
+        for (unsigned int x = 0; x < side; x++)
+        {
+            snprintf(line, sizeof(line), "vt %.5f %.5f\n", static_cast<float>(x) / quads, static_cast<float>(z) / quads);
+            file << line;
+        }
+    }
+    file << "vn 0 1 0\n";
+    for (unsigned int z = 0; z < quads; z++)
+    {
+        for (unsigned int x = 0; x < quads; x++)
+        {
+            const unsigned int a = z * side + x + 1;
+            snprintf(line, sizeof(line), "f %u/%u/1 %u/%u/1 %u/%u/1 %u/%u/1\n", a, a, a + side, a + side, a + side + 1, a + side + 1, a + 1, a + 1);
+            file << line;
+        }
+    }
+    return static_cast<bool>(file);
+}
+
+//The same grid built in memory, the way the loaders hand meshes over
+static void MakeGridMesh(unsigned int quads, MeshData &mesh)
+{
+    const unsigned int side = quads + 1;
+    mesh = MeshData();
+    mesh.vertices.resize(side * side);
+    for (unsigned int z = 0; z < side; z++)
+    {
+        for (unsigned int x = 0; x < side; x++)
+        {
+            VERTEX &vertex = mesh.vertices[z * side + x];
+            vertex.position = XMFLOAT3(x * 0.1f, GridHeight(x, z), z * 0.1f);
+            XMStoreFloat3(&vertex.normal, XMVector3Normalize(XMVectorSet(GridHeight(x, z) - GridHeight(x + 1, z), 0.2f,
+                GridHeight(x, z) - GridHeight(x, z + 1), 0.0f)));
+            vertex.texture = XMFLOAT2(static_cast<float>(x) / quads, static_cast<float>(z) / quads);
+        }
+    }
+    for (unsigned int z = 0; z < quads; z++)
+    {
+        for (unsigned int x = 0; x < quads; x++)
+        {
+            const short a = static_cast<short>(z * side + x);
+            const short b = static_cast<short>(a + side);
+            const short quad[6] = { a, b, static_cast<short>(b + 1), a, static_cast<short>(b + 1), static_cast<short>(a + 1) };
+            mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+    }
+}
+
+static void BenchCamera(BenchRunner &runner)
+{
+    Camera camera;
+    camera.SetLens(0.25f * 3.1415926535f, 16.0f / 9.0f, 0.01f, 100.0f);
+    camera.LookAt(XMFLOAT3(0.0f, 2.0f, -5.0f), XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 1.0f, 0.0f));
+
+    runner.Run("camera/UpdateViewMatrix", 0, [&camera]()
+    {
+        camera.UpdateViewMatrix();
+        BenchSink(camera.GetLook().x);
+    });
+
+    //Turning back and forth keeps the basis from drifting far over millions of calls
+    float sign = 1.0f;
+    runner.Run("camera/Pitch", 0, [&camera, &sign]()
+    {
+        camera.Pitch(sign * 0.001f);
+        sign = -sign;
+        BenchSink(camera.GetUp().y);
+    });
+    runner.Run("camera/RotateY", 0, [&camera, &sign]()
+    {
+        camera.RotateY(sign * 0.001f);
+        sign = -sign;
+        BenchSink(camera.GetRight().x);
+    });
+    camera.UpdateViewMatrix();
+
+    runner.Run("camera/ViewProj", 0, [&camera]()
+    {
+        const XMMATRIX viewProj = camera.ViewProj();
+        BenchSink(XMVectorGetX(viewProj.r[0]));
+    });
+}
+
+static void BenchTarga(BenchRunner &runner, const std::string &directory)
+{
+    const unsigned int sizes[] = { 64, 256, 1024, 2048 };
+    for (unsigned int size : sizes)
+    {
+        const std::string path = directory + "/grid" + std::to_string(size) + ".tga";
+        if (!WriteTarga(path, size))
+        {
+            fprintf(stderr, "Couldn't write %s\n", path.c_str());
+            continue;
+        }
+
+        TextureData texture;
+        runner.Run("targa/" + std::to_string(size), FileSize(path), [&path, &texture]()
+        {
+            LoadTarga(path.c_str(), texture);
+            BenchSink(texture.pixels.data());
+        });
+    }
+}
+
+static void BenchObj(BenchRunner &runner, JobSystem &jobs, const std::string &directory)
+{
+    const unsigned int sizes[] = { 16, 64, 160 };
+    for (unsigned int quads : sizes)
+    {
+        const std::string path = directory + "/grid" + std::to_string(quads) + ".obj";
+        if (!WriteGridObj(path, quads))
+        {
+            fprintf(stderr, "Couldn't write %s\n", path.c_str());
+            continue;
+        }
+
+        const size_t bytes = FileSize(path);
+        MeshData mesh;
+        runner.Run("obj/" + std::to_string(quads), bytes, [&path, &mesh]()
+        {
+            LoadObj(path.c_str(), mesh, nullptr);
+            BenchSink(mesh.vertices.data());
+        });
+        runner.Run("obj/" + std::to_string(quads) + "/jobs", bytes, [&path, &mesh, &jobs]()
+        {
+            LoadObj(path.c_str(), mesh, &jobs);
+            BenchSink(mesh.vertices.data());
+        });
+    }
+}
+
+//What SetupObject does before the GPU gets involved: pack the vertex streams and find the bounds
+static void BenchSetupObject(BenchRunner &runner)
+{
+    const unsigned int sizes[] = { 16, 64, 160 };
+    for (unsigned int quads : sizes)
+    {
+        MeshData mesh;
+        MakeGridMesh(quads, mesh);
+        const size_t count = mesh.vertices.size();
+        std::vector<unsigned char> packed(count * SceneVertexFormat::Stride);
+
+        runner.Run("setup/" + std::to_string(quads), count * sizeof(VERTEX), [&mesh, &packed, count]()
+        {
+            SceneVertexFormat::PackStreams(mesh.vertices.data(), count, packed.data());
+
+            XMVECTOR boundsMin = XMLoadFloat3(&mesh.vertices[0].position);
+            XMVECTOR boundsMax = boundsMin;
+            for (size_t i = 1; i < count; i++)
+            {
+                const XMVECTOR position = XMLoadFloat3(&mesh.vertices[i].position);
+                boundsMin = XMVectorMin(boundsMin, position);
+                boundsMax = XMVectorMax(boundsMax, position);
+            }
+            BenchSink(XMVectorGetX(boundsMax - boundsMin));
+            BenchSink(packed.data());
+        });
+    }
+}
+
+static void BenchMeshProcessing(BenchRunner &runner, JobSystem &jobs)
+{
+    const unsigned int sizes[] = { 16, 64, 160 };
+    for (unsigned int quads : sizes)
+    {
+        MeshData source;
+        MakeGridMesh(quads, source);
+        const unsigned long long bytes = source.vertices.size() * sizeof(VERTEX) + source.indices.size() * sizeof(short);
+
+        //The copy is part of every run, it is small next to the simplifier
+        MeshData mesh;
+        runner.Run("lodchain/" + std::to_string(quads), bytes, [&source, &mesh]()
+        {
+            mesh = source;
+            BuildLodChain(mesh);
+            BenchSink(mesh.indices.data());
+        });
+
+        MeshBvh bvh;
+        const unsigned int indexCount = static_cast<unsigned int>(source.indices.size());
+        runner.Run("bvh/" + std::to_string(quads), bytes, [&source, &bvh, indexCount]()
+        {
+            bvh.Build(source.vertices.data(), sizeof(VERTEX), source.indices.data(), indexCount, nullptr);
+            BenchSink(&bvh);
+        });
+        runner.Run("bvh/" + std::to_string(quads) + "/jobs", bytes, [&source, &bvh, &jobs, indexCount]()
+        {
+            bvh.Build(source.vertices.data(), sizeof(VERTEX), source.indices.data(), indexCount, &jobs);
+            BenchSink(&bvh);
+        });
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string filter;
+    std::string directory = "benchdata";
+    std::string outPath;
+    std::string baselinePath;
+    double tolerance = 0.1;
+    double seconds = 0.5;
+    for (int i = 1; i < argc; i++)
+    {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "-filter") == 0 && hasValue) filter = argv[++i];
+        else if (strcmp(argv[i], "-data") == 0 && hasValue) directory = argv[++i];
+        else if (strcmp(argv[i], "-out") == 0 && hasValue) outPath = argv[++i];
+        else if (strcmp(argv[i], "-baseline") == 0 && hasValue) baselinePath = argv[++i];
+        else if (strcmp(argv[i], "-tolerance") == 0 && hasValue) tolerance = atof(argv[++i]);
+        else if (strcmp(argv[i], "-seconds") == 0 && hasValue) seconds = atof(argv[++i]);
+        else
+        {
+            fprintf(stderr, "Usage: %s [-filter text] [-seconds s] [-data dir] [-out results.csv] [-baseline old.csv] [-tolerance 0.1]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<BenchResult> baseline;
+    if (!baselinePath.empty() && !BenchRunner::ReadCsv(baselinePath, baseline))
+    {
+        fprintf(stderr, "Couldn't read the baseline %s\n", baselinePath.c_str());
+        return 2;
+    }
+
+    MakeDirectory(directory);
+    JobSystem jobs;
+    jobs.Init();
+
+    BenchRunner runner;
+    runner.SetFilter(filter);
+    runner.SetMinSeconds(seconds);
+    BenchCamera(runner);
+    BenchTarga(runner, directory);
+    BenchObj(runner, jobs, directory);
+    BenchSetupObject(runner);
+    BenchMeshProcessing(runner, jobs);
+
+    jobs.Shutdown();
+
+    if (!outPath.empty() && !runner.WriteCsv(outPath))
+    {
+        fprintf(stderr, "Couldn't write %s\n", outPath.c_str());
+        return 2;
+    }
+
+    if (!baselinePath.empty())
+    {
+        const unsigned int regressions = runner.Compare(baseline, tolerance);
+        printf("%u regressions over %.0f%%\n", regressions, 100.0 * tolerance);
+        return regressions > 0 ? 1 : 0;
+    }
+    return 0;
+}
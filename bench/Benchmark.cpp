@@ -0,0 +1,181 @@
+#include "Benchmark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+#include "MemoryTelemetry.h"
+
+static volatile float sFloatSink = 0.0f;
+static const void *volatile sPointerSink = nullptr;
+
+void BenchSink(float value)
+{
+    sFloatSink = sFloatSink + value;
+}
+
+void BenchSink(const void *pointer)
+{
+    sPointerSink = pointer;
+}
+
+BenchRunner::BenchRunner()
+{
+}
+
+BenchRunner::~BenchRunner()
+{
+}
+
+void BenchRunner::SetFilter(const std::string &filter)
+{
+    mFilter = filter;
+}
+
+void BenchRunner::SetMinSeconds(double seconds)
+{
+    mMinSeconds = seconds;
+}
+
+void BenchRunner::Run(const std::string &name, unsigned long long bytesPerOp, const std::function<void()> &body)
+{
+    if (!mFilter.empty() && name.find(mFilter) == std::string::npos)
+    {
+        return;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+
+    //One untimed call warms the caches and whatever the body sets up on first use
+    body();
+
+    //Batches double until one takes long enough, the last batch is the measurement
+    MemoryFrameStats memory;
+    unsigned long long batch = 1;
+    double seconds = 0.0;
+    while (true)
+    {
+        EndMemoryFrame(memory);
+        const Clock::time_point start = Clock::now();
+        for (unsigned long long i = 0; i < batch; i++)
+        {
+            body();
+        }
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        EndMemoryFrame(memory);
+
+        if (seconds >= mMinSeconds || batch >= (1ull << 40))
+        {
+            break;
+        }
+
+        //Aim a bit past the minimum so the next batch is usually the last
+        const double scale = seconds > 0.0 ? 1.2 * mMinSeconds / seconds : 100.0;
+        batch = static_cast<unsigned long long>(batch * (scale < 2.0 ? 2.0 : (scale > 100.0 ? 100.0 : scale)));
+    }
+
+    BenchResult result;
+    result.name = name;
+    result.iterations = batch;
+    result.nsPerOp = seconds * 1e9 / batch;
+    result.bytesPerSecond = seconds > 0.0 ? static_cast<double>(bytesPerOp) * batch / seconds : 0.0;
+    result.allocationsPerOp = static_cast<double>(memory.frame[MemoryTagHeap].allocations) / batch;
+    mResults.push_back(result);
+
+    printf("%-32s %14.1f ns/op %10.1f MB/s %10.2f allocs/op %12llu runs\n",
+        name.c_str(), result.nsPerOp, result.bytesPerSecond / 1048576.0, result.allocationsPerOp, batch);
+    fflush(stdout);
+}
+
+const std::vector<BenchResult> &BenchRunner::GetResults()const
+{
+    return mResults;
+}
+
+bool BenchRunner::WriteCsv(const std::string &path)const
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+
+    file << "name,iterations,ns_per_op,bytes_per_second,allocations_per_op\n";
+    for (const BenchResult &result : mResults)
+    {
+        char line[256] = {};
+        snprintf(line, sizeof(line), "%s,%llu,%.3f,%.1f,%.3f\n",
+            result.name.c_str(), result.iterations, result.nsPerOp, result.bytesPerSecond, result.allocationsPerOp);
+        file << line;
+    }
+    return static_cast<bool>(file);
+}
+
+bool BenchRunner::ReadCsv(const std::string &path, std::vector<BenchResult> &results)
+{
+    std::ifstream file(path);
+    std::string line;
+    if (!file || !std::getline(file, line))
+    {
+        return false;
+    }
+
+    results.clear();
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string name, iterations, ns, bytes, allocations;
+        if (!std::getline(fields, name, ',') || !std::getline(fields, iterations, ',') || !std::getline(fields, ns, ',') ||
+            !std::getline(fields, bytes, ',') || !std::getline(fields, allocations))
+        {
+            continue;
+        }
+
+        BenchResult result;
+        result.name = name;
+        result.iterations = strtoull(iterations.c_str(), nullptr, 10);
+        result.nsPerOp = atof(ns.c_str());
+        result.bytesPerSecond = atof(bytes.c_str());
+        result.allocationsPerOp = atof(allocations.c_str());
+        results.push_back(result);
+    }
+    return true;
+}
+
+unsigned int BenchRunner::Compare(const std::vector<BenchResult> &baseline, double tolerance)const
+{
+    unsigned int regressions = 0;
+    printf("\n%-32s %14s %14s %8s\n", "benchmark", "baseline ns", "now ns", "change");
+    for (const BenchResult &result : mResults)
+    {
+        const BenchResult *before = nullptr;
+        for (const BenchResult &candidate : baseline)
+        {
+            if (candidate.name == result.name)
+            {
+                before = &candidate;
+                break;
+            }
+        }
+        if (!before || before->nsPerOp <= 0.0)
+        {
+            printf("%-32s %14s %14.1f %8s\n", result.name.c_str(), "-", result.nsPerOp, "new");
+            continue;
+        }
+
+        //Allocation counts are exact, any growth is a regression; half an allocation covers rounding
+        const double change = result.nsPerOp / before->nsPerOp - 1.0;
+        const bool slower = change > tolerance;
+        const bool allocates = result.allocationsPerOp > before->allocationsPerOp + 0.5;
+        printf("%-32s %14.1f %14.1f %+7.1f%%%s%s\n", result.name.c_str(), before->nsPerOp, result.nsPerOp, 100.0 * change,
+            slower ? "  SLOWER" : "", allocates ? "  ALLOCATES" : "");
+        if (slower || allocates)
+        {
+            regressions++;
+        }
+    }
+    return regressions;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+//What one benchmark measured, per call of its body
+struct BenchResult
+{
+    std::string name;
+    unsigned long long iterations = 0;
+    double nsPerOp = 0.0;
+    double bytesPerSecond = 0.0;        //0 for benchmarks that don't move data
+    double allocationsPerOp = 0.0;      //Global operator new calls, workers included
+};
+
+//Runs benchmark bodies until they have taken long enough to time, counts their heap
+//allocations through the memory telemetry and keeps the results. Results are written
+//as CSV, one benchmark a line, and can be compared against a file written earlier.
+class BenchRunner
+{
+public:
+    BenchRunner();
+    ~BenchRunner();
+
+    //Only benchmarks whose name contains filter run, empty runs everything
+    void SetFilter(const std::string &filter);
+    void SetMinSeconds(double seconds);
+
+    //Calls body over and over, bytesPerOp is what one call reads or writes for the throughput
+    void Run(const std::string &name, unsigned long long bytesPerOp, const std::function<void()> &body);
+
+    const std::vector<BenchResult> &GetResults()const;
+
+    bool WriteCsv(const std::string &path)const;
+    static bool ReadCsv(const std::string &path, std::vector<BenchResult> &results);
+
+    //Prints every benchmark next to its baseline and returns how many got slower than
+    //tolerance allows or started allocating more
+    unsigned int Compare(const std::vector<BenchResult> &baseline, double tolerance)const;
+
+private:
+    std::string mFilter;
+    double mMinSeconds = 0.5;
+    std::vector<BenchResult> mResults;
+};
+
+//Keeps the compiler from dropping work whose result is never used
+void BenchSink(float value);
+void BenchSink(const void *pointer);
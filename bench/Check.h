@@ -0,0 +1,13 @@
+#pragma once
+
+//Counts a condition that doesn't hold and prints where it is, the run fails if any did
+#define CHECK(condition) CheckResult((condition), #condition, __FILE__, __LINE__)
+
+bool CheckResult(bool passed, const char *condition, const char *file, int line);
+
+//Headless checks of the engine parts that don't need a device, one group per module.
+//CheckMain.cpp runs them in turn.
+void CheckRecordInParallel();
+void CheckShaderCache();
+void CheckResolutionGovernor();
+void CheckUploadRing();
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "Check.h"
+
+//Headless checks of the scheduling and caching logic the renderer builds on, run on the
+//same Linux build as the benchmarks. Prints every failed condition and exits with 1 when
+//there was one.
+//
+//    checks [-filter text]
+
+static unsigned int sChecks = 0;
+static unsigned int sFailures = 0;
+
+bool CheckResult(bool passed, const char *condition, const char *file, int line)
+{
+    sChecks++;
+    if (!passed)
+    {
+        sFailures++;
+        printf("%s:%d: failed: %s\n", file, line, condition);
+    }
+    return passed;
+}
+
+struct CheckGroup
+{
+    const char *name;
+    void (*run)();
+};
+
+static const CheckGroup groups[] =
+{
+    { "recordinparallel", CheckRecordInParallel },
+    { "shadercache", CheckShaderCache },
+    { "resolutiongovernor", CheckResolutionGovernor },
+    { "uploadring", CheckUploadRing },
+};
+
+int main(int argc, char **argv)
+{
+    std::string filter;
+    for (int i = 1; i < argc; i++)
+    {
+        const bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "-filter") == 0 && hasValue) filter = argv[++i];
+        else
+        {
+            fprintf(stderr, "Usage: %s [-filter text]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    for (const CheckGroup &group : groups)
+    {
+        if (!filter.empty() && strstr(group.name, filter.c_str()) == nullptr)
+        {
+            continue;
+        }
+
+        const unsigned int failures = sFailures;
+        group.run();
+        printf("%-20s %s\n", group.name, sFailures == failures ? "ok" : "FAILED");
+    }
+
+    printf("%u checks, %u failed\n", sChecks, sFailures);
+    return sFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "CommandRecorder.h"
+#include "JobSystem.h"
+
+#include "Check.h"
+
+//Splits a draw list the way RenderFrame does and checks what comes out
+static void CheckSplit(JobSystem &jobs, unsigned int threads, unsigned int count, unsigned int minPerChunk)
+{
+    std::unique_ptr<std::atomic<unsigned int>[]> hits(new std::atomic<unsigned int>[count + 1]);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        hits[i] = 0;
+    }
+
+    unsigned int begins[MaxRecordChunks] = {};
+    unsigned int ends[MaxRecordChunks] = {};
+    std::atomic<unsigned int> recorded{ 0 };
+    std::atomic<bool> badChunk{ false };
+    std::vector<unsigned int> submitted;
+    std::vector<unsigned int> recordedAtSubmit;
+
+    const unsigned int chunks = RecordInParallel(jobs, count, minPerChunk,
+        [&](unsigned int begin, unsigned int end, unsigned int chunk)
+        {
+            if (chunk >= MaxRecordChunks)
+            {
+                badChunk = true;
+                return;
+            }
+            begins[chunk] = begin;
+            ends[chunk] = end;
+            for (unsigned int i = begin; i < end && i < count; i++)
+            {
+                hits[i]++;
+            }
+            recorded++;
+        },
+        [&](unsigned int chunk)
+        {
+            submitted.push_back(chunk);
+            recordedAtSubmit.push_back(recorded);
+        });
+
+    CHECK(!badChunk);
+    CHECK(chunks <= MaxRecordChunks);
+    CHECK(chunks <= threads);
+    CHECK(count == 0 ? chunks == 0 : chunks >= 1);
+    CHECK(chunks <= (count + std::max(minPerChunk, 1u) - 1) / std::max(minPerChunk, 1u));
+    CHECK(recorded == chunks);
+
+    //Every chunk is recorded before the first one is submitted
+    for (unsigned int done : recordedAtSubmit)
+    {
+        CHECK(done == chunks);
+    }
+
+    //Every draw exactly once
+    unsigned int wrong = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        wrong += hits[i] != 1 ? 1 : 0;
+    }
+    CHECK(wrong == 0);
+
+    //Submitted in chunk order, and the chunks follow each other through the list so
+    //submitting them in that order keeps the single threaded draw order
+    CHECK(submitted.size() == chunks);
+    for (unsigned int c = 0; c < submitted.size(); c++)
+    {
+        CHECK(submitted[c] == c);
+    }
+    for (unsigned int c = 0; c < chunks && c < MaxRecordChunks; c++)
+    {
+        CHECK(begins[c] == (c == 0 ? 0 : ends[c - 1]));
+        CHECK(begins[c] < ends[c]);
+    }
+    if (chunks > 0 && chunks <= MaxRecordChunks)
+    {
+        CHECK(ends[chunks - 1] == count);
+    }
+}
+
+void CheckRecordInParallel()
+{
+    const unsigned int counts[] = { 0, 1, 2, 3, 5, 7, 8, 9, 63, 64, 65, 500, 4099 };
+    const unsigned int minPerChunks[] = { 0, 1, 16, 64 };
+
+    //One thread is a job system without workers, everything runs on the caller
+    for (unsigned int threads = 1; threads <= MaxRecordChunks + 2; threads++)
+    {
+        JobSystem jobs;
+        if (threads > 1)
+        {
+            jobs.Init(threads - 1);
+        }
+
+        for (unsigned int count : counts)
+        {
+            for (unsigned int minPerChunk : minPerChunks)
+            {
+                CheckSplit(jobs, threads, count, minPerChunk);
+            }
+        }
+        jobs.Shutdown();
+    }
+}
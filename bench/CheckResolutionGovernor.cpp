@@ -0,0 +1,169 @@
+#include <stdio.h>
+
+#include "ResolutionGovernor.h"
+
+#include "Check.h"
+
+//A synthetic GPU load in three phases, frame time is fixed cost plus a cost that grows
+//with the pixel count
+struct GovernorTrace
+{
+    const char *name;
+    float fixedMs;                  //Cost that doesn't depend on the resolution
+    float pixelMs[3];               //Resolution dependent cost at full size, per phase
+};
+
+const int phaseFrames = 300;
+const int settleWithin = 60;        //Frames a phase may take before its average has to stay in budget
+const int quietAfter = 150;         //From this frame of a phase the scale must not change any more
+
+//What a phase of a trace did
+struct PhaseResult
+{
+    float startScale = 0.0f;
+    float endScale = 0.0f;
+    int settledAt = -1;             //First frame from which the average stays in budget, -1 if it never does
+    int lastChange = -1;            //Frame of the last scale change
+    int firstDrop = -1;             //Frame of the first change to a smaller scale
+    bool inRange = true;            //Scale stayed within the settings' limits
+};
+
+static void RunTrace(const GovernorTrace &trace, PhaseResult (&results)[3])
+{
+    ResolutionGovernor governor;
+    const ResolutionGovernorSettings &settings = governor.GetSettings();
+    unsigned int random = 12345;
+
+    for (int phase = 0; phase < 3; phase++)
+    {
+        PhaseResult &result = results[phase];
+        result.startScale = governor.GetScale();
+        for (int frame = 0; frame < phaseFrames; frame++)
+        {
+            //Up to half a millisecond of noise either way
+            random = random * 1664525u + 1013904223u;
+            const float noise = ((random >> 8) & 0xffff) / 65535.0f - 0.5f;
+
+            const float before = governor.GetScale();
+            const float scale = governor.Update(trace.fixedMs + trace.pixelMs[phase] * before * before + noise);
+            if (scale != before)
+            {
+                result.lastChange = frame;
+                if (scale < before && result.firstDrop < 0)
+                {
+                    result.firstDrop = frame;
+                }
+            }
+            result.inRange = result.inRange && scale >= settings.minScale && scale <= settings.maxScale;
+
+            if (governor.GetAverageMs() > settings.targetMs)
+            {
+                result.settledAt = -1;
+            }
+            else if (result.settledAt < 0)
+            {
+                result.settledAt = frame;
+            }
+        }
+        result.endScale = governor.GetScale();
+    }
+}
+
+static void PrintTrace(const GovernorTrace &trace, const PhaseResult (&results)[3])
+{
+    for (int phase = 0; phase < 3; phase++)
+    {
+        const PhaseResult &result = results[phase];
+        printf("  %s, phase %d: scale %.3f -> %.3f, in budget from frame %d, last change at frame %d\n",
+            trace.name, phase, result.startScale, result.endScale, result.settledAt, result.lastChange);
+    }
+}
+
+void CheckResolutionGovernor()
+{
+    const ResolutionGovernorSettings settings;
+
+    //Constant loads that fit at full size, fit at some smaller size and sit right at the budget
+    const GovernorTrace constantTraces[] =
+    {
+        { "light load", 2.0f, { 8.0f, 8.0f, 8.0f } },
+        { "medium load", 2.0f, { 24.0f, 24.0f, 24.0f } },
+        { "load at the budget", 2.0f, { 14.5f, 14.5f, 14.5f } },
+    };
+    for (const GovernorTrace &trace : constantTraces)
+    {
+        PhaseResult results[3];
+        RunTrace(trace, results);
+        bool passed = true;
+        for (int phase = 0; phase < 3; phase++)
+        {
+            passed &= CHECK(results[phase].inRange);
+            passed &= CHECK(results[phase].settledAt >= 0 && results[phase].settledAt <= (phase == 0 ? settleWithin : 0));
+            //No oscillation: after the first phase a constant load never moves the scale
+            passed &= CHECK(results[phase].lastChange < (phase == 0 ? quietAfter : 0));
+        }
+        if (!passed)
+        {
+            PrintTrace(trace, results);
+        }
+    }
+
+    //More than the budget even at the smallest size: the scale goes to the minimum and stays there
+    {
+        const GovernorTrace trace = { "over budget at min scale", 4.0f, { 60.0f, 60.0f, 60.0f } };
+        PhaseResult results[3];
+        RunTrace(trace, results);
+        bool passed = CHECK(results[0].lastChange >= 0 && results[0].lastChange <= settleWithin);
+        for (int phase = 0; phase < 3; phase++)
+        {
+            passed &= CHECK(results[phase].inRange);
+            passed &= CHECK(results[phase].endScale == settings.minScale);
+        }
+        passed &= CHECK(results[1].lastChange < 0 && results[2].lastChange < 0);
+        if (!passed)
+        {
+            PrintTrace(trace, results);
+        }
+    }
+
+    //A spike drops the scale within a few frames and settles, going back to the lighter load raises it again
+    {
+        const GovernorTrace trace = { "load spike and recovery", 2.0f, { 10.0f, 28.0f, 10.0f } };
+        PhaseResult results[3];
+        RunTrace(trace, results);
+        bool passed = CHECK(results[0].endScale == settings.maxScale);
+        passed &= CHECK(results[1].firstDrop >= 0 && results[1].firstDrop <= static_cast<int>(settings.settleFrames));
+        passed &= CHECK(results[1].endScale < results[1].startScale);
+        passed &= CHECK(results[1].settledAt >= 0 && results[1].settledAt <= settleWithin);
+        passed &= CHECK(results[1].lastChange < quietAfter);
+        passed &= CHECK(results[2].endScale > results[1].endScale);
+        passed &= CHECK(results[2].lastChange < quietAfter);
+        for (int phase = 0; phase < 3; phase++)
+        {
+            passed &= CHECK(results[phase].inRange);
+        }
+        if (!passed)
+        {
+            PrintTrace(trace, results);
+        }
+    }
+
+    //A load that keeps growing is followed down without going over budget for long
+    {
+        const GovernorTrace trace = { "slow creep", 3.0f, { 12.0f, 16.0f, 20.0f } };
+        PhaseResult results[3];
+        RunTrace(trace, results);
+        bool passed = true;
+        for (int phase = 0; phase < 3; phase++)
+        {
+            passed &= CHECK(results[phase].inRange);
+            passed &= CHECK(results[phase].settledAt >= 0 && results[phase].settledAt <= settleWithin);
+            passed &= CHECK(results[phase].lastChange < quietAfter);
+            passed &= CHECK(phase == 0 || results[phase].endScale <= results[phase - 1].endScale);
+        }
+        if (!passed)
+        {
+            PrintTrace(trace, results);
+        }
+    }
+}
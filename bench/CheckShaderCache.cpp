@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#endif
+
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "JobSystem.h"
+#include "ShaderCache.h"
+
+#include "Check.h"
+
+static const char *cacheDirectory = "checkdata/shadercache";
+static const char *sourcePath = "checkdata/shader.hlsl";
+
+//Stands in for D3DCompile: the bytecode spells out what it was built from, a source
+//containing "error" fails
+static std::atomic<unsigned int> sCompiles{ 0 };
+
+static bool StubCompile(const std::string &source, const std::string &, const ShaderPermutation &permutation,
+    std::vector<unsigned char> &bytecode, std::string &errors)
+{
+    sCompiles++;
+    if (source.find("error") != std::string::npos)
+    {
+        errors = "stub: error in source\n";
+        return false;
+    }
+
+    std::string text = permutation.entryPoint + "/" + permutation.profile + "/" + std::to_string(permutation.flags);
+    for (const ShaderDefine &define : permutation.defines)
+    {
+        text += "/" + define.name + "=" + define.value;
+    }
+    text += "/" + source;
+    bytecode.assign(text.begin(), text.end());
+    return true;
+}
+
+static std::string Expected(const ShaderPermutation &permutation, const std::string &source)
+{
+    std::vector<unsigned char> bytecode;
+    std::string errors;
+    StubCompile(source, sourcePath, permutation, bytecode, errors);
+    sCompiles--;
+    return std::string(bytecode.begin(), bytecode.end());
+}
+
+static void WriteFile(const std::string &path, const std::string &contents)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+}
+
+static std::string ReadFile(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+//Where ShaderCache keeps the blob of a key
+static std::string BlobPath(unsigned long long key)
+{
+    char name[32] = {};
+    snprintf(name, sizeof(name), "%016llx.cso", key);
+    return std::string(cacheDirectory) + "/" + name;
+}
+
+//Gets one permutation and reports whether the compiler ran for it
+static bool GetCompiles(ShaderCache &cache, const ShaderPermutation &permutation, std::string &bytecodeText)
+{
+    const unsigned int compiles = sCompiles;
+    std::vector<unsigned char> bytecode;
+    std::string errors;
+    const bool succeeded = cache.Get(sourcePath, permutation, bytecode, errors);
+    CHECK(succeeded);
+    bytecodeText.assign(bytecode.begin(), bytecode.end());
+    return sCompiles != compiles;
+}
+
+void CheckShaderCache()
+{
+#if defined(_WIN32)
+    _mkdir("checkdata");
+#else
+    mkdir("checkdata", 0755);
+#endif
+
+    const std::string source = "float4 main() : SV_Target { return 1; }\n";
+    WriteFile(sourcePath, source);
+
+    ShaderPermutation permutation;
+    permutation.entryPoint = "VShader";
+    permutation.profile = "vs_5_0";
+    permutation.defines.push_back({ "SKINNED", "1" });
+    permutation.flags = 1;
+
+    ShaderCache cache(cacheDirectory, "stub 1.0", StubCompile);
+    const unsigned long long key = cache.ComputeKey(source, permutation);
+    std::remove(BlobPath(key).c_str());
+
+    //Key sensitivity: the same inputs give the same key, anything that changes the output another one
+    CHECK(cache.ComputeKey(source, permutation) == key);
+    ShaderPermutation changed = permutation;
+    changed.defines[0].value = "0";
+    CHECK(cache.ComputeKey(source, changed) != key);
+    changed = permutation;
+    changed.defines[0].name = "SKINNEDX";
+    CHECK(cache.ComputeKey(source, changed) != key);
+    changed = permutation;
+    changed.defines.push_back({ "SHADOW", "" });
+    CHECK(cache.ComputeKey(source, changed) != key);
+    changed = permutation;
+    changed.flags = 2;
+    CHECK(cache.ComputeKey(source, changed) != key);
+    changed = permutation;
+    changed.entryPoint = "PShader";
+    CHECK(cache.ComputeKey(source, changed) != key);
+    changed = permutation;
+    changed.profile = "vs_4_0";
+    CHECK(cache.ComputeKey(source, changed) != key);
+    CHECK(cache.ComputeKey(source + " ", permutation) != key);
+    ShaderCache otherCompiler(cacheDirectory, "stub 1.1", StubCompile);
+    CHECK(otherCompiler.ComputeKey(source, permutation) != key);
+
+    //Miss, then a hit in the same cache and in a new one reading the same directory
+    std::string bytecode;
+    CHECK(GetCompiles(cache, permutation, bytecode));
+    CHECK(bytecode == Expected(permutation, source));
+    CHECK(!GetCompiles(cache, permutation, bytecode));
+    CHECK(bytecode == Expected(permutation, source));
+    CHECK(cache.GetHits() == 1 && cache.GetMisses() == 1);
+    {
+        ShaderCache reopened(cacheDirectory, "stub 1.0", StubCompile);
+        CHECK(!GetCompiles(reopened, permutation, bytecode));
+        CHECK(bytecode == Expected(permutation, source));
+    }
+
+    //An updated compiler doesn't reuse the blob
+    std::remove(BlobPath(otherCompiler.ComputeKey(source, permutation)).c_str());
+    CHECK(GetCompiles(otherCompiler, permutation, bytecode));
+
+    //Damaged blobs are misses that get compiled and written again
+    const std::string good = ReadFile(BlobPath(key));
+    CHECK(good.size() > bytecode.size());
+    const std::string damaged[] =
+    {
+        std::string(),                                  //Empty
+        good.substr(0, 10),                             //Cut inside the header
+        good.substr(0, good.size() - 3),                //Cut inside the bytecode
+        good + "trailing",                              //Size in the header doesn't match
+        std::string(good.size(), '\xff'),               //Garbage, the size field would be huge
+    };
+    for (const std::string &contents : damaged)
+    {
+        WriteFile(BlobPath(key), contents);
+        CHECK(GetCompiles(cache, permutation, bytecode));
+        CHECK(bytecode == Expected(permutation, source));
+        CHECK(!GetCompiles(cache, permutation, bytecode));
+    }
+
+    //A failed compile reports its errors and stores nothing
+    WriteFile(sourcePath, "error\n");
+    {
+        std::remove(BlobPath(cache.ComputeKey("error\n", permutation)).c_str());
+        std::vector<unsigned char> failed;
+        std::string errors;
+        const unsigned int compiles = sCompiles;
+        CHECK(!cache.Get(sourcePath, permutation, failed, errors));
+        CHECK(!errors.empty());
+        CHECK(!cache.Get(sourcePath, permutation, failed, errors));
+        CHECK(sCompiles == compiles + 2);
+    }
+
+    //An edited source is a miss
+    const std::string edited = source + "//edited\n";
+    WriteFile(sourcePath, edited);
+    std::remove(BlobPath(cache.ComputeKey(edited, permutation)).c_str());
+    CHECK(GetCompiles(cache, permutation, bytecode));
+    CHECK(bytecode == Expected(permutation, edited));
+
+    //GetAll compiles the misses in parallel and finds them all the second time
+    JobSystem jobs;
+    jobs.Init(3);
+    std::vector<ShaderPermutation> permutations;
+    for (unsigned int i = 0; i < 12; i++)
+    {
+        ShaderPermutation variant = permutation;
+        variant.defines[0].value = std::to_string(i);
+        std::remove(BlobPath(cache.ComputeKey(edited, variant)).c_str());
+        permutations.push_back(variant);
+    }
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const unsigned int compiles = sCompiles;
+        std::vector<std::vector<unsigned char>> bytecodes;
+        std::string errors;
+        CHECK(cache.GetAll(jobs, sourcePath, permutations, bytecodes, errors));
+        CHECK(sCompiles - compiles == (pass == 0 ? permutations.size() : 0));
+        CHECK(bytecodes.size() == permutations.size());
+        for (size_t i = 0; i < bytecodes.size() && i < permutations.size(); i++)
+        {
+            CHECK(std::string(bytecodes[i].begin(), bytecodes[i].end()) == Expected(permutations[i], edited));
+        }
+    }
+    jobs.Shutdown();
+}
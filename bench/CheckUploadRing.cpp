@@ -0,0 +1,207 @@
+#include <stdio.h>
+
+#include <map>
+#include <vector>
+
+#include "UploadRing.h"
+
+#include "Check.h"
+
+const unsigned int segmentBytes = 512;
+const unsigned int segmentCount = 3;
+const unsigned int frameBudget = 768;
+
+//Stands in for the GPU: every Submit gets the next fence value and completed says how far
+//the copies have got
+struct FakeFences
+{
+    unsigned long long submitted = 0;
+    unsigned long long completed = 0;
+};
+
+//One frame of what UploadQueue does with the ring, checking the plan on the way. Returns
+//the staged segment, -1 if there was none.
+static int RunFrame(UploadRing &ring, FakeFences &fences, std::map<UploadTicket, unsigned int> &sent, std::vector<UploadSlice> &slices)
+{
+    ring.Retire(fences.completed);
+
+    int segment = -1;
+    ring.Plan(slices, segment);
+
+    unsigned int bytes = 0;
+    unsigned int stagingEnd = 0;
+    bool staged = false;
+    for (const UploadSlice &slice : slices)
+    {
+        //Slices continue where the upload left off and stay inside it
+        CHECK(slice.ticket != 0 && slice.size > 0);
+        CHECK(slice.offset == sent[slice.ticket]);
+        sent[slice.ticket] += slice.size;
+        bytes += slice.size;
+
+        //Staged slices go one after the other into the frame's segment, aligned and inside it
+        if (slice.staged)
+        {
+            CHECK(segment >= 0 && segment < static_cast<int>(segmentCount));
+            CHECK(slice.stagingOffset % 16 == 0 && slice.stagingOffset >= stagingEnd);
+            CHECK(slice.stagingOffset + slice.size <= segmentBytes);
+            stagingEnd = slice.stagingOffset + slice.size;
+            staged = true;
+        }
+    }
+    CHECK(staged == (segment >= 0));
+    CHECK(ring.GetStats().bytes == bytes);
+
+    ring.Submit(++fences.submitted);
+    return segment;
+}
+
+void CheckUploadRing()
+{
+    UploadRing ring;
+    ring.Init(segmentBytes, segmentCount, frameBudget);
+    FakeFences fences;
+    std::map<UploadTicket, unsigned int> sent;
+    std::vector<UploadSlice> slices;
+
+    //Time slicing: a big direct upload goes out a frame budget at a time, in whole granules
+    {
+        const UploadTicket ticket = ring.Add(2000, 100, false);
+        CHECK(!ring.IsDone(ticket));
+        CHECK(RunFrame(ring, fences, sent, slices) == -1);
+        CHECK(slices.size() == 1 && slices[0].size == 700 && !slices[0].last);
+        RunFrame(ring, fences, sent, slices);
+        CHECK(slices.size() == 1 && slices[0].size == 700 && !slices[0].last);
+        CHECK(!ring.IsDone(ticket));
+        RunFrame(ring, fences, sent, slices);
+        CHECK(slices.size() == 1 && slices[0].size == 600 && slices[0].last);
+        CHECK(ring.IsDone(ticket) && ring.IsIdle());
+        CHECK(ring.GetStats().uploadedBytes == 2000 && ring.GetStats().pendingBytes == 0);
+    }
+
+    //Small uploads share a frame until the budget is used up, the one that doesn't fit is split
+    {
+        const UploadTicket first = ring.Add(300, 1, false);
+        const UploadTicket second = ring.Add(300, 1, false);
+        const UploadTicket third = ring.Add(300, 1, false);
+        RunFrame(ring, fences, sent, slices);
+        CHECK(slices.size() == 3);
+        CHECK(ring.GetStats().bytes == frameBudget);
+        CHECK(ring.IsDone(first) && ring.IsDone(second) && !ring.IsDone(third));
+        RunFrame(ring, fences, sent, slices);
+        CHECK(slices.size() == 1 && slices[0].ticket == third && slices[0].size == 132 && slices[0].last);
+        CHECK(ring.IsIdle());
+    }
+
+    //A granule bigger than the whole budget still goes out, on its own
+    {
+        const UploadTicket small = ring.Add(100, 1, false);
+        const UploadTicket huge = ring.Add(1000, 1000, false);
+        RunFrame(ring, fences, sent, slices);
+        CHECK(slices.size() == 1 && slices[0].ticket == small);
+        CHECK(ring.IsDone(small) && !ring.IsDone(huge));
+        RunFrame(ring, fences, sent, slices);
+        CHECK(slices.size() == 1 && slices[0].ticket == huge && slices[0].size == 1000 && slices[0].last);
+        CHECK(ring.IsIdle());
+    }
+
+    //A staged request bigger than what is left of the segment: the part that fits goes in the
+    //tail, the rest starts the next segment
+    fences.completed = fences.submitted;
+    {
+        const UploadTicket head = ring.Add(300, 1, true);
+        const UploadTicket tail = ring.Add(600, 4, true);
+        const int segment = RunFrame(ring, fences, sent, slices);
+        CHECK(segment >= 0);
+        CHECK(slices.size() == 2 && slices[0].ticket == head && slices[1].ticket == tail);
+        CHECK(slices.size() == 2 && slices[1].stagingOffset == 304 && slices[1].size == 208 && !slices[1].last);
+        CHECK(ring.IsDone(head) && !ring.IsDone(tail));
+
+        fences.completed = fences.submitted;
+        const int next = RunFrame(ring, fences, sent, slices);
+        CHECK(next == (segment + 1) % static_cast<int>(segmentCount));
+        CHECK(slices.size() == 1 && slices[0].stagingOffset == 0 && slices[0].size == 392 && slices[0].last);
+        CHECK(ring.IsDone(tail) && ring.IsIdle());
+    }
+
+    //A full ring: every segment in flight, staged work waits and counts a stall each frame until
+    //the oldest fence completes, then it takes that segment
+    fences.completed = fences.submitted;
+    {
+        std::vector<int> order;
+        std::vector<unsigned long long> segmentFences;
+        for (unsigned int i = 0; i < segmentCount; i++)
+        {
+            ring.Add(200, 1, true);
+            order.push_back(RunFrame(ring, fences, sent, slices));
+            segmentFences.push_back(fences.submitted);
+        }
+        CHECK(ring.GetStats().segmentsInFlight == segmentCount);
+        for (unsigned int i = 0; i < segmentCount; i++)
+        {
+            CHECK(order[i] == static_cast<int>((order[0] + i) % segmentCount));
+        }
+
+        const UploadTicket waiting = ring.Add(200, 1, true);
+        const unsigned long long stalls = ring.GetStats().stalls;
+        for (int frame = 0; frame < 3; frame++)
+        {
+            CHECK(RunFrame(ring, fences, sent, slices) == -1);
+            CHECK(slices.empty());
+        }
+        CHECK(ring.GetStats().stalls == stalls + 3);
+        CHECK(!ring.IsDone(waiting));
+
+        //A fence older than every segment's frees nothing
+        fences.completed = segmentFences[0] - 1;
+        CHECK(RunFrame(ring, fences, sent, slices) == -1);
+
+        //Wrap-around: the oldest segment is freed first and is the one reused
+        fences.completed = segmentFences[0];
+        CHECK(RunFrame(ring, fences, sent, slices) == order[0]);
+        CHECK(slices.size() == 1 && slices[0].ticket == waiting && slices[0].stagingOffset == 0 && slices[0].last);
+        CHECK(ring.IsDone(waiting));
+        CHECK(ring.GetStats().segmentsInFlight == segmentCount);
+        CHECK(ring.GetStats().stalls == stalls + 4);
+
+        //Direct uploads queued behind a waiting staged one wait with it, uploads finish in order
+        ring.Add(100, 1, true);
+        const UploadTicket direct = ring.Add(100, 1, false);
+        CHECK(RunFrame(ring, fences, sent, slices) == -1 && slices.empty());
+        CHECK(!ring.IsDone(direct));
+        fences.completed = fences.submitted;
+        CHECK(RunFrame(ring, fences, sent, slices) == order[1]);
+        CHECK(slices.size() == 2 && ring.IsDone(direct));
+    }
+
+    //Many frames of mixed uploads against a GPU that lags two frames behind: everything arrives,
+    //the stats add up and the ring ends up empty
+    {
+        ring.Clear();
+        sent.clear();
+        unsigned long long added = 0;
+        unsigned int random = 12345;
+        std::vector<UploadTicket> tickets;
+        for (int frame = 0; frame < 400; frame++)
+        {
+            random = random * 1664525u + 1013904223u;
+            if (frame < 300 && (random >> 12) % 3 == 0)
+            {
+                const unsigned int granularity = 1u << ((random >> 4) % 8);
+                const unsigned int size = granularity * (1 + (random >> 16) % 20);
+                tickets.push_back(ring.Add(size, granularity, (random >> 8) % 2 == 0));
+                added += size;
+            }
+            fences.completed = fences.submitted > 2 ? fences.submitted - 2 : 0;
+            RunFrame(ring, fences, sent, slices);
+            CHECK(ring.GetStats().bytes <= frameBudget || slices.size() == 1);
+        }
+        CHECK(ring.IsIdle());
+        for (UploadTicket ticket : tickets)
+        {
+            CHECK(ring.IsDone(ticket));
+        }
+        const UploadRingStats stats = ring.GetStats();
+        CHECK(stats.uploadedBytes == added && stats.pendingBytes == 0 && stats.pendingUploads == 0);
+    }
+}
@@ -0,0 +1,383 @@
+#include "Animation.h"
+
+#include <assert.h>
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "ScratchArena.h"
+
+//Characters below this aren't worth a job of their own
+const unsigned int minCharactersPerJob = 16;
+const unsigned int maxAnimationJobs = 64;
+
+int Skeleton::Find(const std::string &name)const
+{
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        if (names[i] == name)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+static float &Lane(XMFLOAT4A &value, unsigned int lane)
+{
+    return (&value.x)[lane];
+}
+
+void InitClip(AnimationClip &clip, const Skeleton &skeleton, float duration, float sampleRate)
+{
+    clip.duration = duration;
+    clip.sampleRate = sampleRate;
+    clip.frameCount = std::max(2u, static_cast<unsigned int>(ceilf(duration * sampleRate)) + 1);
+    clip.quadCount = (skeleton.GetJointCount() + 3) / 4;
+
+    //Lanes past the last joint hold an identity pose
+    JointQuad identity = {};
+    identity.rw = XMFLOAT4A(1.0f, 1.0f, 1.0f, 1.0f);
+    identity.sx = identity.rw;
+    identity.sy = identity.rw;
+    identity.sz = identity.rw;
+    clip.frames.assign(static_cast<size_t>(clip.frameCount) * clip.quadCount, identity);
+
+    for (unsigned int frame = 0; frame < clip.frameCount; frame++)
+    {
+        for (unsigned int joint = 0; joint < skeleton.GetJointCount(); joint++)
+        {
+            SetClipPose(clip, frame, joint, skeleton.bindPose[joint]);
+        }
+    }
+}
+
+void SetClipPose(AnimationClip &clip, unsigned int frame, unsigned int joint, const JointPose &pose)
+{
+    assert(frame < clip.frameCount && joint / 4 < clip.quadCount);
+    JointQuad &quad = clip.frames[static_cast<size_t>(frame) * clip.quadCount + joint / 4];
+    const unsigned int lane = joint % 4;
+    Lane(quad.tx, lane) = pose.translation.x;
+    Lane(quad.ty, lane) = pose.translation.y;
+    Lane(quad.tz, lane) = pose.translation.z;
+    Lane(quad.rx, lane) = pose.rotation.x;
+    Lane(quad.ry, lane) = pose.rotation.y;
+    Lane(quad.rz, lane) = pose.rotation.z;
+    Lane(quad.rw, lane) = pose.rotation.w;
+    Lane(quad.sx, lane) = pose.scale.x;
+    Lane(quad.sy, lane) = pose.scale.y;
+    Lane(quad.sz, lane) = pose.scale.z;
+}
+
+//Blends four joints from a towards b by t: translation and scale are lerped, rotations
+//take the shorter way round and are lerped and renormalized. out may be a or b.
+static void BlendQuads(const JointQuad &a, const JointQuad &b, FXMVECTOR t, JointQuad &out)
+{
+    XMStoreFloat4A(&out.tx, XMVectorLerpV(XMLoadFloat4A(&a.tx), XMLoadFloat4A(&b.tx), t));
+    XMStoreFloat4A(&out.ty, XMVectorLerpV(XMLoadFloat4A(&a.ty), XMLoadFloat4A(&b.ty), t));
+    XMStoreFloat4A(&out.tz, XMVectorLerpV(XMLoadFloat4A(&a.tz), XMLoadFloat4A(&b.tz), t));
+    XMStoreFloat4A(&out.sx, XMVectorLerpV(XMLoadFloat4A(&a.sx), XMLoadFloat4A(&b.sx), t));
+    XMStoreFloat4A(&out.sy, XMVectorLerpV(XMLoadFloat4A(&a.sy), XMLoadFloat4A(&b.sy), t));
+    XMStoreFloat4A(&out.sz, XMVectorLerpV(XMLoadFloat4A(&a.sz), XMLoadFloat4A(&b.sz), t));
+
+    const XMVECTOR ax = XMLoadFloat4A(&a.rx);
+    const XMVECTOR ay = XMLoadFloat4A(&a.ry);
+    const XMVECTOR az = XMLoadFloat4A(&a.rz);
+    const XMVECTOR aw = XMLoadFloat4A(&a.rw);
+    XMVECTOR bx = XMLoadFloat4A(&b.rx);
+    XMVECTOR by = XMLoadFloat4A(&b.ry);
+    XMVECTOR bz = XMLoadFloat4A(&b.rz);
+    XMVECTOR bw = XMLoadFloat4A(&b.rw);
+
+    const XMVECTOR dot = ax * bx + ay * by + az * bz + aw * bw;
+    const XMVECTOR sign = XMVectorSelect(XMVectorReplicate(1.0f), XMVectorReplicate(-1.0f), XMVectorLess(dot, XMVectorZero()));
+    bx *= sign;
+    by *= sign;
+    bz *= sign;
+    bw *= sign;
+
+    const XMVECTOR rx = XMVectorLerpV(ax, bx, t);
+    const XMVECTOR ry = XMVectorLerpV(ay, by, t);
+    const XMVECTOR rz = XMVectorLerpV(az, bz, t);
+    const XMVECTOR rw = XMVectorLerpV(aw, bw, t);
+    const XMVECTOR scale = XMVectorReciprocalSqrt(rx * rx + ry * ry + rz * rz + rw * rw);
+    XMStoreFloat4A(&out.rx, rx * scale);
+    XMStoreFloat4A(&out.ry, ry * scale);
+    XMStoreFloat4A(&out.rz, rz * scale);
+    XMStoreFloat4A(&out.rw, rw * scale);
+}
+
+void ComposeQuad(const JointQuad &pose, LocalQuad &local)
+{
+    const XMVECTOR x = XMLoadFloat4A(&pose.rx);
+    const XMVECTOR y = XMLoadFloat4A(&pose.ry);
+    const XMVECTOR z = XMLoadFloat4A(&pose.rz);
+    const XMVECTOR w = XMLoadFloat4A(&pose.rw);
+    const XMVECTOR sx = XMLoadFloat4A(&pose.sx);
+    const XMVECTOR sy = XMLoadFloat4A(&pose.sy);
+    const XMVECTOR sz = XMLoadFloat4A(&pose.sz);
+    const XMVECTOR one = XMVectorReplicate(1.0f);
+
+    const XMVECTOR x2 = x + x;
+    const XMVECTOR y2 = y + y;
+    const XMVECTOR z2 = z + z;
+    const XMVECTOR xx = x * x2;
+    const XMVECTOR yy = y * y2;
+    const XMVECTOR zz = z * z2;
+    const XMVECTOR xy = x * y2;
+    const XMVECTOR xz = x * z2;
+    const XMVECTOR yz = y * z2;
+    const XMVECTOR xw = x2 * w;
+    const XMVECTOR yw = y2 * w;
+    const XMVECTOR zw = z2 * w;
+
+    XMStoreFloat4A(&local.m[0], (one - (yy + zz)) * sx);
+    XMStoreFloat4A(&local.m[1], (xy + zw) * sx);
+    XMStoreFloat4A(&local.m[2], (xz - yw) * sx);
+    XMStoreFloat4A(&local.m[3], (xy - zw) * sy);
+    XMStoreFloat4A(&local.m[4], (one - (xx + zz)) * sy);
+    XMStoreFloat4A(&local.m[5], (yz + xw) * sy);
+    XMStoreFloat4A(&local.m[6], (xz + yw) * sz);
+    XMStoreFloat4A(&local.m[7], (yz - xw) * sz);
+    XMStoreFloat4A(&local.m[8], (one - (xx + yy)) * sz);
+    local.m[9] = pose.tx;
+    local.m[10] = pose.ty;
+    local.m[11] = pose.tz;
+}
+
+void SkinVertices(const VERTEX *vertices, const VertexSkin *skin, size_t count, const XMFLOAT3X4 *palette, VERTEX *skinned)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        //Blend the rows of the joints' matrices by weight, then transform once
+        XMVECTOR row0 = XMVectorZero();
+        XMVECTOR row1 = XMVectorZero();
+        XMVECTOR row2 = XMVectorZero();
+        for (unsigned int k = 0; k < 4; k++)
+        {
+            const XMFLOAT3X4 &matrix = palette[skin[i].joints[k]];
+            const float weight = skin[i].weights[k] * (1.0f / 255.0f);
+            row0 += weight * XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&matrix.m[0][0]));
+            row1 += weight * XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&matrix.m[1][0]));
+            row2 += weight * XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&matrix.m[2][0]));
+        }
+
+        const XMVECTOR position = XMVectorSetW(XMLoadFloat3(&vertices[i].position), 1.0f);
+        const XMVECTOR normal = XMVectorSetW(XMLoadFloat3(&vertices[i].normal), 0.0f);
+        XMStoreFloat3(&skinned[i].position, XMVectorSet(XMVectorGetX(XMVector4Dot(row0, position)),
+            XMVectorGetX(XMVector4Dot(row1, position)), XMVectorGetX(XMVector4Dot(row2, position)), 0.0f));
+        XMStoreFloat3(&skinned[i].normal, XMVector3Normalize(XMVectorSet(XMVectorGetX(XMVector4Dot(row0, normal)),
+            XMVectorGetX(XMVector4Dot(row1, normal)), XMVectorGetX(XMVector4Dot(row2, normal)), 0.0f)));
+        skinned[i].occlusion = vertices[i].occlusion;
+        skinned[i].texture = vertices[i].texture;
+    }
+}
+
+AnimationSystem::AnimationSystem()
+{
+}
+
+AnimationSystem::~AnimationSystem()
+{
+    Shutdown();
+}
+
+void AnimationSystem::Init(const Skeleton *skeleton, const AnimationClip *clips, unsigned int clipCount)
+{
+    Shutdown();
+    assert(skeleton->GetJointCount() > 0 && skeleton->GetJointCount() <= MaxJoints && clipCount > 0);
+
+    mSkeleton = skeleton;
+    mClips = clips;
+    mClipCount = clipCount;
+    mQuadCount = (skeleton->GetJointCount() + 3) / 4;
+    for (unsigned int i = 0; i < clipCount; i++)
+    {
+        assert(clips[i].quadCount == mQuadCount && clips[i].frameCount >= 2);
+    }
+}
+
+void AnimationSystem::Shutdown()
+{
+    mSkeleton = nullptr;
+    mClips = nullptr;
+    mClipCount = 0;
+    mQuadCount = 0;
+    mClip.clear();
+    mTime.clear();
+    mSpeed.clear();
+    mFadeClip.clear();
+    mFadeTime.clear();
+    mFade.clear();
+    mFadeRate.clear();
+    mPalettes.clear();
+    mStats = AnimationStats();
+}
+
+CharacterHandle AnimationSystem::AddCharacter(unsigned int clip, float time, float speed)
+{
+    assert(clip < mClipCount);
+    mClip.push_back(clip);
+    mTime.push_back(fmodf(time, mClips[clip].duration));
+    mSpeed.push_back(speed);
+    mFadeClip.push_back(clip);
+    mFadeTime.push_back(0.0f);
+    mFade.push_back(1.0f);
+    mFadeRate.push_back(0.0f);
+
+    //Palettes start in the bind pose until the first update
+    XMFLOAT3X4 identity;
+    XMStoreFloat3x4(&identity, XMMatrixIdentity());
+    mPalettes.resize(mPalettes.size() + mSkeleton->GetJointCount(), identity);
+    return static_cast<CharacterHandle>(mClip.size() - 1);
+}
+
+void AnimationSystem::Play(CharacterHandle character, unsigned int clip, float fadeSeconds)
+{
+    assert(character < mClip.size() && clip < mClipCount);
+    if (fadeSeconds <= 0.0f)
+    {
+        mClip[character] = clip;
+        mTime[character] = 0.0f;
+        mFade[character] = 1.0f;
+        return;
+    }
+
+    mFadeClip[character] = mClip[character];
+    mFadeTime[character] = mTime[character];
+    mClip[character] = clip;
+    mTime[character] = 0.0f;
+    mFade[character] = 0.0f;
+    mFadeRate[character] = 1.0f / fadeSeconds;
+}
+
+void AnimationSystem::SetSpeed(CharacterHandle character, float speed)
+{
+    mSpeed[character] = speed;
+}
+
+unsigned int AnimationSystem::GetCharacterCount()const
+{
+    return static_cast<unsigned int>(mClip.size());
+}
+
+unsigned int AnimationSystem::GetJointCount()const
+{
+    return mSkeleton ? mSkeleton->GetJointCount() : 0;
+}
+
+unsigned int AnimationSystem::GetClip(CharacterHandle character)const
+{
+    return mClip[character];
+}
+
+void AnimationSystem::Update(float deltaTime, JobSystem *jobs)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    //Advance the clocks, one pass over each array
+    const unsigned int count = GetCharacterCount();
+    unsigned int blending = 0;
+    for (unsigned int c = 0; c < count; c++)
+    {
+        const float step = deltaTime * mSpeed[c];
+        mTime[c] = fmodf(mTime[c] + step, mClips[mClip[c]].duration);
+        mFadeTime[c] = fmodf(mFadeTime[c] + step, mClips[mFadeClip[c]].duration);
+        mFade[c] = std::min(1.0f, mFade[c] + deltaTime * mFadeRate[c]);
+        blending += mFade[c] < 1.0f ? 1 : 0;
+    }
+
+    if (jobs)
+    {
+        jobs->ParallelFor(count, minCharactersPerJob, maxAnimationJobs, [this](unsigned int begin, unsigned int end, unsigned int)
+        {
+            UpdateCharacters(begin, end);
+        });
+    }
+    else
+    {
+        UpdateCharacters(0, count);
+    }
+
+    mStats.characters = count;
+    mStats.blending = blending;
+    mStats.ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void AnimationSystem::SamplePose(const AnimationClip &clip, float time, JointQuad *pose)const
+{
+    const float position = std::max(0.0f, time * clip.sampleRate);
+    const unsigned int frame = std::min(static_cast<unsigned int>(position), clip.frameCount - 2);
+    const XMVECTOR t = XMVectorReplicate(std::min(position - frame, 1.0f));
+
+    const JointQuad *a = &clip.frames[static_cast<size_t>(frame) * mQuadCount];
+    const JointQuad *b = a + mQuadCount;
+    for (unsigned int q = 0; q < mQuadCount; q++)
+    {
+        BlendQuads(a[q], b[q], t, pose[q]);
+    }
+}
+
+void AnimationSystem::UpdateCharacters(unsigned int begin, unsigned int end)
+{
+    const unsigned int jointCount = mSkeleton->GetJointCount();
+    const int *parents = mSkeleton->parents.data();
+    const XMFLOAT4X4 *inverseBind = mSkeleton->inverseBind.data();
+
+    ScratchScope scratch;
+    JointQuad *pose = scratch.GetArena().AllocateArray<JointQuad>(mQuadCount);
+    JointQuad *fadePose = scratch.GetArena().AllocateArray<JointQuad>(mQuadCount);
+    LocalQuad *local = scratch.GetArena().AllocateArray<LocalQuad>(mQuadCount);
+    XMMATRIX *model = scratch.GetArena().AllocateArray<XMMATRIX>(jointCount);
+
+    for (unsigned int c = begin; c < end; c++)
+    {
+        SamplePose(mClips[mClip[c]], mTime[c], pose);
+        if (mFade[c] < 1.0f)
+        {
+            SamplePose(mClips[mFadeClip[c]], mFadeTime[c], fadePose);
+            const XMVECTOR fade = XMVectorReplicate(mFade[c]);
+            for (unsigned int q = 0; q < mQuadCount; q++)
+            {
+                BlendQuads(fadePose[q], pose[q], fade, pose[q]);
+            }
+        }
+
+        for (unsigned int q = 0; q < mQuadCount; q++)
+        {
+            ComposeQuad(pose[q], local[q]);
+        }
+
+        //Parents come first, so one pass takes every joint to model space
+        XMFLOAT3X4 *palette = &mPalettes[static_cast<size_t>(c) * jointCount];
+        for (unsigned int j = 0; j < jointCount; j++)
+        {
+            const XMFLOAT4A *m = local[j / 4].m;
+            const unsigned int lane = j % 4;
+            const XMMATRIX matrix(
+                (&m[0].x)[lane], (&m[1].x)[lane], (&m[2].x)[lane], 0.0f,
+                (&m[3].x)[lane], (&m[4].x)[lane], (&m[5].x)[lane], 0.0f,
+                (&m[6].x)[lane], (&m[7].x)[lane], (&m[8].x)[lane], 0.0f,
+                (&m[9].x)[lane], (&m[10].x)[lane], (&m[11].x)[lane], 1.0f);
+
+            model[j] = parents[j] < 0 ? matrix : XMMatrixMultiply(matrix, model[parents[j]]);
+            XMStoreFloat3x4(&palette[j], XMMatrixMultiply(XMLoadFloat4x4(&inverseBind[j]), model[j]));
+        }
+    }
+}
+
+const XMFLOAT3X4 *AnimationSystem::GetPalette(CharacterHandle character)const
+{
+    return &mPalettes[static_cast<size_t>(character) * GetJointCount()];
+}
+
+const XMFLOAT3X4 *AnimationSystem::GetPalettes()const
+{
+    return mPalettes.data();
+}
+
+const AnimationStats &AnimationSystem::GetStats()const
+{
+    return mStats;
+}
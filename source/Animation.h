@@ -0,0 +1,136 @@
+#pragma once
+
+#include <directxmath.h>
+#include <string>
+#include <vector>
+
+#include "Assets.h"
+#include "JobSystem.h"
+
+using namespace DirectX;
+
+//Joint indices are stored in a byte per vertex
+const unsigned int MaxJoints = 256;
+
+//Local transform of a joint relative to its parent
+struct JointPose
+{
+    XMFLOAT3 translation = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    XMFLOAT4 rotation = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+    XMFLOAT3 scale = XMFLOAT3(1.0f, 1.0f, 1.0f);
+};
+
+//Joints sorted so every parent comes before its children
+struct Skeleton
+{
+    std::vector<std::string> names;
+    std::vector<int> parents;                   //-1 for a root
+    std::vector<JointPose> bindPose;            //Where a clip doesn't move a joint it stays here
+    std::vector<XMFLOAT4X4> inverseBind;        //Model space to the joint's space in the bind pose
+
+    unsigned int GetJointCount()const { return static_cast<unsigned int>(parents.size()); }
+    int Find(const std::string &name)const;
+};
+
+//Four joints of a pose with every component in its own vector, so sampling and blending
+//work on four joints per instruction
+struct JointQuad
+{
+    XMFLOAT4A tx, ty, tz;
+    XMFLOAT4A rx, ry, rz, rw;
+    XMFLOAT4A sx, sy, sz;
+};
+
+//Components of four joints' local matrices: 3x3 rotation and scale, then translation
+struct LocalQuad
+{
+    XMFLOAT4A m[12];
+};
+
+//Rotation, scale and translation of four joints to the rows of their local matrices,
+//the same as XMMatrixAffineTransformation without a rotation origin
+void ComposeQuad(const JointQuad &pose, LocalQuad &local);
+
+//An animation resampled at a fixed rate when it is imported, so sampling it is two frame
+//lookups and a blend instead of a key search per joint
+struct AnimationClip
+{
+    std::string name;
+    float duration = 0.0f;                      //Seconds, the clip loops
+    float sampleRate = 30.0f;
+    unsigned int frameCount = 0;                //The last frame is at duration
+    unsigned int quadCount = 0;                 //Joints rounded up to a multiple of four, over four
+    std::vector<JointQuad> frames;              //frameCount * quadCount
+};
+
+//Sizes a clip for a skeleton and fills every frame with the bind pose
+void InitClip(AnimationClip &clip, const Skeleton &skeleton, float duration, float sampleRate);
+void SetClipPose(AnimationClip &clip, unsigned int frame, unsigned int joint, const JointPose &pose);
+
+//Software skinning: moves positions and normals by up to four palette matrices each
+void SkinVertices(const VERTEX *vertices, const VertexSkin *skin, size_t count, const XMFLOAT3X4 *palette, VERTEX *skinned);
+
+typedef unsigned int CharacterHandle;
+
+//What the last Update did
+struct AnimationStats
+{
+    unsigned int characters = 0;
+    unsigned int blending = 0;                  //Characters sampling two clips for a cross fade
+    float ms = 0.0f;
+};
+
+//Plays clips on a crowd of characters sharing one skeleton. Per character state is kept
+//in separate arrays, sampling runs on four joints at a time and the characters are split
+//over the job system, each ending up with a palette of skinning matrices.
+class AnimationSystem
+{
+public:
+    AnimationSystem();
+    ~AnimationSystem();
+
+    //The skeleton and clips have to stay alive and unchanged while the system uses them
+    void Init(const Skeleton *skeleton, const AnimationClip *clips, unsigned int clipCount);
+    void Shutdown();
+
+    CharacterHandle AddCharacter(unsigned int clip, float time = 0.0f, float speed = 1.0f);
+
+    //Cross fades from what the character plays now to another clip over fadeSeconds
+    void Play(CharacterHandle character, unsigned int clip, float fadeSeconds);
+    void SetSpeed(CharacterHandle character, float speed);
+
+    unsigned int GetCharacterCount()const;
+    unsigned int GetJointCount()const;
+    unsigned int GetClip(CharacterHandle character)const;
+
+    //Advances every character and rebuilds the palettes
+    void Update(float deltaTime, JobSystem *jobs);
+
+    //GetJointCount() skinning matrices of a character, stored as 3x4 so they go to the
+    //shader as they are; the palettes of all characters follow each other
+    const XMFLOAT3X4 *GetPalette(CharacterHandle character)const;
+    const XMFLOAT3X4 *GetPalettes()const;
+
+    const AnimationStats &GetStats()const;
+
+private:
+    void UpdateCharacters(unsigned int begin, unsigned int end);
+    void SamplePose(const AnimationClip &clip, float time, JointQuad *pose)const;
+
+    const Skeleton *mSkeleton = nullptr;
+    const AnimationClip *mClips = nullptr;
+    unsigned int mClipCount = 0;
+    unsigned int mQuadCount = 0;
+
+    //Per character
+    std::vector<unsigned int> mClip;
+    std::vector<float> mTime;
+    std::vector<float> mSpeed;
+    std::vector<unsigned int> mFadeClip;        //Clip faded out of
+    std::vector<float> mFadeTime;
+    std::vector<float> mFade;                   //Weight of mClip, 1 once the fade is done
+    std::vector<float> mFadeRate;
+    std::vector<XMFLOAT3X4> mPalettes;
+
+    AnimationStats mStats;
+};
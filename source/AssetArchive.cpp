@@ -0,0 +1,708 @@
+#include "AssetArchive.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include "FileCache.h"
+#include "Lz4.h"
+
+//Bump when the layout changes so old archives are rejected
+const unsigned int archiveVersion = 1;
+const unsigned int archiveMagic = 0x52414750; //"PGAR"
+const unsigned int archiveAlignment = 64;
+const unsigned int entryStored = 1;         //Every block is stored, the data is one contiguous range
+
+struct AssetArchive::Header
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int entryCount;
+    unsigned int blockCount;
+    unsigned long long entriesOffset;
+    unsigned long long blocksOffset;
+    unsigned long long namesOffset;
+    unsigned long long namesSize;
+    unsigned long long fileSize;            //Catches archives that were cut short
+    unsigned char padding[8];
+};
+
+//Sorted by name hash
+struct AssetArchive::Entry
+{
+    unsigned long long nameHash;
+    unsigned long long contentHash;
+    unsigned long long size;
+    unsigned int firstBlock;
+    unsigned int blockCount;
+    unsigned int nameOffset;
+    unsigned int nameLength;
+    unsigned int flags;
+    unsigned int padding;
+};
+
+//Every block but the last of an entry holds BlockSize bytes
+struct AssetArchive::Block
+{
+    unsigned long long offset;
+    unsigned int packedSize;                //Equal to size when the block is stored
+    unsigned int size;
+};
+
+static unsigned long long RotateLeft(unsigned long long value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+//Fast 64 bit hash that eats eight bytes at a time, for names and to verify contents
+static unsigned long long HashBytes(const unsigned char *data, size_t size)
+{
+    const unsigned long long prime = 0x9e3779b97f4a7c15ull;
+    unsigned long long hash = 0xcbf29ce484222325ull ^ (size * prime);
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        unsigned long long word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = RotateLeft(hash ^ (word * prime), 29) * prime;
+    }
+    for (; i < size; i++)
+    {
+        hash = RotateLeft(hash ^ (data[i] * prime), 29) * prime;
+    }
+
+    hash ^= hash >> 32;
+    hash *= prime;
+    return hash ^ (hash >> 29);
+}
+
+//Lower case, forward slashes, no "." segments and ".." applied, so every spelling of a path matches
+static std::string NormalizePath(const std::string &path)
+{
+    std::vector<std::string> segments;
+    std::string segment;
+    for (size_t i = 0; i <= path.size(); i++)
+    {
+        const char c = i < path.size() ? path[i] : '/';
+        if (c != '/' && c != '\\')
+        {
+            segment += static_cast<char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+            continue;
+        }
+
+        if (segment == "..")
+        {
+            if (!segments.empty() && segments.back() != "..")
+            {
+                segments.pop_back();
+            }
+            else
+            {
+                segments.push_back(segment);
+            }
+        }
+        else if (!segment.empty() && segment != ".")
+        {
+            segments.push_back(segment);
+        }
+        segment.clear();
+    }
+
+    std::string normalized;
+    for (const std::string &part : segments)
+    {
+        if (!normalized.empty())
+        {
+            normalized += '/';
+        }
+        normalized += part;
+    }
+    return normalized;
+}
+
+static unsigned long long AlignUp(unsigned long long value, unsigned long long alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+AssetArchive::AssetArchive()
+{
+}
+
+AssetArchive::~AssetArchive()
+{
+    Close();
+}
+
+bool AssetArchive::Open(const char *filename)
+{
+    static_assert(sizeof(Header) == 64, "Archive header layout changed");
+    static_assert(sizeof(Entry) == 48, "Archive entry layout changed");
+    static_assert(sizeof(Block) == 16, "Archive block layout changed");
+
+    Close();
+    if (!mFile.Open(filename) || mFile.GetSize() < sizeof(Header))
+    {
+        Close();
+        return false;
+    }
+
+    const char *data = mFile.GetData();
+    const unsigned long long fileSize = mFile.GetSize();
+    const Header *header = reinterpret_cast<const Header*>(data);
+    if (header->magic != archiveMagic || header->version != archiveVersion || header->fileSize != fileSize ||
+        header->entriesOffset + static_cast<unsigned long long>(header->entryCount) * sizeof(Entry) > fileSize ||
+        header->blocksOffset + static_cast<unsigned long long>(header->blockCount) * sizeof(Block) > fileSize ||
+        header->namesOffset + header->namesSize > fileSize)
+    {
+        Close();
+        return false;
+    }
+
+    const Entry *entries = reinterpret_cast<const Entry*>(data + header->entriesOffset);
+    const Block *blocks = reinterpret_cast<const Block*>(data + header->blocksOffset);
+
+    //Check every range once here, so reads can trust the table
+    for (unsigned int i = 0; i < header->entryCount; i++)
+    {
+        const Entry &entry = entries[i];
+        if (static_cast<unsigned long long>(entry.firstBlock) + entry.blockCount > header->blockCount ||
+            static_cast<unsigned long long>(entry.nameOffset) + entry.nameLength > header->namesSize ||
+            (entry.blockCount == 0 && entry.size > 0) ||
+            (entry.blockCount > 0 && (entry.blockCount - 1ull) * BlockSize >= entry.size) ||
+            (i > 0 && entries[i - 1].nameHash > entry.nameHash))
+        {
+            Close();
+            return false;
+        }
+
+        unsigned long long size = 0;
+        for (unsigned int b = 0; b < entry.blockCount; b++)
+        {
+            const Block &block = blocks[entry.firstBlock + b];
+            const unsigned int expected = static_cast<unsigned int>(std::min<unsigned long long>(BlockSize, entry.size - size));
+            if (block.size != expected || block.offset + block.packedSize > fileSize ||
+                ((entry.flags & entryStored) && block.offset != blocks[entry.firstBlock].offset + size))
+            {
+                Close();
+                return false;
+            }
+            size += block.size;
+        }
+    }
+
+    mHeader = header;
+    mEntries = entries;
+    mBlocks = blocks;
+    mNames = data + header->namesOffset;
+    return true;
+}
+
+void AssetArchive::Close()
+{
+    mFile.Close();
+    mHeader = nullptr;
+    mEntries = nullptr;
+    mBlocks = nullptr;
+    mNames = nullptr;
+}
+
+bool AssetArchive::IsOpen()const
+{
+    return mHeader != nullptr;
+}
+
+int AssetArchive::Find(const char *path)const
+{
+    if (!mHeader)
+    {
+        return -1;
+    }
+
+    const std::string name = NormalizePath(path);
+    const unsigned long long hash = HashBytes(reinterpret_cast<const unsigned char*>(name.data()), name.size());
+
+    const Entry *end = mEntries + mHeader->entryCount;
+    const Entry *entry = std::lower_bound(mEntries, end, hash, [](const Entry &e, unsigned long long h) { return e.nameHash < h; });
+    for (; entry != end && entry->nameHash == hash; entry++)
+    {
+        if (entry->nameLength == name.size() && memcmp(mNames + entry->nameOffset, name.data(), name.size()) == 0)
+        {
+            return static_cast<int>(entry - mEntries);
+        }
+    }
+    return -1;
+}
+
+unsigned int AssetArchive::GetEntryCount()const
+{
+    return mHeader ? mHeader->entryCount : 0;
+}
+
+std::string AssetArchive::GetName(int entry)const
+{
+    const Entry *e = GetEntry(entry);
+    return e ? std::string(mNames + e->nameOffset, e->nameLength) : std::string();
+}
+
+size_t AssetArchive::GetSize(int entry)const
+{
+    const Entry *e = GetEntry(entry);
+    return e ? static_cast<size_t>(e->size) : 0;
+}
+
+unsigned long long AssetArchive::GetContentHash(int entry)const
+{
+    const Entry *e = GetEntry(entry);
+    return e ? e->contentHash : 0;
+}
+
+const unsigned char* AssetArchive::GetStoredData(int entry)const
+{
+    const Entry *e = GetEntry(entry);
+    if (!e || !(e->flags & entryStored) || e->blockCount == 0)
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<const unsigned char*>(mFile.GetData()) + mBlocks[e->firstBlock].offset;
+}
+
+bool AssetArchive::Read(int entry, unsigned char *destination, JobSystem *jobs, bool verify)const
+{
+    const Entry *e = GetEntry(entry);
+    if (!e)
+    {
+        return false;
+    }
+
+    const unsigned char *data = reinterpret_cast<const unsigned char*>(mFile.GetData());
+    std::atomic<bool> failed{ false };
+    const auto unpack = [this, e, data, destination, &failed](unsigned int begin, unsigned int end, unsigned int)
+    {
+        for (unsigned int b = begin; b < end; b++)
+        {
+            const Block &block = mBlocks[e->firstBlock + b];
+            unsigned char *target = destination + static_cast<size_t>(b) * BlockSize;
+            if (block.packedSize == block.size)
+            {
+                memcpy(target, data + block.offset, block.size);
+            }
+            else if (!Lz4Decompress(data + block.offset, block.packedSize, target, block.size))
+            {
+                failed = true;
+            }
+        }
+    };
+
+    if (jobs && e->blockCount > 1)
+    {
+        jobs->ParallelFor(e->blockCount, 1, e->blockCount, unpack);
+    }
+    else
+    {
+        unpack(0, e->blockCount, 0);
+    }
+
+    if (failed)
+    {
+        return false;
+    }
+    return !verify || HashBytes(destination, static_cast<size_t>(e->size)) == e->contentHash;
+}
+
+const AssetArchive::Entry* AssetArchive::GetEntry(int entry)const
+{
+    if (!mHeader || entry < 0 || static_cast<unsigned int>(entry) >= mHeader->entryCount)
+    {
+        return nullptr;
+    }
+    return &mEntries[entry];
+}
+
+
+//Every file under a directory, paths start with the directory
+static void ListFiles(const std::string &directory, std::vector<std::string> &files)
+{
+#if defined(_WIN32)
+    WIN32_FIND_DATAA data = {};
+    HANDLE find = FindFirstFileA((directory + "/*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    do
+    {
+        const std::string name = data.cFileName;
+        if (name == "." || name == "..")
+        {
+            continue;
+        }
+
+        const std::string path = directory + "/" + name;
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            ListFiles(path, files);
+        }
+        else
+        {
+            files.push_back(path);
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR *dir = opendir(directory.c_str());
+    if (!dir)
+    {
+        return;
+    }
+
+    while (dirent *item = readdir(dir))
+    {
+        const std::string name = item->d_name;
+        if (name == "." || name == "..")
+        {
+            continue;
+        }
+
+        const std::string path = directory + "/" + name;
+        struct stat info = {};
+        if (stat(path.c_str(), &info) != 0)
+        {
+            continue;
+        }
+        if (S_ISDIR(info.st_mode))
+        {
+            ListFiles(path, files);
+        }
+        else
+        {
+            files.push_back(path);
+        }
+    }
+    closedir(dir);
+#endif
+}
+
+bool PackAssetArchive(const char *directory, const char *archivePath, JobSystem *jobs, AssetPackStats &stats)
+{
+    typedef AssetArchive::Entry Entry;
+    typedef AssetArchive::Block Block;
+
+    const auto start = std::chrono::high_resolution_clock::now();
+    stats = AssetPackStats();
+
+    //An archive written into the directory it packs must not pack itself
+    std::vector<std::string> paths;
+    ListFiles(directory, paths);
+    const std::string archiveName = NormalizePath(archivePath);
+    paths.erase(std::remove_if(paths.begin(), paths.end(), [&archiveName](const std::string &path)
+    {
+        const std::string name = NormalizePath(path);
+        return name == archiveName || name == archiveName + ".tmp";
+    }), paths.end());
+
+    struct PackFile
+    {
+        std::string name;
+        std::unique_ptr<MappedFile> file;
+        Entry entry = {};
+    };
+
+    //Map every file and lay out its blocks
+    std::vector<PackFile> files(paths.size());
+    std::vector<Block> blocks;
+    std::vector<unsigned int> blockFiles;
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        PackFile &file = files[i];
+        file.name = NormalizePath(paths[i]);
+        file.file.reset(new MappedFile());
+        if (!file.file->Open(paths[i].c_str()))
+        {
+            return false;
+        }
+
+        const unsigned long long size = file.file->GetSize();
+        file.entry.nameHash = HashBytes(reinterpret_cast<const unsigned char*>(file.name.data()), file.name.size());
+        file.entry.size = size;
+        file.entry.firstBlock = static_cast<unsigned int>(blocks.size());
+        file.entry.blockCount = static_cast<unsigned int>((size + AssetArchive::BlockSize - 1) / AssetArchive::BlockSize);
+        for (unsigned int b = 0; b < file.entry.blockCount; b++)
+        {
+            Block block = {};
+            block.size = static_cast<unsigned int>(std::min<unsigned long long>(AssetArchive::BlockSize, size - static_cast<unsigned long long>(b) * AssetArchive::BlockSize));
+            blocks.push_back(block);
+            blockFiles.push_back(static_cast<unsigned int>(i));
+        }
+        stats.bytes += size;
+    }
+
+    //Compress every block on its own, keep it stored unless LZ4 saves at least 1/16
+    std::vector<std::vector<unsigned char>> packed(blocks.size());
+    const auto compress = [&](unsigned int begin, unsigned int end, unsigned int)
+    {
+        for (unsigned int b = begin; b < end; b++)
+        {
+            const PackFile &file = files[blockFiles[b]];
+            const unsigned char *source = reinterpret_cast<const unsigned char*>(file.file->GetData()) +
+                static_cast<size_t>(b - file.entry.firstBlock) * AssetArchive::BlockSize;
+
+            std::vector<unsigned char> &output = packed[b];
+            output.resize(Lz4CompressBound(blocks[b].size));
+            const size_t packedSize = Lz4Compress(source, blocks[b].size, output.data(), output.size());
+            if (packedSize == 0 || packedSize >= blocks[b].size - blocks[b].size / 16)
+            {
+                output.assign(source, source + blocks[b].size);
+            }
+            else
+            {
+                output.resize(packedSize);
+            }
+            blocks[b].packedSize = static_cast<unsigned int>(output.size());
+        }
+    };
+    const auto hash = [&](unsigned int begin, unsigned int end, unsigned int)
+    {
+        for (unsigned int i = begin; i < end; i++)
+        {
+            files[i].entry.contentHash = HashBytes(reinterpret_cast<const unsigned char*>(files[i].file->GetData()), files[i].file->GetSize());
+        }
+    };
+    if (jobs)
+    {
+        jobs->ParallelFor(static_cast<unsigned int>(blocks.size()), 1, 64, compress);
+        jobs->ParallelFor(static_cast<unsigned int>(files.size()), 1, 64, hash);
+    }
+    else
+    {
+        compress(0, static_cast<unsigned int>(blocks.size()), 0);
+        hash(0, static_cast<unsigned int>(files.size()), 0);
+    }
+
+    //Table of contents sorted for the binary search, names packed after the blocks
+    std::sort(files.begin(), files.end(), [](const PackFile &a, const PackFile &b)
+    {
+        return a.entry.nameHash != b.entry.nameHash ? a.entry.nameHash < b.entry.nameHash : a.name < b.name;
+    });
+
+    std::string names;
+    for (PackFile &file : files)
+    {
+        file.entry.nameOffset = static_cast<unsigned int>(names.size());
+        file.entry.nameLength = static_cast<unsigned int>(file.name.size());
+        names += file.name;
+    }
+
+    AssetArchive::Header header = {};
+    header.magic = archiveMagic;
+    header.version = archiveVersion;
+    header.entryCount = static_cast<unsigned int>(files.size());
+    header.blockCount = static_cast<unsigned int>(blocks.size());
+    header.entriesOffset = AlignUp(sizeof(header), archiveAlignment);
+    header.blocksOffset = AlignUp(header.entriesOffset + files.size() * sizeof(Entry), archiveAlignment);
+    header.namesOffset = header.blocksOffset + blocks.size() * sizeof(Block);
+    header.namesSize = names.size();
+
+    //Entry data starts aligned, blocks of an entry follow each other
+    unsigned long long offset = AlignUp(header.namesOffset + header.namesSize, archiveAlignment);
+    for (PackFile &file : files)
+    {
+        offset = AlignUp(offset, archiveAlignment);
+        bool stored = true;
+        for (unsigned int b = 0; b < file.entry.blockCount; b++)
+        {
+            Block &block = blocks[file.entry.firstBlock + b];
+            block.offset = offset;
+            offset += block.packedSize;
+            stored = stored && block.packedSize == block.size;
+        }
+        file.entry.flags = stored ? entryStored : 0;
+    }
+    header.fileSize = offset;
+
+    const bool written = ReplaceFile(archivePath, [&](std::ofstream &output)
+    {
+        const auto padTo = [&output](unsigned long long position)
+        {
+            static const char zeros[archiveAlignment] = {};
+            const unsigned long long current = static_cast<unsigned long long>(output.tellp());
+            output.write(zeros, static_cast<std::streamsize>(position - current));
+        };
+
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        padTo(header.entriesOffset);
+        for (const PackFile &file : files)
+        {
+            output.write(reinterpret_cast<const char*>(&file.entry), sizeof(file.entry));
+        }
+        padTo(header.blocksOffset);
+        output.write(reinterpret_cast<const char*>(blocks.data()), static_cast<std::streamsize>(blocks.size() * sizeof(Block)));
+        output.write(names.data(), static_cast<std::streamsize>(names.size()));
+        for (const PackFile &file : files)
+        {
+            for (unsigned int b = 0; b < file.entry.blockCount; b++)
+            {
+                const unsigned int block = file.entry.firstBlock + b;
+                padTo(blocks[block].offset);
+                output.write(reinterpret_cast<const char*>(packed[block].data()), static_cast<std::streamsize>(packed[block].size()));
+            }
+        }
+    });
+    if (!written)
+    {
+        return false;
+    }
+
+    stats.files = header.entryCount;
+    stats.packedBytes = header.fileSize;
+    stats.ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return true;
+}
+
+
+static AssetArchive *sMountedArchive = nullptr;
+static std::mutex sChangedLock;
+static std::unordered_set<std::string> sChangedPaths;      //Guarded by sChangedLock, normalized
+
+void MountAssetArchive(AssetArchive *archive)
+{
+    sMountedArchive = archive && archive->IsOpen() ? archive : nullptr;
+}
+
+AssetArchive* GetMountedAssetArchive()
+{
+    return sMountedArchive;
+}
+
+void MarkAssetChanged(const std::string &path)
+{
+    std::lock_guard<std::mutex> guard(sChangedLock);
+    sChangedPaths.insert(NormalizePath(path));
+}
+
+//Entry of a path in the mounted archive, -1 when it has to come from the loose file
+static int FindMountedEntry(const std::string &path)
+{
+    if (!sMountedArchive)
+    {
+        return -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(sChangedLock);
+        if (!sChangedPaths.empty() && sChangedPaths.count(NormalizePath(path)) > 0)
+        {
+            return -1;
+        }
+    }
+    return sMountedArchive->Find(path.c_str());
+}
+
+bool GetAssetStamp(const std::string &path, unsigned long long &size, unsigned long long &stamp)
+{
+    const int entry = FindMountedEntry(path);
+    if (entry >= 0)
+    {
+        size = sMountedArchive->GetSize(entry);
+        stamp = sMountedArchive->GetContentHash(entry);
+        return true;
+    }
+
+#if defined(_WIN32)
+    struct _stat64 info = {};
+    if (_stat64(path.c_str(), &info) != 0)
+#else
+    struct stat info = {};
+    if (stat(path.c_str(), &info) != 0)
+#endif
+    {
+        return false;
+    }
+
+    size = static_cast<unsigned long long>(info.st_size);
+    stamp = static_cast<unsigned long long>(info.st_mtime);
+    return true;
+}
+
+AssetFile::AssetFile()
+{
+}
+
+AssetFile::~AssetFile()
+{
+    Close();
+}
+
+bool AssetFile::Open(const char *path, JobSystem *jobs)
+{
+    Close();
+
+    const int entry = FindMountedEntry(path);
+    if (entry >= 0)
+    {
+        mFromArchive = true;
+        mSize = sMountedArchive->GetSize(entry);
+        mData = sMountedArchive->GetStoredData(entry);
+        if (!mData)
+        {
+            mUnpacked.resize(mSize);
+            if (!sMountedArchive->Read(entry, mUnpacked.data(), jobs, true))
+            {
+                Close();
+                return false;
+            }
+            mData = mUnpacked.data();
+        }
+        return true;
+    }
+
+    if (!mLoose.Open(path))
+    {
+        return false;
+    }
+    mData = reinterpret_cast<const unsigned char*>(mLoose.GetData());
+    mSize = mLoose.GetSize();
+    return true;
+}
+
+void AssetFile::Close()
+{
+    mLoose.Close();
+    mUnpacked.clear();
+    mUnpacked.shrink_to_fit();
+    mData = nullptr;
+    mSize = 0;
+    mFromArchive = false;
+}
+
+const unsigned char* AssetFile::GetData()const
+{
+    return mData;
+}
+
+size_t AssetFile::GetSize()const
+{
+    return mSize;
+}
+
+bool AssetFile::IsFromArchive()const
+{
+    return mFromArchive;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "JobSystem.h"
+#include "MappedFile.h"
+
+//What packing an archive produced
+struct AssetPackStats
+{
+    unsigned int files = 0;
+    unsigned long long bytes = 0;               //Before compression
+    unsigned long long packedBytes = 0;         //Archive size
+    float ms = 0.0f;
+};
+
+//Single file archive of every asset, opened once and memory mapped. A 64 byte aligned
+//table of contents sorted by name hash comes first, followed by the entries, each
+//cut into BlockSize blocks that are LZ4 compressed on their own (or stored when that
+//doesn't pay off), so the blocks of one file decompress in parallel. Every entry keeps
+//a hash of its content to verify what comes out.
+//
+//Names are the paths the loaders ask for relative to the working directory, like
+//"assets/stone.tga", compared without case and with / and \ treated the same.
+class AssetArchive
+{
+public:
+    static const unsigned int BlockSize = 256 * 1024;
+
+    AssetArchive();
+    ~AssetArchive();
+
+    AssetArchive(const AssetArchive&) = delete;
+    AssetArchive &operator=(const AssetArchive&) = delete;
+
+    //Maps the archive and checks its table of contents, false if it is missing or damaged
+    bool Open(const char *filename);
+    void Close();
+    bool IsOpen()const;
+
+    //Entry holding a path, -1 when the archive doesn't have it
+    int Find(const char *path)const;
+
+    unsigned int GetEntryCount()const;
+    std::string GetName(int entry)const;
+    size_t GetSize(int entry)const;
+    unsigned long long GetContentHash(int entry)const;
+
+    //Entries stored without compression are read straight from the mapping, null otherwise
+    const unsigned char* GetStoredData(int entry)const;
+
+    //Decompresses an entry into GetSize(entry) bytes, the blocks are split over the job
+    //system when there is one. verify checks the result against the content hash.
+    bool Read(int entry, unsigned char *destination, JobSystem *jobs, bool verify)const;
+
+private:
+    friend bool PackAssetArchive(const char *directory, const char *archivePath, JobSystem *jobs, AssetPackStats &stats);
+
+    struct Header;
+    struct Entry;
+    struct Block;
+
+    const Entry* GetEntry(int entry)const;
+
+    MappedFile mFile;
+    const Header *mHeader = nullptr;
+    const Entry *mEntries = nullptr;
+    const Block *mBlocks = nullptr;
+    const char *mNames = nullptr;
+};
+
+//Packs every file under directory into an archive, compressing the blocks in parallel
+bool PackAssetArchive(const char *directory, const char *archivePath, JobSystem *jobs, AssetPackStats &stats);
+
+//Loaders read through this: the mounted archive if it has the path, the loose file otherwise.
+//null unmounts. Mount before any loads start, it isn't synchronized with loads in flight.
+void MountAssetArchive(AssetArchive *archive);
+AssetArchive* GetMountedAssetArchive();
+
+//The loose file changed on disk, read it from there from now on instead of the archive
+void MarkAssetChanged(const std::string &path);
+
+//Size and a value that changes with the content, from the archive's content hash or the
+//loose file's modification time. Used to tell when derived data like mip chains is stale.
+bool GetAssetStamp(const std::string &path, unsigned long long &size, unsigned long long &stamp);
+
+//A whole asset in memory: archive entries that are stored come straight from the archive
+//mapping, compressed ones are decompressed into a buffer, loose files are mapped
+class AssetFile
+{
+public:
+    AssetFile();
+    ~AssetFile();
+
+    AssetFile(const AssetFile&) = delete;
+    AssetFile &operator=(const AssetFile&) = delete;
+
+    bool Open(const char *path, JobSystem *jobs = nullptr);
+    void Close();
+
+    const unsigned char* GetData()const;
+    size_t GetSize()const;
+    bool IsFromArchive()const;
+
+private:
+    MappedFile mLoose;
+    std::vector<unsigned char> mUnpacked;
+    const unsigned char *mData = nullptr;
+    size_t mSize = 0;
+    bool mFromArchive = false;
+};
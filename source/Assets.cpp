@@ -0,0 +1,467 @@
+#include "Assets.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <assimp\Importer.hpp>
+#include <assimp\scene.h>
+#include <assimp\postprocess.h>
+
+#include "Animation.h"
+#include "AssetArchive.h"
+#include "MeshSimplifier.h"
+#include "ObjLoader.h"
+
+static bool HasExtension(const char* filename, const char* extension)
+{
+    const size_t length = strlen(filename);
+    const size_t extensionLength = strlen(extension);
+    if (length < extensionLength)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < extensionLength; i++)
+    {
+        if (tolower(static_cast<unsigned char>(filename[length - extensionLength + i])) != extension[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool LoadModelData(const char* filename, MeshData& mesh, JobSystem* jobs)
+{
+    const bool loaded = HasExtension(filename, ".obj") ? LoadObj(filename, mesh, jobs) : LoadModelDataAssimp(filename, mesh);
+    if (!loaded)
+    {
+        return false;
+    }
+
+    //Distant copies draw one of the simplified levels
+    BuildLodChain(mesh);
+
+    return true;
+}
+
+
+bool LoadModelDataAssimp(const char* filename, MeshData& mesh)
+{
+
+    // Create importer
+    Assimp::Importer importer;
+    importer.SetPropertyBool(AI_CONFIG_PP_PTV_NORMALIZE, true);
+    importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE,
+        aiPrimitiveType_LINE |
+        aiPrimitiveType_POINT);
+    importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS,
+        aiComponent_COLORS |
+        aiComponent_LIGHTS |
+        aiComponent_CAMERAS |
+        aiComponent_BONEWEIGHTS);
+    // Load scene
+    auto const* scene = importer.ReadFile(filename,
+        aiProcess_ConvertToLeftHanded |
+        aiProcess_CalcTangentSpace |
+        aiProcess_Triangulate |
+        aiProcess_JoinIdenticalVertices |
+        aiProcess_TransformUVCoords |
+        aiProcess_GenUVCoords |
+        aiProcess_ValidateDataStructure |
+        aiProcess_GenSmoothNormals |
+        aiProcess_RemoveRedundantMaterials |
+        aiProcess_OptimizeMeshes |
+        aiProcess_FindDegenerates |
+        aiProcess_FindInvalidData |
+        aiProcess_FindInstances |
+        aiProcess_SortByPType);
+
+    //A file that is missing or still being written just fails the import
+    if (scene == nullptr || scene->mNumMeshes == 0)
+    {
+        return false;
+    }
+
+    //Find number of vertices and indices
+    uint32_t vertex_count = 0;
+    uint32_t index_count = 0;
+
+    for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
+        auto const* const curr_mesh = scene->mMeshes[m];
+        vertex_count += curr_mesh->mNumVertices;
+        index_count += curr_mesh->mNumFaces * 3;
+    }
+
+    // For each model
+    //  for each mesh
+    //      get verices
+    //      get indices
+
+    std::vector<VERTEX>& vertices = mesh.vertices;
+    std::vector<short>& indices = mesh.indices;
+    vertices.clear();
+    indices.clear();
+    vertices.reserve(vertex_count);
+    indices.reserve(index_count);
+
+    for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
+        auto const* curr_mesh = scene->mMeshes[m];
+
+        size_t vertex_start_offset = vertices.size();
+
+        for (uint32_t i = 0; i < curr_mesh->mNumVertices; i++) {
+            aiVector3D const& pos = curr_mesh->mVertices[i];
+            aiVector3D const& tex = curr_mesh->HasTextureCoords(0) ? curr_mesh->mTextureCoords[0][i] : aiVector3D(0.0f);
+            aiVector3D const& normal = curr_mesh->mNormals[i];
+
+            VERTEX vertex = {
+                { pos.x, pos.y, pos.z },
+                { normal.x, normal.y, normal.z },
+                1.0f,
+                { tex.x, tex.y }
+            };
+
+            vertices.push_back(vertex);
+        }
+
+        for (uint32_t i = 0; i < curr_mesh->mNumFaces; i++) {
+            aiFace const& face = curr_mesh->mFaces[i];
+            //for (int j = 2; j >=0; --j) {
+            for (int j = 0; j < 3; j++) {
+                indices.push_back((uint16_t)face.mIndices[j] + (uint16_t)vertex_start_offset);
+            }
+        }
+    }
+
+    mesh.lods.clear();
+    mesh.skin.clear();
+    mesh.diffuseTexture.clear();
+
+    return true;
+}
+
+
+//Assimp matrices are column vector, DirectXMath transforms row vectors
+static XMMATRIX ToRowMatrix(const aiMatrix4x4 &matrix)
+{
+    return XMMatrixTranspose(XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4*>(&matrix.a1)));
+}
+
+
+static XMMATRIX GetGlobalTransform(const aiNode *node)
+{
+    XMMATRIX global = ToRowMatrix(node->mTransformation);
+    for (const aiNode *parent = node->mParent; parent != nullptr; parent = parent->mParent)
+    {
+        global = global * ToRowMatrix(parent->mTransformation);
+    }
+    return global;
+}
+
+
+static void FindMeshNodes(const aiNode *node, std::vector<const aiNode*> &meshNodes)
+{
+    for (unsigned int i = 0; i < node->mNumMeshes; i++)
+    {
+        //An instanced mesh is skinned to the first node that draws it
+        if (meshNodes[node->mMeshes[i]] == nullptr)
+        {
+            meshNodes[node->mMeshes[i]] = node;
+        }
+    }
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+    {
+        FindMeshNodes(node->mChildren[i], meshNodes);
+    }
+}
+
+
+//Depth first so every parent lands before its children; a node that isn't needed can't
+//have needed children since the ancestors of every needed node are needed too
+static void AddJoints(const aiNode *node, int parent, const std::unordered_set<const aiNode*> &needed, Skeleton &skeleton, std::vector<const aiNode*> &jointNodes)
+{
+    if (needed.count(node) == 0 || skeleton.GetJointCount() >= MaxJoints)
+    {
+        return;
+    }
+
+    aiVector3D scale, translation;
+    aiQuaternion rotation;
+    node->mTransformation.Decompose(scale, rotation, translation);
+
+    JointPose pose;
+    pose.translation = XMFLOAT3(translation.x, translation.y, translation.z);
+    pose.rotation = XMFLOAT4(rotation.x, rotation.y, rotation.z, rotation.w);
+    pose.scale = XMFLOAT3(scale.x, scale.y, scale.z);
+
+    const int joint = static_cast<int>(skeleton.GetJointCount());
+    skeleton.names.push_back(node->mName.C_Str());
+    skeleton.parents.push_back(parent);
+    skeleton.bindPose.push_back(pose);
+    jointNodes.push_back(node);
+
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+    {
+        AddJoints(node->mChildren[i], joint, needed, skeleton, jointNodes);
+    }
+}
+
+
+template <typename Key>
+static size_t FindKey(const Key *keys, unsigned int count, double time)
+{
+    const Key *next = std::upper_bound(keys, keys + count, time, [](double t, const Key &key) { return t < key.mTime; });
+    return next == keys ? 0 : static_cast<size_t>(next - keys) - 1;
+}
+
+
+static aiVector3D SampleKeys(const aiVectorKey *keys, unsigned int count, double time)
+{
+    const size_t key = FindKey(keys, count, time);
+    if (key + 1 >= count)
+    {
+        return keys[key].mValue;
+    }
+    const double span = keys[key + 1].mTime - keys[key].mTime;
+    const float t = span > 0.0 ? static_cast<float>((time - keys[key].mTime) / span) : 0.0f;
+    return keys[key].mValue + (keys[key + 1].mValue - keys[key].mValue) * t;
+}
+
+
+static aiQuaternion SampleKeys(const aiQuatKey *keys, unsigned int count, double time)
+{
+    const size_t key = FindKey(keys, count, time);
+    if (key + 1 >= count)
+    {
+        return keys[key].mValue;
+    }
+    const double span = keys[key + 1].mTime - keys[key].mTime;
+    const float t = span > 0.0 ? static_cast<float>((time - keys[key].mTime) / span) : 0.0f;
+    aiQuaternion rotation;
+    aiQuaternion::Interpolate(rotation, keys[key].mValue, keys[key + 1].mValue, t);
+    return rotation.Normalize();
+}
+
+
+bool LoadSkinnedModelData(const char* filename, MeshData& mesh, Skeleton& skeleton, std::vector<AnimationClip>& clips)
+{
+    //Same cleanup as LoadModelDataAssimp minus the steps that would lose the bones: no
+    //pretransforming and the weights stay
+    Assimp::Importer importer;
+    importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE,
+        aiPrimitiveType_LINE |
+        aiPrimitiveType_POINT);
+    importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS,
+        aiComponent_COLORS |
+        aiComponent_LIGHTS |
+        aiComponent_CAMERAS);
+    importer.SetPropertyInteger(AI_CONFIG_PP_LBW_MAX_WEIGHTS, 4);
+    auto const* scene = importer.ReadFile(filename,
+        aiProcess_ConvertToLeftHanded |
+        aiProcess_Triangulate |
+        aiProcess_JoinIdenticalVertices |
+        aiProcess_TransformUVCoords |
+        aiProcess_GenUVCoords |
+        aiProcess_ValidateDataStructure |
+        aiProcess_GenSmoothNormals |
+        aiProcess_LimitBoneWeights |
+        aiProcess_RemoveRedundantMaterials |
+        aiProcess_FindDegenerates |
+        aiProcess_FindInvalidData |
+        aiProcess_SortByPType);
+
+    if (scene == nullptr || scene->mNumMeshes == 0)
+    {
+        return false;
+    }
+
+    std::vector<const aiNode*> meshNodes(scene->mNumMeshes, nullptr);
+    FindMeshNodes(scene->mRootNode, meshNodes);
+
+    //The joints are the bones, the nodes the meshes hang off and everything above them
+    std::unordered_set<const aiNode*> needed;
+    auto need = [&](const aiNode *node)
+    {
+        for (; node != nullptr && needed.insert(node).second; node = node->mParent)
+        {
+        }
+    };
+    need(scene->mRootNode);
+    for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+    {
+        need(meshNodes[m]);
+        for (unsigned int b = 0; b < scene->mMeshes[m]->mNumBones; b++)
+        {
+            need(scene->mRootNode->FindNode(scene->mMeshes[m]->mBones[b]->mName));
+        }
+    }
+
+    skeleton = Skeleton();
+    std::vector<const aiNode*> jointNodes;
+    AddJoints(scene->mRootNode, -1, needed, skeleton, jointNodes);
+
+    std::unordered_map<const aiNode*, int> jointOfNode;
+    skeleton.inverseBind.resize(jointNodes.size());
+    for (size_t j = 0; j < jointNodes.size(); j++)
+    {
+        jointOfNode[jointNodes[j]] = static_cast<int>(j);
+        XMStoreFloat4x4(&skeleton.inverseBind[j], XMMatrixInverse(nullptr, GetGlobalTransform(jointNodes[j])));
+    }
+
+    //Vertices are moved into the space of the root, so one palette serves every mesh
+    std::vector<VERTEX>& vertices = mesh.vertices;
+    std::vector<short>& indices = mesh.indices;
+    vertices.clear();
+    indices.clear();
+    mesh.skin.clear();
+
+    for (uint32_t m = 0; m < scene->mNumMeshes; m++)
+    {
+        auto const* curr_mesh = scene->mMeshes[m];
+        const aiNode *meshNode = meshNodes[m];
+        const XMMATRIX meshGlobal = meshNode != nullptr ? GetGlobalTransform(meshNode) : XMMatrixIdentity();
+        const XMMATRIX meshGlobalInverse = XMMatrixInverse(nullptr, meshGlobal);
+        const auto rigid = meshNode != nullptr ? jointOfNode.find(meshNode) : jointOfNode.end();
+        const unsigned char rigidJoint = rigid != jointOfNode.end() ? static_cast<unsigned char>(rigid->second) : 0;
+
+        size_t vertex_start_offset = vertices.size();
+
+        for (uint32_t i = 0; i < curr_mesh->mNumVertices; i++)
+        {
+            aiVector3D const& pos = curr_mesh->mVertices[i];
+            aiVector3D const& tex = curr_mesh->HasTextureCoords(0) ? curr_mesh->mTextureCoords[0][i] : aiVector3D(0.0f);
+            aiVector3D const& normal = curr_mesh->mNormals[i];
+
+            VERTEX vertex;
+            XMStoreFloat3(&vertex.position, XMVector3TransformCoord(XMVectorSet(pos.x, pos.y, pos.z, 1.0f), meshGlobal));
+            XMStoreFloat3(&vertex.normal, XMVector3Normalize(XMVector3TransformNormal(XMVectorSet(normal.x, normal.y, normal.z, 0.0f), meshGlobal)));
+            vertex.texture = XMFLOAT2(tex.x, tex.y);
+            vertices.push_back(vertex);
+        }
+
+        //Up to four influences per vertex, heaviest first
+        std::vector<std::pair<float, int>> influences(curr_mesh->mNumVertices * 4, std::make_pair(0.0f, 0));
+        for (unsigned int b = 0; b < curr_mesh->mNumBones; b++)
+        {
+            const aiBone *bone = curr_mesh->mBones[b];
+            const auto joint = jointOfNode.find(scene->mRootNode->FindNode(bone->mName));
+            if (joint == jointOfNode.end())
+            {
+                continue;
+            }
+
+            //The offset matrix takes mesh space to bone space, the vertices are in root space now
+            XMStoreFloat4x4(&skeleton.inverseBind[joint->second], meshGlobalInverse * ToRowMatrix(bone->mOffsetMatrix));
+
+            for (unsigned int w = 0; w < bone->mNumWeights; w++)
+            {
+                std::pair<float, int> *slots = &influences[bone->mWeights[w].mVertexId * 4];
+                std::pair<float, int> influence(bone->mWeights[w].mWeight, joint->second);
+                for (int s = 0; s < 4; s++)
+                {
+                    if (influence.first > slots[s].first)
+                    {
+                        std::swap(influence, slots[s]);
+                    }
+                }
+            }
+        }
+
+        for (uint32_t i = 0; i < curr_mesh->mNumVertices; i++)
+        {
+            const std::pair<float, int> *slots = &influences[i * 4];
+            const float total = slots[0].first + slots[1].first + slots[2].first + slots[3].first;
+
+            VertexSkin skin = {};
+            if (total <= 0.0f)
+            {
+                //Unweighted vertices follow the node of their mesh
+                skin.joints[0] = rigidJoint;
+                skin.weights[0] = 255;
+            }
+            else
+            {
+                //Weights are bytes summing to 255; rounding leftovers go to the heaviest
+                int sum = 0;
+                for (int s = 0; s < 4; s++)
+                {
+                    skin.joints[s] = static_cast<unsigned char>(slots[s].second);
+                    skin.weights[s] = static_cast<unsigned char>(slots[s].first / total * 255.0f + 0.5f);
+                    sum += skin.weights[s];
+                }
+                skin.weights[0] = static_cast<unsigned char>(skin.weights[0] + 255 - sum);
+            }
+            mesh.skin.push_back(skin);
+        }
+
+        for (uint32_t i = 0; i < curr_mesh->mNumFaces; i++)
+        {
+            aiFace const& face = curr_mesh->mFaces[i];
+            for (int j = 0; j < 3; j++)
+            {
+                indices.push_back((uint16_t)face.mIndices[j] + (uint16_t)vertex_start_offset);
+            }
+        }
+    }
+
+    //Clips are resampled once here so playing them never searches keys
+    clips.clear();
+    for (unsigned int a = 0; a < scene->mNumAnimations; a++)
+    {
+        const aiAnimation *animation = scene->mAnimations[a];
+        const double ticksPerSecond = animation->mTicksPerSecond > 0.0 ? animation->mTicksPerSecond : 25.0;
+
+        AnimationClip clip;
+        clip.name = animation->mName.C_Str();
+        InitClip(clip, skeleton, static_cast<float>(animation->mDuration / ticksPerSecond), clip.sampleRate);
+
+        for (unsigned int c = 0; c < animation->mNumChannels; c++)
+        {
+            const aiNodeAnim *channel = animation->mChannels[c];
+            const auto joint = jointOfNode.find(scene->mRootNode->FindNode(channel->mNodeName));
+            if (joint == jointOfNode.end())
+            {
+                continue;
+            }
+
+            for (unsigned int f = 0; f < clip.frameCount; f++)
+            {
+                const double time = std::min(f / clip.sampleRate, clip.duration) * ticksPerSecond;
+
+                JointPose pose = skeleton.bindPose[joint->second];
+                if (channel->mNumPositionKeys > 0)
+                {
+                    const aiVector3D translation = SampleKeys(channel->mPositionKeys, channel->mNumPositionKeys, time);
+                    pose.translation = XMFLOAT3(translation.x, translation.y, translation.z);
+                }
+                if (channel->mNumRotationKeys > 0)
+                {
+                    const aiQuaternion rotation = SampleKeys(channel->mRotationKeys, channel->mNumRotationKeys, time);
+                    pose.rotation = XMFLOAT4(rotation.x, rotation.y, rotation.z, rotation.w);
+                }
+                if (channel->mNumScalingKeys > 0)
+                {
+                    const aiVector3D scale = SampleKeys(channel->mScalingKeys, channel->mNumScalingKeys, time);
+                    pose.scale = XMFLOAT3(scale.x, scale.y, scale.z);
+                }
+                SetClipPose(clip, f, static_cast<unsigned int>(joint->second), pose);
+            }
+        }
+
+        clips.push_back(std::move(clip));
+    }
+
+    //The levels only pick index ranges, so they share the skin with the full mesh
+    BuildLodChain(mesh);
+    mesh.diffuseTexture.clear();
+
+    return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <directxmath.h>
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+//Struct for a single vertex
+struct VERTEX {
+    XMFLOAT3 position;
+    XMFLOAT3 normal;
+    float occlusion = 1.0f;             //Share of the ambient light that reaches the vertex, baked offline
+    XMFLOAT2 texture;
+};
+
+//Joints moving a vertex, up to four with weights in 1/255 that add up to 255. Unused slots
+//have weight 0.
+struct VertexSkin
+{
+    unsigned char joints[4];
+    unsigned char weights[4];
+};
+
+//Decoded 32-bit RGBA image
+struct TextureData
+{
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;
+};
+
+//One level of detail, a range of the index buffer drawn with the shared vertices
+struct MeshLod
+{
+    unsigned int indexOffset = 0;
+    unsigned int indexCount = 0;
+    float error = 0.0f;                 //Largest distance from the full mesh, in object space units
+};
+
+//Indexed triangle list ready to go into vertex and index buffers
+struct MeshData
+{
+    std::vector<VERTEX> vertices;
+    std::vector<short> indices;
+    std::vector<MeshLod> lods;          //Most detailed first, empty when indices is a single level
+    std::vector<VertexSkin> skin;       //One per vertex for skinned meshes, empty otherwise
+    std::string diffuseTexture;         //From the model's material, empty when it doesn't name one
+};
+
+class JobSystem;
+struct Skeleton;
+struct AnimationClip;
+
+//CPU side importers, they touch no global state so they are safe to run on worker threads
+bool LoadTarga(const char* filename, TextureData& texture);
+//OBJ files go through the native importer split over jobs, anything else through Assimp
+bool LoadModelData(const char* filename, MeshData& mesh, JobSystem* jobs = nullptr);
+bool LoadModelDataAssimp(const char* filename, MeshData& mesh);
+//Rigged model with its skeleton and every animation in the file, through Assimp. Vertices
+//come out in the space of the scene's root node, where the skeleton's bind pose puts them.
+bool LoadSkinnedModelData(const char* filename, MeshData& mesh, Skeleton& skeleton, std::vector<AnimationClip>& clips);
@@ -161,6 +161,16 @@ XMMATRIX Camera::ViewProj()const
     return XMMatrixMultiply(View(), Proj());
 }
 
+void Camera::GetPickingRay(float x, float y, float width, float height, XMVECTOR &origin, XMVECTOR &direction)const
+{
+    //Pixel to view space at a depth of one, undoing the projection's scale
+    const float viewX = (2.0f * x / width - 1.0f) / mProj(0, 0);
+    const float viewY = (1.0f - 2.0f * y / height) / mProj(1, 1);
+
+    origin = XMLoadFloat3(&mPosition);
+    direction = XMVector3Normalize(viewX * XMLoadFloat3(&mRight) + viewY * XMLoadFloat3(&mUp) + XMLoadFloat3(&mLook));
+}
+
 void Camera::Strafe(float d)
 {
     // mPosition += d*mRight
@@ -1,8 +1,5 @@
 #pragma once
 
-#include <d3d11.h>
-#include <d3dcompiler.h>
-
 #include <directxmath.h>
 
 using namespace DirectX;
@@ -52,6 +49,9 @@ public:
     XMMATRIX Proj()const;
     XMMATRIX ViewProj()const;
 
+    //World space ray from the camera through a pixel of a width x height view, with a unit direction
+    void GetPickingRay(float x, float y, float width, float height, XMVECTOR &origin, XMVECTOR &direction)const;
+
     //Strafe/Walk the camera a distance d
     void Strafe(float d);
     void Walk(float d);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "JobSystem.h"
+
+//Upper bound on how many command lists a frame is split into, one deferred context each
+const unsigned int MaxRecordChunks = 8;
+
+//Backend-agnostic parallel recording. The draw list [0, drawCount) is split into chunks,
+//record(begin, end, chunk) is called for every chunk on the job system and once all of
+//them are done submit(chunk) is called on the calling thread in chunk order, so the
+//final draw order matches a single threaded submission.
+template<typename RecordFn, typename SubmitFn>
+unsigned int RecordInParallel(JobSystem &jobs, unsigned int drawCount, unsigned int minDrawsPerChunk, RecordFn record, SubmitFn submit)
+{
+    const unsigned int chunks = jobs.ParallelFor(drawCount, minDrawsPerChunk, MaxRecordChunks,
+        [&record](unsigned int begin, unsigned int end, unsigned int chunk) { record(begin, end, chunk); });
+
+    for (unsigned int c = 0; c < chunks; c++)
+    {
+        submit(c);
+    }
+
+    return chunks;
+}
@@ -0,0 +1,103 @@
+#include "FileCache.h"
+
+#include <stdio.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+struct KeyedFileHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long key;
+    unsigned long long size;            //Bytes of data after the header, the rest of the file
+};
+
+void HashFnv1a(unsigned long long &hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+void CreateCacheDirectory(const std::string &directory)
+{
+#if defined(_WIN32)
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+}
+
+std::string GetCacheFilePath(const std::string &directory, unsigned long long key, const char *extension)
+{
+    char name[48] = {};
+    snprintf(name, sizeof(name), "%016llx%s", key, extension);
+    return directory + "/" + name;
+}
+
+bool ReplaceFile(const std::string &path, const std::function<void(std::ofstream &file)> &write)
+{
+    const std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            return false;
+        }
+
+        write(file);
+        if (!file)
+        {
+            file.close();
+            remove(tempPath.c_str());
+            return false;
+        }
+    }
+
+    //Windows won't rename onto an existing file
+    remove(path.c_str());
+    return rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+bool ReadKeyedFile(const std::string &path, unsigned int magic, unsigned int version, unsigned long long key, std::vector<unsigned char> &data)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        return false;
+    }
+    const unsigned long long fileSize = static_cast<unsigned long long>(file.tellg());
+    file.seekg(0);
+
+    //Another version, a truncated write or a damaged header is treated as a miss
+    KeyedFileHeader header = {};
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != magic || header.version != version || header.key != key || header.size != fileSize - sizeof(header))
+    {
+        return false;
+    }
+
+    data.resize(static_cast<size_t>(header.size));
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(header.size)));
+}
+
+bool WriteKeyedFile(const std::string &path, unsigned int magic, unsigned int version, unsigned long long key, const void *data, size_t size)
+{
+    KeyedFileHeader header = {};
+    header.magic = magic;
+    header.version = version;
+    header.key = key;
+    header.size = size;
+    return ReplaceFile(path, [&header, data, size](std::ofstream &file)
+    {
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    });
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+//File handling shared by everything the engine keeps on disk between runs: shader blobs,
+//occlusion bakes, terrain heights, texture mip chains and the asset archive.
+
+const unsigned long long fnvOffsetBasis = 14695981039346656037ull;
+
+//FNV-1a, start from fnvOffsetBasis. Plenty for naming and keying cache files, not for
+//verifying what is in them.
+void HashFnv1a(unsigned long long &hash, const void *data, size_t size);
+
+//Makes the directory if it isn't there yet, its parent has to exist
+void CreateCacheDirectory(const std::string &directory);
+
+//The key as 16 hex digits with the extension, inside directory
+std::string GetCacheFilePath(const std::string &directory, unsigned long long key, const char *extension);
+
+//Calls write with a fresh file next to path and renames that over path once everything
+//went in, so a crash or a full disk never leaves a half written file under the real name.
+//Readers only have to reject files from another version. False if the file couldn't be
+//written, path is left as it was then.
+bool ReplaceFile(const std::string &path, const std::function<void(std::ofstream &file)> &write);
+
+//A file that holds the data of one key, behind a header naming the format and the key
+bool ReadKeyedFile(const std::string &path, unsigned int magic, unsigned int version, unsigned long long key, std::vector<unsigned char> &data);
+bool WriteKeyedFile(const std::string &path, unsigned int magic, unsigned int version, unsigned long long key, const void *data, size_t size);
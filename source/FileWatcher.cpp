@@ -0,0 +1,276 @@
+#include "FileWatcher.h"
+
+#include <algorithm>
+#include <cctype>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+//How long a file has to stay untouched before its change is reported
+const std::chrono::milliseconds settleTime(100);
+
+static void SplitPath(const std::string &path, std::string &directory, std::string &name)
+{
+    const size_t slash = path.find_last_of("/\\");
+    directory = slash == std::string::npos ? "." : path.substr(0, slash);
+    name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+#if defined(_WIN32)
+    //File names are case insensitive on Windows
+    std::transform(name.begin(), name.end(), name.begin(), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+#endif
+}
+
+FileWatcher::FileWatcher()
+{
+}
+
+FileWatcher::~FileWatcher()
+{
+    Stop();
+}
+
+void FileWatcher::Watch(const std::string &path)
+{
+    std::string directory;
+    std::string name;
+    SplitPath(path, directory, name);
+
+    for (WatchedDirectory &watched : mDirectories)
+    {
+        if (watched.path == directory)
+        {
+            watched.files[name] = path;
+            return;
+        }
+    }
+
+    WatchedDirectory watched;
+    watched.path = directory;
+    watched.files[name] = path;
+    mDirectories.push_back(watched);
+}
+
+void FileWatcher::Start()
+{
+    if (mRunning || mDirectories.empty())
+    {
+        return;
+    }
+
+#if defined(_WIN32)
+    mStopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+#else
+    if (pipe(mStopPipe) != 0)
+    {
+        return;
+    }
+#endif
+
+    mRunning = true;
+    mThread = std::thread(&FileWatcher::ThreadLoop, this);
+}
+
+void FileWatcher::Stop()
+{
+    if (!mRunning)
+    {
+        return;
+    }
+
+    mRunning = false;
+#if defined(_WIN32)
+    SetEvent(mStopEvent);
+    mThread.join();
+    CloseHandle(mStopEvent);
+    mStopEvent = nullptr;
+#else
+    const char wake = 1;
+    (void)write(mStopPipe[1], &wake, 1);
+    mThread.join();
+    close(mStopPipe[0]);
+    close(mStopPipe[1]);
+    mStopPipe[0] = mStopPipe[1] = -1;
+#endif
+}
+
+std::vector<std::string> FileWatcher::PollChanges()
+{
+    std::vector<std::string> settled;
+    const auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> guard(mLock);
+    for (auto it = mChanged.begin(); it != mChanged.end();)
+    {
+        if (now - it->second >= settleTime)
+        {
+            settled.push_back(it->first);
+            it = mChanged.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    return settled;
+}
+
+void FileWatcher::OnFileChanged(const WatchedDirectory &directory, const std::string &name)
+{
+    std::string key = name;
+#if defined(_WIN32)
+    std::transform(key.begin(), key.end(), key.begin(), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+#endif
+
+    const auto file = directory.files.find(key);
+    if (file == directory.files.end())
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(mLock);
+    mChanged[file->second] = std::chrono::steady_clock::now();
+}
+
+#if defined(_WIN32)
+
+void FileWatcher::ThreadLoop()
+{
+    struct DirectoryWatch
+    {
+        HANDLE handle = INVALID_HANDLE_VALUE;
+        OVERLAPPED overlapped = {};
+        DWORD buffer[4096] = {};
+    };
+
+    const DWORD filter = FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE;
+
+    //One overlapped directory read per directory, all waited on together with the stop event
+    std::vector<DirectoryWatch> watches(mDirectories.size());
+    std::vector<HANDLE> waitHandles;
+    std::vector<size_t> waitDirectories;
+    for (size_t i = 0; i < mDirectories.size() && waitHandles.size() + 1 < MAXIMUM_WAIT_OBJECTS; i++)
+    {
+        const std::wstring path(mDirectories[i].path.begin(), mDirectories[i].path.end());
+        DirectoryWatch &watch = watches[i];
+        watch.handle = CreateFileW(path.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+        if (watch.handle == INVALID_HANDLE_VALUE)
+        {
+            continue;
+        }
+
+        watch.overlapped.hEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        ReadDirectoryChangesW(watch.handle, watch.buffer, sizeof(watch.buffer), FALSE, filter, nullptr, &watch.overlapped, nullptr);
+        waitHandles.push_back(watch.overlapped.hEvent);
+        waitDirectories.push_back(i);
+    }
+    waitHandles.push_back(static_cast<HANDLE>(mStopEvent));
+
+    while (mRunning)
+    {
+        const DWORD result = WaitForMultipleObjects(static_cast<DWORD>(waitHandles.size()), waitHandles.data(), FALSE, INFINITE);
+        const DWORD signaled = result - WAIT_OBJECT_0;
+        if (signaled >= waitDirectories.size())
+        {
+            break;
+        }
+
+        const size_t index = waitDirectories[signaled];
+        DirectoryWatch &watch = watches[index];
+        DWORD bytes = 0;
+        if (GetOverlappedResult(watch.handle, &watch.overlapped, &bytes, FALSE) && bytes > 0)
+        {
+            const unsigned char *cursor = reinterpret_cast<const unsigned char*>(watch.buffer);
+            while (true)
+            {
+                const FILE_NOTIFY_INFORMATION *info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(cursor);
+
+                //Names come back as UTF-16
+                const int nameLength = static_cast<int>(info->FileNameLength / sizeof(WCHAR));
+                char name[MAX_PATH] = {};
+                WideCharToMultiByte(CP_UTF8, 0, info->FileName, nameLength, name, MAX_PATH - 1, nullptr, nullptr);
+                OnFileChanged(mDirectories[index], name);
+
+                if (info->NextEntryOffset == 0)
+                {
+                    break;
+                }
+                cursor += info->NextEntryOffset;
+            }
+        }
+
+        ReadDirectoryChangesW(watch.handle, watch.buffer, sizeof(watch.buffer), FALSE, filter, nullptr, &watch.overlapped, nullptr);
+    }
+
+    for (DirectoryWatch &watch : watches)
+    {
+        if (watch.handle != INVALID_HANDLE_VALUE)
+        {
+            CancelIo(watch.handle);
+            CloseHandle(watch.handle);
+            CloseHandle(watch.overlapped.hEvent);
+        }
+    }
+}
+
+#else
+
+void FileWatcher::ThreadLoop()
+{
+    const int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify < 0)
+    {
+        return;
+    }
+
+    //Watch descriptor -> index into mDirectories
+    std::map<int, size_t> watches;
+    for (size_t i = 0; i < mDirectories.size(); i++)
+    {
+        const int watch = inotify_add_watch(notify, mDirectories[i].path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_CREATE);
+        if (watch >= 0)
+        {
+            watches[watch] = i;
+        }
+    }
+
+    alignas(struct inotify_event) char buffer[16384];
+    while (mRunning)
+    {
+        pollfd fds[2] = {};
+        fds[0].fd = notify;
+        fds[0].events = POLLIN;
+        fds[1].fd = mStopPipe[0];
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) <= 0 || (fds[1].revents & POLLIN))
+        {
+            continue;
+        }
+
+        ssize_t length = 0;
+        while ((length = read(notify, buffer, sizeof(buffer))) > 0)
+        {
+            for (char *cursor = buffer; cursor < buffer + length;)
+            {
+                const inotify_event *event = reinterpret_cast<const inotify_event*>(cursor);
+                const auto watch = watches.find(event->wd);
+                if (watch != watches.end() && event->len > 0)
+                {
+                    OnFileChanged(mDirectories[watch->second], event->name);
+                }
+                cursor += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+
+    close(notify);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Watches a set of files for writes on a background thread, using inotify on Linux and
+//ReadDirectoryChangesW on Windows. Changes are collected and handed out by PollChanges
+//once a file has been quiet for a moment, so a save that writes in several steps
+//is only reported once.
+class FileWatcher
+{
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    //Register a file, call before Start
+    void Watch(const std::string &path);
+
+    void Start();
+    void Stop();
+
+    //Watched files that changed and have settled since the last call
+    std::vector<std::string> PollChanges();
+
+private:
+    struct WatchedDirectory
+    {
+        std::string path;
+        std::map<std::string, std::string> files;   //File name in the directory -> path as registered
+    };
+
+    void ThreadLoop();
+    void OnFileChanged(const WatchedDirectory &directory, const std::string &name);
+
+    std::vector<WatchedDirectory> mDirectories;
+    std::map<std::string, std::chrono::steady_clock::time_point> mChanged;  //Path -> time of last write
+    std::mutex mLock;
+    std::thread mThread;
+    std::atomic<bool> mRunning{ false };
+#if defined(_WIN32)
+    void *mStopEvent = nullptr;
+#else
+    int mStopPipe[2] = { -1, -1 };
+#endif
+};
@@ -0,0 +1,98 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <stdint.h>
+
+#include "MemoryTelemetry.h"
+
+FrameArena::FrameArena()
+{
+}
+
+FrameArena::~FrameArena()
+{
+    Shutdown();
+}
+
+void FrameArena::Init(size_t capacity)
+{
+    Shutdown();
+    mCapacity = capacity;
+    mBlock = static_cast<unsigned char*>(::operator new(mCapacity));
+    mOffset = 0;
+}
+
+void FrameArena::Shutdown()
+{
+    Reset();
+    ::operator delete(mBlock);
+    mBlock = nullptr;
+    mCapacity = 0;
+}
+
+void* FrameArena::Allocate(size_t bytes, size_t alignment)
+{
+    RecordAllocation(MemoryTagFrame, bytes);
+
+    //Reserve enough to align anywhere in the range, cheaper than a compare and swap loop
+    const size_t reserved = bytes + alignment - 1;
+    const size_t offset = mOffset.fetch_add(reserved, std::memory_order_relaxed);
+    if (offset + reserved <= mCapacity)
+    {
+        const uintptr_t address = reinterpret_cast<uintptr_t>(mBlock + offset);
+        return reinterpret_cast<void*>((address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1));
+    }
+
+    //Out of room this frame, Reset grows the block
+    void *block = ::operator new(reserved);
+    {
+        std::lock_guard<std::mutex> guard(mOverflowLock);
+        mOverflowBlocks.push_back(block);
+    }
+    const uintptr_t address = reinterpret_cast<uintptr_t>(block);
+    return reinterpret_cast<void*>((address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1));
+}
+
+void FrameArena::Reset()
+{
+    const size_t used = mOffset.exchange(0);
+    mHighWater = std::max(mHighWater, used);
+
+    std::lock_guard<std::mutex> guard(mOverflowLock);
+    if (mOverflowBlocks.empty())
+    {
+        return;
+    }
+
+    for (void *block : mOverflowBlocks)
+    {
+        ::operator delete(block);
+    }
+    mOverflowBlocks.clear();
+    mOverflows++;
+
+    //Leave some room on top so a slowly growing frame doesn't overflow every time
+    ::operator delete(mBlock);
+    mCapacity = std::max(mCapacity * 2, used + used / 2);
+    mBlock = static_cast<unsigned char*>(::operator new(mCapacity));
+}
+
+size_t FrameArena::GetUsed()const
+{
+    return mOffset.load(std::memory_order_relaxed);
+}
+
+size_t FrameArena::GetCapacity()const
+{
+    return mCapacity;
+}
+
+size_t FrameArena::GetHighWater()const
+{
+    return mHighWater;
+}
+
+unsigned int FrameArena::GetOverflows()const
+{
+    return mOverflows;
+}
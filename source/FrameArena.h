@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+#include <vector>
+
+//Bump allocator for memory that only lives for one frame. Allocation is a single atomic
+//add so workers can use it too, and Reset drops everything at once. A frame that runs out
+//of room gets extra blocks from the heap; the next Reset grows the main block to fit the
+//whole frame, so after the first few frames the arena stops touching the heap.
+class FrameArena
+{
+public:
+    FrameArena();
+    ~FrameArena();
+
+    void Init(size_t capacity);
+    void Shutdown();
+
+    //Memory stays valid until the next Reset, safe to call from any thread
+    void* Allocate(size_t bytes, size_t alignment = 16);
+
+    //Default constructed array, only for types that don't need their destructor called
+    template<typename T>
+    T* AllocateArray(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Frame memory is dropped without running destructors");
+        T *items = static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+        for (size_t i = 0; i < count; i++)
+        {
+            new (items + i) T();
+        }
+        return items;
+    }
+
+    //Frees everything allocated since the last Reset, nothing may use it any more
+    void Reset();
+
+    size_t GetUsed()const;                  //Bytes handed out since the last Reset
+    size_t GetCapacity()const;
+    size_t GetHighWater()const;             //Most bytes a frame asked for
+    unsigned int GetOverflows()const;       //Frames that needed extra blocks
+
+private:
+    unsigned char *mBlock = nullptr;
+    size_t mCapacity = 0;
+    std::atomic<size_t> mOffset{ 0 };       //Keeps counting past the capacity, so it is what the frame asked for
+    size_t mHighWater = 0;
+    unsigned int mOverflows = 0;
+
+    std::mutex mOverflowLock;
+    std::vector<void*> mOverflowBlocks;     //Guarded by mOverflowLock
+};
+
+
+//Growable array whose memory comes from a FrameArena. Bind it to the arena every frame
+//after the arena is reset; the old contents are forgotten without being freed.
+template<typename T>
+class FrameVector
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Items are moved with memcpy when the vector grows");
+
+public:
+    void Begin(FrameArena &arena, size_t capacity = 0)
+    {
+        mArena = &arena;
+        mData = nullptr;
+        mSize = 0;
+        mCapacity = 0;
+        if (capacity > 0)
+        {
+            Grow(capacity);
+        }
+    }
+
+    void push_back(const T &item)
+    {
+        if (mSize == mCapacity)
+        {
+            Grow(mCapacity * 2);
+        }
+        mData[mSize++] = item;
+    }
+
+    //Shrinks, or grows with default constructed items
+    void resize(size_t size)
+    {
+        if (size > mCapacity)
+        {
+            Grow(size);
+        }
+        for (size_t i = mSize; i < size; i++)
+        {
+            mData[i] = T();
+        }
+        mSize = size;
+    }
+
+    void assign(const T *first, const T *last)
+    {
+        const size_t count = static_cast<size_t>(last - first);
+        mSize = 0;
+        if (count > mCapacity)
+        {
+            Grow(count);
+        }
+        if (count > 0)
+        {
+            memcpy(mData, first, count * sizeof(T));
+        }
+        mSize = count;
+    }
+
+    void clear() { mSize = 0; }
+    bool empty()const { return mSize == 0; }
+    size_t size()const { return mSize; }
+    T* data() { return mData; }
+    const T* data()const { return mData; }
+    T& operator[](size_t index) { return mData[index]; }
+    const T& operator[](size_t index)const { return mData[index]; }
+    T* begin() { return mData; }
+    T* end() { return mData + mSize; }
+    const T* begin()const { return mData; }
+    const T* end()const { return mData + mSize; }
+
+private:
+    void Grow(size_t capacity)
+    {
+        capacity = capacity < 16 ? 16 : capacity;
+        T *items = static_cast<T*>(mArena->Allocate(sizeof(T) * capacity, alignof(T)));
+        if (mSize > 0)
+        {
+            memcpy(items, mData, mSize * sizeof(T));
+        }
+        mData = items;
+        mCapacity = capacity;
+    }
+
+    FrameArena *mArena = nullptr;
+    T *mData = nullptr;
+    size_t mSize = 0;
+    size_t mCapacity = 0;
+};
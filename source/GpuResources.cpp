@@ -0,0 +1,354 @@
+#include "GpuResources.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+
+#include "MemoryTelemetry.h"
+
+//Private data slot the trackers are attached to resources under
+static const GUID trackerGuid = { 0x6f1c2a57, 0x3d4e, 0x4b8a, { 0x9c, 0x21, 0x5e, 0x7a, 0x13, 0xd4, 0x88, 0x0b } };
+
+//Attached to a resource as private data. The resource holds the only reference to it, so
+//its last Release is the resource being destroyed.
+class GpuTracker : public IUnknown
+{
+public:
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID id, void **object) override;
+    ULONG STDMETHODCALLTYPE AddRef() override;
+    ULONG STDMETHODCALLTYPE Release() override;
+
+    GpuCategory category = GpuCategoryOther;
+    unsigned long long bytes = 0;
+    char owner[64] = {};
+    GpuTracker *previous = nullptr;         //In the live list, the next one is also the free list link
+    GpuTracker *next = nullptr;
+    std::atomic<ULONG> references{ 1 };
+};
+
+//Trackers live in pages taken with malloc, so they don't go through the counted global
+//operator new under whatever tag the caller is in and show up under their own tag. The
+//pages are never freed: globals may still hold resources when the statics here go away,
+//so nothing asserts at exit and leaks are left to ReportLiveGpuResources.
+const unsigned int trackerPageSize = 64;
+
+static std::mutex sLock;
+static GpuTracker *sFree = nullptr;                 //Guarded by sLock
+static GpuTracker *sLive = nullptr;                 //Guarded by sLock, newest first
+static unsigned int sLiveCount = 0;                 //Guarded by sLock
+static GpuCategoryStats sStats[GpuCategoryCount];   //Guarded by sLock
+static bool sStrict = false;
+
+//Takes a tracker off the free list and links it into the live list, call with sLock held
+static GpuTracker* AllocateTracker()
+{
+    if (!sFree)
+    {
+        GpuTracker *page = static_cast<GpuTracker*>(malloc(sizeof(GpuTracker) * trackerPageSize));
+        assert(page && "Out of memory for GPU trackers");
+        RecordAllocation(MemoryTagGpuTrackers, sizeof(GpuTracker) * trackerPageSize);
+        for (unsigned int i = trackerPageSize; i > 0; i--)
+        {
+            GpuTracker *tracker = new (&page[i - 1]) GpuTracker();
+            tracker->next = sFree;
+            sFree = tracker;
+        }
+    }
+
+    GpuTracker *tracker = sFree;
+    sFree = tracker->next;
+    tracker->references = 1;
+    tracker->previous = nullptr;
+    tracker->next = sLive;
+    if (sLive)
+    {
+        sLive->previous = tracker;
+    }
+    sLive = tracker;
+    sLiveCount++;
+    return tracker;
+}
+
+static void Untrack(GpuTracker *tracker)
+{
+    std::lock_guard<std::mutex> guard(sLock);
+    GpuCategoryStats &stats = sStats[tracker->category];
+    stats.resources--;
+    stats.bytes -= tracker->bytes;
+
+    if (tracker->previous)
+    {
+        tracker->previous->next = tracker->next;
+    }
+    else
+    {
+        sLive = tracker->next;
+    }
+    if (tracker->next)
+    {
+        tracker->next->previous = tracker->previous;
+    }
+    sLiveCount--;
+
+    tracker->previous = nullptr;
+    tracker->next = sFree;
+    sFree = tracker;
+}
+
+HRESULT STDMETHODCALLTYPE GpuTracker::QueryInterface(REFIID id, void **object)
+{
+    if (!object)
+    {
+        return E_POINTER;
+    }
+    if (id == __uuidof(IUnknown))
+    {
+        AddRef();
+        *object = static_cast<IUnknown*>(this);
+        return S_OK;
+    }
+    *object = nullptr;
+    return E_NOINTERFACE;
+}
+
+ULONG STDMETHODCALLTYPE GpuTracker::AddRef()
+{
+    return ++references;
+}
+
+ULONG STDMETHODCALLTYPE GpuTracker::Release()
+{
+    const ULONG left = --references;
+    if (left == 0)
+    {
+        Untrack(this);
+    }
+    return left;
+}
+
+static unsigned int GetBitsPerPixel(DXGI_FORMAT format)
+{
+    switch (format)
+    {
+        case DXGI_FORMAT_R32G32B32A32_TYPELESS:
+        case DXGI_FORMAT_R32G32B32A32_FLOAT:
+            return 128;
+        case DXGI_FORMAT_R16G16B16A16_TYPELESS:
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+        case DXGI_FORMAT_R32G32_TYPELESS:
+        case DXGI_FORMAT_R32G32_FLOAT:
+            return 64;
+        case DXGI_FORMAT_R16_TYPELESS:
+        case DXGI_FORMAT_R16_FLOAT:
+        case DXGI_FORMAT_R16_UNORM:
+        case DXGI_FORMAT_D16_UNORM:
+            return 16;
+        case DXGI_FORMAT_R8_TYPELESS:
+        case DXGI_FORMAT_R8_UNORM:
+            return 8;
+        case DXGI_FORMAT_BC1_TYPELESS:
+        case DXGI_FORMAT_BC1_UNORM:
+        case DXGI_FORMAT_BC4_UNORM:
+            return 4;
+        case DXGI_FORMAT_BC3_TYPELESS:
+        case DXGI_FORMAT_BC3_UNORM:
+        case DXGI_FORMAT_BC5_UNORM:
+        case DXGI_FORMAT_BC7_TYPELESS:
+        case DXGI_FORMAT_BC7_UNORM:
+            return 8;
+        default:
+            return 32;      //RGBA8, R32 and the 32 bit depth formats the app uses
+    }
+}
+
+static bool IsBlockCompressed(DXGI_FORMAT format)
+{
+    return (format >= DXGI_FORMAT_BC1_TYPELESS && format <= DXGI_FORMAT_BC5_SNORM) ||
+        (format >= DXGI_FORMAT_BC6H_TYPELESS && format <= DXGI_FORMAT_BC7_UNORM_SRGB);
+}
+
+//Memory a buffer or texture takes, views and anything else have none of their own
+static unsigned long long GetResourceBytes(ID3D11DeviceChild *resource)
+{
+    ID3D11Buffer *buffer = nullptr;
+    if (SUCCEEDED(resource->QueryInterface(__uuidof(ID3D11Buffer), reinterpret_cast<void**>(&buffer))))
+    {
+        D3D11_BUFFER_DESC desc = {};
+        buffer->GetDesc(&desc);
+        buffer->Release();
+        return desc.ByteWidth;
+    }
+
+    ID3D11Texture2D *texture = nullptr;
+    if (SUCCEEDED(resource->QueryInterface(__uuidof(ID3D11Texture2D), reinterpret_cast<void**>(&texture))))
+    {
+        D3D11_TEXTURE2D_DESC desc = {};
+        texture->GetDesc(&desc);
+        texture->Release();
+
+        //A mip count of 0 asks for the whole chain
+        unsigned int mipLevels = desc.MipLevels;
+        if (mipLevels == 0)
+        {
+            for (unsigned int size = std::max(desc.Width, desc.Height); size > 0; size >>= 1)
+            {
+                mipLevels++;
+            }
+        }
+
+        const bool blocks = IsBlockCompressed(desc.Format);
+        unsigned long long bytes = 0;
+        for (unsigned int mip = 0; mip < mipLevels; mip++)
+        {
+            unsigned long long width = std::max(desc.Width >> mip, 1u);
+            unsigned long long height = std::max(desc.Height >> mip, 1u);
+            if (blocks)
+            {
+                width = (width + 3) & ~3ull;
+                height = (height + 3) & ~3ull;
+            }
+            bytes += width * height * GetBitsPerPixel(desc.Format) / 8;
+        }
+        return bytes * desc.ArraySize * std::max(desc.SampleDesc.Count, 1u);
+    }
+
+    return 0;
+}
+
+void TrackGpuResource(ID3D11DeviceChild *resource, GpuCategory category, const char *owner)
+{
+    if (!resource)
+    {
+        return;
+    }
+
+    const unsigned long long bytes = GetResourceBytes(resource);
+    GpuTracker *tracker = nullptr;
+    char message[256] = {};
+    {
+        std::lock_guard<std::mutex> guard(sLock);
+        tracker = AllocateTracker();
+        tracker->category = category;
+        tracker->bytes = bytes;
+        strncpy_s(tracker->owner, owner ? owner : "unknown", _TRUNCATE);
+
+        GpuCategoryStats &stats = sStats[category];
+        stats.resources++;
+        stats.bytes += bytes;
+        stats.peakBytes = std::max(stats.peakBytes, stats.bytes);
+        if (stats.budgetBytes > 0 && bytes > 0 && stats.bytes > stats.budgetBytes)
+        {
+            stats.overBudget++;
+            sprintf_s(message, "GPU memory: %s is over its %.1f MB budget at %.1f MB after %.2f MB for %s\n", GetGpuCategoryName(category),
+                stats.budgetBytes / 1048576.0, stats.bytes / 1048576.0, bytes / 1048576.0, tracker->owner);
+        }
+    }
+
+    //Outside the lock, both can release a tracker: one the resource already had, or this one if
+    //the resource doesn't take it, which untracks it again
+    resource->SetPrivateDataInterface(trackerGuid, tracker);
+    tracker->Release();
+
+    if (message[0])
+    {
+        OutputDebugStringA(message);
+        assert(!sStrict && "GPU memory budget exceeded");
+    }
+}
+
+void SetGpuBudget(GpuCategory category, unsigned long long bytes)
+{
+    std::lock_guard<std::mutex> guard(sLock);
+    sStats[category].budgetBytes = bytes;
+}
+
+void SetStrictGpuBudgets(bool strict)
+{
+    sStrict = strict;
+}
+
+void GetGpuCategoryStats(GpuCategoryStats (&stats)[GpuCategoryCount])
+{
+    std::lock_guard<std::mutex> guard(sLock);
+    std::copy(sStats, sStats + GpuCategoryCount, stats);
+}
+
+unsigned int GetGpuOwnerBytes(GpuOwnerBytes *owners, unsigned int capacity)
+{
+    if (capacity == 0)
+    {
+        return 0;
+    }
+
+    //Sum per owner into the caller's array, owners that don't fit go into the last entry
+    unsigned int count = 0;
+    {
+        std::lock_guard<std::mutex> guard(sLock);
+        for (const GpuTracker *tracker = sLive; tracker; tracker = tracker->next)
+        {
+            unsigned int i = 0;
+            while (i < count && strcmp(owners[i].owner, tracker->owner) != 0)
+            {
+                i++;
+            }
+            if (i == count)
+            {
+                if (count == capacity)
+                {
+                    i = capacity - 1;
+                    strcpy_s(owners[i].owner, "(others)");
+                }
+                else
+                {
+                    strcpy_s(owners[i].owner, tracker->owner);
+                    owners[i].bytes = 0;
+                    owners[i].resources = 0;
+                    count++;
+                }
+            }
+            owners[i].bytes += tracker->bytes;
+            owners[i].resources++;
+        }
+    }
+
+    std::sort(owners, owners + count, [](const GpuOwnerBytes &a, const GpuOwnerBytes &b)
+    {
+        return a.bytes > b.bytes;
+    });
+    return count;
+}
+
+unsigned int ReportLiveGpuResources()
+{
+    std::lock_guard<std::mutex> guard(sLock);
+    char line[256] = {};
+    for (const GpuTracker *tracker = sLive; tracker; tracker = tracker->next)
+    {
+        sprintf_s(line, "GPU resource still alive: %s, %s, %.2f MB, %lu references\n", tracker->owner, GetGpuCategoryName(tracker->category),
+            tracker->bytes / 1048576.0, static_cast<unsigned long>(tracker->references.load()));
+        OutputDebugStringA(line);
+    }
+    return sLiveCount;
+}
+
+const char* GetGpuCategoryName(GpuCategory category)
+{
+    switch (category)
+    {
+        case GpuCategoryVertex: return "vertex";
+        case GpuCategoryIndex: return "index";
+        case GpuCategoryConstant: return "constant";
+        case GpuCategoryTexture: return "texture";
+        case GpuCategoryTarget: return "target";
+        case GpuCategoryStaging: return "staging";
+        case GpuCategoryOther: return "other";
+        case GpuCategoryView: return "view";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <d3d11.h>
+
+#include <utility>
+
+//What a GPU resource is used for, live bytes and budgets are kept per category
+enum GpuCategory
+{
+    GpuCategoryVertex,      //Vertex buffers, the CPU skinned ones too
+    GpuCategoryIndex,
+    GpuCategoryConstant,
+    GpuCategoryTexture,     //Sampled textures
+    GpuCategoryTarget,      //Render targets, depth buffers and shadow maps
+    GpuCategoryStaging,     //Upload staging
+    GpuCategoryOther,       //Structured buffers and anything else
+    GpuCategoryView,        //Views, counted but holding no memory of their own
+    GpuCategoryCount
+};
+
+struct GpuCategoryStats
+{
+    unsigned int resources = 0;
+    unsigned long long bytes = 0;
+    unsigned long long peakBytes = 0;
+    unsigned long long budgetBytes = 0;     //0 when the category has no budget
+    unsigned int overBudget = 0;            //Resources created since startup that pushed it over its budget
+};
+
+//Live bytes of everything one asset or system owns
+struct GpuOwnerBytes
+{
+    char owner[64];
+    unsigned long long bytes;
+    unsigned int resources;
+};
+
+//Registers a resource or view with the owner it is charged to. The size is read from its
+//description, and the entry goes away by itself when the last reference is released,
+//whoever releases it. Safe to call from any thread.
+void TrackGpuResource(ID3D11DeviceChild *resource, GpuCategory category, const char *owner);
+
+//Creating a resource that takes its category past the budget is reported, or asserts while strict
+void SetGpuBudget(GpuCategory category, unsigned long long bytes);
+void SetStrictGpuBudgets(bool strict);
+
+void GetGpuCategoryStats(GpuCategoryStats (&stats)[GpuCategoryCount]);
+
+//The owners holding the most live bytes, largest first. Doesn't allocate, returns how many it filled in.
+unsigned int GetGpuOwnerBytes(GpuOwnerBytes *owners, unsigned int capacity);
+
+//Prints every tracked resource that is still alive and returns how many there are, for leaks at shutdown
+unsigned int ReportLiveGpuResources();
+
+const char* GetGpuCategoryName(GpuCategory category);
+
+//Owning reference to a D3D object. Copies add a reference and destruction releases it, so
+//whatever holds one can be copied, moved and destroyed without hand written releases. There
+//is no ->, a Release called through it would be one too many.
+template<typename T>
+class GpuRef
+{
+public:
+    GpuRef()
+    {
+    }
+
+    GpuRef(const GpuRef &other) : mPointer(other.mPointer)
+    {
+        if (mPointer) mPointer->AddRef();
+    }
+
+    GpuRef(GpuRef &&other) : mPointer(other.mPointer)
+    {
+        other.mPointer = nullptr;
+    }
+
+    ~GpuRef()
+    {
+        Reset();
+    }
+
+    GpuRef &operator=(GpuRef other)
+    {
+        std::swap(mPointer, other.mPointer);
+        return *this;
+    }
+
+    //Another reference to an object someone else owns
+    static GpuRef Share(T *pointer)
+    {
+        GpuRef ref;
+        ref.mPointer = pointer;
+        if (pointer) pointer->AddRef();
+        return ref;
+    }
+
+    void Reset()
+    {
+        if (mPointer)
+        {
+            mPointer->Release();
+            mPointer = nullptr;
+        }
+    }
+
+    //Out parameter of a Create call, whatever was held before is released first
+    T **Receive()
+    {
+        Reset();
+        return &mPointer;
+    }
+
+    T *Get()const { return mPointer; }
+    operator T*()const { return mPointer; }
+
+private:
+    T *mPointer = nullptr;
+};
@@ -0,0 +1,98 @@
+#include "GpuTimer.h"
+
+#include <assert.h>
+
+GpuTimer::GpuTimer()
+{
+}
+
+GpuTimer::~GpuTimer()
+{
+}
+
+void GpuTimer::Init(ID3D11Device *device)
+{
+    HRESULT hr = S_OK;
+
+    D3D11_QUERY_DESC disjointDesc = {};
+    disjointDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+    D3D11_QUERY_DESC timestampDesc = {};
+    timestampDesc.Query = D3D11_QUERY_TIMESTAMP;
+
+    for (Frame &frame : mFrames)
+    {
+        hr = device->CreateQuery(&disjointDesc, &frame.disjoint);
+        assert(SUCCEEDED(hr));
+        hr = device->CreateQuery(&timestampDesc, &frame.start);
+        assert(SUCCEEDED(hr));
+        hr = device->CreateQuery(&timestampDesc, &frame.end);
+        assert(SUCCEEDED(hr));
+        frame.pending = false;
+    }
+    mNext = 0;
+    mOldest = 0;
+}
+
+void GpuTimer::Shutdown()
+{
+    for (Frame &frame : mFrames)
+    {
+        if (frame.disjoint) frame.disjoint->Release();
+        if (frame.start) frame.start->Release();
+        if (frame.end) frame.end->Release();
+        frame = Frame();
+    }
+}
+
+void GpuTimer::Begin(ID3D11DeviceContext *context)
+{
+    //If the GPU is more than Latency frames behind, the oldest measurement is dropped
+    Frame &frame = mFrames[mNext];
+    if (frame.pending && mOldest == mNext)
+    {
+        mOldest = (mOldest + 1) % Latency;
+    }
+    frame.pending = false;
+
+    context->Begin(frame.disjoint);
+    context->End(frame.start);
+}
+
+void GpuTimer::End(ID3D11DeviceContext *context)
+{
+    Frame &frame = mFrames[mNext];
+    context->End(frame.end);
+    context->End(frame.disjoint);
+    frame.pending = true;
+    mNext = (mNext + 1) % Latency;
+}
+
+bool GpuTimer::Collect(ID3D11DeviceContext *context, float &ms)
+{
+    //Frames finish in order, stop at the first one that isn't done
+    while (mFrames[mOldest].pending)
+    {
+        Frame &frame = mFrames[mOldest];
+
+        D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint = {};
+        UINT64 start = 0;
+        UINT64 end = 0;
+        if (context->GetData(frame.disjoint, &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+            context->GetData(frame.start, &start, sizeof(start), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+            context->GetData(frame.end, &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+        {
+            return false;
+        }
+
+        frame.pending = false;
+        mOldest = (mOldest + 1) % Latency;
+
+        //A disjoint frame had its clock change speed, its timestamps mean nothing
+        if (!disjoint.Disjoint && disjoint.Frequency > 0 && end >= start)
+        {
+            ms = static_cast<float>(1000.0 * (end - start) / disjoint.Frequency);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <d3d11.h>
+
+//Measures how long the GPU takes for the work between Begin and End with timestamp
+//queries. Results only come back a few frames later, so every frame uses its own set
+//of queries from a small ring and Collect never waits for the GPU.
+class GpuTimer
+{
+public:
+    static const unsigned int Latency = 4;     //Frames a measurement may be in flight
+
+    GpuTimer();
+    ~GpuTimer();
+
+    void Init(ID3D11Device *device);
+    void Shutdown();
+
+    //Bracket the GPU work of one frame on the immediate context
+    void Begin(ID3D11DeviceContext *context);
+    void End(ID3D11DeviceContext *context);
+
+    //Oldest finished measurement in milliseconds, call until it returns false to get every one
+    bool Collect(ID3D11DeviceContext *context, float &ms);
+
+private:
+    struct Frame
+    {
+        ID3D11Query *disjoint = nullptr;
+        ID3D11Query *start = nullptr;
+        ID3D11Query *end = nullptr;
+        bool pending = false;                   //Issued and not read back yet
+    };
+
+    Frame mFrames[Latency];
+    unsigned int mNext = 0;                     //Frame the next Begin uses
+    unsigned int mOldest = 0;                   //Oldest frame that may still be pending
+};
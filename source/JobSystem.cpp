@@ -0,0 +1,262 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+
+//Index of the queue owned by the current thread, threads outside the pool share the last queue
+static thread_local int tQueueIndex = -1;
+
+JobSystem::JobSystem()
+{
+}
+
+JobSystem::~JobSystem()
+{
+    Shutdown();
+}
+
+void JobSystem::Init(unsigned int workerCount)
+{
+    if (mRunning)
+    {
+        return;
+    }
+
+    if (workerCount == 0)
+    {
+        const unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    //One queue per worker plus one for jobs queued from outside the pool
+    for (unsigned int i = 0; i < workerCount + 1; i++)
+    {
+        mQueues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    mRunning = true;
+    for (unsigned int i = 0; i < workerCount; i++)
+    {
+        mThreads.emplace_back(&JobSystem::WorkerLoop, this, i);
+    }
+}
+
+void JobSystem::Shutdown()
+{
+    if (!mRunning)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mSleepLock);
+        mRunning = false;
+    }
+    mWake.notify_all();
+
+    for (std::thread &thread : mThreads)
+    {
+        thread.join();
+    }
+    mThreads.clear();
+    mQueues.clear();
+}
+
+unsigned int JobSystem::GetWorkerCount()const
+{
+    return static_cast<unsigned int>(mThreads.size());
+}
+
+void JobSystem::Run(std::function<void()> job, JobCounter *counter)
+{
+    if (counter)
+    {
+        counter->pending++;
+    }
+
+    Job newJob;
+    newJob.work = std::move(job);
+    newJob.counter = counter;
+
+    //Without workers just do the work right away
+    if (mThreads.empty())
+    {
+        Execute(newJob);
+        return;
+    }
+
+    const unsigned int queueIndex = tQueueIndex >= 0 ? static_cast<unsigned int>(tQueueIndex) : static_cast<unsigned int>(mQueues.size() - 1);
+    {
+        std::lock_guard<std::mutex> guard(mQueues[queueIndex]->lock);
+        mQueues[queueIndex]->jobs.push_back(std::move(newJob));
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mSleepLock);
+        mQueued++;
+    }
+    mWake.notify_one();
+}
+
+void JobSystem::Wait(JobCounter &counter)
+{
+    const unsigned int queueIndex = tQueueIndex >= 0 ? static_cast<unsigned int>(tQueueIndex) : static_cast<unsigned int>(mQueues.size() - 1);
+
+    while (counter.pending > 0)
+    {
+        Job job;
+        if (!mQueues.empty() && PopJob(queueIndex, job))
+        {
+            Execute(job);
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+unsigned int JobSystem::ParallelFor(unsigned int count, unsigned int minPerChunk, unsigned int maxChunks,
+    const std::function<void(unsigned int, unsigned int, unsigned int)> &fn)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    //Never make more chunks than there are threads to run them or items to fill them
+    minPerChunk = std::max(minPerChunk, 1u);
+    unsigned int chunks = std::min(maxChunks, GetWorkerCount() + 1);
+    chunks = std::min(chunks, (count + minPerChunk - 1) / minPerChunk);
+    chunks = std::max(chunks, 1u);
+
+    const unsigned int perChunk = count / chunks;
+    const unsigned int remainder = count % chunks;
+
+    JobCounter counter;
+    unsigned int begin = 0;
+    for (unsigned int c = 0; c < chunks; c++)
+    {
+        //Spread the remainder over the first chunks so sizes differ by at most one
+        const unsigned int end = begin + perChunk + (c < remainder ? 1 : 0);
+        if (c + 1 < chunks)
+        {
+            Run([&fn, begin, end, c]() { fn(begin, end, c); }, &counter);
+        }
+        else
+        {
+            fn(begin, end, c);
+        }
+        begin = end;
+    }
+
+    Wait(counter);
+    return chunks;
+}
+
+void JobSystem::WorkerLoop(unsigned int index)
+{
+    tQueueIndex = static_cast<int>(index);
+
+    while (true)
+    {
+        Job job;
+        if (PopJob(index, job))
+        {
+            Execute(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(mSleepLock);
+        mWake.wait(guard, [this]() { return mQueued > 0 || !mRunning; });
+        if (!mRunning && mQueued == 0)
+        {
+            break;
+        }
+    }
+
+    tQueueIndex = -1;
+}
+
+bool JobSystem::PopJob(unsigned int index, Job &job)
+{
+    //Own queue first, newest job is the one most likely still in cache
+    {
+        WorkQueue &own = *mQueues[index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.jobs.empty())
+        {
+            job = own.jobs.pop_back();
+            mQueued--;
+            return true;
+        }
+    }
+
+    //Steal the oldest job from somebody else
+    const unsigned int queueCount = static_cast<unsigned int>(mQueues.size());
+    const unsigned int start = mNextQueue++;
+    for (unsigned int i = 0; i < queueCount; i++)
+    {
+        const unsigned int victim = (start + i) % queueCount;
+        if (victim == index)
+        {
+            continue;
+        }
+
+        WorkQueue &other = *mQueues[victim];
+        std::lock_guard<std::mutex> guard(other.lock);
+        if (!other.jobs.empty())
+        {
+            job = other.jobs.pop_front();
+            mQueued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void JobSystem::Execute(Job &job)
+{
+    job.work();
+    if (job.counter)
+    {
+        job.counter->pending--;
+    }
+}
+
+void JobSystem::JobRing::push_back(Job &&job)
+{
+    //Full, move everything into a ring twice the size starting at slot 0
+    if (count == slots.size())
+    {
+        std::vector<Job> grown(std::max<size_t>(16, slots.size() * 2));
+        for (size_t i = 0; i < count; i++)
+        {
+            grown[i] = std::move(slots[(head + i) % slots.size()]);
+        }
+        slots.swap(grown);
+        head = 0;
+    }
+
+    slots[(head + count) % slots.size()] = std::move(job);
+    count++;
+}
+
+JobSystem::Job JobSystem::JobRing::pop_back()
+{
+    Job &slot = slots[(head + count - 1) % slots.size()];
+    Job job = std::move(slot);
+    slot = Job();
+    count--;
+    return job;
+}
+
+JobSystem::Job JobSystem::JobRing::pop_front()
+{
+    Job &slot = slots[head];
+    Job job = std::move(slot);
+    slot = Job();
+    head = (head + 1) % slots.size();
+    count--;
+    return job;
+}
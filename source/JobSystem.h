@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Counts jobs that are still running so a caller can wait on a group of them
+struct JobCounter
+{
+    std::atomic<int> pending{ 0 };
+};
+
+//Small work-stealing thread pool. Every worker owns a queue, pops its own work
+//from the back and steals from the front of the other queues when it runs dry.
+class JobSystem
+{
+public:
+    JobSystem();
+    ~JobSystem();
+
+    //Start the worker threads, 0 means one per hardware thread minus the calling thread
+    void Init(unsigned int workerCount = 0);
+    void Shutdown();
+
+    unsigned int GetWorkerCount()const;
+
+    //Queue a job, the counter is incremented now and decremented when the job is done
+    void Run(std::function<void()> job, JobCounter *counter = nullptr);
+
+    //Run queued jobs on the calling thread until the counter reaches zero
+    void Wait(JobCounter &counter);
+
+    //Split [0, count) into at most maxChunks ranges of at least minPerChunk items and
+    //call fn(begin, end, chunkIndex) for each of them, the last chunk runs on the caller
+    unsigned int ParallelFor(unsigned int count, unsigned int minPerChunk, unsigned int maxChunks,
+        const std::function<void(unsigned int, unsigned int, unsigned int)> &fn);
+
+private:
+    struct Job
+    {
+        std::function<void()> work;
+        JobCounter *counter = nullptr;
+    };
+
+    //Double ended queue on a ring buffer. Unlike std::deque, which allocates a block for
+    //every job this size, it keeps its memory when it runs empty, so queuing jobs in
+    //steady state doesn't touch the heap.
+    struct JobRing
+    {
+        std::vector<Job> slots;
+        size_t head = 0;                //Oldest job
+        size_t count = 0;
+
+        bool empty()const { return count == 0; }
+        void push_back(Job &&job);
+        Job pop_back();
+        Job pop_front();
+    };
+
+    struct WorkQueue
+    {
+        std::mutex lock;
+        JobRing jobs;
+    };
+
+    void WorkerLoop(unsigned int index);
+    bool PopJob(unsigned int index, Job &job);
+    void Execute(Job &job);
+
+    std::vector<std::unique_ptr<WorkQueue>> mQueues;
+    std::vector<std::thread> mThreads;
+    std::mutex mSleepLock;
+    std::condition_variable mWake;
+    std::atomic<int> mQueued{ 0 };
+    std::atomic<unsigned int> mNextQueue{ 0 };
+    std::atomic<bool> mRunning{ false };
+};
@@ -0,0 +1,382 @@
+#include "LightClusterer.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CLUSTER_SSE_PATH 1
+#include <xmmintrin.h>
+#endif
+
+#include "GpuResources.h"
+
+//Buffers start with room for this many lights and light indices
+const unsigned int initialLightCapacity = 1024;
+const unsigned int initialIndexCapacity = 16 * 1024;
+
+LightClusterer::LightClusterer()
+{
+}
+
+LightClusterer::~LightClusterer()
+{
+    ReleaseBuffers();
+}
+
+void LightClusterer::Init(ID3D11Device *device)
+{
+    mDevice = device;
+
+    mMinX.resize(ClusterCount);
+    mMaxX.resize(ClusterCount);
+    mMinY.resize(ClusterCount);
+    mMaxY.resize(ClusterCount);
+    mClusterLights.resize(ClusterCount);
+    mRanges.resize(ClusterCount);
+
+    mLightCapacity = initialLightCapacity;
+    mIndexCapacity = initialIndexCapacity;
+    CreateBuffer(sizeof(GpuLight), mLightCapacity, &mLightBuffer, &mLightView);
+    CreateBuffer(sizeof(XMUINT2), ClusterCount, &mRangeBuffer, &mRangeView);
+    CreateBuffer(sizeof(unsigned int), mIndexCapacity, &mIndexBuffer, &mIndexView);
+}
+
+void LightClusterer::Shutdown()
+{
+    ReleaseBuffers();
+    mDevice = nullptr;
+}
+
+void LightClusterer::Update(const Camera &camera, const ClusterLight *lights, unsigned int count, JobSystem &jobs)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    BuildClusterBounds(camera);
+
+    mLights.resize(count);
+    mSpheres.resize(count);
+    mLightSlices.resize(count);
+
+    const XMMATRIX view = camera.View();
+    unsigned int visible = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const ClusterLight &light = lights[i];
+        const XMVECTOR position = XMLoadFloat3(&light.position);
+        const XMVECTOR direction = XMVector3Normalize(XMLoadFloat3(&light.direction));
+
+        //The shader fades spot lights with saturate(cos * scale + offset), point lights get a constant 1
+        GpuLight &gpu = mLights[i];
+        gpu.position = light.position;
+        gpu.range = light.range;
+        gpu.color = light.color;
+        XMStoreFloat3(&gpu.direction, direction);
+
+        XMVECTOR center = position;
+        float radius = light.range;
+        if (light.spotOuterCos > -1.0f)
+        {
+            gpu.spotScale = 1.0f / std::max(light.spotInnerCos - light.spotOuterCos, 1e-4f);
+            gpu.spotOffset = -light.spotOuterCos * gpu.spotScale;
+
+            //Bounding sphere of the cone: through the apex and the cap rim for narrow cones,
+            //around the cap rim up to 90 degrees, wider cones keep the whole range sphere
+            if (light.spotOuterCos >= 0.7071f)
+            {
+                radius = light.range / (2.0f * light.spotOuterCos);
+                center = position + direction * radius;
+            }
+            else if (light.spotOuterCos > 0.0f)
+            {
+                radius = light.range * sqrtf(1.0f - light.spotOuterCos * light.spotOuterCos);
+                center = position + direction * (light.range * light.spotOuterCos);
+            }
+        }
+        else
+        {
+            gpu.spotScale = 0.0f;
+            gpu.spotOffset = 1.0f;
+        }
+
+        XMFLOAT4 &sphere = mSpheres[i];
+        XMStoreFloat4(&sphere, XMVector3TransformCoord(center, view));
+        sphere.w = radius;
+
+        //Depth slices the sphere reaches, an empty range when it is all in front of or behind the frustum
+        if (sphere.z + radius < mNearZ || sphere.z - radius > mFarZ)
+        {
+            mLightSlices[i] = { 1, 0 };
+            continue;
+        }
+        mLightSlices[i] = { SliceOf(sphere.z - radius), SliceOf(sphere.z + radius) };
+        visible++;
+    }
+
+    //Every job owns whole depth slices, so no two jobs write to the same cluster
+    jobs.ParallelFor(ClustersZ, 1, ClustersZ, [this](unsigned int begin, unsigned int end, unsigned int)
+    {
+        AssignSlices(begin, end);
+    });
+
+    //Pack the per cluster lists into one index list
+    mIndices.clear();
+    mStats = LightClusterStats();
+    for (unsigned int c = 0; c < ClusterCount; c++)
+    {
+        const std::vector<unsigned int> &clusterLights = mClusterLights[c];
+        mRanges[c] = { static_cast<unsigned int>(mIndices.size()), static_cast<unsigned int>(clusterLights.size()) };
+        mIndices.insert(mIndices.end(), clusterLights.begin(), clusterLights.end());
+
+        mStats.occupiedClusters += clusterLights.empty() ? 0 : 1;
+        mStats.maxPerCluster = std::max(mStats.maxPerCluster, static_cast<unsigned int>(clusterLights.size()));
+    }
+
+    mStats.lights = count;
+    mStats.visibleLights = visible;
+    mStats.lightIndices = static_cast<unsigned int>(mIndices.size());
+    mStats.assignMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void LightClusterer::Upload(ID3D11DeviceContext *context)
+{
+    //Grow to the next power of two so a slowly growing light count doesn't recreate every frame
+    const unsigned int lightCount = static_cast<unsigned int>(mLights.size());
+    if (lightCount > mLightCapacity)
+    {
+        while (mLightCapacity < lightCount)
+        {
+            mLightCapacity *= 2;
+        }
+        mLightBuffer->Release();
+        mLightView->Release();
+        CreateBuffer(sizeof(GpuLight), mLightCapacity, &mLightBuffer, &mLightView);
+    }
+
+    const unsigned int indexCount = static_cast<unsigned int>(mIndices.size());
+    if (indexCount > mIndexCapacity)
+    {
+        while (mIndexCapacity < indexCount)
+        {
+            mIndexCapacity *= 2;
+        }
+        mIndexBuffer->Release();
+        mIndexView->Release();
+        CreateBuffer(sizeof(unsigned int), mIndexCapacity, &mIndexBuffer, &mIndexView);
+    }
+
+    //Empty ranges never read the other two buffers, so an empty list leaves its buffer as it
+    //was. An empty vector's data() may be null, which memcpy must not get even for 0 bytes.
+    D3D11_MAPPED_SUBRESOURCE mapped = {};
+    HRESULT hr = S_OK;
+    if (lightCount > 0)
+    {
+        hr = context->Map(mLightBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+        assert(SUCCEEDED(hr));
+        memcpy(mapped.pData, mLights.data(), lightCount * sizeof(GpuLight));
+        context->Unmap(mLightBuffer, 0);
+    }
+
+    hr = context->Map(mRangeBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+    assert(SUCCEEDED(hr));
+    memcpy(mapped.pData, mRanges.data(), ClusterCount * sizeof(XMUINT2));
+    context->Unmap(mRangeBuffer, 0);
+
+    if (indexCount > 0)
+    {
+        hr = context->Map(mIndexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+        assert(SUCCEEDED(hr));
+        memcpy(mapped.pData, mIndices.data(), indexCount * sizeof(unsigned int));
+        context->Unmap(mIndexBuffer, 0);
+    }
+}
+
+void LightClusterer::GetViews(ID3D11ShaderResourceView *views[3])const
+{
+    views[0] = mLightView;
+    views[1] = mRangeView;
+    views[2] = mIndexView;
+}
+
+XMFLOAT4 LightClusterer::GetShaderScale(float screenWidth, float screenHeight)const
+{
+    return XMFLOAT4(ClustersX / screenWidth, ClustersY / screenHeight, mSliceScale, -logf(mNearZ) * mSliceScale);
+}
+
+const LightClusterStats& LightClusterer::GetStats()const
+{
+    return mStats;
+}
+
+//The boxes only depend on the projection, so they are rebuilt when the lens changes
+void LightClusterer::BuildClusterBounds(const Camera &camera)
+{
+    if (camera.GetFovY() == mFovY && camera.GetAspect() == mAspect && camera.GetNearZ() == mNearZ && camera.GetFarZ() == mFarZ)
+    {
+        return;
+    }
+
+    mFovY = camera.GetFovY();
+    mAspect = camera.GetAspect();
+    mNearZ = camera.GetNearZ();
+    mFarZ = camera.GetFarZ();
+    mSliceScale = ClustersZ / logf(mFarZ / mNearZ);
+
+    for (unsigned int z = 0; z <= ClustersZ; z++)
+    {
+        mSliceNear[z] = mNearZ * powf(mFarZ / mNearZ, static_cast<float>(z) / ClustersZ);
+    }
+
+    //View space x and y per unit of depth at the screen edges
+    const float tanX = tanf(0.5f * camera.GetFovX());
+    const float tanY = tanf(0.5f * mFovY);
+
+    for (unsigned int z = 0; z < ClustersZ; z++)
+    {
+        const float nearDepth = mSliceNear[z];
+        const float farDepth = mSliceNear[z + 1];
+        for (unsigned int y = 0; y < ClustersY; y++)
+        {
+            //Tile rows go down the screen like SV_Position does
+            const float top = (1.0f - 2.0f * y / ClustersY) * tanY;
+            const float bottom = (1.0f - 2.0f * (y + 1) / ClustersY) * tanY;
+            for (unsigned int x = 0; x < ClustersX; x++)
+            {
+                const float left = (-1.0f + 2.0f * x / ClustersX) * tanX;
+                const float right = (-1.0f + 2.0f * (x + 1) / ClustersX) * tanX;
+
+                const unsigned int c = z * TilesPerSlice + y * ClustersX + x;
+                mMinX[c] = std::min(left * nearDepth, left * farDepth);
+                mMaxX[c] = std::max(right * nearDepth, right * farDepth);
+                mMinY[c] = std::min(bottom * nearDepth, bottom * farDepth);
+                mMaxY[c] = std::max(top * nearDepth, top * farDepth);
+            }
+        }
+    }
+}
+
+void LightClusterer::AssignSlices(unsigned int firstSlice, unsigned int lastSlice)
+{
+    const unsigned int lightCount = static_cast<unsigned int>(mSpheres.size());
+    for (unsigned int z = firstSlice; z < lastSlice; z++)
+    {
+        const unsigned int base = z * TilesPerSlice;
+        for (unsigned int t = 0; t < TilesPerSlice; t++)
+        {
+            mClusterLights[base + t].clear();
+        }
+
+        for (unsigned int i = 0; i < lightCount; i++)
+        {
+            if (z < mLightSlices[i].x || z > mLightSlices[i].y)
+            {
+                continue;
+            }
+
+            //Sphere against box: squared distance from the center to the nearest point of the box.
+            //Depth is the same for the whole slice and height for a whole row of tiles, so only
+            //the columns need testing one by one.
+            const XMFLOAT4 &sphere = mSpheres[i];
+            const float dz = std::max(mSliceNear[z] - sphere.z, 0.0f) + std::max(sphere.z - mSliceNear[z + 1], 0.0f);
+            const float sliceRemaining = sphere.w * sphere.w - dz * dz;
+            if (sliceRemaining < 0.0f)
+            {
+                continue;
+            }
+
+            for (unsigned int y = 0; y < ClustersY; y++)
+            {
+                const unsigned int row = base + y * ClustersX;
+                const float dy = std::max(mMinY[row] - sphere.y, 0.0f) + std::max(sphere.y - mMaxY[row], 0.0f);
+                const float remaining = sliceRemaining - dy * dy;
+                if (remaining < 0.0f)
+                {
+                    continue;
+                }
+
+#if defined(CLUSTER_SSE_PATH)
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 cx = _mm_set1_ps(sphere.x);
+                const __m128 limit = _mm_set1_ps(remaining);
+                for (unsigned int x = 0; x < ClustersX; x += 4)
+                {
+                    const unsigned int c = row + x;
+                    const __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&mMinX[c]), cx), zero),
+                        _mm_max_ps(_mm_sub_ps(cx, _mm_loadu_ps(&mMaxX[c])), zero));
+
+                    const int mask = _mm_movemask_ps(_mm_cmple_ps(_mm_mul_ps(dx, dx), limit));
+                    for (unsigned int k = 0; mask != 0 && k < 4; k++)
+                    {
+                        std::vector<unsigned int> &clusterLights = mClusterLights[c + k];
+                        if ((mask & (1 << k)) && clusterLights.size() < MaxLightsPerCluster)
+                        {
+                            clusterLights.push_back(i);
+                        }
+                    }
+                }
+#else
+                for (unsigned int x = 0; x < ClustersX; x++)
+                {
+                    const unsigned int c = row + x;
+                    const float dx = std::max(mMinX[c] - sphere.x, 0.0f) + std::max(sphere.x - mMaxX[c], 0.0f);
+                    if (dx * dx <= remaining && mClusterLights[c].size() < MaxLightsPerCluster)
+                    {
+                        mClusterLights[c].push_back(i);
+                    }
+                }
+#endif
+            }
+        }
+    }
+}
+
+unsigned int LightClusterer::SliceOf(float depth)const
+{
+    const float slice = logf(std::max(depth, mNearZ) / mNearZ) * mSliceScale;
+    return std::min(static_cast<unsigned int>(slice), ClustersZ - 1);
+}
+
+void LightClusterer::CreateBuffer(unsigned int stride, unsigned int count, ID3D11Buffer **buffer, ID3D11ShaderResourceView **view)
+{
+    //Rewritten every frame by the CPU
+    D3D11_BUFFER_DESC bufferDesc = {};
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    bufferDesc.ByteWidth = stride * count;
+    bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    bufferDesc.StructureByteStride = stride;
+
+    HRESULT hr = mDevice->CreateBuffer(&bufferDesc, nullptr, buffer);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(*buffer, GpuCategoryOther, "light clusters");
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc = {};
+    viewDesc.Format = DXGI_FORMAT_UNKNOWN;
+    viewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+    viewDesc.Buffer.FirstElement = 0;
+    viewDesc.Buffer.NumElements = count;
+
+    hr = mDevice->CreateShaderResourceView(*buffer, &viewDesc, view);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(*view, GpuCategoryView, "light clusters");
+}
+
+void LightClusterer::ReleaseBuffers()
+{
+    if (mLightView) mLightView->Release();
+    if (mRangeView) mRangeView->Release();
+    if (mIndexView) mIndexView->Release();
+    if (mLightBuffer) mLightBuffer->Release();
+    if (mRangeBuffer) mRangeBuffer->Release();
+    if (mIndexBuffer) mIndexBuffer->Release();
+    mLightView = nullptr;
+    mRangeView = nullptr;
+    mIndexView = nullptr;
+    mLightBuffer = nullptr;
+    mRangeBuffer = nullptr;
+    mIndexBuffer = nullptr;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <d3d11.h>
+#include <directxmath.h>
+#include <vector>
+
+#include "Camera.h"
+#include "JobSystem.h"
+
+using namespace DirectX;
+
+//Point or spot light in world space, leave the spot cones at -1 for a point light
+struct ClusterLight
+{
+    XMFLOAT3 position = {};
+    float range = 1.0f;                                 //Light fades to nothing at this distance
+    XMFLOAT3 color = { 1.0f, 1.0f, 1.0f };
+    XMFLOAT3 direction = { 0.0f, -1.0f, 0.0f };         //Spot lights only
+    float spotInnerCos = -1.0f;                         //Cosine of the half angle at full strength
+    float spotOuterCos = -1.0f;                         //Cosine of the half angle where the cone ends
+};
+
+//Numbers from the last light assignment
+struct LightClusterStats
+{
+    unsigned int lights = 0;
+    unsigned int visibleLights = 0;                     //Lights touching at least one depth slice
+    unsigned int occupiedClusters = 0;
+    unsigned int lightIndices = 0;                      //Cluster and light pairs, the size of the index list
+    unsigned int maxPerCluster = 0;
+    float assignMs = 0.0f;
+};
+
+//Clustered forward lighting. The view frustum is cut into ClustersX*ClustersY screen
+//tiles and ClustersZ depth slices that grow exponentially with distance. Every frame
+//the lights are assigned to the clusters their bounding spheres touch: the depth
+//slices are split over the job system and every light is tested against four cluster
+//boxes at a time with SSE. The pixel shader finds its cluster from the screen position
+//and view depth and only loops over the lights in that cluster.
+class LightClusterer
+{
+public:
+    static const unsigned int ClustersX = 16;
+    static const unsigned int ClustersY = 8;
+    static const unsigned int ClustersZ = 24;
+    static const unsigned int TilesPerSlice = ClustersX * ClustersY;
+    static const unsigned int ClusterCount = TilesPerSlice * ClustersZ;
+    static const unsigned int MaxLightsPerCluster = 256;
+
+    LightClusterer();
+    ~LightClusterer();
+
+    void Init(ID3D11Device *device);
+    void Shutdown();
+
+    //Assigns the lights to the clusters of the camera's frustum, call once per frame
+    void Update(const Camera &camera, const ClusterLight *lights, unsigned int count, JobSystem &jobs);
+
+    //Copies the lights and cluster lists to the GPU, buffers grow when they have to
+    void Upload(ID3D11DeviceContext *context);
+
+    //Light, cluster range and light index views, bound to three consecutive slots
+    void GetViews(ID3D11ShaderResourceView *views[3])const;
+
+    //Shader constants that turn a pixel position and view depth into a cluster: x and y
+    //scale pixels to tiles, z and w map log(depth) to a depth slice
+    XMFLOAT4 GetShaderScale(float screenWidth, float screenHeight)const;
+
+    const LightClusterStats& GetStats()const;
+
+private:
+    //Light as the shader reads it, the spot cone is folded into a scale and offset
+    struct GpuLight
+    {
+        XMFLOAT3 position;
+        float range;
+        XMFLOAT3 color;
+        float spotScale;
+        XMFLOAT3 direction;
+        float spotOffset;
+    };
+
+    void BuildClusterBounds(const Camera &camera);
+    void AssignSlices(unsigned int firstSlice, unsigned int lastSlice);
+    unsigned int SliceOf(float depth)const;
+    void CreateBuffer(unsigned int stride, unsigned int count, ID3D11Buffer **buffer, ID3D11ShaderResourceView **view);
+    void ReleaseBuffers();
+
+    ID3D11Device *mDevice = nullptr;
+    ID3D11Buffer *mLightBuffer = nullptr;
+    ID3D11Buffer *mRangeBuffer = nullptr;
+    ID3D11Buffer *mIndexBuffer = nullptr;
+    ID3D11ShaderResourceView *mLightView = nullptr;
+    ID3D11ShaderResourceView *mRangeView = nullptr;
+    ID3D11ShaderResourceView *mIndexView = nullptr;
+    unsigned int mLightCapacity = 0;
+    unsigned int mIndexCapacity = 0;
+
+    //Projection the cluster boxes were built for
+    float mFovY = 0.0f;
+    float mAspect = 0.0f;
+    float mNearZ = 0.0f;
+    float mFarZ = 0.0f;
+    float mSliceScale = 1.0f;                           //Depth slices per unit of log(depth / near)
+
+    //View space cluster boxes, one entry per cluster, slice major so four tiles load at once
+    std::vector<float> mMinX;
+    std::vector<float> mMaxX;
+    std::vector<float> mMinY;
+    std::vector<float> mMaxY;
+    float mSliceNear[ClustersZ + 1] = {};
+
+    //This frame's lights
+    std::vector<GpuLight> mLights;
+    std::vector<XMFLOAT4> mSpheres;                     //View space bounding spheres
+    std::vector<XMUINT2> mLightSlices;                  //First and last depth slice each light touches
+
+    //Every cluster is written by the one job that owns its depth slice
+    std::vector<std::vector<unsigned int>> mClusterLights;
+    std::vector<XMUINT2> mRanges;                       //Offset and count into mIndices per cluster
+    std::vector<unsigned int> mIndices;
+
+    LightClusterStats mStats;
+};
@@ -0,0 +1,58 @@
+#include "LodSelector.h"
+
+#include <algorithm>
+
+LodSelector::LodSelector()
+{
+}
+
+LodSelector::~LodSelector()
+{
+}
+
+void LodSelector::SetView(const Camera &camera, float screenHeight)
+{
+    mEye = camera.GetPosition();
+    mNearZ = camera.GetNearZ();
+
+    //The near window is NearWindowHeight units tall at distance NearZ and fills the screen
+    mPixelsPerUnit = screenHeight * mNearZ / camera.GetNearWindowHeight();
+}
+
+void LodSelector::SetMaxPixelError(float pixels)
+{
+    mMaxPixelError = pixels;
+}
+
+unsigned int LodSelector::Select(const std::vector<MeshLod> &lods, FXMVECTOR center, float scale)const
+{
+    if (lods.empty())
+    {
+        return 0;
+    }
+
+    const float distance = std::max(XMVectorGetX(XMVector3Length(center - XMLoadFloat3(&mEye))), mNearZ);
+    return SelectForPixelsPerUnit(lods, mPixelsPerUnit * scale / distance);
+}
+
+unsigned int LodSelector::SelectForTexelSize(const std::vector<MeshLod> &lods, float scale, float texelSize)const
+{
+    if (lods.empty() || texelSize <= 0.0f)
+    {
+        return 0;
+    }
+
+    return SelectForPixelsPerUnit(lods, scale / texelSize);
+}
+
+unsigned int LodSelector::SelectForPixelsPerUnit(const std::vector<MeshLod> &lods, float pixelsPerUnit)const
+{
+    for (size_t i = lods.size() - 1; i > 0; i--)
+    {
+        if (lods[i].error * pixelsPerUnit <= mMaxPixelError)
+        {
+            return static_cast<unsigned int>(i);
+        }
+    }
+    return 0;
+}
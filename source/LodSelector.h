@@ -0,0 +1,40 @@
+#pragma once
+
+#include <directxmath.h>
+#include <vector>
+
+#include "Assets.h"
+#include "Camera.h"
+
+using namespace DirectX;
+
+//Picks a level of detail per object from how many pixels its simplification error
+//covers on screen, using the camera's near plane to turn distance into pixels
+class LodSelector
+{
+public:
+    LodSelector();
+    ~LodSelector();
+
+    //Call once per frame with the camera the frame is drawn with
+    void SetView(const Camera &camera, float screenHeight);
+
+    //Largest error on screen a level may have, in pixels
+    void SetMaxPixelError(float pixels);
+
+    //Coarsest level that stays under the pixel error, center is the object's position
+    //and scale its largest world scale factor
+    unsigned int Select(const std::vector<MeshLod> &lods, FXMVECTOR center, float scale)const;
+
+    //Same for an orthographic view like a shadow cascade, where a pixel covers texelSize
+    //world units at any distance
+    unsigned int SelectForTexelSize(const std::vector<MeshLod> &lods, float scale, float texelSize)const;
+
+private:
+    unsigned int SelectForPixelsPerUnit(const std::vector<MeshLod> &lods, float pixelsPerUnit)const;
+
+    XMFLOAT3 mEye = {};
+    float mNearZ = 1.0f;
+    float mPixelsPerUnit = 1.0f;        //Pixels covered by one world unit at distance 1
+    float mMaxPixelError = 1.0f;
+};
@@ -0,0 +1,218 @@
+#include "Lz4.h"
+
+#include <string.h>
+
+#include <vector>
+
+const size_t minMatch = 4;
+const size_t lastLiterals = 5;          //The block always ends in at least this many literals
+const size_t matchFindLimit = 12;       //No match may start closer than this to the end
+const size_t maxOffset = 65535;
+const unsigned int hashBits = 14;
+
+static unsigned int Read32(const unsigned char *p)
+{
+    unsigned int value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static unsigned int HashSequence(unsigned int sequence)
+{
+    return (sequence * 2654435761u) >> (32 - hashBits);
+}
+
+//Lengths of 15 and up spill into extra bytes of 255 each and a final remainder
+static unsigned char *WriteLength(unsigned char *op, size_t length)
+{
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = static_cast<unsigned char>(length);
+    return op;
+}
+
+size_t Lz4CompressBound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+size_t Lz4Compress(const unsigned char *source, size_t size, unsigned char *destination, size_t capacity)
+{
+    //Only the bound guarantees the output fits, so nothing is checked while writing
+    if (capacity < Lz4CompressBound(size))
+    {
+        return 0;
+    }
+
+    const unsigned char *ip = source;
+    const unsigned char *anchor = source;
+    const unsigned char *end = source + size;
+    unsigned char *op = destination;
+
+    if (size > matchFindLimit)
+    {
+        const unsigned char *matchStartLimit = end - matchFindLimit;
+        const unsigned char *matchEndLimit = end - lastLiterals;
+
+        //Position + 1 of the last sequence with each hash, 0 for none
+        std::vector<unsigned int> table(static_cast<size_t>(1) << hashBits, 0);
+
+        while (ip < matchStartLimit)
+        {
+            const unsigned int sequence = Read32(ip);
+            const unsigned int hash = HashSequence(sequence);
+            const unsigned int candidate = table[hash];
+            table[hash] = static_cast<unsigned int>(ip - source) + 1;
+
+            const unsigned char *match = candidate > 0 ? source + (candidate - 1) : nullptr;
+            if (!match || static_cast<size_t>(ip - match) > maxOffset || Read32(match) != sequence)
+            {
+                //Skip faster through data that doesn't compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            //Grow the match backwards over literals that also match
+            while (ip > anchor && match > source && ip[-1] == match[-1])
+            {
+                ip--;
+                match--;
+            }
+
+            size_t matchLength = minMatch;
+            while (ip + matchLength < matchEndLimit && ip[matchLength] == match[matchLength])
+            {
+                matchLength++;
+            }
+
+            //Token, literal length, literals, offset, match length
+            const size_t literalLength = static_cast<size_t>(ip - anchor);
+            unsigned char *token = op++;
+            *token = static_cast<unsigned char>((literalLength >= 15 ? 15 : literalLength) << 4);
+            if (literalLength >= 15)
+            {
+                op = WriteLength(op, literalLength - 15);
+            }
+            memcpy(op, anchor, literalLength);
+            op += literalLength;
+
+            const size_t offset = static_cast<size_t>(ip - match);
+            *op++ = static_cast<unsigned char>(offset & 0xff);
+            *op++ = static_cast<unsigned char>(offset >> 8);
+
+            const size_t extraMatch = matchLength - minMatch;
+            *token |= static_cast<unsigned char>(extraMatch >= 15 ? 15 : extraMatch);
+            if (extraMatch >= 15)
+            {
+                op = WriteLength(op, extraMatch - 15);
+            }
+
+            ip += matchLength;
+            anchor = ip;
+        }
+    }
+
+    //Whatever is left goes out as literals
+    const size_t literalLength = static_cast<size_t>(end - anchor);
+    *op++ = static_cast<unsigned char>((literalLength >= 15 ? 15 : literalLength) << 4);
+    if (literalLength >= 15)
+    {
+        op = WriteLength(op, literalLength - 15);
+    }
+    memcpy(op, anchor, literalLength);
+    op += literalLength;
+
+    return static_cast<size_t>(op - destination);
+}
+
+bool Lz4Decompress(const unsigned char *source, size_t packedSize, unsigned char *destination, size_t size)
+{
+    const unsigned char *ip = source;
+    const unsigned char *inputEnd = source + packedSize;
+    unsigned char *op = destination;
+    unsigned char *outputEnd = destination + size;
+
+    while (ip < inputEnd)
+    {
+        const unsigned int token = *ip++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15)
+        {
+            unsigned char extra = 255;
+            while (extra == 255)
+            {
+                if (ip >= inputEnd)
+                {
+                    return false;
+                }
+                extra = *ip++;
+                literalLength += extra;
+            }
+        }
+        if (literalLength > static_cast<size_t>(inputEnd - ip) || literalLength > static_cast<size_t>(outputEnd - op))
+        {
+            return false;
+        }
+        memcpy(op, ip, literalLength);
+        ip += literalLength;
+        op += literalLength;
+
+        //The last sequence has no match
+        if (ip == inputEnd)
+        {
+            break;
+        }
+
+        if (inputEnd - ip < 2)
+        {
+            return false;
+        }
+        const size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - destination))
+        {
+            return false;
+        }
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15)
+        {
+            unsigned char extra = 255;
+            while (extra == 255)
+            {
+                if (ip >= inputEnd)
+                {
+                    return false;
+                }
+                extra = *ip++;
+                matchLength += extra;
+            }
+        }
+        matchLength += minMatch;
+        if (matchLength > static_cast<size_t>(outputEnd - op))
+        {
+            return false;
+        }
+
+        //Overlapping matches repeat the last offset bytes, so they have to go byte by byte
+        const unsigned char *match = op - offset;
+        if (offset >= matchLength)
+        {
+            memcpy(op, match, matchLength);
+            op += matchLength;
+        }
+        else
+        {
+            for (size_t i = 0; i < matchLength; i++)
+            {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return op == outputEnd;
+}
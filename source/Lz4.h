@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+
+//LZ4 block format, compatible with the reference implementation's LZ4_compress_default
+//and LZ4_decompress_safe. The compressor is the plain greedy one with a single hash
+//table; the decompressor checks every length and offset against both buffers, so a
+//corrupt block fails instead of reading or writing out of bounds.
+
+//Largest compressed size of size input bytes
+size_t Lz4CompressBound(size_t size);
+
+//Returns the compressed size, 0 if it doesn't fit in capacity
+size_t Lz4Compress(const unsigned char *source, size_t size, unsigned char *destination, size_t capacity);
+
+//Decompresses a whole block, false if it is corrupt or doesn't decode to exactly size bytes
+bool Lz4Decompress(const unsigned char *source, size_t packedSize, unsigned char *destination, size_t size);
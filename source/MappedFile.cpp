@@ -0,0 +1,132 @@
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const char *filename)
+{
+    Close();
+
+    mFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (mFile == INVALID_HANDLE_VALUE)
+    {
+        mFile = nullptr;
+        return false;
+    }
+
+    LARGE_INTEGER size = {};
+    if (!GetFileSizeEx(mFile, &size))
+    {
+        Close();
+        return false;
+    }
+
+    //Empty files can't be mapped but are still valid
+    mSize = static_cast<size_t>(size.QuadPart);
+    if (mSize == 0)
+    {
+        return true;
+    }
+
+    mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mMapping == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    mData = static_cast<const char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+    if (mData == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (mData) UnmapViewOfFile(mData);
+    if (mMapping) CloseHandle(mMapping);
+    if (mFile) CloseHandle(mFile);
+    mData = nullptr;
+    mMapping = nullptr;
+    mFile = nullptr;
+    mSize = 0;
+}
+
+#else
+
+bool MappedFile::Open(const char *filename)
+{
+    Close();
+
+    mFile = open(filename, O_RDONLY);
+    if (mFile < 0)
+    {
+        return false;
+    }
+
+    struct stat info = {};
+    if (fstat(mFile, &info) != 0)
+    {
+        Close();
+        return false;
+    }
+
+    //Empty files can't be mapped but are still valid
+    mSize = static_cast<size_t>(info.st_size);
+    if (mSize == 0)
+    {
+        return true;
+    }
+
+    void *data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, mFile, 0);
+    if (data == MAP_FAILED)
+    {
+        Close();
+        return false;
+    }
+
+    mData = static_cast<const char*>(data);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (mData) munmap(const_cast<char*>(mData), mSize);
+    if (mFile >= 0) close(mFile);
+    mData = nullptr;
+    mFile = -1;
+    mSize = 0;
+}
+
+#endif
+
+const char *MappedFile::GetData()const
+{
+    return mData;
+}
+
+size_t MappedFile::GetSize()const
+{
+    return mSize;
+}
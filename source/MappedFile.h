@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+
+//Read only view of a whole file mapped into memory
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile &operator=(const MappedFile&) = delete;
+
+    bool Open(const char *filename);
+    void Close();
+
+    const char *GetData()const;
+    size_t GetSize()const;
+
+private:
+    const char *mData = nullptr;
+    size_t mSize = 0;
+#if defined(_WIN32)
+    void *mFile = nullptr;
+    void *mMapping = nullptr;
+#else
+    int mFile = -1;
+#endif
+};
@@ -0,0 +1,129 @@
+#include "MemoryTelemetry.h"
+
+#include <assert.h>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+//Zero initialized before any constructor runs, so allocations during static init are counted too
+static std::atomic<unsigned long long> sAllocations[MemoryTagCount];
+static std::atomic<unsigned long long> sBytes[MemoryTagCount];
+static std::atomic<unsigned long long> sForbidden;
+static MemoryCounter sFrameStart[MemoryTagCount];          //Totals when the current frame started
+static thread_local bool tHeapForbidden = false;
+
+void RecordAllocation(MemoryTag tag, size_t bytes)
+{
+    sAllocations[tag].fetch_add(1, std::memory_order_relaxed);
+    sBytes[tag].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void EndMemoryFrame(MemoryFrameStats &stats)
+{
+    for (int i = 0; i < MemoryTagCount; i++)
+    {
+        stats.total[i].allocations = sAllocations[i].load(std::memory_order_relaxed);
+        stats.total[i].bytes = sBytes[i].load(std::memory_order_relaxed);
+        stats.frame[i].allocations = stats.total[i].allocations - sFrameStart[i].allocations;
+        stats.frame[i].bytes = stats.total[i].bytes - sFrameStart[i].bytes;
+        sFrameStart[i] = stats.total[i];
+    }
+    stats.forbiddenHeapAllocations = sForbidden.load(std::memory_order_relaxed);
+}
+
+const char* GetMemoryTagName(MemoryTag tag)
+{
+    switch (tag)
+    {
+        case MemoryTagHeap: return "heap";
+        case MemoryTagFrame: return "frame";
+        case MemoryTagScene: return "scene";
+        case MemoryTagScratch: return "scratch";
+        case MemoryTagGpuTrackers: return "gputrackers";
+        default: return "unknown";
+    }
+}
+
+void ForbidHeapAllocations(bool forbid)
+{
+    tHeapForbidden = forbid;
+}
+
+static void* HeapAllocate(size_t size)
+{
+    RecordAllocation(MemoryTagHeap, size);
+    if (tHeapForbidden)
+    {
+        //The assert itself may allocate, so lift the ban before it fires
+        sForbidden.fetch_add(1, std::memory_order_relaxed);
+        tHeapForbidden = false;
+        assert(!"Heap allocation in a frame that must not allocate");
+        tHeapForbidden = true;
+    }
+    return malloc(size > 0 ? size : 1);
+}
+
+//Replacements of the global allocation functions, every heap allocation goes through here
+void* operator new(size_t size)
+{
+    while (true)
+    {
+        void *memory = HeapAllocate(size);
+        if (memory)
+        {
+            return memory;
+        }
+
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return HeapAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return HeapAllocate(size);
+}
+
+void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void *memory, const std::nothrow_t&) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void *memory, const std::nothrow_t&) noexcept
+{
+    free(memory);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+//Where an allocation came from
+enum MemoryTag
+{
+    MemoryTagHeap,          //Global operator new, counted for the whole process
+    MemoryTagFrame,         //Per frame arena, dropped every frame
+    MemoryTagScene,         //Object pools
+    MemoryTagScratch,       //Loader scratch arenas
+    MemoryTagGpuTrackers,   //Pages of the GPU resource trackers, see GpuResources.cpp
+    MemoryTagCount
+};
+
+struct MemoryCounter
+{
+    unsigned long long allocations = 0;
+    unsigned long long bytes = 0;
+};
+
+//Allocations per tag in the last frame and since startup
+struct MemoryFrameStats
+{
+    MemoryCounter frame[MemoryTagCount];
+    MemoryCounter total[MemoryTagCount];
+    unsigned long long forbiddenHeapAllocations = 0;    //Since startup, see ForbidHeapAllocations
+};
+
+//Counts an allocation, safe to call from any thread
+void RecordAllocation(MemoryTag tag, size_t bytes);
+
+//Closes the counters of the frame that just ended and starts the next one, main thread only
+void EndMemoryFrame(MemoryFrameStats &stats);
+
+const char* GetMemoryTagName(MemoryTag tag);
+
+//While forbidden, any global operator new on the calling thread is counted as a
+//violation and asserts in debug builds. Used to hold steady state frames to zero
+//heap allocations.
+void ForbidHeapAllocations(bool forbid);
@@ -0,0 +1,630 @@
+#include "MeshBvh.h"
+
+#include <assert.h>
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BVH_AVX2_PATH 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+const unsigned int binCount = 16;
+const unsigned int maxLeafTriangles = 8;
+const unsigned int parallelBuildTriangles = 4096;   //Below this a subtree is built on one thread
+const unsigned int maxTraversalDepth = 64;
+const unsigned int maxSahDepth = 40;                //Deeper than this nodes are split at the median, so traversal fits its stack
+const float traversalCost = 1.0f;                   //Relative to testing a triangle
+
+static bool CpuHasAvx2()
+{
+#if defined(BVH_AVX2_PATH) && defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+
+    //The OS also has to save the upper halves of the ymm registers
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6)
+    {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif defined(BVH_AVX2_PATH)
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return false;
+#endif
+}
+
+//Bounds and centroid of a triangle, what the build sorts by
+struct BuildTriangle
+{
+    XMFLOAT3 boundsMin;
+    XMFLOAT3 boundsMax;
+    XMFLOAT3 centroid;
+};
+
+struct BuildContext
+{
+    const BuildTriangle *triangles = nullptr;
+    unsigned int *references = nullptr;     //Triangle indices, partitioned in place as the tree grows
+    BvhNode *nodes = nullptr;
+    std::atomic<unsigned int> nodeCount{ 0 };
+    JobSystem *jobs = nullptr;
+};
+
+struct Bin
+{
+    XMVECTOR boundsMin;
+    XMVECTOR boundsMax;
+    unsigned int count;
+};
+
+static float HalfArea(FXMVECTOR boundsMin, FXMVECTOR boundsMax)
+{
+    XMFLOAT3 size;
+    XMStoreFloat3(&size, XMVectorMax(boundsMax - boundsMin, XMVectorZero()));
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static void BuildNode(BuildContext &context, unsigned int nodeIndex, unsigned int begin, unsigned int end, unsigned int depth)
+{
+    const BuildTriangle *triangles = context.triangles;
+    unsigned int *references = context.references;
+    BvhNode &node = context.nodes[nodeIndex];
+
+    XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+    XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+    XMVECTOR centroidMin = boundsMin;
+    XMVECTOR centroidMax = boundsMax;
+    for (unsigned int i = begin; i < end; i++)
+    {
+        const BuildTriangle &triangle = triangles[references[i]];
+        boundsMin = XMVectorMin(boundsMin, XMLoadFloat3(&triangle.boundsMin));
+        boundsMax = XMVectorMax(boundsMax, XMLoadFloat3(&triangle.boundsMax));
+        const XMVECTOR centroid = XMLoadFloat3(&triangle.centroid);
+        centroidMin = XMVectorMin(centroidMin, centroid);
+        centroidMax = XMVectorMax(centroidMax, centroid);
+    }
+    XMStoreFloat3(&node.boundsMin, boundsMin);
+    XMStoreFloat3(&node.boundsMax, boundsMax);
+
+    const unsigned int count = end - begin;
+    node.first = begin;
+    node.count = count;
+    if (count <= 4)
+    {
+        return;
+    }
+
+    //Bin the centroids along every axis and keep the cheapest split
+    XMFLOAT3 extent;
+    XMFLOAT3 origin;
+    XMStoreFloat3(&extent, centroidMax - centroidMin);
+    XMStoreFloat3(&origin, centroidMin);
+    const float extents[3] = { extent.x, extent.y, extent.z };
+    const float origins[3] = { origin.x, origin.y, origin.z };
+
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    unsigned int bestBin = 0;
+    for (int axis = 0; axis < 3 && depth < maxSahDepth; axis++)
+    {
+        if (extents[axis] <= 0.0f)
+        {
+            continue;
+        }
+
+        Bin bins[binCount];
+        for (Bin &bin : bins)
+        {
+            bin.boundsMin = XMVectorReplicate(FLT_MAX);
+            bin.boundsMax = XMVectorReplicate(-FLT_MAX);
+            bin.count = 0;
+        }
+        const float scale = binCount / extents[axis];
+        for (unsigned int i = begin; i < end; i++)
+        {
+            const BuildTriangle &triangle = triangles[references[i]];
+            const float position = (&triangle.centroid.x)[axis];
+            Bin &bin = bins[std::min(binCount - 1, static_cast<unsigned int>((position - origins[axis]) * scale))];
+            bin.boundsMin = XMVectorMin(bin.boundsMin, XMLoadFloat3(&triangle.boundsMin));
+            bin.boundsMax = XMVectorMax(bin.boundsMax, XMLoadFloat3(&triangle.boundsMax));
+            bin.count++;
+        }
+
+        //Sweep from the right, then from the left adding up the cost of each split
+        float rightCost[binCount] = {};
+        XMVECTOR sweepMin = XMVectorReplicate(FLT_MAX);
+        XMVECTOR sweepMax = XMVectorReplicate(-FLT_MAX);
+        unsigned int sweepCount = 0;
+        for (unsigned int b = binCount - 1; b > 0; b--)
+        {
+            sweepMin = XMVectorMin(sweepMin, bins[b].boundsMin);
+            sweepMax = XMVectorMax(sweepMax, bins[b].boundsMax);
+            sweepCount += bins[b].count;
+            rightCost[b] = sweepCount > 0 ? HalfArea(sweepMin, sweepMax) * sweepCount : 0.0f;
+        }
+        sweepMin = XMVectorReplicate(FLT_MAX);
+        sweepMax = XMVectorReplicate(-FLT_MAX);
+        sweepCount = 0;
+        for (unsigned int b = 0; b < binCount - 1; b++)
+        {
+            sweepMin = XMVectorMin(sweepMin, bins[b].boundsMin);
+            sweepMax = XMVectorMax(sweepMax, bins[b].boundsMax);
+            sweepCount += bins[b].count;
+            if (sweepCount == 0 || sweepCount == count)
+            {
+                continue;
+            }
+            const float cost = HalfArea(sweepMin, sweepMax) * sweepCount + rightCost[b + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b + 1;
+            }
+        }
+    }
+
+    //Stop when testing every triangle is cheaper than descending, as long as the leaf stays small
+    const float leafCost = static_cast<float>(count);
+    const float splitCost = bestAxis >= 0 ? traversalCost + bestCost / HalfArea(boundsMin, boundsMax) : FLT_MAX;
+    if (count <= maxLeafTriangles && (leafCost <= splitCost || depth >= maxSahDepth))
+    {
+        return;
+    }
+
+    unsigned int middle = begin;
+    if (bestAxis >= 0)
+    {
+        const float scale = binCount / extents[bestAxis];
+        const float axisOrigin = origins[bestAxis];
+        middle = static_cast<unsigned int>(std::partition(references + begin, references + end, [&](unsigned int reference)
+        {
+            const float position = (&triangles[reference].centroid.x)[bestAxis];
+            return std::min(binCount - 1, static_cast<unsigned int>((position - axisOrigin) * scale)) < bestBin;
+        }) - references);
+    }
+    else
+    {
+        //Every centroid is in the same place or the tree got too deep, halve along the widest axis
+        const int axis = extents[0] >= extents[1] && extents[0] >= extents[2] ? 0 : (extents[1] >= extents[2] ? 1 : 2);
+        middle = begin + count / 2;
+        std::nth_element(references + begin, references + middle, references + end, [triangles, axis](unsigned int a, unsigned int b)
+        {
+            return (&triangles[a].centroid.x)[axis] < (&triangles[b].centroid.x)[axis];
+        });
+    }
+
+    const unsigned int children = context.nodeCount.fetch_add(2);
+    node.first = children;
+    node.count = 0;
+
+    if (context.jobs && count >= parallelBuildTriangles)
+    {
+        JobCounter left;
+        context.jobs->Run([&context, children, begin, middle, depth]()
+        {
+            BuildNode(context, children, begin, middle, depth + 1);
+        }, &left);
+        BuildNode(context, children + 1, middle, end, depth + 1);
+        context.jobs->Wait(left);
+    }
+    else
+    {
+        BuildNode(context, children, begin, middle, depth + 1);
+        BuildNode(context, children + 1, middle, end, depth + 1);
+    }
+}
+
+MeshBvh::MeshBvh()
+{
+    mAvx2 = CpuHasAvx2();
+}
+
+MeshBvh::~MeshBvh()
+{
+}
+
+void MeshBvh::Build(const void *vertices, unsigned int stride, const short *indices, unsigned int indexCount, JobSystem *jobs)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    Clear();
+    const unsigned int triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    const unsigned char *bytes = static_cast<const unsigned char*>(vertices);
+    auto position = [bytes, stride](short index)
+    {
+        return XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(bytes + static_cast<size_t>(static_cast<unsigned short>(index)) * stride));
+    };
+
+    std::vector<BuildTriangle> triangles(triangleCount);
+    std::vector<unsigned int> references(triangleCount);
+    for (unsigned int t = 0; t < triangleCount; t++)
+    {
+        const XMVECTOR v0 = position(indices[t * 3]);
+        const XMVECTOR v1 = position(indices[t * 3 + 1]);
+        const XMVECTOR v2 = position(indices[t * 3 + 2]);
+        const XMVECTOR boundsMin = XMVectorMin(v0, XMVectorMin(v1, v2));
+        const XMVECTOR boundsMax = XMVectorMax(v0, XMVectorMax(v1, v2));
+        XMStoreFloat3(&triangles[t].boundsMin, boundsMin);
+        XMStoreFloat3(&triangles[t].boundsMax, boundsMax);
+        XMStoreFloat3(&triangles[t].centroid, 0.5f * (boundsMin + boundsMax));
+        references[t] = t;
+    }
+
+    //A binary tree with at least one triangle per leaf never needs more nodes than this
+    mNodes.resize(2 * static_cast<size_t>(triangleCount) - 1);
+    BuildContext context;
+    context.triangles = triangles.data();
+    context.references = references.data();
+    context.nodes = mNodes.data();
+    context.nodeCount = 1;
+    context.jobs = jobs;
+    BuildNode(context, 0, 0, triangleCount, 0);
+    mNodes.resize(context.nodeCount);
+    mNodes.shrink_to_fit();
+
+    //Lay the leaves' triangles out one after the other, each leaf padded to a run of four
+    unsigned int leaves = 0;
+    mSlotCount = 0;
+    for (const BvhNode &node : mNodes)
+    {
+        if (node.count > 0)
+        {
+            mSlotCount += (node.count + 3) & ~3u;
+            leaves++;
+        }
+    }
+    mTriangles.assign(static_cast<size_t>(ComponentCount) * mSlotCount, 0.0f);
+    mTriangleIndices.assign(mSlotCount, 0xffffffff);
+
+    unsigned int slot = 0;
+    for (BvhNode &node : mNodes)
+    {
+        if (node.count == 0)
+        {
+            continue;
+        }
+
+        for (unsigned int i = 0; i < node.count; i++)
+        {
+            const unsigned int t = references[node.first + i];
+            const XMVECTOR v0 = position(indices[t * 3]);
+            XMFLOAT3 components[3];
+            XMStoreFloat3(&components[0], v0);
+            XMStoreFloat3(&components[1], position(indices[t * 3 + 1]) - v0);
+            XMStoreFloat3(&components[2], position(indices[t * 3 + 2]) - v0);
+            for (unsigned int c = 0; c < ComponentCount; c++)
+            {
+                mTriangles[c * static_cast<size_t>(mSlotCount) + slot + i] = (&components[c / 3].x)[c % 3];
+            }
+            mTriangleIndices[slot + i] = t;
+        }
+
+        node.first = slot;
+        node.count = (node.count + 3) & ~3u;
+        slot += node.count;
+    }
+
+    mStats.triangles = triangleCount;
+    mStats.nodes = static_cast<unsigned int>(mNodes.size());
+    mStats.leaves = leaves;
+    mStats.bytes = mNodes.size() * sizeof(BvhNode) + mTriangles.size() * sizeof(float) + mTriangleIndices.size() * sizeof(unsigned int);
+    mStats.buildMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void MeshBvh::Clear()
+{
+    mNodes.clear();
+    mTriangles.clear();
+    mTriangleIndices.clear();
+    mSlotCount = 0;
+    mStats = BvhStats();
+}
+
+bool MeshBvh::IsEmpty()const
+{
+    return mNodes.empty();
+}
+
+//The ray with every component in all lanes, and the closest hit so far
+struct RayPacket
+{
+    XMVECTOR ox, oy, oz;
+    XMVECTOR dx, dy, dz;
+    float distance;
+    unsigned int slot;
+    float u, v;
+};
+
+//Moller-Trumbore against four triangles, keeps the closest hit nearer than the current one
+static bool IntersectTriangles4(const float *triangles, size_t slotCount, unsigned int first, RayPacket &ray)
+{
+    auto load = [triangles, slotCount, first](unsigned int component)
+    {
+        return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(triangles + component * slotCount + first));
+    };
+    const XMVECTOR e1x = load(3), e1y = load(4), e1z = load(5);
+    const XMVECTOR e2x = load(6), e2y = load(7), e2z = load(8);
+
+    const XMVECTOR px = ray.dy * e2z - ray.dz * e2y;
+    const XMVECTOR py = ray.dz * e2x - ray.dx * e2z;
+    const XMVECTOR pz = ray.dx * e2y - ray.dy * e2x;
+    const XMVECTOR det = e1x * px + e1y * py + e1z * pz;
+    const XMVECTOR inverse = XMVectorReciprocal(det);
+
+    const XMVECTOR tx = ray.ox - load(0);
+    const XMVECTOR ty = ray.oy - load(1);
+    const XMVECTOR tz = ray.oz - load(2);
+    const XMVECTOR u = (tx * px + ty * py + tz * pz) * inverse;
+
+    const XMVECTOR qx = ty * e1z - tz * e1y;
+    const XMVECTOR qy = tz * e1x - tx * e1z;
+    const XMVECTOR qz = tx * e1y - ty * e1x;
+    const XMVECTOR v = (ray.dx * qx + ray.dy * qy + ray.dz * qz) * inverse;
+    const XMVECTOR t = (e2x * qx + e2y * qy + e2z * qz) * inverse;
+
+    const XMVECTOR zero = XMVectorZero();
+    XMVECTOR hit = XMVectorGreater(XMVectorAbs(det), XMVectorReplicate(1e-12f));
+    hit = XMVectorAndInt(hit, XMVectorGreaterOrEqual(u, zero));
+    hit = XMVectorAndInt(hit, XMVectorGreaterOrEqual(v, zero));
+    hit = XMVectorAndInt(hit, XMVectorLessOrEqual(u + v, XMVectorReplicate(1.0f)));
+    hit = XMVectorAndInt(hit, XMVectorGreaterOrEqual(t, zero));
+    hit = XMVectorAndInt(hit, XMVectorLess(t, XMVectorReplicate(ray.distance)));
+    if (XMVector4EqualInt(hit, XMVectorFalseInt()))
+    {
+        return false;
+    }
+
+    XMFLOAT4A distances, us, vs;
+    XMStoreFloat4A(&distances, XMVectorSelect(XMVectorReplicate(FLT_MAX), t, hit));
+    XMStoreFloat4A(&us, u);
+    XMStoreFloat4A(&vs, v);
+    for (unsigned int lane = 0; lane < 4; lane++)
+    {
+        if ((&distances.x)[lane] < ray.distance)
+        {
+            ray.distance = (&distances.x)[lane];
+            ray.slot = first + lane;
+            ray.u = (&us.x)[lane];
+            ray.v = (&vs.x)[lane];
+        }
+    }
+    return true;
+}
+
+#if defined(BVH_AVX2_PATH)
+//The same on eight triangles
+AVX2_TARGET static bool IntersectTriangles8(const float *triangles, size_t slotCount, unsigned int first, RayPacket &ray)
+{
+    const float *base = triangles + first;
+    const __m256 e1x = _mm256_loadu_ps(base + 3 * slotCount);
+    const __m256 e1y = _mm256_loadu_ps(base + 4 * slotCount);
+    const __m256 e1z = _mm256_loadu_ps(base + 5 * slotCount);
+    const __m256 e2x = _mm256_loadu_ps(base + 6 * slotCount);
+    const __m256 e2y = _mm256_loadu_ps(base + 7 * slotCount);
+    const __m256 e2z = _mm256_loadu_ps(base + 8 * slotCount);
+    const __m256 dx = _mm256_set1_ps(XMVectorGetX(ray.dx));
+    const __m256 dy = _mm256_set1_ps(XMVectorGetX(ray.dy));
+    const __m256 dz = _mm256_set1_ps(XMVectorGetX(ray.dz));
+
+    const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    const __m256 inverse = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    const __m256 tx = _mm256_sub_ps(_mm256_set1_ps(XMVectorGetX(ray.ox)), _mm256_loadu_ps(base));
+    const __m256 ty = _mm256_sub_ps(_mm256_set1_ps(XMVectorGetX(ray.oy)), _mm256_loadu_ps(base + slotCount));
+    const __m256 tz = _mm256_sub_ps(_mm256_set1_ps(XMVectorGetX(ray.oz)), _mm256_loadu_ps(base + 2 * slotCount));
+    const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), inverse);
+
+    const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+    const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+    const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+    const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inverse);
+    const __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inverse);
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+    __m256 hit = _mm256_cmp_ps(absDet, _mm256_set1_ps(1e-12f), _CMP_GT_OQ);
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, _mm256_set1_ps(ray.distance), _CMP_LT_OQ));
+    if (_mm256_movemask_ps(hit) == 0)
+    {
+        return false;
+    }
+
+    alignas(32) float distances[8];
+    alignas(32) float us[8];
+    alignas(32) float vs[8];
+    _mm256_store_ps(distances, _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), t, hit));
+    _mm256_store_ps(us, u);
+    _mm256_store_ps(vs, v);
+    for (unsigned int lane = 0; lane < 8; lane++)
+    {
+        if (distances[lane] < ray.distance)
+        {
+            ray.distance = distances[lane];
+            ray.slot = first + lane;
+            ray.u = us[lane];
+            ray.v = vs[lane];
+        }
+    }
+    return true;
+}
+#endif
+
+//Slab test, the entry distance when the ray enters the box before maxDistance
+static bool IntersectBox(const BvhNode &node, FXMVECTOR origin, FXMVECTOR inverseDirection, float maxDistance, float &entry)
+{
+    const XMVECTOR t0 = (XMLoadFloat3(&node.boundsMin) - origin) * inverseDirection;
+    const XMVECTOR t1 = (XMLoadFloat3(&node.boundsMax) - origin) * inverseDirection;
+    XMFLOAT3 enter, leave;
+    XMStoreFloat3(&enter, XMVectorMin(t0, t1));
+    XMStoreFloat3(&leave, XMVectorMax(t0, t1));
+    entry = std::max(std::max(enter.x, enter.y), std::max(enter.z, 0.0f));
+    const float exit = std::min(std::min(leave.x, leave.y), std::min(leave.z, maxDistance));
+    return entry <= exit;
+}
+
+template<bool AnyHit>
+bool MeshBvh::Traverse(FXMVECTOR origin, FXMVECTOR direction, float maxDistance, RayHit &hit)const
+{
+    if (mNodes.empty())
+    {
+        return false;
+    }
+
+    RayPacket ray;
+    ray.ox = XMVectorSplatX(origin);
+    ray.oy = XMVectorSplatY(origin);
+    ray.oz = XMVectorSplatZ(origin);
+    ray.dx = XMVectorSplatX(direction);
+    ray.dy = XMVectorSplatY(direction);
+    ray.dz = XMVectorSplatZ(direction);
+    ray.distance = maxDistance;
+    ray.slot = 0xffffffff;
+    ray.u = 0.0f;
+    ray.v = 0.0f;
+
+    //Zero components become infinities, which the slab test handles
+    const XMVECTOR inverseDirection = XMVectorReciprocal(direction);
+    const float *triangles = mTriangles.data();
+    const size_t slotCount = mSlotCount;
+
+    float entry = 0.0f;
+    if (!IntersectBox(mNodes[0], origin, inverseDirection, ray.distance, entry))
+    {
+        return false;
+    }
+
+    unsigned int stack[maxTraversalDepth];
+    unsigned int depth = 0;
+    unsigned int current = 0;
+    while (true)
+    {
+        const BvhNode &node = mNodes[current];
+        if (node.count > 0)
+        {
+            const unsigned int end = node.first + node.count;
+            for (unsigned int first = node.first; first < end;)
+            {
+#if defined(BVH_AVX2_PATH)
+                if (mAvx2 && first + 8 <= end)
+                {
+                    IntersectTriangles8(triangles, slotCount, first, ray);
+                    first += 8;
+                    continue;
+                }
+#endif
+                IntersectTriangles4(triangles, slotCount, first, ray);
+                first += 4;
+            }
+            if (AnyHit && ray.slot != 0xffffffff)
+            {
+                break;
+            }
+        }
+        else
+        {
+            //Visit the nearer child first, the farther one may be culled by then
+            float leftEntry = 0.0f;
+            float rightEntry = 0.0f;
+            const bool left = IntersectBox(mNodes[node.first], origin, inverseDirection, ray.distance, leftEntry);
+            const bool right = IntersectBox(mNodes[node.first + 1], origin, inverseDirection, ray.distance, rightEntry);
+            if (left && right)
+            {
+                assert(depth < maxTraversalDepth);
+                const bool leftFirst = leftEntry <= rightEntry;
+                stack[depth++] = leftFirst ? node.first + 1 : node.first;
+                current = leftFirst ? node.first : node.first + 1;
+                continue;
+            }
+            if (left || right)
+            {
+                current = left ? node.first : node.first + 1;
+                continue;
+            }
+        }
+
+        //Pop until a node is still in front of the closest hit
+        bool found = false;
+        while (depth > 0)
+        {
+            current = stack[--depth];
+            if (IntersectBox(mNodes[current], origin, inverseDirection, ray.distance, entry))
+            {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+        {
+            break;
+        }
+    }
+
+    if (ray.slot == 0xffffffff)
+    {
+        return false;
+    }
+    hit.distance = ray.distance;
+    hit.triangle = mTriangleIndices[ray.slot];
+    hit.u = ray.u;
+    hit.v = ray.v;
+    return true;
+}
+
+bool MeshBvh::Intersect(FXMVECTOR origin, FXMVECTOR direction, float maxDistance, RayHit &hit)const
+{
+    return Traverse<false>(origin, direction, maxDistance, hit);
+}
+
+bool MeshBvh::IntersectAny(FXMVECTOR origin, FXMVECTOR direction, float maxDistance)const
+{
+    RayHit hit;
+    return Traverse<true>(origin, direction, maxDistance, hit);
+}
+
+void MeshBvh::UseAvx2(bool enable)
+{
+    mAvx2 = enable && CpuHasAvx2();
+}
+
+bool MeshBvh::IsUsingAvx2()const
+{
+    return mAvx2;
+}
+
+const BvhStats &MeshBvh::GetStats()const
+{
+    return mStats;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <directxmath.h>
+#include <vector>
+
+#include "JobSystem.h"
+
+using namespace DirectX;
+
+//32 bytes, two to a cache line. Children of an inner node are next to each other.
+struct BvhNode
+{
+    XMFLOAT3 boundsMin;
+    unsigned int first;                 //Left child of an inner node, first triangle slot of a leaf
+    XMFLOAT3 boundsMax;
+    unsigned int count;                 //Triangle slots of a leaf, 0 for an inner node
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode should stay 32 bytes");
+
+//Closest hit of a ray
+struct RayHit
+{
+    float distance = 0.0f;              //In multiples of the ray direction
+    unsigned int triangle = 0;          //Index of the triangle's first index / 3
+    float u = 0.0f;                     //Barycentrics of the second and third vertex
+    float v = 0.0f;
+};
+
+struct BvhStats
+{
+    unsigned int triangles = 0;
+    unsigned int nodes = 0;
+    unsigned int leaves = 0;
+    size_t bytes = 0;
+    float buildMs = 0.0f;
+};
+
+//Bounding volume hierarchy over the triangles of one mesh for ray queries on the CPU.
+//Built with binned SAH, the top of the tree split over the job system. Leaves hold
+//their triangles in runs of four, each component in its own array, so a ray is tested
+//against four triangles at a time, or eight with AVX2 when the CPU has it.
+class MeshBvh
+{
+public:
+    MeshBvh();
+    ~MeshBvh();
+    MeshBvh(const MeshBvh&) = default;
+    MeshBvh(MeshBvh&&) = default;
+    MeshBvh &operator=(const MeshBvh&) = default;
+    MeshBvh &operator=(MeshBvh&&) = default;
+
+    //Vertices only need a float3 position at offset 0, jobs may be null
+    void Build(const void *vertices, unsigned int stride, const short *indices, unsigned int indexCount, JobSystem *jobs);
+    void Clear();
+    bool IsEmpty()const;
+
+    //Closest triangle the ray hits before maxDistance, the direction doesn't have to be
+    //normalized and distances are in multiples of it
+    bool Intersect(FXMVECTOR origin, FXMVECTOR direction, float maxDistance, RayHit &hit)const;
+
+    //True as soon as any triangle is hit before maxDistance, for collision and visibility
+    bool IntersectAny(FXMVECTOR origin, FXMVECTOR direction, float maxDistance)const;
+
+    //Falls back to four triangles at a time when disabled or the CPU has no AVX2
+    void UseAvx2(bool enable);
+    bool IsUsingAvx2()const;
+
+    const BvhStats &GetStats()const;
+
+private:
+    template<bool AnyHit>
+    bool Traverse(FXMVECTOR origin, FXMVECTOR direction, float maxDistance, RayHit &hit)const;
+
+    std::vector<BvhNode> mNodes;        //The root comes first
+
+    //Triangles in leaf order, the first vertex and the two edges from it. Every leaf is
+    //padded to a multiple of four with degenerate triangles that can't be hit.
+    enum Component { V0X, V0Y, V0Z, E1X, E1Y, E1Z, E2X, E2Y, E2Z, ComponentCount };
+    std::vector<float> mTriangles;      //ComponentCount arrays of mSlotCount
+    std::vector<unsigned int> mTriangleIndices;
+    unsigned int mSlotCount = 0;
+
+    bool mAvx2 = false;
+    BvhStats mStats;
+};
@@ -0,0 +1,561 @@
+#include "MeshSimplifier.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <numeric>
+
+const unsigned int invalidIndex = ~0u;
+
+//Border and seam edges get an extra plane through the edge so they stay where they are
+const double edgeWeight = 10.0;
+
+//What a vertex position is allowed to do, decided once from the input mesh
+enum VertexKind
+{
+    KindManifold,       //Single vertex, closed fan: can collapse anywhere
+    KindBorder,         //Single vertex on an open border: can only slide along the border
+    KindSeam,           //Two vertices with different attributes: can only slide along the seam
+    KindLocked          //Anything more complicated never moves
+};
+
+struct Quadric
+{
+    double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0;
+    double b0 = 0, b1 = 0, b2 = 0;
+    double c = 0;
+    double weight = 0;
+};
+
+struct Vector3
+{
+    double x, y, z;
+};
+
+struct Collapse
+{
+    unsigned int v0;
+    unsigned int v1;
+    double error;
+};
+
+static Vector3 Subtract(const Vector3 &a, const Vector3 &b)
+{
+    return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+static Vector3 Cross(const Vector3 &a, const Vector3 &b)
+{
+    return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+static double Dot(const Vector3 &a, const Vector3 &b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static double Normalize(Vector3 &v)
+{
+    const double length = sqrt(Dot(v, v));
+    if (length > 0.0)
+    {
+        v.x /= length;
+        v.y /= length;
+        v.z /= length;
+    }
+    return length;
+}
+
+//Quadric of the squared distance to the plane n.p + d = 0
+static void AddPlane(Quadric &q, const Vector3 &n, double d, double weight)
+{
+    q.a00 += weight * n.x * n.x;
+    q.a11 += weight * n.y * n.y;
+    q.a22 += weight * n.z * n.z;
+    q.a01 += weight * n.x * n.y;
+    q.a02 += weight * n.x * n.z;
+    q.a12 += weight * n.y * n.z;
+    q.b0 += weight * n.x * d;
+    q.b1 += weight * n.y * d;
+    q.b2 += weight * n.z * d;
+    q.c += weight * d * d;
+    q.weight += weight;
+}
+
+static void AddQuadric(Quadric &q, const Quadric &other)
+{
+    q.a00 += other.a00;
+    q.a11 += other.a11;
+    q.a22 += other.a22;
+    q.a01 += other.a01;
+    q.a02 += other.a02;
+    q.a12 += other.a12;
+    q.b0 += other.b0;
+    q.b1 += other.b1;
+    q.b2 += other.b2;
+    q.c += other.c;
+    q.weight += other.weight;
+}
+
+//Weighted mean squared distance of p to the planes in the quadric
+static double QuadricError(const Quadric &q, const Vector3 &p)
+{
+    const double rx = q.a00 * p.x + q.a01 * p.y + q.a02 * p.z + 2.0 * q.b0;
+    const double ry = q.a01 * p.x + q.a11 * p.y + q.a12 * p.z + 2.0 * q.b1;
+    const double rz = q.a02 * p.x + q.a12 * p.y + q.a22 * p.z + 2.0 * q.b2;
+    const double error = p.x * rx + p.y * ry + p.z * rz + q.c;
+    return q.weight > 0.0 ? fabs(error) / q.weight : 0.0;
+}
+
+//Triangles around each vertex, rebuilt after every pass
+struct Adjacency
+{
+    std::vector<unsigned int> offsets;
+    std::vector<unsigned int> counts;
+    std::vector<unsigned int> triangles;
+};
+
+static void BuildAdjacency(Adjacency &adjacency, const std::vector<unsigned int> &indices, size_t vertexCount)
+{
+    adjacency.counts.assign(vertexCount, 0);
+    adjacency.offsets.resize(vertexCount);
+    adjacency.triangles.resize(indices.size());
+
+    for (const unsigned int index : indices)
+    {
+        adjacency.counts[index]++;
+    }
+
+    unsigned int offset = 0;
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        adjacency.offsets[i] = offset;
+        offset += adjacency.counts[i];
+    }
+
+    std::vector<unsigned int> fill(adjacency.offsets);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        adjacency.triangles[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+    }
+}
+
+//Is there a triangle with the directed edge a->b
+static bool HasEdge(const Adjacency &adjacency, const std::vector<unsigned int> &indices, unsigned int a, unsigned int b)
+{
+    const unsigned int *triangles = &adjacency.triangles[adjacency.offsets[a]];
+    for (unsigned int i = 0; i < adjacency.counts[a]; i++)
+    {
+        const unsigned int *triangle = &indices[triangles[i] * 3];
+        for (unsigned int e = 0; e < 3; e++)
+        {
+            if (triangle[e] == a && triangle[(e + 1) % 3] == b)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//Groups vertices with the same position: remap points at the first of them, wedge links them in a ring
+static void BuildPositionRemap(const VERTEX *vertices, size_t vertexCount, std::vector<unsigned int> &remap, std::vector<unsigned int> &wedge)
+{
+    std::vector<unsigned int> order(vertexCount);
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [vertices](unsigned int a, unsigned int b)
+    {
+        const XMFLOAT3 &pa = vertices[a].position;
+        const XMFLOAT3 &pb = vertices[b].position;
+        if (pa.x != pb.x) return pa.x < pb.x;
+        if (pa.y != pb.y) return pa.y < pb.y;
+        if (pa.z != pb.z) return pa.z < pb.z;
+        return a < b;
+    });
+
+    remap.resize(vertexCount);
+    wedge.resize(vertexCount);
+    for (size_t begin = 0; begin < vertexCount;)
+    {
+        const XMFLOAT3 &p = vertices[order[begin]].position;
+        size_t end = begin + 1;
+        while (end < vertexCount && vertices[order[end]].position.x == p.x && vertices[order[end]].position.y == p.y &&
+            vertices[order[end]].position.z == p.z)
+        {
+            end++;
+        }
+
+        for (size_t i = begin; i < end; i++)
+        {
+            remap[order[i]] = order[begin];
+            wedge[order[i]] = order[i + 1 < end ? i + 1 : begin];
+        }
+        begin = end;
+    }
+}
+
+//Would moving v0 onto v1 turn any triangle around v0 upside down
+static bool FlipsTriangles(const Adjacency &adjacency, const std::vector<unsigned int> &indices, const std::vector<Vector3> &positions,
+    const std::vector<unsigned int> &remap, unsigned int v0, unsigned int v1)
+{
+    const Vector3 &target = positions[v1];
+    const unsigned int *triangles = &adjacency.triangles[adjacency.offsets[v0]];
+    for (unsigned int i = 0; i < adjacency.counts[v0]; i++)
+    {
+        const unsigned int *triangle = &indices[triangles[i] * 3];
+        unsigned int corner = 0;
+        while (triangle[corner] != v0)
+        {
+            corner++;
+        }
+
+        const unsigned int a = triangle[(corner + 1) % 3];
+        const unsigned int b = triangle[(corner + 2) % 3];
+
+        //These collapse away
+        if (remap[a] == remap[v1] || remap[b] == remap[v1])
+        {
+            continue;
+        }
+
+        const Vector3 before = Cross(Subtract(positions[a], positions[v0]), Subtract(positions[b], positions[v0]));
+        const Vector3 after = Cross(Subtract(positions[a], target), Subtract(positions[b], target));
+        if (Dot(before, after) <= 0.0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+float SimplifyMesh(const VERTEX *vertices, size_t vertexCount, const short *indices, size_t indexCount,
+    size_t targetIndexCount, float maxError, std::vector<short> &result)
+{
+    std::vector<unsigned int> working(indexCount);
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        working[i] = static_cast<unsigned short>(indices[i]);
+    }
+
+    //Work in a unit box so the error limit doesn't depend on the model's scale
+    XMFLOAT3 boundsMin = vertices[0].position;
+    XMFLOAT3 boundsMax = vertices[0].position;
+    for (size_t i = 1; i < vertexCount; i++)
+    {
+        const XMFLOAT3 &p = vertices[i].position;
+        boundsMin = XMFLOAT3(std::min(boundsMin.x, p.x), std::min(boundsMin.y, p.y), std::min(boundsMin.z, p.z));
+        boundsMax = XMFLOAT3(std::max(boundsMax.x, p.x), std::max(boundsMax.y, p.y), std::max(boundsMax.z, p.z));
+    }
+    const double extent = std::max(std::max(boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y), std::max(boundsMax.z - boundsMin.z, 1e-6f));
+
+    std::vector<Vector3> positions(vertexCount);
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        const XMFLOAT3 &p = vertices[i].position;
+        positions[i] = { (p.x - boundsMin.x) / extent, (p.y - boundsMin.y) / extent, (p.z - boundsMin.z) / extent };
+    }
+
+    std::vector<unsigned int> remap;
+    std::vector<unsigned int> wedge;
+    BuildPositionRemap(vertices, vertexCount, remap, wedge);
+
+    Adjacency adjacency;
+    BuildAdjacency(adjacency, working, vertexCount);
+
+    //Open edges have no twin going the other way. openOut/openIn hold the vertex at the
+    //other end, invalidIndex when there is none and the vertex itself when there are several.
+    std::vector<unsigned int> openOut(vertexCount, invalidIndex);
+    std::vector<unsigned int> openIn(vertexCount, invalidIndex);
+    for (size_t i = 0; i < working.size(); i += 3)
+    {
+        for (unsigned int e = 0; e < 3; e++)
+        {
+            const unsigned int a = working[i + e];
+            const unsigned int b = working[i + (e + 1) % 3];
+            if (!HasEdge(adjacency, working, b, a))
+            {
+                openOut[a] = openOut[a] == invalidIndex ? b : a;
+                openIn[b] = openIn[b] == invalidIndex ? a : b;
+            }
+        }
+    }
+
+    std::vector<unsigned char> kinds(vertexCount, KindLocked);
+    for (unsigned int i = 0; i < vertexCount; i++)
+    {
+        if (remap[i] != i)
+        {
+            continue;
+        }
+
+        if (wedge[i] == i)
+        {
+            if (openOut[i] == invalidIndex && openIn[i] == invalidIndex)
+            {
+                kinds[i] = KindManifold;
+            }
+            else if (openOut[i] != invalidIndex && openIn[i] != invalidIndex && openOut[i] != i && openIn[i] != i)
+            {
+                kinds[i] = KindBorder;
+            }
+        }
+        else if (wedge[wedge[i]] == i)
+        {
+            //A seam has each side's open edges running opposite to the other side's
+            const unsigned int w = wedge[i];
+            const unsigned int a = openIn[i];
+            const unsigned int b = openOut[i];
+            const unsigned int c = openIn[w];
+            const unsigned int d = openOut[w];
+            if (a != invalidIndex && b != invalidIndex && c != invalidIndex && d != invalidIndex &&
+                a != i && b != i && c != w && d != w && remap[a] == remap[d] && remap[b] == remap[c] && remap[a] != remap[b])
+            {
+                kinds[i] = KindSeam;
+            }
+        }
+    }
+    for (unsigned int i = 0; i < vertexCount; i++)
+    {
+        kinds[i] = kinds[remap[i]];
+    }
+
+    //Quadrics live on the first vertex of each position
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < working.size(); i += 3)
+    {
+        const Vector3 &p0 = positions[working[i]];
+        const Vector3 &p1 = positions[working[i + 1]];
+        const Vector3 &p2 = positions[working[i + 2]];
+
+        Vector3 normal = Cross(Subtract(p1, p0), Subtract(p2, p0));
+        const double area = Normalize(normal);
+        const double d = -Dot(normal, p0);
+        for (unsigned int e = 0; e < 3; e++)
+        {
+            AddPlane(quadrics[remap[working[i + e]]], normal, d, area);
+        }
+
+        for (unsigned int e = 0; e < 3; e++)
+        {
+            const unsigned int a = working[i + e];
+            const unsigned int b = working[i + (e + 1) % 3];
+            if ((kinds[a] != KindBorder && kinds[a] != KindSeam) || openOut[a] != b)
+            {
+                continue;
+            }
+
+            //Plane through the edge, at right angles to the triangle
+            Vector3 edge = Subtract(positions[b], positions[a]);
+            const double length = Normalize(edge);
+            Vector3 side = Cross(edge, normal);
+            Normalize(side);
+            const double sideD = -Dot(side, positions[a]);
+            AddPlane(quadrics[remap[a]], side, sideD, length * edgeWeight);
+            AddPlane(quadrics[remap[b]], side, sideD, length * edgeWeight);
+        }
+    }
+
+    const double maxErrorSq = static_cast<double>(maxError) * maxError;
+    double resultError = 0.0;
+
+    std::vector<Collapse> collapses;
+    std::vector<unsigned int> collapseRemap(vertexCount);
+    std::vector<unsigned char> touched(vertexCount);
+
+    while (working.size() > targetIndexCount)
+    {
+        //Cheapest allowed direction of every edge
+        collapses.clear();
+        for (size_t i = 0; i < working.size(); i += 3)
+        {
+            for (unsigned int e = 0; e < 3; e++)
+            {
+                const unsigned int a = working[i + e];
+                const unsigned int b = working[i + (e + 1) % 3];
+
+                Collapse best = { invalidIndex, invalidIndex, 0.0 };
+                for (unsigned int direction = 0; direction < 2; direction++)
+                {
+                    const unsigned int v0 = direction == 0 ? a : b;
+                    const unsigned int v1 = direction == 0 ? b : a;
+                    const unsigned char k0 = kinds[v0];
+                    const unsigned char k1 = kinds[v1];
+
+                    bool allowed = k0 == KindManifold;
+                    if (k0 == KindBorder || k0 == KindSeam)
+                    {
+                        allowed = (k1 == k0 || k1 == KindLocked) && (openOut[v0] == v1 || openIn[v0] == v1);
+                    }
+                    if (!allowed)
+                    {
+                        continue;
+                    }
+
+                    Quadric q = quadrics[remap[v0]];
+                    AddQuadric(q, quadrics[remap[v1]]);
+                    const double error = QuadricError(q, positions[v1]);
+                    if (best.v0 == invalidIndex || error < best.error)
+                    {
+                        best = { v0, v1, error };
+                    }
+                }
+
+                if (best.v0 != invalidIndex)
+                {
+                    collapses.push_back(best);
+                }
+            }
+        }
+
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) { return a.error < b.error; });
+
+        //Take the cheapest collapses that don't touch each other, each one removes one or two triangles
+        std::iota(collapseRemap.begin(), collapseRemap.end(), 0u);
+        std::fill(touched.begin(), touched.end(), static_cast<unsigned char>(0));
+        const size_t triangleGoal = (working.size() - targetIndexCount) / 3;
+        size_t removed = 0;
+        bool overError = false;
+        for (const Collapse &collapse : collapses)
+        {
+            if (collapse.error > maxErrorSq)
+            {
+                overError = true;
+                break;
+            }
+
+            const unsigned int r0 = remap[collapse.v0];
+            const unsigned int r1 = remap[collapse.v1];
+            if (touched[r0] || touched[r1])
+            {
+                continue;
+            }
+
+            //The other side of a seam moves with it, onto the matching vertex on the other end
+            unsigned int s0 = invalidIndex;
+            unsigned int s1 = invalidIndex;
+            if (kinds[collapse.v0] == KindSeam)
+            {
+                s0 = wedge[collapse.v0];
+                s1 = openOut[collapse.v0] == collapse.v1 ? openIn[s0] : openOut[s0];
+                if (s1 == invalidIndex || remap[s1] != r1)
+                {
+                    continue;
+                }
+            }
+
+            if (FlipsTriangles(adjacency, working, positions, remap, collapse.v0, collapse.v1) ||
+                (s0 != invalidIndex && FlipsTriangles(adjacency, working, positions, remap, s0, s1)))
+            {
+                continue;
+            }
+
+            collapseRemap[collapse.v0] = collapse.v1;
+            if (s0 != invalidIndex)
+            {
+                collapseRemap[s0] = s1;
+            }
+            AddQuadric(quadrics[r1], quadrics[r0]);
+            touched[r0] = 1;
+            touched[r1] = 1;
+
+            resultError = std::max(resultError, collapse.error);
+            removed += kinds[collapse.v0] == KindBorder ? 1 : 2;
+            if (removed >= triangleGoal)
+            {
+                break;
+            }
+        }
+
+        if (removed == 0)
+        {
+            break;
+        }
+
+        //Apply the pass and drop the triangles that collapsed to a line
+        size_t kept = 0;
+        for (size_t i = 0; i < working.size(); i += 3)
+        {
+            const unsigned int a = collapseRemap[working[i]];
+            const unsigned int b = collapseRemap[working[i + 1]];
+            const unsigned int c = collapseRemap[working[i + 2]];
+            if (remap[a] != remap[b] && remap[b] != remap[c] && remap[a] != remap[c])
+            {
+                working[kept++] = a;
+                working[kept++] = b;
+                working[kept++] = c;
+            }
+        }
+        working.resize(kept);
+
+        //Keep the border and seam loops pointing at vertices that still exist
+        for (unsigned int i = 0; i < vertexCount; i++)
+        {
+            unsigned int *loops[2] = { &openOut[i], &openIn[i] };
+            for (unsigned int *loop : loops)
+            {
+                if (*loop != invalidIndex && *loop != i)
+                {
+                    const unsigned int target = collapseRemap[*loop];
+                    *loop = target == i ? (loop == &openOut[i] ? openOut[*loop] : openIn[*loop]) : target;
+                }
+            }
+        }
+
+        if (overError)
+        {
+            break;
+        }
+
+        BuildAdjacency(adjacency, working, vertexCount);
+    }
+
+    result.resize(working.size());
+    for (size_t i = 0; i < working.size(); i++)
+    {
+        result[i] = static_cast<short>(working[i]);
+    }
+
+    return static_cast<float>(sqrt(resultError) * extent);
+}
+
+void BuildLodChain(MeshData &mesh, const LodChainSettings &settings)
+{
+    mesh.lods.clear();
+    if (mesh.vertices.empty() || mesh.indices.empty())
+    {
+        return;
+    }
+
+    MeshLod full;
+    full.indexCount = static_cast<unsigned int>(mesh.indices.size());
+    mesh.lods.push_back(full);
+
+    //Each level is simplified from the one before it, so the errors add up
+    std::vector<short> source(mesh.indices);
+    std::vector<short> level;
+    float error = 0.0f;
+    while (mesh.lods.size() < settings.maxLods)
+    {
+        const size_t target = static_cast<size_t>(source.size() / 3 * settings.reduction) * 3;
+        if (target / 3 < settings.minTriangles)
+        {
+            break;
+        }
+
+        error += SimplifyMesh(mesh.vertices.data(), mesh.vertices.size(), source.data(), source.size(), target, settings.maxError, level);
+
+        //Not worth a level of its own when the error limit stopped it early
+        if (level.size() > source.size() * 9 / 10)
+        {
+            break;
+        }
+
+        MeshLod lod;
+        lod.indexOffset = static_cast<unsigned int>(mesh.indices.size());
+        lod.indexCount = static_cast<unsigned int>(level.size());
+        lod.error = error;
+        mesh.lods.push_back(lod);
+        mesh.indices.insert(mesh.indices.end(), level.begin(), level.end());
+        source.swap(level);
+    }
+}
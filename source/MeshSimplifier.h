@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vector>
+
+#include "Assets.h"
+
+//How BuildLodChain picks its levels
+struct LodChainSettings
+{
+    unsigned int maxLods = 6;           //Including the full resolution level
+    float reduction = 0.5f;             //Triangle count of a level relative to the one before it
+    float maxError = 0.05f;             //Largest error per level, relative to the size of the mesh
+    unsigned int minTriangles = 64;     //Don't build levels smaller than this
+};
+
+//Simplifies an indexed triangle list with quadric error metrics by collapsing edges
+//onto existing vertices, so normals and texture coordinates are never interpolated.
+//Vertices on UV or normal seams and on open borders only slide along the seam or
+//border, and vertices where those meet never move. Stops at targetIndexCount or
+//when the next collapse would cost more than maxError (relative to the mesh size).
+//Returns the error of the result in object space units.
+float SimplifyMesh(const VERTEX *vertices, size_t vertexCount, const short *indices, size_t indexCount,
+    size_t targetIndexCount, float maxError, std::vector<short> &result);
+
+//Appends simplified levels to mesh.indices and describes every level in mesh.lods,
+//all levels share the vertex array
+void BuildLodChain(MeshData &mesh, const LodChainSettings &settings = LodChainSettings());
@@ -0,0 +1,609 @@
+#include "ObjLoader.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "AssetArchive.h"
+
+//Chunks smaller than this aren't worth a job of their own
+const size_t minChunkSize = 256 * 1024;
+const unsigned int maxChunks = 64;
+
+const unsigned int invalidVertex = ~0u;
+
+static_assert(sizeof(VERTEX) == 9 * sizeof(float), "VERTEX is hashed and compared as nine floats");
+
+//One corner of a face as written in the file
+struct ObjCorner
+{
+    int index[3];               //Position, texture coordinate, normal
+    unsigned char relative;     //Bit per index that is relative to the chunk's own start
+    unsigned char present;      //Bit per index that the corner gives
+};
+
+//Everything one chunk of the file declares. Indices are resolved once every chunk is
+//parsed and it is known how many elements the chunks before it declared.
+struct ObjChunk
+{
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    std::vector<XMFLOAT3> positions;
+    std::vector<XMFLOAT2> texCoords;
+    std::vector<XMFLOAT3> normals;
+    std::vector<ObjCorner> corners;
+    std::vector<unsigned int> faceSizes;
+    std::string materialLibrary;
+    std::string firstMaterial;
+};
+
+//Resolved corner, -1 for a missing texture coordinate or normal
+struct ObjVertexRef
+{
+    int position;
+    int texCoord;
+    int normal;
+};
+
+static const double powersOf10[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static const char *SkipSpaces(const char *p, const char *end)
+{
+    while (p < end && IsSpace(*p))
+    {
+        p++;
+    }
+    return p;
+}
+
+static const char *SkipLine(const char *p, const char *end)
+{
+    while (p < end && *p != '\n')
+    {
+        p++;
+    }
+    return p < end ? p + 1 : end;
+}
+
+static std::string ReadRestOfLine(const char *p, const char *end)
+{
+    p = SkipSpaces(p, end);
+    const char *lineEnd = p;
+    while (lineEnd < end && *lineEnd != '\n' && *lineEnd != '\r')
+    {
+        lineEnd++;
+    }
+    while (lineEnd > p && IsSpace(lineEnd[-1]))
+    {
+        lineEnd--;
+    }
+    return std::string(p, lineEnd);
+}
+
+//Decimal float without locale or errno overhead, enough for what exporters write
+static const char *ParseFloat(const char *p, const char *end, float &value)
+{
+    p = SkipSpaces(p, end);
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    //Up to 19 significant digits fit the integer, the rest only move the exponent
+    unsigned long long digits = 0;
+    int significant = 0;
+    int exponent = 0;
+    for (; p < end && IsDigit(*p); p++)
+    {
+        if (significant < 19)
+        {
+            digits = digits * 10 + (*p - '0');
+            significant += digits > 0 ? 1 : 0;
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && IsDigit(*p); p++)
+        {
+            if (significant < 19)
+            {
+                digits = digits * 10 + (*p - '0');
+                significant += digits > 0 ? 1 : 0;
+                exponent--;
+            }
+        }
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negativeExponent = *p == '-';
+            p++;
+        }
+
+        int written = 0;
+        for (; p < end && IsDigit(*p); p++)
+        {
+            written = std::min(written * 10 + (*p - '0'), 1000);
+        }
+        exponent += negativeExponent ? -written : written;
+    }
+
+    double result = static_cast<double>(digits);
+    if (exponent != 0)
+    {
+        const int magnitude = exponent < 0 ? -exponent : exponent;
+        const double scale = magnitude <= 22 ? powersOf10[magnitude] : pow(10.0, magnitude);
+        result = exponent < 0 ? result / scale : result * scale;
+    }
+
+    value = static_cast<float>(negative ? -result : result);
+    return p;
+}
+
+static const char *ParseInt(const char *p, const char *end, int &value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    int result = 0;
+    for (; p < end && IsDigit(*p); p++)
+    {
+        result = result * 10 + (*p - '0');
+    }
+
+    value = negative ? -result : result;
+    return p;
+}
+
+static bool StartsWith(const char *p, const char *end, const char *keyword)
+{
+    const size_t length = strlen(keyword);
+    return static_cast<size_t>(end - p) > length && memcmp(p, keyword, length) == 0 && IsSpace(p[length]);
+}
+
+static void ParseChunk(ObjChunk &chunk)
+{
+    const char *p = chunk.begin;
+    const char *end = chunk.end;
+    while (p < end)
+    {
+        p = SkipSpaces(p, end);
+        if (p >= end)
+        {
+            break;
+        }
+
+        //The importer always produced a left-handed mesh: mirror z and flip V
+        if (StartsWith(p, end, "v"))
+        {
+            XMFLOAT3 position;
+            p = ParseFloat(p + 1, end, position.x);
+            p = ParseFloat(p, end, position.y);
+            p = ParseFloat(p, end, position.z);
+            position.z = -position.z;
+            chunk.positions.push_back(position);
+        }
+        else if (StartsWith(p, end, "vt"))
+        {
+            XMFLOAT2 texCoord;
+            p = ParseFloat(p + 2, end, texCoord.x);
+            p = ParseFloat(p, end, texCoord.y);
+            texCoord.y = 1.0f - texCoord.y;
+            chunk.texCoords.push_back(texCoord);
+        }
+        else if (StartsWith(p, end, "vn"))
+        {
+            XMFLOAT3 normal;
+            p = ParseFloat(p + 2, end, normal.x);
+            p = ParseFloat(p, end, normal.y);
+            p = ParseFloat(p, end, normal.z);
+            normal.z = -normal.z;
+            chunk.normals.push_back(normal);
+        }
+        else if (StartsWith(p, end, "f"))
+        {
+            const int counts[3] =
+            {
+                static_cast<int>(chunk.positions.size()),
+                static_cast<int>(chunk.texCoords.size()),
+                static_cast<int>(chunk.normals.size())
+            };
+
+            unsigned int faceSize = 0;
+            p++;
+            while (true)
+            {
+                p = SkipSpaces(p, end);
+                if (p >= end || *p == '\n' || *p == '\r' || *p == '#')
+                {
+                    break;
+                }
+
+                //v, v/vt, v//vn or v/vt/vn, negative indices count back from the last element
+                ObjCorner corner = {};
+                for (unsigned int k = 0; k < 3; k++)
+                {
+                    if (k > 0)
+                    {
+                        if (p >= end || *p != '/')
+                        {
+                            break;
+                        }
+                        p++;
+                    }
+
+                    if (p < end && (IsDigit(*p) || *p == '-' || *p == '+'))
+                    {
+                        int value = 0;
+                        p = ParseInt(p, end, value);
+                        if (value < 0)
+                        {
+                            corner.index[k] = counts[k] + value;
+                            corner.relative |= 1 << k;
+                        }
+                        else
+                        {
+                            corner.index[k] = value - 1;
+                        }
+                        corner.present |= 1 << k;
+                    }
+                }
+
+                while (p < end && !IsSpace(*p) && *p != '\n' && *p != '\r')
+                {
+                    p++;
+                }
+
+                if (corner.present & 1)
+                {
+                    chunk.corners.push_back(corner);
+                    faceSize++;
+                }
+            }
+            chunk.faceSizes.push_back(faceSize);
+        }
+        else if (StartsWith(p, end, "mtllib"))
+        {
+            if (chunk.materialLibrary.empty())
+            {
+                chunk.materialLibrary = ReadRestOfLine(p + 6, end);
+            }
+        }
+        else if (StartsWith(p, end, "usemtl"))
+        {
+            if (chunk.firstMaterial.empty())
+            {
+                chunk.firstMaterial = ReadRestOfLine(p + 6, end);
+            }
+        }
+
+        p = SkipLine(p, end);
+    }
+}
+
+static bool SamePosition(const XMFLOAT3 &a, const XMFLOAT3 &b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static XMFLOAT3 Subtract(const XMFLOAT3 &a, const XMFLOAT3 &b)
+{
+    return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+static XMFLOAT3 Normalized(const XMFLOAT3 &v)
+{
+    const float length = sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
+    return length > 0.0f ? XMFLOAT3(v.x / length, v.y / length, v.z / length) : v;
+}
+
+static float Dot(const XMFLOAT3 &a, const XMFLOAT3 &b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+//Quads start the fan at their concave corner if they have one, like Assimp does
+static unsigned int QuadStartCorner(const std::vector<XMFLOAT3> &positions, const ObjVertexRef *face)
+{
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        const XMFLOAT3 &v = positions[face[i].position];
+        const XMFLOAT3 left = Normalized(Subtract(positions[face[(i + 3) % 4].position], v));
+        const XMFLOAT3 diagonal = Normalized(Subtract(positions[face[(i + 2) % 4].position], v));
+        const XMFLOAT3 right = Normalized(Subtract(positions[face[(i + 1) % 4].position], v));
+
+        const float angle = acosf(std::max(-1.0f, std::min(1.0f, Dot(left, diagonal)))) +
+            acosf(std::max(-1.0f, std::min(1.0f, Dot(right, diagonal))));
+        if (angle > XM_PI)
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static unsigned int HashVertex(const VERTEX &vertex)
+{
+    unsigned int words[9];
+    memcpy(words, &vertex, sizeof(words));
+
+    unsigned int hash = 2166136261u;
+    for (const unsigned int word : words)
+    {
+        hash = (hash ^ word) * 16777619u;
+    }
+    return hash ^ (hash >> 15);
+}
+
+//Finds the diffuse map of a material in an MTL file, the first one when material is empty
+static std::string FindDiffuseMap(const std::string &path, const std::string &material)
+{
+    AssetFile file;
+    if (!file.Open(path.c_str()))
+    {
+        return std::string();
+    }
+
+    const char *p = reinterpret_cast<const char*>(file.GetData());
+    const char *end = p + file.GetSize();
+    std::string current;
+    while (p < end)
+    {
+        p = SkipSpaces(p, end);
+
+        if (StartsWith(p, end, "newmtl"))
+        {
+            current = ReadRestOfLine(p + 6, end);
+        }
+        else if (StartsWith(p, end, "map_Kd") && (material.empty() || current == material))
+        {
+            //Options like -s or -bm come first, the file name is last
+            const std::string value = ReadRestOfLine(p + 6, end);
+            const size_t space = value.find_last_of(" \t");
+            return space == std::string::npos ? value : value.substr(space + 1);
+        }
+        p = SkipLine(p, end);
+    }
+    return std::string();
+}
+
+bool LoadObj(const char *filename, MeshData &mesh, JobSystem *jobs)
+{
+    AssetFile file;
+    if (!file.Open(filename, jobs))
+    {
+        return false;
+    }
+
+    //Split the file at line breaks into chunks that parse on their own
+    const char *data = reinterpret_cast<const char*>(file.GetData());
+    const char *dataEnd = data + file.GetSize();
+    const unsigned int chunkCount = static_cast<unsigned int>(std::max<size_t>(1, std::min<size_t>(file.GetSize() / minChunkSize, maxChunks)));
+    std::vector<ObjChunk> chunks(chunkCount);
+    const char *begin = data;
+    for (unsigned int c = 0; c < chunkCount; c++)
+    {
+        const char *end = c + 1 == chunkCount ? dataEnd : std::max(begin, data + file.GetSize() / chunkCount * (c + 1));
+        while (end < dataEnd && end > data && end[-1] != '\n')
+        {
+            end++;
+        }
+        chunks[c].begin = begin;
+        chunks[c].end = end;
+        begin = end;
+    }
+
+    const auto parse = [&chunks](unsigned int first, unsigned int last, unsigned int)
+    {
+        for (unsigned int c = first; c < last; c++)
+        {
+            ParseChunk(chunks[c]);
+        }
+    };
+    if (jobs)
+    {
+        jobs->ParallelFor(chunkCount, 1, chunkCount, parse);
+    }
+    else
+    {
+        parse(0, chunkCount, 0);
+    }
+
+    //Stitch the chunks together and resolve every corner to absolute indices
+    std::vector<XMFLOAT3> positions;
+    std::vector<XMFLOAT2> texCoords;
+    std::vector<XMFLOAT3> normals;
+    std::vector<ObjVertexRef> triangles;
+    std::vector<ObjVertexRef> face;
+    std::string materialLibrary;
+    std::string material;
+    for (const ObjChunk &chunk : chunks)
+    {
+        const int bases[3] =
+        {
+            static_cast<int>(positions.size()),
+            static_cast<int>(texCoords.size()),
+            static_cast<int>(normals.size())
+        };
+        positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+        texCoords.insert(texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+        normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+        const int counts[3] = { static_cast<int>(positions.size()), static_cast<int>(texCoords.size()), static_cast<int>(normals.size()) };
+
+        if (materialLibrary.empty())
+        {
+            materialLibrary = chunk.materialLibrary;
+        }
+        if (material.empty())
+        {
+            material = chunk.firstMaterial;
+        }
+
+        const ObjCorner *corner = chunk.corners.data();
+        for (const unsigned int faceSize : chunk.faceSizes)
+        {
+            //Reverse the corners for the left-handed winding, then triangulate
+            face.resize(faceSize);
+            for (unsigned int i = 0; i < faceSize; i++, corner++)
+            {
+                int resolved[3] = { -1, -1, -1 };
+                for (unsigned int k = 0; k < 3; k++)
+                {
+                    if (corner->present & (1 << k))
+                    {
+                        resolved[k] = corner->index[k] + ((corner->relative & (1 << k)) ? bases[k] : 0);
+                        if (resolved[k] < 0 || resolved[k] >= counts[k])
+                        {
+                            return false;
+                        }
+                    }
+                }
+                face[faceSize - 1 - i] = { resolved[0], resolved[1], resolved[2] };
+            }
+
+            if (faceSize < 3)
+            {
+                continue;
+            }
+
+            const unsigned int start = faceSize == 4 ? QuadStartCorner(positions, face.data()) : 0;
+            for (unsigned int i = 1; i + 1 < faceSize; i++)
+            {
+                triangles.push_back(face[start]);
+                triangles.push_back(face[(start + i) % faceSize]);
+                triangles.push_back(face[(start + i + 1) % faceSize]);
+            }
+        }
+    }
+
+    //Smooth normals for corners the file gives none, from the faces around each position
+    std::vector<XMFLOAT3> smoothNormals;
+    for (const ObjVertexRef &ref : triangles)
+    {
+        if (ref.normal >= 0)
+        {
+            continue;
+        }
+
+        smoothNormals.assign(positions.size(), XMFLOAT3(0.0f, 0.0f, 0.0f));
+        for (size_t i = 0; i < triangles.size(); i += 3)
+        {
+            const XMFLOAT3 &p0 = positions[triangles[i].position];
+            const XMFLOAT3 &p1 = positions[triangles[i + 1].position];
+            const XMFLOAT3 &p2 = positions[triangles[i + 2].position];
+            const XMFLOAT3 e1 = Subtract(p1, p0);
+            const XMFLOAT3 e2 = Subtract(p2, p0);
+            const XMFLOAT3 normal = Normalized(XMFLOAT3(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x));
+            for (size_t k = 0; k < 3; k++)
+            {
+                XMFLOAT3 &sum = smoothNormals[triangles[i + k].position];
+                sum = XMFLOAT3(sum.x + normal.x, sum.y + normal.y, sum.z + normal.z);
+            }
+        }
+        for (XMFLOAT3 &normal : smoothNormals)
+        {
+            normal = Normalized(normal);
+        }
+        break;
+    }
+
+    //Weld corners with identical attributes through an open addressing hash table
+    size_t capacity = 1;
+    while (capacity < triangles.size() * 2)
+    {
+        capacity *= 2;
+    }
+    std::vector<unsigned int> table(capacity, invalidVertex);
+
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    mesh.lods.clear();
+    mesh.skin.clear();
+    mesh.vertices.reserve(triangles.size() / 2);
+    mesh.indices.reserve(triangles.size());
+    for (size_t i = 0; i < triangles.size(); i += 3)
+    {
+        //Triangles that collapse to a line or a point were dropped by the old import too
+        const XMFLOAT3 &p0 = positions[triangles[i].position];
+        const XMFLOAT3 &p1 = positions[triangles[i + 1].position];
+        const XMFLOAT3 &p2 = positions[triangles[i + 2].position];
+        if (SamePosition(p0, p1) || SamePosition(p1, p2) || SamePosition(p0, p2))
+        {
+            continue;
+        }
+
+        for (size_t k = 0; k < 3; k++)
+        {
+            const ObjVertexRef &ref = triangles[i + k];
+            VERTEX vertex = {};
+            vertex.position = positions[ref.position];
+            vertex.normal = ref.normal >= 0 ? normals[ref.normal] : smoothNormals[ref.position];
+            vertex.texture = ref.texCoord >= 0 ? texCoords[ref.texCoord] : XMFLOAT2(0.0f, 0.0f);
+
+            size_t slot = HashVertex(vertex) & (capacity - 1);
+            while (table[slot] != invalidVertex && memcmp(&mesh.vertices[table[slot]], &vertex, sizeof(vertex)) != 0)
+            {
+                slot = (slot + 1) & (capacity - 1);
+            }
+
+            if (table[slot] == invalidVertex)
+            {
+                //Indices are 16 bit
+                if (mesh.vertices.size() > 0xffff)
+                {
+                    return false;
+                }
+                table[slot] = static_cast<unsigned int>(mesh.vertices.size());
+                mesh.vertices.push_back(vertex);
+            }
+            mesh.indices.push_back(static_cast<short>(table[slot]));
+        }
+    }
+
+    //Texture names in the material library are relative to the model
+    const std::string path(filename);
+    const size_t slash = path.find_last_of("/\\");
+    const std::string directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    mesh.diffuseTexture.clear();
+    if (!materialLibrary.empty())
+    {
+        const std::string diffuse = FindDiffuseMap(directory + materialLibrary, material);
+        if (!diffuse.empty())
+        {
+            mesh.diffuseTexture = directory + diffuse;
+        }
+    }
+
+    return !mesh.indices.empty();
+}
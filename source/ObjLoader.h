@@ -0,0 +1,13 @@
+#pragma once
+
+#include "Assets.h"
+#include "JobSystem.h"
+
+//Wavefront OBJ importer that replaces Assimp for .obj files. The file is memory mapped
+//and split into chunks at line breaks that are parsed in parallel, then the faces are
+//triangulated and identical vertices welded through a hash table. The output matches
+//what the Assimp import produced: left-handed (z mirrored, V flipped, winding reversed),
+//smooth normals generated when the file has none and degenerate triangles removed.
+//The diffuse map of the first material the faces use is returned in
+//mesh.diffuseTexture. jobs may be null to parse on the calling thread only.
+bool LoadObj(const char *filename, MeshData &mesh, JobSystem *jobs);
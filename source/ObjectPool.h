@@ -0,0 +1,96 @@
+#pragma once
+
+#include <assert.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "MemoryTelemetry.h"
+
+//Fixed size slots for objects of one type, handed out from a free list. Slots come in
+//pages of PageSize that stay allocated while the pool lives, so pointers never move and
+//creating and destroying objects in steady state doesn't touch the heap. Not thread safe.
+template<typename T, unsigned int PageSize = 64>
+class ObjectPool
+{
+public:
+    ObjectPool()
+    {
+    }
+
+    ~ObjectPool()
+    {
+        assert(mLive == 0 && "Objects still alive when their pool went away");
+        for (Slot *page : mPages)
+        {
+            ::operator delete(page);
+        }
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool &operator=(const ObjectPool&) = delete;
+
+    template<typename... Args>
+    T* Create(Args&&... args)
+    {
+        if (!mFree)
+        {
+            AddPage();
+        }
+
+        Slot *slot = mFree;
+        mFree = slot->next;
+        mLive++;
+        RecordAllocation(MemoryTagScene, sizeof(T));
+        return new (&slot->storage) T(std::forward<Args>(args)...);
+    }
+
+    void Destroy(T *object)
+    {
+        if (!object)
+        {
+            return;
+        }
+
+        object->~T();
+        Slot *slot = reinterpret_cast<Slot*>(object);
+        slot->next = mFree;
+        mFree = slot;
+        mLive--;
+    }
+
+    unsigned int GetLive()const
+    {
+        return mLive;
+    }
+
+    unsigned int GetCapacity()const
+    {
+        return static_cast<unsigned int>(mPages.size()) * PageSize;
+    }
+
+private:
+    union Slot
+    {
+        Slot *next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    void AddPage()
+    {
+        Slot *page = static_cast<Slot*>(::operator new(sizeof(Slot) * PageSize));
+        mPages.push_back(page);
+
+        //Thread the new slots onto the free list in order
+        for (unsigned int i = 0; i < PageSize; i++)
+        {
+            page[i].next = i + 1 < PageSize ? &page[i + 1] : mFree;
+        }
+        mFree = page;
+    }
+
+    std::vector<Slot*> mPages;
+    Slot *mFree = nullptr;
+    unsigned int mLive = 0;
+};
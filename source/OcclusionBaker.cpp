@@ -0,0 +1,222 @@
+#include "OcclusionBaker.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <vector>
+
+#include "FileCache.h"
+
+//Every vertex traces all of its rays, so even small chunks are worth a job
+const unsigned int minVerticesPerJob = 64;
+const unsigned int maxOcclusionJobs = 256;
+
+//Rays start this far off the surface and this far along, as a share of the bounding box
+//diagonal, so they don't hit the triangles around the vertex they leave from
+const float rayBias = 0.001f;
+
+//Bump when the file layout or the way rays are traced changes so old bakes get redone. A
+//bake holds one byte per vertex, 255 for fully open.
+const unsigned int occlusionCacheVersion = 1;
+const unsigned int occlusionCacheMagic = 0x4f414750; //"PGAO"
+
+//Bits of the index mirrored behind the point, the second coordinate of a Hammersley set
+static float RadicalInverse(unsigned int bits)
+{
+    bits = (bits << 16) | (bits >> 16);
+    bits = ((bits & 0x55555555u) << 1) | ((bits & 0xaaaaaaaau) >> 1);
+    bits = ((bits & 0x33333333u) << 2) | ((bits & 0xccccccccu) >> 2);
+    bits = ((bits & 0x0f0f0f0fu) << 4) | ((bits & 0xf0f0f0f0u) >> 4);
+    bits = ((bits & 0x00ff00ffu) << 8) | ((bits & 0xff00ff00u) >> 8);
+    return bits * (1.0f / 4294967296.0f);
+}
+
+//0 to 1 from an integer, shifts every vertex's ray pattern so neighbours don't band together
+static float HashToUnit(unsigned int value)
+{
+    value ^= value >> 16;
+    value *= 0x7feb352du;
+    value ^= value >> 15;
+    value *= 0x846ca68bu;
+    value ^= value >> 16;
+    return (value >> 8) * (1.0f / 16777216.0f);
+}
+
+static float Wrap(float value)
+{
+    return value >= 1.0f ? value - 1.0f : value;
+}
+
+static float AverageOcclusion(const VERTEX *vertices, size_t vertexCount)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        sum += vertices[i].occlusion;
+    }
+    return vertexCount > 0 ? static_cast<float>(sum / vertexCount) : 1.0f;
+}
+
+OcclusionBaker::OcclusionBaker(const std::string &cacheDirectory, const OcclusionBakeSettings &settings) : mDirectory(cacheDirectory),
+    mSettings(settings)
+{
+    CreateCacheDirectory(mDirectory);
+}
+
+OcclusionBaker::~OcclusionBaker()
+{
+}
+
+unsigned long long OcclusionBaker::ComputeKey(const VERTEX *vertices, size_t vertexCount, const short *indices, size_t indexCount)const
+{
+    unsigned long long hash = fnvOffsetBasis;
+    HashFnv1a(hash, &occlusionCacheVersion, sizeof(occlusionCacheVersion));
+    HashFnv1a(hash, &mSettings.rays, sizeof(mSettings.rays));
+    HashFnv1a(hash, &mSettings.distance, sizeof(mSettings.distance));
+    HashFnv1a(hash, &vertexCount, sizeof(vertexCount));
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        //Not the occlusion, which is what gets baked
+        HashFnv1a(hash, &vertices[i].position, sizeof(vertices[i].position));
+        HashFnv1a(hash, &vertices[i].normal, sizeof(vertices[i].normal));
+    }
+    HashFnv1a(hash, indices, indexCount * sizeof(short));
+    return hash;
+}
+
+OcclusionBakeStats OcclusionBaker::Bake(VERTEX *vertices, size_t vertexCount, const short *indices, size_t indexCount, const MeshBvh &bvh, JobSystem *jobs)const
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    const unsigned long long key = ComputeKey(vertices, vertexCount, indices, indexCount);
+    if (Load(key, vertices, vertexCount))
+    {
+        OcclusionBakeStats stats;
+        stats.vertices = static_cast<unsigned int>(vertexCount);
+        stats.cached = true;
+        stats.average = AverageOcclusion(vertices, vertexCount);
+        stats.ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return stats;
+    }
+
+    OcclusionBakeStats stats = Trace(vertices, vertexCount, bvh, jobs);
+    Store(key, vertices, vertexCount);
+    stats.ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return stats;
+}
+
+OcclusionBakeStats OcclusionBaker::Trace(VERTEX *vertices, size_t vertexCount, const MeshBvh &bvh, JobSystem *jobs)const
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    //Distances scale with the mesh, so the same settings suit a pebble and a building
+    XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+    XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        const XMVECTOR position = XMLoadFloat3(&vertices[i].position);
+        boundsMin = XMVectorMin(boundsMin, position);
+        boundsMax = XMVectorMax(boundsMax, position);
+    }
+    const float diagonal = vertexCount > 0 ? XMVectorGetX(XMVector3Length(boundsMax - boundsMin)) : 0.0f;
+    const float maxDistance = mSettings.distance * diagonal;
+    const float bias = rayBias * diagonal;
+    const unsigned int rays = std::max(1u, mSettings.rays);
+
+    auto traceRange = [&](unsigned int begin, unsigned int end, unsigned int)
+    {
+        for (unsigned int i = begin; i < end; i++)
+        {
+            VERTEX &vertex = vertices[i];
+            const XMVECTOR normalLength = XMVector3Length(XMLoadFloat3(&vertex.normal));
+            if (bvh.IsEmpty() || XMVectorGetX(normalLength) < 1e-6f)
+            {
+                vertex.occlusion = 1.0f;
+                continue;
+            }
+
+            //Orthonormal basis around the normal without a branch on its direction
+            XMFLOAT3 n;
+            XMStoreFloat3(&n, XMVector3Normalize(XMLoadFloat3(&vertex.normal)));
+            const float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+            const float a = -1.0f / (sign + n.z);
+            const float b = n.x * n.y * a;
+            const XMVECTOR tangent = XMVectorSet(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x, 0.0f);
+            const XMVECTOR bitangent = XMVectorSet(b, sign + n.y * n.y * a, -n.y, 0.0f);
+            const XMVECTOR normal = XMLoadFloat3(&n);
+            const XMVECTOR origin = XMLoadFloat3(&vertex.position) + normal * bias;
+
+            //Hammersley points mapped to a cosine weighted hemisphere, so the share of rays
+            //that get out is the share of ambient light that reaches a diffuse surface
+            const float shiftU = HashToUnit(i * 2);
+            const float shiftV = HashToUnit(i * 2 + 1);
+            unsigned int open = 0;
+            for (unsigned int r = 0; r < rays; r++)
+            {
+                const float u = Wrap((r + 0.5f) / rays + shiftU);
+                const float v = Wrap(RadicalInverse(r) + shiftV);
+                const float radius = sqrtf(u);
+                const float angle = XM_2PI * v;
+                const XMVECTOR direction = tangent * (radius * cosf(angle)) + bitangent * (radius * sinf(angle)) + normal * sqrtf(1.0f - u);
+
+                //Step along the ray too, a vertex in a crease lies on the plane of the other side
+                open += bvh.IntersectAny(origin + direction * bias, direction, maxDistance - bias) ? 0 : 1;
+            }
+            vertex.occlusion = static_cast<float>(open) / rays;
+        }
+    };
+
+    const unsigned int count = static_cast<unsigned int>(vertexCount);
+    if (jobs)
+    {
+        jobs->ParallelFor(count, minVerticesPerJob, maxOcclusionJobs, traceRange);
+    }
+    else
+    {
+        traceRange(0, count, 0);
+    }
+
+    OcclusionBakeStats stats;
+    stats.vertices = count;
+    stats.rays = static_cast<unsigned long long>(count) * rays;
+    stats.average = AverageOcclusion(vertices, vertexCount);
+    stats.ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return stats;
+}
+
+const OcclusionBakeSettings &OcclusionBaker::GetSettings()const
+{
+    return mSettings;
+}
+
+std::string OcclusionBaker::GetCachePath(unsigned long long key)const
+{
+    return GetCacheFilePath(mDirectory, key, ".ao");
+}
+
+bool OcclusionBaker::Load(unsigned long long key, VERTEX *vertices, size_t vertexCount)const
+{
+    std::vector<unsigned char> occlusion;
+    if (!ReadKeyedFile(GetCachePath(key), occlusionCacheMagic, occlusionCacheVersion, key, occlusion) || occlusion.size() != vertexCount)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        vertices[i].occlusion = occlusion[i] * (1.0f / 255.0f);
+    }
+    return true;
+}
+
+void OcclusionBaker::Store(unsigned long long key, const VERTEX *vertices, size_t vertexCount)const
+{
+    std::vector<unsigned char> occlusion(vertexCount);
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        occlusion[i] = static_cast<unsigned char>(std::min(std::max(vertices[i].occlusion, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+    WriteKeyedFile(GetCachePath(key), occlusionCacheMagic, occlusionCacheVersion, key, occlusion.data(), occlusion.size());
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+
+#include "Assets.h"
+#include "JobSystem.h"
+#include "MeshBvh.h"
+
+struct OcclusionBakeSettings
+{
+    unsigned int rays = 128;            //Per vertex, cosine weighted over the hemisphere around its normal
+    float distance = 0.2f;              //Furthest a blocker counts, as a share of the mesh's bounding box diagonal
+};
+
+//What the last bake of a mesh did
+struct OcclusionBakeStats
+{
+    unsigned int vertices = 0;
+    unsigned long long rays = 0;
+    bool cached = false;                //Read back from the cache, nothing was traced
+    float average = 1.0f;               //Mean occlusion over the vertices
+    float ms = 0.0f;
+};
+
+//Ambient occlusion baked into the vertices of static meshes. Every vertex shoots rays over
+//the hemisphere around its normal at the mesh's own BVH, and the share that gets out is
+//stored in the vertex's occlusion, which the compact vertex format packs into the normal's
+//spare byte. Tracing is split over the job system. Results are kept on disk keyed by a hash
+//of the triangles and the settings, like the shader cache, so only an edited mesh is traced
+//again.
+class OcclusionBaker
+{
+public:
+    OcclusionBaker(const std::string &cacheDirectory, const OcclusionBakeSettings &settings = OcclusionBakeSettings());
+    ~OcclusionBaker();
+
+    //Hash of the positions, normals and indices, and of the settings
+    unsigned long long ComputeKey(const VERTEX *vertices, size_t vertexCount, const short *indices, size_t indexCount)const;
+
+    //Fills in the occlusion of every vertex from the cache, or traces it against a BVH of the
+    //same triangles and stores the result. Safe to call from several threads at once.
+    OcclusionBakeStats Bake(VERTEX *vertices, size_t vertexCount, const short *indices, size_t indexCount, const MeshBvh &bvh, JobSystem *jobs)const;
+
+    //Always traces and never touches the cache, jobs may be null
+    OcclusionBakeStats Trace(VERTEX *vertices, size_t vertexCount, const MeshBvh &bvh, JobSystem *jobs)const;
+
+    const OcclusionBakeSettings &GetSettings()const;
+
+private:
+    std::string GetCachePath(unsigned long long key)const;
+    bool Load(unsigned long long key, VERTEX *vertices, size_t vertexCount)const;
+    void Store(unsigned long long key, const VERTEX *vertices, size_t vertexCount)const;
+
+    std::string mDirectory;
+    OcclusionBakeSettings mSettings;
+};
@@ -0,0 +1,398 @@
+#include "OcclusionCuller.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define OCCLUSION_AVX2_PATH 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+//Vertices closer than this (in clip space w) are not rasterized, the occluder is just dropped
+const float nearClipW = 1e-3f;
+
+static float ElapsedMs(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static bool CpuHasAvx2()
+{
+#if defined(OCCLUSION_AVX2_PATH) && defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+
+    //The OS also has to save the upper halves of the ymm registers
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6)
+    {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif defined(OCCLUSION_AVX2_PATH)
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return false;
+#endif
+}
+
+//Triangle set up for rasterizing: three edge functions a*x + b*y + c and a depth plane
+struct TriangleSetup
+{
+    float a[3];
+    float b[3];
+    float c[3];
+    float z0, dzdx, dzdy;
+    int minX, maxX, minY, maxY;
+};
+
+static bool SetupTriangle(const XMFLOAT4 &p0, const XMFLOAT4 &q1, const XMFLOAT4 &q2, TriangleSetup &tri)
+{
+    //Make the winding consistent so inside is always where all edges are positive
+    float det = (q1.x - p0.x) * (q2.y - p0.y) - (q2.x - p0.x) * (q1.y - p0.y);
+    const bool flip = det < 0.0f;
+    const XMFLOAT4 &p1 = flip ? q2 : q1;
+    const XMFLOAT4 &p2 = flip ? q1 : q2;
+    det = fabsf(det);
+    if (det < 1e-6f)
+    {
+        return false;
+    }
+
+    const XMFLOAT4 *v[3] = { &p0, &p1, &p2 };
+    for (int e = 0; e < 3; e++)
+    {
+        const XMFLOAT4 &from = *v[e];
+        const XMFLOAT4 &to = *v[(e + 1) % 3];
+        tri.a[e] = -(to.y - from.y);
+        tri.b[e] = to.x - from.x;
+        tri.c[e] = -(tri.a[e] * from.x + tri.b[e] * from.y);
+    }
+
+    //z/w is linear in screen space, so a plane through the three vertices gives the depth
+    tri.dzdx = ((p1.z - p0.z) * (p2.y - p0.y) - (p2.z - p0.z) * (p1.y - p0.y)) / det;
+    tri.dzdy = ((p2.z - p0.z) * (p1.x - p0.x) - (p1.z - p0.z) * (p2.x - p0.x)) / det;
+    tri.z0 = p0.z - tri.dzdx * p0.x - tri.dzdy * p0.y;
+
+    const float minX = std::min(std::min(p0.x, p1.x), p2.x);
+    const float maxX = std::max(std::max(p0.x, p1.x), p2.x);
+    const float minY = std::min(std::min(p0.y, p1.y), p2.y);
+    const float maxY = std::max(std::max(p0.y, p1.y), p2.y);
+
+    tri.minX = std::max(static_cast<int>(floorf(minX)), 0);
+    tri.maxX = std::min(static_cast<int>(ceilf(maxX)), OcclusionCuller::Width - 1);
+    tri.minY = std::max(static_cast<int>(floorf(minY)), 0);
+    tri.maxY = std::min(static_cast<int>(ceilf(maxY)), OcclusionCuller::Height - 1);
+
+    return tri.minX <= tri.maxX && tri.minY <= tri.maxY;
+}
+
+static void RasterizeScalar(const TriangleSetup &tri, float *depth)
+{
+    for (int y = tri.minY; y <= tri.maxY; y++)
+    {
+        const float py = y + 0.5f;
+        float *row = depth + y * OcclusionCuller::Width;
+
+        for (int x = tri.minX; x <= tri.maxX; x++)
+        {
+            const float px = x + 0.5f;
+            const float e0 = tri.a[0] * px + tri.b[0] * py + tri.c[0];
+            const float e1 = tri.a[1] * px + tri.b[1] * py + tri.c[1];
+            const float e2 = tri.a[2] * px + tri.b[2] * py + tri.c[2];
+            if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f)
+            {
+                const float z = tri.z0 + tri.dzdx * px + tri.dzdy * py;
+                row[x] = std::min(row[x], z);
+            }
+        }
+    }
+}
+
+#if defined(OCCLUSION_AVX2_PATH)
+AVX2_TARGET static void RasterizeAvx2(const TriangleSetup &tri, float *depth)
+{
+    //Rows are walked in blocks of 8 pixels starting on an 8 pixel boundary
+    const int startX = tri.minX & ~7;
+    const __m256 laneOffsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+    const __m256 zero = _mm256_setzero_ps();
+
+    const __m256 a0 = _mm256_set1_ps(tri.a[0]);
+    const __m256 a1 = _mm256_set1_ps(tri.a[1]);
+    const __m256 a2 = _mm256_set1_ps(tri.a[2]);
+    const __m256 dzdx = _mm256_set1_ps(tri.dzdx);
+
+    for (int y = tri.minY; y <= tri.maxY; y++)
+    {
+        const float py = y + 0.5f;
+        float *row = depth + y * OcclusionCuller::Width;
+
+        //Everything that only depends on the row is folded into one constant per edge
+        const __m256 r0 = _mm256_set1_ps(tri.b[0] * py + tri.c[0]);
+        const __m256 r1 = _mm256_set1_ps(tri.b[1] * py + tri.c[1]);
+        const __m256 r2 = _mm256_set1_ps(tri.b[2] * py + tri.c[2]);
+        const __m256 rz = _mm256_set1_ps(tri.z0 + tri.dzdy * py);
+
+        for (int x = startX; x <= tri.maxX; x += 8)
+        {
+            const __m256 px = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), laneOffsets);
+            const __m256 e0 = _mm256_add_ps(_mm256_mul_ps(a0, px), r0);
+            const __m256 e1 = _mm256_add_ps(_mm256_mul_ps(a1, px), r1);
+            const __m256 e2 = _mm256_add_ps(_mm256_mul_ps(a2, px), r2);
+
+            const __m256 inside = _mm256_and_ps(_mm256_and_ps(
+                _mm256_cmp_ps(e0, zero, _CMP_GE_OQ),
+                _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)),
+                _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+            if (_mm256_movemask_ps(inside) == 0)
+            {
+                continue;
+            }
+
+            const __m256 z = _mm256_add_ps(_mm256_mul_ps(dzdx, px), rz);
+            const __m256 current = _mm256_loadu_ps(row + x);
+            const __m256 nearest = _mm256_min_ps(current, z);
+            _mm256_storeu_ps(row + x, _mm256_blendv_ps(current, nearest, inside));
+        }
+    }
+}
+#endif
+
+OcclusionCuller::OcclusionCuller() : mDepth(Width * Height, 1.0f),
+    mTileMax(TilesX * TilesY, 1.0f)
+{
+    mAvx2 = CpuHasAvx2();
+    XMStoreFloat4x4(&mViewProj, XMMatrixIdentity());
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+}
+
+void OcclusionCuller::BeginFrame(CXMMATRIX viewProj)
+{
+    XMStoreFloat4x4(&mViewProj, viewProj);
+    std::fill(mDepth.begin(), mDepth.end(), 1.0f);
+    std::fill(mTileMax.begin(), mTileMax.end(), 1.0f);
+    mStats = OcclusionStats();
+}
+
+void OcclusionCuller::RasterizeOccluder(const void *vertices, unsigned int stride, const short *indices, unsigned int indexCount, CXMMATRIX world)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    const XMMATRIX worldViewProj = XMMatrixMultiply(world, XMLoadFloat4x4(&mViewProj));
+
+    //Only transform the vertices the index list actually reaches
+    unsigned int vertexCount = 0;
+    for (unsigned int i = 0; i < indexCount; i++)
+    {
+        vertexCount = std::max(vertexCount, static_cast<unsigned int>(static_cast<unsigned short>(indices[i])) + 1);
+    }
+
+    mScreen.resize(vertexCount);
+    const unsigned char *bytes = static_cast<const unsigned char*>(vertices);
+    for (unsigned int i = 0; i < vertexCount; i++)
+    {
+        const XMFLOAT3 *position = reinterpret_cast<const XMFLOAT3*>(bytes + i * stride);
+        const XMVECTOR clip = XMVector3Transform(XMLoadFloat3(position), worldViewProj);
+
+        //Clip space to pixels, y grows downwards like the render target
+        XMFLOAT4 &out = mScreen[i];
+        XMStoreFloat4(&out, clip);
+        if (out.w > nearClipW)
+        {
+            const float invW = 1.0f / out.w;
+            out.x = (out.x * invW * 0.5f + 0.5f) * Width;
+            out.y = (0.5f - out.y * invW * 0.5f) * Height;
+            out.z = out.z * invW;
+        }
+    }
+
+    for (unsigned int i = 0; i + 2 < indexCount; i += 3)
+    {
+        const XMFLOAT4 &v0 = mScreen[static_cast<unsigned short>(indices[i + 0])];
+        const XMFLOAT4 &v1 = mScreen[static_cast<unsigned short>(indices[i + 1])];
+        const XMFLOAT4 &v2 = mScreen[static_cast<unsigned short>(indices[i + 2])];
+
+        //Triangles crossing the near plane are skipped, which only makes culling less aggressive
+        if (v0.w <= nearClipW || v1.w <= nearClipW || v2.w <= nearClipW)
+        {
+            continue;
+        }
+
+        RasterizeTriangle(v0, v1, v2);
+        mStats.occluderTriangles++;
+    }
+
+    mStats.rasterMs += ElapsedMs(start);
+}
+
+void OcclusionCuller::RasterizeTriangle(const XMFLOAT4 &v0, const XMFLOAT4 &v1, const XMFLOAT4 &v2)
+{
+    TriangleSetup tri = {};
+    if (!SetupTriangle(v0, v1, v2, tri))
+    {
+        return;
+    }
+
+#if defined(OCCLUSION_AVX2_PATH)
+    if (mAvx2)
+    {
+        RasterizeAvx2(tri, mDepth.data());
+        return;
+    }
+#endif
+
+    RasterizeScalar(tri, mDepth.data());
+}
+
+void OcclusionCuller::Finalize()
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    for (int ty = 0; ty < TilesY; ty++)
+    {
+        for (int tx = 0; tx < TilesX; tx++)
+        {
+            float farthest = 0.0f;
+            for (int y = 0; y < TileSize; y++)
+            {
+                const float *row = mDepth.data() + (ty * TileSize + y) * Width + tx * TileSize;
+                for (int x = 0; x < TileSize; x++)
+                {
+                    farthest = std::max(farthest, row[x]);
+                }
+            }
+            mTileMax[ty * TilesX + tx] = farthest;
+        }
+    }
+
+    mStats.rasterMs += ElapsedMs(start);
+}
+
+bool OcclusionCuller::IsVisible(const XMFLOAT3 &boundsMin, const XMFLOAT3 &boundsMax, CXMMATRIX world)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+    mStats.tested++;
+
+    const XMMATRIX worldViewProj = XMMatrixMultiply(world, XMLoadFloat4x4(&mViewProj));
+
+    //Project the 8 corners and keep their screen rectangle and nearest depth
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    float nearestZ = FLT_MAX;
+    int outside[6] = {};
+    for (int i = 0; i < 8; i++)
+    {
+        const XMVECTOR corner = XMVectorSet(
+            (i & 1) ? boundsMax.x : boundsMin.x,
+            (i & 2) ? boundsMax.y : boundsMin.y,
+            (i & 4) ? boundsMax.z : boundsMin.z, 1.0f);
+
+        XMFLOAT4 clip;
+        XMStoreFloat4(&clip, XMVector3Transform(corner, worldViewProj));
+
+        //Count corners outside each clip plane, all 8 outside one plane means off screen
+        outside[0] += clip.x < -clip.w;
+        outside[1] += clip.x > clip.w;
+        outside[2] += clip.y < -clip.w;
+        outside[3] += clip.y > clip.w;
+        outside[4] += clip.z < 0.0f;
+        outside[5] += clip.z > clip.w;
+
+        if (clip.w <= nearClipW)
+        {
+            //Box reaches behind the camera, can't be projected so treat it as covering everything
+            minX = 0.0f; minY = 0.0f; maxX = static_cast<float>(Width); maxY = static_cast<float>(Height);
+            nearestZ = 0.0f;
+            continue;
+        }
+
+        const float invW = 1.0f / clip.w;
+        const float sx = (clip.x * invW * 0.5f + 0.5f) * Width;
+        const float sy = (0.5f - clip.y * invW * 0.5f) * Height;
+        minX = std::min(minX, sx);
+        maxX = std::max(maxX, sx);
+        minY = std::min(minY, sy);
+        maxY = std::max(maxY, sy);
+        nearestZ = std::min(nearestZ, clip.z * invW);
+    }
+
+    for (int p = 0; p < 6; p++)
+    {
+        if (outside[p] == 8)
+        {
+            mStats.frustumCulled++;
+            mStats.testMs += ElapsedMs(start);
+            return false;
+        }
+    }
+
+    const int x0 = std::max(static_cast<int>(floorf(minX)), 0);
+    const int x1 = std::min(static_cast<int>(ceilf(maxX)), Width - 1);
+    const int y0 = std::max(static_cast<int>(floorf(minY)), 0);
+    const int y1 = std::min(static_cast<int>(ceilf(maxY)), Height - 1);
+
+    //Coarse pass: a tile whose farthest occluder is behind the box means we need to look closer
+    bool visible = false;
+    for (int ty = y0 / TileSize; ty <= y1 / TileSize && !visible; ty++)
+    {
+        for (int tx = x0 / TileSize; tx <= x1 / TileSize && !visible; tx++)
+        {
+            if (nearestZ > mTileMax[ty * TilesX + tx])
+            {
+                continue;
+            }
+
+            //Fine pass over the pixels of this tile the box covers
+            const int px0 = std::max(x0, tx * TileSize);
+            const int px1 = std::min(x1, tx * TileSize + TileSize - 1);
+            const int py0 = std::max(y0, ty * TileSize);
+            const int py1 = std::min(y1, ty * TileSize + TileSize - 1);
+            for (int y = py0; y <= py1 && !visible; y++)
+            {
+                const float *row = mDepth.data() + y * Width;
+                for (int x = px0; x <= px1; x++)
+                {
+                    if (nearestZ <= row[x])
+                    {
+                        visible = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    if (!visible)
+    {
+        mStats.occlusionCulled++;
+    }
+
+    mStats.testMs += ElapsedMs(start);
+    return visible;
+}
+
+bool OcclusionCuller::IsUsingAvx2()const
+{
+    return mAvx2;
+}
+
+const OcclusionStats& OcclusionCuller::GetStats()const
+{
+    return mStats;
+}
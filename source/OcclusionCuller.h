@@ -0,0 +1,59 @@
+#pragma once
+
+#include <directxmath.h>
+#include <vector>
+
+using namespace DirectX;
+
+//Per-frame culling numbers
+struct OcclusionStats
+{
+    unsigned int occluderTriangles = 0;
+    unsigned int tested = 0;
+    unsigned int frustumCulled = 0;
+    unsigned int occlusionCulled = 0;
+    float rasterMs = 0.0f;
+    float testMs = 0.0f;
+};
+
+//Masked software occlusion culling. Occluder triangles are rasterized into a small
+//CPU depth buffer (8 pixels at a time with AVX2 when the CPU has it), every 8x8 tile
+//keeps the farthest depth it holds and bounding boxes are tested against the tiles
+//before falling back to the pixels.
+class OcclusionCuller
+{
+public:
+    static const int Width = 256;
+    static const int Height = 128;
+    static const int TileSize = 8;
+    static const int TilesX = Width / TileSize;
+    static const int TilesY = Height / TileSize;
+
+    OcclusionCuller();
+    ~OcclusionCuller();
+
+    //Clear the depth buffer and remember the camera for this frame
+    void BeginFrame(CXMMATRIX viewProj);
+
+    //Rasterize an indexed triangle list, vertices only need a float3 position at offset 0
+    void RasterizeOccluder(const void *vertices, unsigned int stride, const short *indices, unsigned int indexCount, CXMMATRIX world);
+
+    //Build the tile depths, call once all occluders are in
+    void Finalize();
+
+    //False if the world space box is outside the frustum or hidden behind occluders
+    bool IsVisible(const XMFLOAT3 &boundsMin, const XMFLOAT3 &boundsMax, CXMMATRIX world);
+
+    bool IsUsingAvx2()const;
+    const OcclusionStats& GetStats()const;
+
+private:
+    void RasterizeTriangle(const XMFLOAT4 &v0, const XMFLOAT4 &v1, const XMFLOAT4 &v2);
+
+    std::vector<float> mDepth;      //Width*Height, cleared to the far plane
+    std::vector<float> mTileMax;    //Farthest depth in each tile
+    std::vector<XMFLOAT4> mScreen;  //Occluder vertices in screen space (x, y, z, w)
+    XMFLOAT4X4 mViewProj = {};
+    OcclusionStats mStats;
+    bool mAvx2 = false;
+};
@@ -0,0 +1,102 @@
+#include "OverdrawMeter.h"
+
+#include <assert.h>
+
+OverdrawMeter::OverdrawMeter()
+{
+}
+
+OverdrawMeter::~OverdrawMeter()
+{
+}
+
+void OverdrawMeter::Init(ID3D11Device *device)
+{
+    HRESULT hr = S_OK;
+
+    D3D11_QUERY_DESC depthDesc = {};
+    depthDesc.Query = D3D11_QUERY_OCCLUSION;
+    D3D11_QUERY_DESC shadingDesc = {};
+    shadingDesc.Query = D3D11_QUERY_PIPELINE_STATISTICS;
+
+    for (Frame &frame : mFrames)
+    {
+        hr = device->CreateQuery(&depthDesc, &frame.depth);
+        assert(SUCCEEDED(hr));
+        hr = device->CreateQuery(&shadingDesc, &frame.shading);
+        assert(SUCCEEDED(hr));
+        frame.pending = false;
+    }
+    mNext = 0;
+    mOldest = 0;
+}
+
+void OverdrawMeter::Shutdown()
+{
+    for (Frame &frame : mFrames)
+    {
+        if (frame.depth) frame.depth->Release();
+        if (frame.shading) frame.shading->Release();
+        frame = Frame();
+    }
+}
+
+void OverdrawMeter::BeginDepth(ID3D11DeviceContext *context)
+{
+    //If the GPU is more than Latency frames behind, the oldest measurement is dropped
+    Frame &frame = mFrames[mNext];
+    if (frame.pending && mOldest == mNext)
+    {
+        mOldest = (mOldest + 1) % Latency;
+    }
+    frame.pending = false;
+
+    context->Begin(frame.depth);
+}
+
+void OverdrawMeter::EndDepth(ID3D11DeviceContext *context)
+{
+    context->End(mFrames[mNext].depth);
+}
+
+void OverdrawMeter::BeginShading(ID3D11DeviceContext *context)
+{
+    context->Begin(mFrames[mNext].shading);
+}
+
+void OverdrawMeter::EndShading(ID3D11DeviceContext *context, unsigned int pixels)
+{
+    Frame &frame = mFrames[mNext];
+    context->End(frame.shading);
+    frame.pixels = pixels;
+    frame.pending = true;
+    mNext = (mNext + 1) % Latency;
+}
+
+bool OverdrawMeter::Collect(ID3D11DeviceContext *context, OverdrawSample &sample)
+{
+    //Frames finish in order, stop at the first one that isn't done
+    while (mFrames[mOldest].pending)
+    {
+        Frame &frame = mFrames[mOldest];
+
+        UINT64 depthSamples = 0;
+        D3D11_QUERY_DATA_PIPELINE_STATISTICS statistics = {};
+        if (context->GetData(frame.depth, &depthSamples, sizeof(depthSamples), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+            context->GetData(frame.shading, &statistics, sizeof(statistics), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+        {
+            return false;
+        }
+
+        frame.pending = false;
+        mOldest = (mOldest + 1) % Latency;
+
+        if (frame.pixels > 0)
+        {
+            sample.depth = static_cast<float>(static_cast<double>(depthSamples) / frame.pixels);
+            sample.shaded = static_cast<float>(static_cast<double>(statistics.PSInvocations) / frame.pixels);
+            return true;
+        }
+    }
+    return false;
+}
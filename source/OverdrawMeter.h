@@ -0,0 +1,51 @@
+#pragma once
+
+#include <d3d11.h>
+
+//Overdraw of one frame, per rendered pixel
+struct OverdrawSample
+{
+    float depth = 0.0f;         //Samples that passed the depth test while the depth buffer was laid down
+    float shaded = 0.0f;        //Pixel shader invocations of the shading pass
+};
+
+//Measures how often each pixel is written with an occlusion query around the pass that
+//lays down depth and a pipeline statistics query around the shading pass. Without a
+//depth pre-pass both cover the same draws and shaded follows depth, with one the shading
+//pass only runs the pixel shader about once a pixel while depth still tells how much
+//overdraw the pre-pass is saving. Like GpuTimer every frame has its own queries from a
+//small ring and Collect never waits for the GPU.
+class OverdrawMeter
+{
+public:
+    static const unsigned int Latency = 4;     //Frames a measurement may be in flight
+
+    OverdrawMeter();
+    ~OverdrawMeter();
+
+    void Init(ID3D11Device *device);
+    void Shutdown();
+
+    //Bracket the passes of one frame on the immediate context, the two may cover the same draws.
+    //EndShading closes the frame so it comes last, pixels is the size of the area rendered to.
+    void BeginDepth(ID3D11DeviceContext *context);
+    void EndDepth(ID3D11DeviceContext *context);
+    void BeginShading(ID3D11DeviceContext *context);
+    void EndShading(ID3D11DeviceContext *context, unsigned int pixels);
+
+    //Oldest finished measurement, call until it returns false to get every one
+    bool Collect(ID3D11DeviceContext *context, OverdrawSample &sample);
+
+private:
+    struct Frame
+    {
+        ID3D11Query *depth = nullptr;
+        ID3D11Query *shading = nullptr;
+        unsigned int pixels = 0;
+        bool pending = false;                   //Issued and not read back yet
+    };
+
+    Frame mFrames[Latency];
+    unsigned int mNext = 0;                     //Frame the next queries go to
+    unsigned int mOldest = 0;                   //Oldest frame that may still be pending
+};
@@ -0,0 +1,114 @@
+#include "ResolutionGovernor.h"
+
+#include <algorithm>
+#include <math.h>
+
+ResolutionGovernor::ResolutionGovernor()
+{
+    Reset(mSettings.maxScale);
+}
+
+ResolutionGovernor::ResolutionGovernor(const ResolutionGovernorSettings &settings) : mSettings(settings)
+{
+    Reset(mSettings.maxScale);
+}
+
+ResolutionGovernor::~ResolutionGovernor()
+{
+}
+
+void ResolutionGovernor::Reset(float scale)
+{
+    mScale = Quantize(std::min(std::max(scale, mSettings.minScale), mSettings.maxScale));
+    mAverageMs = 0.0f;
+    mCheapFrames = 0;
+    mSettling = 0;
+    mChanges = 0;
+}
+
+float ResolutionGovernor::Update(float frameMs)
+{
+    if (mAverageMs <= 0.0f)
+    {
+        mAverageMs = frameMs;
+    }
+    else
+    {
+        mAverageMs += mSettings.smoothing * (frameMs - mAverageMs);
+    }
+
+    //Frames still in flight were rendered at the old size
+    if (mSettling > 0)
+    {
+        mSettling--;
+        return mScale;
+    }
+
+    float wanted = mScale;
+    if (mAverageMs > mSettings.targetMs)
+    {
+        //Over budget, go straight to the size that fits
+        wanted = mScale * sqrtf(mSettings.targetMs / mAverageMs);
+        wanted = std::max(wanted, mScale - mSettings.maxStep);
+        mCheapFrames = 0;
+    }
+    else if (mAverageMs < mSettings.targetMs * mSettings.raiseBelow)
+    {
+        //Aim at the raise threshold rather than the target, so the next size still leaves headroom
+        if (++mCheapFrames >= mSettings.raiseFrames)
+        {
+            wanted = mScale * sqrtf(mSettings.targetMs * mSettings.raiseBelow / mAverageMs);
+            wanted = std::min(wanted, mScale + 0.5f * mSettings.maxStep);
+            mCheapFrames = 0;
+        }
+    }
+    else
+    {
+        mCheapFrames = 0;
+    }
+
+    wanted = Quantize(std::min(std::max(wanted, mSettings.minScale), mSettings.maxScale));
+    if (wanted != mScale)
+    {
+        //Expect the average to follow the pixel count until real frames at the new size arrive
+        mAverageMs *= (wanted * wanted) / (mScale * mScale);
+        mScale = wanted;
+        mSettling = mSettings.settleFrames;
+        mCheapFrames = 0;
+        mChanges++;
+    }
+
+    return mScale;
+}
+
+float ResolutionGovernor::GetScale()const
+{
+    return mScale;
+}
+
+float ResolutionGovernor::GetAverageMs()const
+{
+    return mAverageMs;
+}
+
+unsigned int ResolutionGovernor::GetChanges()const
+{
+    return mChanges;
+}
+
+const ResolutionGovernorSettings& ResolutionGovernor::GetSettings()const
+{
+    return mSettings;
+}
+
+//Rounds down to a whole step, so a scale only goes up once the larger size is known to fit
+float ResolutionGovernor::Quantize(float scale)const
+{
+    if (mSettings.scaleStep <= 0.0f)
+    {
+        return scale;
+    }
+
+    const float quantized = floorf(scale / mSettings.scaleStep + 0.001f) * mSettings.scaleStep;
+    return std::min(std::max(quantized, mSettings.minScale), mSettings.maxScale);
+}
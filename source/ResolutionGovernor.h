@@ -0,0 +1,52 @@
+#pragma once
+
+//How the governor trades resolution for frame time
+struct ResolutionGovernorSettings
+{
+    float targetMs = 1000.0f / 60.0f;   //Frame time to hold
+    float minScale = 0.5f;              //Render size relative to the window, per axis
+    float maxScale = 1.0f;
+    float smoothing = 0.15f;            //Weight of the newest frame in the running average
+    float raiseBelow = 0.85f;           //Average has to stay under targetMs times this before the scale goes up
+    unsigned int raiseFrames = 30;      //...for this many frames in a row
+    unsigned int settleFrames = 6;      //Frames ignored after a change while the new size reaches the GPU
+    float maxStep = 0.15f;              //Largest change of the scale at once
+    float scaleStep = 0.025f;           //Scales are rounded to this so tiny changes don't reallocate anything
+};
+
+//Picks the render resolution from measured frame times. It knows nothing about the
+//device or the clock: it is fed one frame time per frame and answers with the scale
+//to render the next frames at, so it can be driven by synthetic traces as well.
+//
+//GPU time grows about with the pixel count, so the scale that hits the target is
+//scale * sqrt(target / average). Going down happens as soon as the average is over
+//budget, going up only after a run of cheap frames and in smaller steps, so the
+//scale doesn't oscillate around the point where the frame just fits.
+class ResolutionGovernor
+{
+public:
+    ResolutionGovernor();
+    explicit ResolutionGovernor(const ResolutionGovernorSettings &settings);
+    ~ResolutionGovernor();
+
+    //Starts over at a scale, forgetting every measured frame
+    void Reset(float scale);
+
+    //Feeds the time of one finished frame in milliseconds and returns the scale for the next
+    float Update(float frameMs);
+
+    float GetScale()const;
+    float GetAverageMs()const;
+    unsigned int GetChanges()const;     //Scale changes since the last Reset
+    const ResolutionGovernorSettings& GetSettings()const;
+
+private:
+    float Quantize(float scale)const;
+
+    ResolutionGovernorSettings mSettings;
+    float mScale = 1.0f;
+    float mAverageMs = 0.0f;            //0 until the first frame comes in
+    unsigned int mCheapFrames = 0;      //Frames in a row under the raise threshold
+    unsigned int mSettling = 0;         //Frames left to ignore after a change
+    unsigned int mChanges = 0;
+};
@@ -0,0 +1,128 @@
+#include "ScratchArena.h"
+
+#include <algorithm>
+#include <stdint.h>
+
+#include "MemoryTelemetry.h"
+
+//Smallest block, loaders usually want a file's worth at once
+static const size_t MinBlockSize = 256 * 1024;
+
+ScratchArena::ScratchArena()
+{
+}
+
+ScratchArena::~ScratchArena()
+{
+    for (Block &block : mBlocks)
+    {
+        ::operator delete(block.memory);
+    }
+}
+
+void* ScratchArena::Allocate(size_t bytes, size_t alignment)
+{
+    RecordAllocation(MemoryTagScratch, bytes);
+
+    while (true)
+    {
+        if (mBlock < mBlocks.size())
+        {
+            const Block &block = mBlocks[mBlock];
+            const uintptr_t start = reinterpret_cast<uintptr_t>(block.memory);
+            const uintptr_t aligned = (start + mOffset + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+            if (aligned + bytes <= start + block.size)
+            {
+                mOffset = static_cast<size_t>(aligned + bytes - start);
+                return reinterpret_cast<void*>(aligned);
+            }
+
+            //Try the next block, it is kept from an earlier rewind
+            if (mBlock + 1 < mBlocks.size() && mBlocks[mBlock + 1].size >= bytes + alignment)
+            {
+                mBlock++;
+                mOffset = 0;
+                continue;
+            }
+        }
+
+        //Blocks after this one are too small to be of use, replace them with one that fits
+        const size_t keep = std::min(mBlocks.empty() ? 0 : mBlock + 1, mBlocks.size());
+        size_t size = std::max(MinBlockSize, bytes + alignment);
+        for (size_t i = keep; i < mBlocks.size(); i++)
+        {
+            size = std::max(size, mBlocks[i].size);
+            ::operator delete(mBlocks[i].memory);
+        }
+        mBlocks.resize(keep);
+        if (!mBlocks.empty())
+        {
+            size = std::max(size, mBlocks.back().size * 2);
+        }
+
+        Block block;
+        block.memory = static_cast<unsigned char*>(::operator new(size));
+        block.size = size;
+        mBlocks.push_back(block);
+        mBlock = mBlocks.size() - 1;
+        mOffset = 0;
+    }
+}
+
+ScratchMark ScratchArena::GetMark()const
+{
+    ScratchMark mark;
+    mark.block = mBlock;
+    mark.offset = mOffset;
+    return mark;
+}
+
+void ScratchArena::Rewind(const ScratchMark &mark)
+{
+    mBlock = mark.block;
+    mOffset = mark.offset;
+
+    //Fully rewound with several blocks: merge them into one so the next load fits in a single block
+    if (mBlock == 0 && mOffset == 0 && mBlocks.size() > 1)
+    {
+        size_t size = 0;
+        for (Block &block : mBlocks)
+        {
+            size += block.size;
+            ::operator delete(block.memory);
+        }
+        mBlocks.resize(1);
+        mBlocks[0].memory = static_cast<unsigned char*>(::operator new(size));
+        mBlocks[0].size = size;
+    }
+}
+
+size_t ScratchArena::GetCapacity()const
+{
+    size_t capacity = 0;
+    for (const Block &block : mBlocks)
+    {
+        capacity += block.size;
+    }
+    return capacity;
+}
+
+ScratchArena& GetThreadScratch()
+{
+    static thread_local ScratchArena scratch;
+    return scratch;
+}
+
+ScratchScope::ScratchScope(ScratchArena &arena) : mArena(arena), mMark(arena.GetMark())
+{
+}
+
+ScratchScope::~ScratchScope()
+{
+    mArena.Rewind(mMark);
+}
+
+ScratchArena& ScratchScope::GetArena()const
+{
+    return mArena;
+}
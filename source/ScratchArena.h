@@ -0,0 +1,80 @@
+#pragma once
+
+#include <new>
+#include <stddef.h>
+#include <type_traits>
+#include <vector>
+
+//Position in a ScratchArena to rewind to
+struct ScratchMark
+{
+    size_t block = 0;
+    size_t offset = 0;
+};
+
+//Growable bump allocator for temporary buffers of loaders. Used like a stack: take a
+//mark, allocate, rewind to the mark when done. Blocks are kept when the arena rewinds,
+//so a thread that loads one file after another stops touching the heap after the first.
+//Not thread safe, every thread has its own through GetThreadScratch.
+class ScratchArena
+{
+public:
+    ScratchArena();
+    ~ScratchArena();
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena &operator=(const ScratchArena&) = delete;
+
+    void* Allocate(size_t bytes, size_t alignment = 16);
+
+    //Default constructed array, only for types that don't need their destructor called
+    template<typename T>
+    T* AllocateArray(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Scratch memory is rewound without running destructors");
+        T *items = static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+        for (size_t i = 0; i < count; i++)
+        {
+            new (items + i) T();
+        }
+        return items;
+    }
+
+    ScratchMark GetMark()const;
+
+    //Frees everything allocated after the mark was taken
+    void Rewind(const ScratchMark &mark);
+
+    size_t GetCapacity()const;
+
+private:
+    struct Block
+    {
+        unsigned char *memory = nullptr;
+        size_t size = 0;
+    };
+
+    std::vector<Block> mBlocks;
+    size_t mBlock = 0;                  //Block allocations come from
+    size_t mOffset = 0;                 //Into that block
+};
+
+//The calling thread's scratch arena
+ScratchArena& GetThreadScratch();
+
+//Rewinds a scratch arena to where it was when the scope started
+class ScratchScope
+{
+public:
+    explicit ScratchScope(ScratchArena &arena = GetThreadScratch());
+    ~ScratchScope();
+
+    ScratchScope(const ScratchScope&) = delete;
+    ScratchScope &operator=(const ScratchScope&) = delete;
+
+    ScratchArena& GetArena()const;
+
+private:
+    ScratchArena &mArena;
+    ScratchMark mMark;
+};
@@ -0,0 +1,151 @@
+#include "ShaderCache.h"
+
+#include <fstream>
+#include <iterator>
+#include <mutex>
+
+#include "FileCache.h"
+
+//Bump when the blob format changes so old blobs stop matching, the compiler version is in the key
+const unsigned int shaderCacheVersion = 2;
+const unsigned int shaderBlobMagic = 0x43534750; //"PGSC"
+
+static void HashString(unsigned long long &hash, const std::string &text)
+{
+    //Hash the terminator too so "ab"+"c" and "a"+"bc" differ
+    HashFnv1a(hash, text.c_str(), text.size() + 1);
+}
+
+static bool ReadTextFile(const std::string &path, std::string &text)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+ShaderCache::ShaderCache(const std::string &cacheDirectory, const std::string &compilerVersion, ShaderCompileFn compile) :
+    mDirectory(cacheDirectory), mCompilerVersion(compilerVersion), mCompile(compile)
+{
+    CreateCacheDirectory(mDirectory);
+}
+
+ShaderCache::~ShaderCache()
+{
+}
+
+unsigned long long ShaderCache::ComputeKey(const std::string &source, const ShaderPermutation &permutation)const
+{
+    unsigned long long hash = fnvOffsetBasis;
+    HashFnv1a(hash, &shaderCacheVersion, sizeof(shaderCacheVersion));
+    HashString(hash, mCompilerVersion);
+    HashString(hash, source);
+    HashString(hash, permutation.entryPoint);
+    HashString(hash, permutation.profile);
+    for (const ShaderDefine &define : permutation.defines)
+    {
+        HashString(hash, define.name);
+        HashString(hash, define.value);
+    }
+    HashFnv1a(hash, &permutation.flags, sizeof(permutation.flags));
+    return hash;
+}
+
+bool ShaderCache::Get(const std::string &sourcePath, const ShaderPermutation &permutation, std::vector<unsigned char> &bytecode, std::string &errors)
+{
+    std::string source;
+    if (!ReadTextFile(sourcePath, source))
+    {
+        errors = "Can't open shader source " + sourcePath + "\n";
+        return false;
+    }
+
+    return GetFromSource(source, sourcePath, permutation, bytecode, errors);
+}
+
+bool ShaderCache::GetAll(JobSystem &jobs, const std::string &sourcePath, const std::vector<ShaderPermutation> &permutations,
+    std::vector<std::vector<unsigned char>> &bytecodes, std::string &errors)
+{
+    //Read the source once and share it between all permutations
+    std::string source;
+    if (!ReadTextFile(sourcePath, source))
+    {
+        errors = "Can't open shader source " + sourcePath + "\n";
+        return false;
+    }
+
+    bytecodes.clear();
+    bytecodes.resize(permutations.size());
+
+    std::mutex errorLock;
+    std::atomic<bool> succeeded{ true };
+    jobs.ParallelFor(static_cast<unsigned int>(permutations.size()), 1, static_cast<unsigned int>(permutations.size()),
+        [&](unsigned int begin, unsigned int end, unsigned int)
+        {
+            for (unsigned int i = begin; i < end; i++)
+            {
+                std::string permutationErrors;
+                if (!GetFromSource(source, sourcePath, permutations[i], bytecodes[i], permutationErrors))
+                {
+                    succeeded = false;
+                }
+
+                if (!permutationErrors.empty())
+                {
+                    std::lock_guard<std::mutex> guard(errorLock);
+                    errors += permutationErrors;
+                }
+            }
+        });
+
+    return succeeded;
+}
+
+unsigned int ShaderCache::GetHits()const
+{
+    return mHits;
+}
+
+unsigned int ShaderCache::GetMisses()const
+{
+    return mMisses;
+}
+
+bool ShaderCache::GetFromSource(const std::string &source, const std::string &sourcePath, const ShaderPermutation &permutation,
+    std::vector<unsigned char> &bytecode, std::string &errors)
+{
+    const unsigned long long key = ComputeKey(source, permutation);
+    if (LoadBlob(key, bytecode))
+    {
+        mHits++;
+        return true;
+    }
+
+    mMisses++;
+    if (!mCompile(source, sourcePath, permutation, bytecode, errors))
+    {
+        return false;
+    }
+
+    StoreBlob(key, bytecode);
+    return true;
+}
+
+std::string ShaderCache::GetBlobPath(unsigned long long key)const
+{
+    return GetCacheFilePath(mDirectory, key, ".cso");
+}
+
+bool ShaderCache::LoadBlob(unsigned long long key, std::vector<unsigned char> &bytecode)const
+{
+    return ReadKeyedFile(GetBlobPath(key), shaderBlobMagic, shaderCacheVersion, key, bytecode);
+}
+
+void ShaderCache::StoreBlob(unsigned long long key, const std::vector<unsigned char> &bytecode)const
+{
+    WriteKeyedFile(GetBlobPath(key), shaderBlobMagic, shaderCacheVersion, key, bytecode.data(), bytecode.size());
+}
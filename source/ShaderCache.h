@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "JobSystem.h"
+
+struct ShaderDefine
+{
+    std::string name;
+    std::string value;
+};
+
+//One compiled variant of a shader: entry point, target profile, defines and compile flags
+struct ShaderPermutation
+{
+    std::string entryPoint;
+    std::string profile;
+    std::vector<ShaderDefine> defines;
+    unsigned int flags = 0;
+};
+
+//Turns HLSL source into bytecode, returns false and fills errors when compilation fails
+typedef std::function<bool(const std::string &source, const std::string &sourceName, const ShaderPermutation &permutation,
+    std::vector<unsigned char> &bytecode, std::string &errors)> ShaderCompileFn;
+
+//Disk cache of compiled shader blobs. Blobs are keyed by a hash of the source text and
+//everything that changes the output, so an edited shader or a new define is simply a
+//miss. The compiler is passed in, which keeps this free of any D3D dependency, along
+//with a string naming its version so blobs from an updated compiler aren't reused.
+class ShaderCache
+{
+public:
+    ShaderCache(const std::string &cacheDirectory, const std::string &compilerVersion, ShaderCompileFn compile);
+    ~ShaderCache();
+
+    //Hash of the compiler version, the source and every input that affects the compiled bytecode
+    unsigned long long ComputeKey(const std::string &source, const ShaderPermutation &permutation)const;
+
+    //Load the bytecode for one permutation, compiling and storing it on a miss
+    bool Get(const std::string &sourcePath, const ShaderPermutation &permutation, std::vector<unsigned char> &bytecode, std::string &errors);
+
+    //Same for a list of permutations of one source file, misses are compiled in parallel
+    bool GetAll(JobSystem &jobs, const std::string &sourcePath, const std::vector<ShaderPermutation> &permutations,
+        std::vector<std::vector<unsigned char>> &bytecodes, std::string &errors);
+
+    unsigned int GetHits()const;
+    unsigned int GetMisses()const;
+
+private:
+    bool GetFromSource(const std::string &source, const std::string &sourcePath, const ShaderPermutation &permutation,
+        std::vector<unsigned char> &bytecode, std::string &errors);
+    std::string GetBlobPath(unsigned long long key)const;
+    bool LoadBlob(unsigned long long key, std::vector<unsigned char> &bytecode)const;
+    void StoreBlob(unsigned long long key, const std::vector<unsigned char> &bytecode)const;
+
+    std::string mDirectory;
+    std::string mCompilerVersion;
+    ShaderCompileFn mCompile;
+    std::atomic<unsigned int> mHits{ 0 };
+    std::atomic<unsigned int> mMisses{ 0 };
+};
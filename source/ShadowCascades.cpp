@@ -0,0 +1,324 @@
+#include "ShadowCascades.h"
+
+#include <assert.h>
+#include <math.h>
+
+#include <algorithm>
+
+#include "GpuResources.h"
+
+//Blend between logarithmic (1) and uniform (0) cascade splits
+const float splitLambda = 0.75f;
+
+static_assert(ShadowCascades::CascadeCount == 4, "The cascade splits are passed to the shader in one float4");
+
+//Cached cascades cover this much more than their slice so the camera can move a while
+const float cachePadding = 1.3f;
+
+ShadowCascades::ShadowCascades()
+{
+}
+
+ShadowCascades::~ShadowCascades()
+{
+    Shutdown();
+}
+
+void ShadowCascades::Init(ID3D11Device *device)
+{
+    //One depth slice per cascade, written as depth and read as a float texture
+    D3D11_TEXTURE2D_DESC textureDesc = {};
+    textureDesc.Width = Resolution;
+    textureDesc.Height = Resolution;
+    textureDesc.MipLevels = 1;
+    textureDesc.ArraySize = CascadeCount;
+    textureDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+    textureDesc.SampleDesc.Count = 1;
+    textureDesc.Usage = D3D11_USAGE_DEFAULT;
+    textureDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
+
+    HRESULT hr = device->CreateTexture2D(&textureDesc, nullptr, &mShadowMap);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(mShadowMap, GpuCategoryTarget, "shadow cascades");
+
+    //The static casters of the cached cascades, only ever copied from
+    textureDesc.ArraySize = CascadeCount - CachedCascades;
+    textureDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+    hr = device->CreateTexture2D(&textureDesc, nullptr, &mStaticCache);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(mStaticCache, GpuCategoryTarget, "shadow cascades");
+
+    D3D11_DEPTH_STENCIL_VIEW_DESC targetDesc = {};
+    targetDesc.Format = DXGI_FORMAT_D32_FLOAT;
+    targetDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
+    targetDesc.Texture2DArray.MipSlice = 0;
+    targetDesc.Texture2DArray.ArraySize = 1;
+    for (unsigned int i = 0; i < CascadeCount; i++)
+    {
+        targetDesc.Texture2DArray.FirstArraySlice = i;
+        hr = device->CreateDepthStencilView(mShadowMap, &targetDesc, &mCascadeTargets[i]);
+        assert(SUCCEEDED(hr));
+        TrackGpuResource(mCascadeTargets[i], GpuCategoryView, "shadow cascades");
+    }
+    for (unsigned int i = 0; i < CascadeCount - CachedCascades; i++)
+    {
+        targetDesc.Texture2DArray.FirstArraySlice = i;
+        hr = device->CreateDepthStencilView(mStaticCache, &targetDesc, &mCacheTargets[i]);
+        assert(SUCCEEDED(hr));
+        TrackGpuResource(mCacheTargets[i], GpuCategoryView, "shadow cascades");
+    }
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc = {};
+    viewDesc.Format = DXGI_FORMAT_R32_FLOAT;
+    viewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+    viewDesc.Texture2DArray.MostDetailedMip = 0;
+    viewDesc.Texture2DArray.MipLevels = 1;
+    viewDesc.Texture2DArray.FirstArraySlice = 0;
+    viewDesc.Texture2DArray.ArraySize = CascadeCount;
+    hr = device->CreateShaderResourceView(mShadowMap, &viewDesc, &mView);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(mView, GpuCategoryView, "shadow cascades");
+
+    //Hardware 2x2 comparison, anything outside a cascade counts as lit
+    D3D11_SAMPLER_DESC samplerDesc = {};
+    samplerDesc.Filter = D3D11_FILTER_COMPARISON_MIN_MAG_LINEAR_MIP_POINT;
+    samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_BORDER;
+    samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_BORDER;
+    samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_BORDER;
+    samplerDesc.ComparisonFunc = D3D11_COMPARISON_LESS_EQUAL;
+    samplerDesc.BorderColor[0] = 1.0f;
+    samplerDesc.BorderColor[1] = 1.0f;
+    samplerDesc.BorderColor[2] = 1.0f;
+    samplerDesc.BorderColor[3] = 1.0f;
+    samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+    hr = device->CreateSamplerState(&samplerDesc, &mSampler);
+    assert(SUCCEEDED(hr));
+
+    //Slope scaled bias keeps surfaces from shadowing themselves
+    D3D11_RASTERIZER_DESC rasterizerDesc = {};
+    rasterizerDesc.FillMode = D3D11_FILL_SOLID;
+    rasterizerDesc.CullMode = D3D11_CULL_BACK;
+    rasterizerDesc.DepthBias = 100;
+    rasterizerDesc.SlopeScaledDepthBias = 2.0f;
+    rasterizerDesc.DepthClipEnable = TRUE;
+    hr = device->CreateRasterizerState(&rasterizerDesc, &mRasterizerState);
+    assert(SUCCEEDED(hr));
+}
+
+void ShadowCascades::Shutdown()
+{
+    for (ID3D11DepthStencilView *&target : mCascadeTargets)
+    {
+        if (target) target->Release();
+        target = nullptr;
+    }
+    for (ID3D11DepthStencilView *&target : mCacheTargets)
+    {
+        if (target) target->Release();
+        target = nullptr;
+    }
+    if (mView) mView->Release();
+    if (mSampler) mSampler->Release();
+    if (mRasterizerState) mRasterizerState->Release();
+    if (mShadowMap) mShadowMap->Release();
+    if (mStaticCache) mStaticCache->Release();
+    mView = nullptr;
+    mSampler = nullptr;
+    mRasterizerState = nullptr;
+    mShadowMap = nullptr;
+    mStaticCache = nullptr;
+}
+
+void ShadowCascades::Update(const Camera &camera, FXMVECTOR lightDir, float shadowDistance)
+{
+    //Light space only rotates, so a new light direction is the only thing that changes it
+    XMFLOAT3 direction;
+    XMStoreFloat3(&direction, XMVector3Normalize(lightDir));
+    if (direction.x != mLightDir.x || direction.y != mLightDir.y || direction.z != mLightDir.z)
+    {
+        mLightDir = direction;
+        const XMVECTOR up = fabsf(direction.y) > 0.99f ? XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+        XMStoreFloat4x4(&mLightView, XMMatrixLookToLH(XMVectorZero(), XMLoadFloat3(&direction), up));
+        InvalidateStatic();
+    }
+    mCasterDepth = shadowDistance;
+
+    const float nearZ = camera.GetNearZ();
+    const float farZ = std::min(camera.GetFarZ(), shadowDistance);
+    const float tanX = tanf(0.5f * camera.GetFovX());
+    const float tanY = tanf(0.5f * camera.GetFovY());
+    const float corner = tanX * tanX + tanY * tanY;    //Squared distance of a frustum corner from the axis per unit of depth
+
+    const XMMATRIX lightView = XMLoadFloat4x4(&mLightView);
+    const XMVECTOR eye = camera.GetPositionXM();
+    const XMVECTOR look = camera.GetLookXM();
+
+    float splitNear = nearZ;
+    for (unsigned int i = 0; i < CascadeCount; i++)
+    {
+        const float fraction = static_cast<float>(i + 1) / CascadeCount;
+        const float splitFar = splitLambda * nearZ * powf(farZ / nearZ, fraction) + (1.0f - splitLambda) * (nearZ + (farZ - nearZ) * fraction);
+
+        //Smallest sphere around the slice with its center on the view axis. It only depends
+        //on the projection, so it keeps its size however the camera turns.
+        const float centerDepth = std::min(0.5f * (splitNear + splitFar) * (1.0f + corner), splitFar);
+        const float nearDistance = (centerDepth - splitNear) * (centerDepth - splitNear) + splitNear * splitNear * corner;
+        const float farDistance = (splitFar - centerDepth) * (splitFar - centerDepth) + splitFar * splitFar * corner;
+        const float radius = sqrtf(std::max(nearDistance, farDistance));
+        const XMVECTOR center = XMVector3TransformCoord(eye + look * centerDepth, lightView);
+
+        Cascade &cascade = mCascades[i];
+        cascade.splitFar = splitFar;
+        if (i < CachedCascades)
+        {
+            PlaceCascade(cascade, center, radius);
+        }
+        else
+        {
+            //Cached cascades stay where they are until the slice reaches their padding
+            const float paddedRadius = radius * cachePadding;
+            const float offset = XMVectorGetX(XMVector3Length(center - XMLoadFloat3(&cascade.center)));
+            if (!cascade.cacheValid || cascade.radius != paddedRadius || offset + radius > paddedRadius)
+            {
+                PlaceCascade(cascade, center, paddedRadius);
+                cascade.cacheValid = false;
+            }
+        }
+
+        splitNear = splitFar;
+    }
+}
+
+void ShadowCascades::InvalidateStatic()
+{
+    for (Cascade &cascade : mCascades)
+    {
+        cascade.cacheValid = false;
+    }
+}
+
+void ShadowCascades::Render(ID3D11DeviceContext *context, const DrawCasters &drawCasters)
+{
+    mStats = ShadowStats();
+
+    D3D11_VIEWPORT viewport = {};
+    viewport.Width = static_cast<float>(Resolution);
+    viewport.Height = static_cast<float>(Resolution);
+    viewport.MinDepth = 0.0f;
+    viewport.MaxDepth = 1.0f;
+    context->RSSetViewports(1, &viewport);
+    context->RSSetState(mRasterizerState);
+    context->PSSetShader(nullptr, nullptr, 0);
+
+    for (unsigned int i = 0; i < CascadeCount; i++)
+    {
+        Cascade &cascade = mCascades[i];
+        if (i < CachedCascades)
+        {
+            context->OMSetRenderTargets(0, nullptr, mCascadeTargets[i]);
+            context->ClearDepthStencilView(mCascadeTargets[i], D3D11_CLEAR_DEPTH, 1.0f, 0);
+            drawCasters(context, i, ShadowCastersAll);
+            mStats.cascadesRendered++;
+            continue;
+        }
+
+        const unsigned int cache = i - CachedCascades;
+        if (!cascade.cacheValid)
+        {
+            context->OMSetRenderTargets(0, nullptr, mCacheTargets[cache]);
+            context->ClearDepthStencilView(mCacheTargets[cache], D3D11_CLEAR_DEPTH, 1.0f, 0);
+            drawCasters(context, i, ShadowCastersStatic);
+            cascade.cacheValid = true;
+            mStats.cascadesRendered++;
+            mStats.staticRefreshes++;
+        }
+
+        //Start from the cached static depth and add what moves
+        context->OMSetRenderTargets(0, nullptr, nullptr);
+        context->CopySubresourceRegion(mShadowMap, D3D11CalcSubresource(0, i, 1), 0, 0, 0,
+            mStaticCache, D3D11CalcSubresource(0, cache, 1), nullptr);
+        context->OMSetRenderTargets(0, nullptr, mCascadeTargets[i]);
+        drawCasters(context, i, ShadowCastersDynamic);
+    }
+
+    context->OMSetRenderTargets(0, nullptr, nullptr);
+    context->RSSetState(nullptr);
+}
+
+XMMATRIX ShadowCascades::GetView(unsigned int cascade)const
+{
+    assert(cascade < CascadeCount);
+    return XMLoadFloat4x4(&mLightView);
+}
+
+XMMATRIX ShadowCascades::GetProjection(unsigned int cascade)const
+{
+    assert(cascade < CascadeCount);
+    return XMLoadFloat4x4(&mCascades[cascade].projection);
+}
+
+float ShadowCascades::GetTexelSize(unsigned int cascade)const
+{
+    assert(cascade < CascadeCount);
+    return 2.0f * mCascades[cascade].radius / Resolution;
+}
+
+bool ShadowCascades::Intersects(unsigned int cascade, FXMVECTOR center, float radius)const
+{
+    const Cascade &c = mCascades[cascade];
+    XMFLOAT3 p;
+    XMStoreFloat3(&p, XMVector3TransformCoord(center, XMLoadFloat4x4(&mLightView)));
+
+    return fabsf(p.x - c.center.x) <= c.radius + radius &&
+        fabsf(p.y - c.center.y) <= c.radius + radius &&
+        p.z + radius >= c.center.z - c.radius - mCasterDepth &&
+        p.z - radius <= c.center.z + c.radius;
+}
+
+void ShadowCascades::GetShaderConstants(XMMATRIX matrices[CascadeCount], XMFLOAT4 &splits, XMFLOAT4 &params)const
+{
+    //Clip space to texture space
+    const XMMATRIX toTexture = XMMatrixScaling(0.5f, -0.5f, 1.0f) * XMMatrixTranslation(0.5f, 0.5f, 0.0f);
+    const XMMATRIX lightView = XMLoadFloat4x4(&mLightView);
+    for (unsigned int i = 0; i < CascadeCount; i++)
+    {
+        matrices[i] = lightView * XMLoadFloat4x4(&mCascades[i].projection) * toTexture;
+    }
+
+    splits = XMFLOAT4(mCascades[0].splitFar, mCascades[1].splitFar, mCascades[2].splitFar, mCascades[3].splitFar);
+    params = XMFLOAT4(1.0f / Resolution, 0.0f, 0.0f, 0.0f);
+}
+
+ID3D11ShaderResourceView* ShadowCascades::GetShadowMapView()const
+{
+    return mView;
+}
+
+ID3D11SamplerState* ShadowCascades::GetSampler()const
+{
+    return mSampler;
+}
+
+const ShadowStats& ShadowCascades::GetStats()const
+{
+    return mStats;
+}
+
+//Orthographic projection around a light space sphere, moved in whole texels so the
+//shadow map samples the scene at the same spots from frame to frame
+void ShadowCascades::PlaceCascade(Cascade &cascade, FXMVECTOR lightSpaceCenter, float radius)
+{
+    const float texel = 2.0f * radius / Resolution;
+
+    XMFLOAT3 center;
+    XMStoreFloat3(&center, lightSpaceCenter);
+    center.x = floorf(center.x / texel) * texel;
+    center.y = floorf(center.y / texel) * texel;
+
+    cascade.center = center;
+    cascade.radius = radius;
+
+    //Casters up to the caster depth in front of the slice still throw shadows into it
+    XMStoreFloat4x4(&cascade.projection, XMMatrixOrthographicOffCenterLH(center.x - radius, center.x + radius,
+        center.y - radius, center.y + radius, center.z - radius - mCasterDepth, center.z + radius));
+}
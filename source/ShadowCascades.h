@@ -0,0 +1,104 @@
+#pragma once
+
+#include <d3d11.h>
+#include <directxmath.h>
+#include <functional>
+
+#include "Camera.h"
+
+using namespace DirectX;
+
+//Which casters a render callback should draw into a cascade
+enum ShadowCasterSet
+{
+    ShadowCastersAll,
+    ShadowCastersStatic,
+    ShadowCastersDynamic
+};
+
+//Shadow work of the last frame
+struct ShadowStats
+{
+    unsigned int cascadesRendered = 0;  //Cascades whose depth was cleared and drawn this frame
+    unsigned int staticRefreshes = 0;   //Cached cascades that had to draw their static casters again
+};
+
+//Cascaded shadow maps for the directional light. The camera frustum up to the shadow
+//distance is cut into CascadeCount slices (half logarithmic, half uniform splits) and
+//every slice gets an orthographic light projection around its bounding sphere. The
+//sphere keeps its size while the camera turns and its center is snapped to whole
+//shadow map texels, so shadow edges don't crawl when the camera moves.
+//
+//Cascades from CachedCascades on keep their static casters in a cache that is only
+//drawn again when the light or the static content changes, or when the camera leaves
+//the padding around the cached area. Every frame they just copy the cache and draw
+//the dynamic casters on top.
+class ShadowCascades
+{
+public:
+    static const unsigned int CascadeCount = 4;
+    static const unsigned int CachedCascades = 2;       //First cascade that is cached
+    static const unsigned int Resolution = 2048;
+
+    //Draws casters with the cascade's view and projection, all pipeline state but the
+    //shaders, input layout and constants is already set up
+    typedef std::function<void(ID3D11DeviceContext *context, unsigned int cascade, ShadowCasterSet casters)> DrawCasters;
+
+    ShadowCascades();
+    ~ShadowCascades();
+
+    void Init(ID3D11Device *device);
+    void Shutdown();
+
+    //Fits the cascades to the camera frustum up to shadowDistance, lightDir points away from the light
+    void Update(const Camera &camera, FXMVECTOR lightDir, float shadowDistance);
+
+    //Static casters moved or changed, the cached cascades draw them again next frame
+    void InvalidateStatic();
+
+    //Renders every cascade into the shadow map, leaves no render targets bound
+    void Render(ID3D11DeviceContext *context, const DrawCasters &drawCasters);
+
+    XMMATRIX GetView(unsigned int cascade)const;
+    XMMATRIX GetProjection(unsigned int cascade)const;
+
+    //World space size of one shadow map texel, the same everywhere in a cascade
+    float GetTexelSize(unsigned int cascade)const;
+
+    //False if a world space sphere is outside a cascade's light volume
+    bool Intersects(unsigned int cascade, FXMVECTOR center, float radius)const;
+
+    //Shader constants: world to shadow map texture space per cascade, the view depth
+    //where every cascade ends, and the size of one texel in x
+    void GetShaderConstants(XMMATRIX matrices[CascadeCount], XMFLOAT4 &splits, XMFLOAT4 &params)const;
+
+    ID3D11ShaderResourceView* GetShadowMapView()const;
+    ID3D11SamplerState* GetSampler()const;
+    const ShadowStats& GetStats()const;
+
+private:
+    struct Cascade
+    {
+        XMFLOAT3 center = {};           //Light space, snapped to texels
+        float radius = 0.0f;
+        float splitFar = 0.0f;          //View depth where the cascade ends
+        XMFLOAT4X4 projection = {};
+        bool cacheValid = false;        //Cached cascades only
+    };
+
+    void PlaceCascade(Cascade &cascade, FXMVECTOR lightSpaceCenter, float radius);
+
+    ID3D11Texture2D *mShadowMap = nullptr;
+    ID3D11Texture2D *mStaticCache = nullptr;
+    ID3D11DepthStencilView *mCascadeTargets[CascadeCount] = {};
+    ID3D11DepthStencilView *mCacheTargets[CascadeCount - CachedCascades] = {};
+    ID3D11ShaderResourceView *mView = nullptr;
+    ID3D11SamplerState *mSampler = nullptr;
+    ID3D11RasterizerState *mRasterizerState = nullptr;
+
+    Cascade mCascades[CascadeCount];
+    XMFLOAT4X4 mLightView = {};         //Rotation only, shared by every cascade
+    XMFLOAT3 mLightDir = {};
+    float mCasterDepth = 0.0f;          //How far behind a cascade casters are still caught
+    ShadowStats mStats;
+};
@@ -0,0 +1,93 @@
+#include "Assets.h"
+
+#include <string.h>
+
+#include "AssetArchive.h"
+
+//Struct for the targa texture file
+struct TargaHeader
+{
+    unsigned char data1[12];
+    unsigned short width;
+    unsigned short height;
+    unsigned char bpp;
+    unsigned char data2;
+};
+
+
+bool LoadTarga(const char* filename, TextureData& texture)
+{
+    TargaHeader targaFileHeader = {};
+    const unsigned char* targaImage = nullptr;
+
+    //Mapped from the asset archive or the loose file, nothing is copied before the swizzle below
+    AssetFile file;
+
+
+    // Open the targa file for reading.
+    if (!file.Open(filename))
+    {
+        return false;
+    }
+
+    // Read in the file header.
+    if (file.GetSize() < sizeof(TargaHeader))
+    {
+        return false;
+    }
+    memcpy(&targaFileHeader, file.GetData(), sizeof(TargaHeader));
+
+    // Get the important information from the header.
+    const int height = (int)targaFileHeader.height;
+    const int width = (int)targaFileHeader.width;
+    const int bpp = (int)targaFileHeader.bpp;
+
+    // Check that it is 32 bit and not 24 bit.
+    if (bpp != 32)
+    {
+        return false;
+    }
+
+    // Calculate the size of the 32 bit image data.
+    int imageSize = width * height * 4;
+
+    // Point at the targa image data.
+    if (file.GetSize() - sizeof(TargaHeader) < static_cast<size_t>(imageSize))
+    {
+        return false;
+    }
+    targaImage = file.GetData() + sizeof(TargaHeader);
+
+    // Allocate memory for the targa destination data.
+    texture.width = width;
+    texture.height = height;
+    texture.pixels.resize(imageSize);
+    unsigned char* targaData = texture.pixels.data();
+
+    // Initialize the index into the targa destination data array.
+    int index = 0;
+
+    // Initialize the index into the targa image data.
+    int k = (width * height * 4) - (width * 4);
+
+    // Now copy the targa image data into the targa destination array in the correct order since the targa format is stored upside down.
+    for (int j = 0; j<height; j++)
+    {
+        for (int i = 0; i<width; i++)
+        {
+            targaData[index + 0] = targaImage[k + 2];  // Red.
+            targaData[index + 1] = targaImage[k + 1];  // Green.
+            targaData[index + 2] = targaImage[k + 0];  // Blue
+            targaData[index + 3] = targaImage[k + 3];  // Alpha
+
+                                                         // Increment the indexes into the targa data.
+            k += 4;
+            index += 4;
+        }
+
+        // Set the targa image data index back to the preceding row at the beginning of the column since its reading it in upside down.
+        k -= (width * 8);
+    }
+
+    return true;
+}
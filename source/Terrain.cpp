@@ -0,0 +1,651 @@
+#include "Terrain.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "FileCache.h"
+#include "GpuResources.h"
+#include "ScratchArena.h"
+#include "VertexFormat.h"
+
+//Bump when the height file layout changes so old files get regenerated
+const unsigned int heightFileVersion = 2;
+const unsigned int heightFileMagic = 0x48544750; //"PGTH"
+
+//Edges of a chunk that meet a coarser neighbour, bits of the lod index
+const unsigned int EdgeMinX = 1;
+const unsigned int EdgeMaxX = 2;
+const unsigned int EdgeMinZ = 4;
+const unsigned int EdgeMaxZ = 8;
+const unsigned int EdgeCombinations = 16;
+
+static float Hash(int x, int z, unsigned int seed)
+{
+    unsigned int h = static_cast<unsigned int>(x) * 374761393u + static_cast<unsigned int>(z) * 668265263u + seed * 2246822519u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    h ^= h >> 16;
+    return (h & 0xffffff) / 16777216.0f;
+}
+
+//Smoothly interpolated random values on the integer grid
+static float ValueNoise(float x, float z, unsigned int seed)
+{
+    const float fx = floorf(x);
+    const float fz = floorf(z);
+    const int ix = static_cast<int>(fx);
+    const int iz = static_cast<int>(fz);
+    float tx = x - fx;
+    float tz = z - fz;
+    tx = tx * tx * (3.0f - 2.0f * tx);
+    tz = tz * tz * (3.0f - 2.0f * tz);
+
+    const float a = Hash(ix, iz, seed);
+    const float b = Hash(ix + 1, iz, seed);
+    const float c = Hash(ix, iz + 1, seed);
+    const float d = Hash(ix + 1, iz + 1, seed);
+    return (a + (b - a) * tx) + ((c + (d - c) * tx) - (a + (b - a) * tx)) * tz;
+}
+
+//Height files are keyed by the generator settings they were made with, a mismatch means one is stale
+static unsigned long long GetHeightKey(const TerrainSettings &settings)
+{
+    const unsigned int samples = settings.chunkQuads + 3;      //Along a side, a chunk plus one sample of its neighbours all around
+    unsigned long long key = fnvOffsetBasis;
+    HashFnv1a(key, &samples, sizeof(samples));
+    HashFnv1a(key, &settings.seed, sizeof(settings.seed));
+    HashFnv1a(key, &settings.quadSize, sizeof(settings.quadSize));
+    HashFnv1a(key, &settings.baseHeight, sizeof(settings.baseHeight));
+    HashFnv1a(key, &settings.heightScale, sizeof(settings.heightScale));
+    HashFnv1a(key, &settings.featureSize, sizeof(settings.featureSize));
+    HashFnv1a(key, &settings.flatRadius, sizeof(settings.flatRadius));
+    return key;
+}
+
+Terrain::Terrain()
+{
+}
+
+Terrain::~Terrain()
+{
+}
+
+void Terrain::Init(ID3D11Device *device, JobSystem *jobs, const TerrainSettings &settings, const std::string &cacheDirectory)
+{
+    mSettings = settings;
+    mDevice = device;
+    mJobs = jobs;
+    mDirectory = cacheDirectory;
+    CreateCacheDirectory(mDirectory);
+
+    const unsigned int quads = mSettings.chunkQuads;
+    assert((quads & (quads - 1)) == 0 && "Chunk quads have to be a power of two");
+    assert(mSettings.levelCount >= 1 && mSettings.levelCount <= 8 && (quads >> (mSettings.levelCount - 1)) >= 2);
+    assert((quads + 1) * (quads + 1) <= 32768 && "Chunk vertices have to fit 16 bit indices");
+    assert(mSettings.occluderLevel < mSettings.levelCount);
+
+    mChunkSize = quads * mSettings.quadSize;
+    mWindowRadius = static_cast<int>(ceilf(mSettings.streamRadius / mChunkSize)) + 1;
+
+    const size_t windowSize = static_cast<size_t>(2 * mWindowRadius + 1) * (2 * mWindowRadius + 1);
+    mWindowSlots.resize(windowSize);
+    mWindowLevels.resize(windowSize);
+    mWanted.reserve(windowSize);
+    mDraws.reserve(windowSize);
+    mLoading.reserve(mSettings.maxLoadsInFlight);
+
+    //Every level with every combination of stitched edges, shared by all chunks
+    std::vector<short> indices;
+    BuildIndices(indices);
+
+    D3D11_BUFFER_DESC indexDesc = {};
+    indexDesc.Usage = D3D11_USAGE_IMMUTABLE;
+    indexDesc.ByteWidth = static_cast<UINT>(indices.size() * sizeof(short));
+    indexDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+    D3D11_SUBRESOURCE_DATA indexData = {};
+    indexData.pSysMem = indices.data();
+
+    HRESULT hr = mDevice->CreateBuffer(&indexDesc, &indexData, &mIndexBuffer);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(mIndexBuffer, GpuCategoryIndex, "terrain");
+    BuildOccluderIndices();
+
+    //Enough slots for every chunk that can be in range at once
+    D3D11_BUFFER_DESC vertexDesc = {};
+    vertexDesc.Usage = D3D11_USAGE_DEFAULT;
+    vertexDesc.ByteWidth = (quads + 1) * (quads + 1) * SceneVertexFormat::Stride;
+    vertexDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+
+    const unsigned int occluderSide = (quads >> mSettings.occluderLevel) + 1;
+    mSlots.resize(windowSize);
+    for (Slot &slot : mSlots)
+    {
+        hr = mDevice->CreateBuffer(&vertexDesc, nullptr, &slot.buffer);
+        assert(SUCCEEDED(hr));
+        TrackGpuResource(slot.buffer, GpuCategoryVertex, "terrain");
+        slot.occluder.resize(occluderSide * occluderSide);
+    }
+
+    mStats = TerrainStats();
+    mStats.slots = static_cast<unsigned int>(mSlots.size());
+    mStats.residentBytes = static_cast<unsigned long long>(vertexDesc.ByteWidth) * mSlots.size() + indexDesc.ByteWidth;
+}
+
+void Terrain::Shutdown()
+{
+    if (mJobs)
+    {
+        mJobs->Wait(mLoadJobs);
+    }
+    mFinishedLoads.clear();
+    mApplying.clear();
+    mLoading.clear();
+
+    for (Slot &slot : mSlots)
+    {
+        if (slot.buffer) slot.buffer->Release();
+    }
+    mSlots.clear();
+
+    if (mIndexBuffer) mIndexBuffer->Release();
+    mIndexBuffer = nullptr;
+    mLods.clear();
+    mOccluderIndices.clear();
+    mDraws.clear();
+}
+
+void Terrain::Update(ID3D11DeviceContext *context, FXMVECTOR eye)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    {
+        std::lock_guard<std::mutex> guard(mLoadLock);
+        mApplying.swap(mFinishedLoads);
+    }
+
+    mStats.uploaded = 0;
+    for (const ChunkLoad &load : mApplying)
+    {
+        mLoading.erase(std::find(mLoading.begin(), mLoading.end(), load.chunk));
+        ApplyLoad(context, load, eye);
+    }
+    mApplying.clear();
+
+    //Resident chunks in range go into the window around the camera's chunk, with the level their distance asks for
+    const int side = 2 * mWindowRadius + 1;
+    const int cornerX = static_cast<int>(floorf(XMVectorGetX(eye) / mChunkSize + mSettings.chunksX * 0.5f)) - mWindowRadius;
+    const int cornerZ = static_cast<int>(floorf(XMVectorGetZ(eye) / mChunkSize + mSettings.chunksZ * 0.5f)) - mWindowRadius;
+    std::fill(mWindowSlots.begin(), mWindowSlots.end(), -1);
+    std::fill(mWindowLevels.begin(), mWindowLevels.end(), static_cast<unsigned char>(0xff));
+
+    mStats.resident = 0;
+    for (size_t s = 0; s < mSlots.size(); s++)
+    {
+        const Slot &slot = mSlots[s];
+        if (slot.chunk < 0)
+        {
+            continue;
+        }
+        mStats.resident++;
+
+        const int x = slot.chunk % static_cast<int>(mSettings.chunksX) - cornerX;
+        const int z = slot.chunk / static_cast<int>(mSettings.chunksX) - cornerZ;
+        if (x >= 0 && x < side && z >= 0 && z < side && GetStreamDistance(slot.chunk, eye) <= mSettings.streamRadius)
+        {
+            mWindowSlots[z * side + x] = static_cast<int>(s);
+            mWindowLevels[z * side + x] = static_cast<unsigned char>(GetLevel(GetDistance(slot.chunk, slot.boundsMin.y, slot.boundsMax.y, eye)));
+        }
+    }
+
+    //Load the missing chunks in range, nearest first
+    mWanted.clear();
+    for (int z = 0; z < side; z++)
+    {
+        for (int x = 0; x < side; x++)
+        {
+            const int chunkX = cornerX + x;
+            const int chunkZ = cornerZ + z;
+            if (chunkX < 0 || chunkZ < 0 || chunkX >= static_cast<int>(mSettings.chunksX) || chunkZ >= static_cast<int>(mSettings.chunksZ) ||
+                mWindowSlots[z * side + x] >= 0)
+            {
+                continue;
+            }
+
+            const unsigned int chunk = chunkZ * mSettings.chunksX + chunkX;
+            const float distance = GetStreamDistance(chunk, eye);
+            if (distance <= mSettings.streamRadius && std::find(mLoading.begin(), mLoading.end(), chunk) == mLoading.end())
+            {
+                mWanted.push_back(std::make_pair(distance, chunk));
+            }
+        }
+    }
+
+    const size_t starts = std::min(mWanted.size(), mSettings.maxLoadsInFlight - std::min<size_t>(mLoading.size(), mSettings.maxLoadsInFlight));
+    std::partial_sort(mWanted.begin(), mWanted.begin() + starts, mWanted.end());
+    for (size_t i = 0; i < starts; i++)
+    {
+        StartLoad(mWanted[i].second);
+    }
+
+    //Neighbours may only be one level apart, pull chunks next to much finer ones down until nothing changes
+    const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+    for (unsigned int pass = 0; pass < mSettings.levelCount; pass++)
+    {
+        bool changed = false;
+        for (int z = 0; z < side; z++)
+        {
+            for (int x = 0; x < side; x++)
+            {
+                unsigned char &level = mWindowLevels[z * side + x];
+                if (level == 0xff)
+                {
+                    continue;
+                }
+
+                for (const int *offset : offsets)
+                {
+                    const int nx = x + offset[0];
+                    const int nz = z + offset[1];
+                    if (nx < 0 || nz < 0 || nx >= side || nz >= side)
+                    {
+                        continue;
+                    }
+
+                    const unsigned char neighbour = mWindowLevels[nz * side + nx];
+                    if (neighbour != 0xff && level > neighbour + 1)
+                    {
+                        level = static_cast<unsigned char>(neighbour + 1);
+                        changed = true;
+                    }
+                }
+            }
+        }
+        if (!changed)
+        {
+            break;
+        }
+    }
+
+    //Stitch every edge that meets a coarser neighbour
+    mDraws.clear();
+    mStats.drawn = 0;
+    mStats.triangles = 0;
+    std::fill(std::begin(mStats.levelChunks), std::end(mStats.levelChunks), 0u);
+    const unsigned int edges[4] = { EdgeMinX, EdgeMaxX, EdgeMinZ, EdgeMaxZ };
+    for (int z = 0; z < side; z++)
+    {
+        for (int x = 0; x < side; x++)
+        {
+            const int s = mWindowSlots[z * side + x];
+            if (s < 0)
+            {
+                continue;
+            }
+
+            const unsigned char level = mWindowLevels[z * side + x];
+            unsigned int mask = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                const int nx = x + offsets[i][0];
+                const int nz = z + offsets[i][1];
+                if (nx >= 0 && nz >= 0 && nx < side && nz < side)
+                {
+                    const unsigned char neighbour = mWindowLevels[nz * side + nx];
+                    if (neighbour != 0xff && neighbour > level)
+                    {
+                        mask |= edges[i];
+                    }
+                }
+            }
+
+            TerrainDraw draw;
+            draw.slot = static_cast<unsigned int>(s);
+            draw.lod = level * EdgeCombinations + mask;
+            draw.boundsMin = mSlots[s].boundsMin;
+            draw.boundsMax = mSlots[s].boundsMax;
+            mDraws.push_back(draw);
+
+            mStats.drawn++;
+            mStats.triangles += mLods[draw.lod].indexCount / 3;
+            mStats.levelChunks[level]++;
+        }
+    }
+
+    mStats.pendingLoads = static_cast<unsigned int>(mLoading.size());
+    mStats.ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+const std::vector<TerrainDraw> &Terrain::GetDraws()const
+{
+    return mDraws;
+}
+
+unsigned int Terrain::GetSlotCount()const
+{
+    return static_cast<unsigned int>(mSlots.size());
+}
+
+ID3D11Buffer *Terrain::GetVertexBuffer(unsigned int slot)const
+{
+    return mSlots[slot].buffer;
+}
+
+unsigned int Terrain::GetChunkVertexCount()const
+{
+    return (mSettings.chunkQuads + 1) * (mSettings.chunkQuads + 1);
+}
+
+ID3D11Buffer *Terrain::GetIndexBuffer()const
+{
+    return mIndexBuffer;
+}
+
+const std::vector<MeshLod> &Terrain::GetLods()const
+{
+    return mLods;
+}
+
+const std::vector<XMFLOAT3> &Terrain::GetOccluderPositions(unsigned int slot)const
+{
+    return mSlots[slot].occluder;
+}
+
+const std::vector<short> &Terrain::GetOccluderIndices()const
+{
+    return mOccluderIndices;
+}
+
+const TerrainStats &Terrain::GetStats()const
+{
+    return mStats;
+}
+
+float Terrain::GetGeneratedHeight(float x, float z)const
+{
+    //Octaves of value noise, the first one as wide as the largest hills
+    float height = 0.0f;
+    float amplitude = 1.0f;
+    float total = 0.0f;
+    float frequency = 1.0f / mSettings.featureSize;
+    for (unsigned int octave = 0; octave < 5; octave++)
+    {
+        height += amplitude * ValueNoise(x * frequency, z * frequency, mSettings.seed + octave);
+        total += amplitude;
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+
+    //Rises out of the flat middle over one feature size
+    float rise = std::min(std::max((sqrtf(x * x + z * z) - mSettings.flatRadius) / mSettings.featureSize, 0.0f), 1.0f);
+    rise = rise * rise * (3.0f - 2.0f * rise);
+    return mSettings.baseHeight + rise * mSettings.heightScale * height / total;
+}
+
+//Level 0 is the full grid, each level after it uses every other vertex of the one before.
+//On an edge that meets a coarser chunk the odd vertices are snapped onto the even one
+//before them, so the edge matches the neighbour's; triangles that collapse are left out.
+void Terrain::BuildIndices(std::vector<short> &indices)
+{
+    const unsigned int quads = mSettings.chunkQuads;
+    mLods.clear();
+
+    for (unsigned int level = 0; level < mSettings.levelCount; level++)
+    {
+        const unsigned int step = 1u << level;
+        for (unsigned int mask = 0; mask < EdgeCombinations; mask++)
+        {
+            auto vertex = [quads, step, mask](unsigned int x, unsigned int z)
+            {
+                if (((x == 0 && (mask & EdgeMinX)) || (x == quads && (mask & EdgeMaxX))) && (z / step) % 2 == 1)
+                {
+                    z -= step;
+                }
+                if (((z == 0 && (mask & EdgeMinZ)) || (z == quads && (mask & EdgeMaxZ))) && (x / step) % 2 == 1)
+                {
+                    x -= step;
+                }
+                return static_cast<short>(z * (quads + 1) + x);
+            };
+            auto triangle = [&indices](short a, short b, short c)
+            {
+                if (a != b && b != c && a != c)
+                {
+                    indices.push_back(a);
+                    indices.push_back(b);
+                    indices.push_back(c);
+                }
+            };
+
+            MeshLod lod;
+            lod.indexOffset = static_cast<unsigned int>(indices.size());
+            lod.error = mSettings.quadSize * (step - 1);
+            for (unsigned int z = 0; z < quads; z += step)
+            {
+                for (unsigned int x = 0; x < quads; x += step)
+                {
+                    const short v00 = vertex(x, z);
+                    const short v10 = vertex(x + step, z);
+                    const short v01 = vertex(x, z + step);
+                    const short v11 = vertex(x + step, z + step);
+                    triangle(v00, v01, v11);
+                    triangle(v00, v11, v10);
+                }
+            }
+            lod.indexCount = static_cast<unsigned int>(indices.size()) - lod.indexOffset;
+            mLods.push_back(lod);
+        }
+    }
+}
+
+//A plain grid at the occluder level, no stitching: a crack between chunks only hides less
+void Terrain::BuildOccluderIndices()
+{
+    const unsigned int side = (mSettings.chunkQuads >> mSettings.occluderLevel) + 1;
+    mOccluderIndices.clear();
+    for (unsigned int z = 0; z + 1 < side; z++)
+    {
+        for (unsigned int x = 0; x + 1 < side; x++)
+        {
+            const short v00 = static_cast<short>(z * side + x);
+            const short v10 = static_cast<short>(v00 + 1);
+            const short v01 = static_cast<short>(v00 + side);
+            const short v11 = static_cast<short>(v01 + 1);
+            mOccluderIndices.insert(mOccluderIndices.end(), { v00, v01, v11, v00, v11, v10 });
+        }
+    }
+}
+
+void Terrain::StartLoad(unsigned int chunk)
+{
+    mLoading.push_back(chunk);
+    mJobs->Run([this, chunk]()
+    {
+        ChunkLoad load;
+        load.chunk = chunk;
+        LoadChunk(load);
+
+        std::lock_guard<std::mutex> guard(mLoadLock);
+        mFinishedLoads.push_back(std::move(load));
+    }, &mLoadJobs);
+}
+
+//Reads the chunk's heights from the cache, generating them the first time, and builds its vertices
+void Terrain::LoadChunk(ChunkLoad &load)const
+{
+    const unsigned int quads = mSettings.chunkQuads;
+    const unsigned int samples = quads + 3;
+    const unsigned int chunkX = load.chunk % mSettings.chunksX;
+    const unsigned int chunkZ = load.chunk / mSettings.chunksX;
+    const float originX = (chunkX - mSettings.chunksX * 0.5f) * mChunkSize;
+    const float originZ = (chunkZ - mSettings.chunksZ * 0.5f) * mChunkSize;
+
+    char name[64] = {};
+    snprintf(name, sizeof(name), "%u_%u.height", chunkX, chunkZ);
+    const std::string path = mDirectory + "/" + name;
+
+    std::vector<float> heights;
+    if (!ReadHeights(path, heights))
+    {
+        heights.resize(samples * samples);
+        for (unsigned int z = 0; z < samples; z++)
+        {
+            for (unsigned int x = 0; x < samples; x++)
+            {
+                heights[z * samples + x] = GetGeneratedHeight(originX + (static_cast<float>(x) - 1.0f) * mSettings.quadSize,
+                    originZ + (static_cast<float>(z) - 1.0f) * mSettings.quadSize);
+            }
+        }
+        WriteHeights(path, heights);
+    }
+
+    //The border samples only feed the normals, so they match across chunk edges
+    const unsigned int vertexCount = (quads + 1) * (quads + 1);
+    ScratchScope scratch;
+    VERTEX *vertices = scratch.GetArena().AllocateArray<VERTEX>(vertexCount);
+    load.minHeight = heights[samples + 1];
+    load.maxHeight = load.minHeight;
+    for (unsigned int z = 0; z <= quads; z++)
+    {
+        for (unsigned int x = 0; x <= quads; x++)
+        {
+            const float *h = &heights[(z + 1) * samples + x + 1];
+            const float worldX = originX + x * mSettings.quadSize;
+            const float worldZ = originZ + z * mSettings.quadSize;
+
+            VERTEX &vertex = vertices[z * (quads + 1) + x];
+            vertex.position = XMFLOAT3(worldX, h[0], worldZ);
+            XMStoreFloat3(&vertex.normal, XMVector3Normalize(XMVectorSet(h[-1] - h[1], 2.0f * mSettings.quadSize, h[-static_cast<int>(samples)] - h[samples], 0.0f)));
+            vertex.texture = XMFLOAT2(worldX * 0.25f, worldZ * 0.25f);
+
+            load.minHeight = std::min(load.minHeight, h[0]);
+            load.maxHeight = std::max(load.maxHeight, h[0]);
+        }
+    }
+
+    load.vertices.resize(vertexCount * SceneVertexFormat::Stride);
+    SceneVertexFormat::PackStreams(vertices, vertexCount, load.vertices.data());
+
+    //Every occluder vertex takes the lowest height of the cells it touches, so the coarse
+    //triangles stay under the full detail surface and never hide something in a dip
+    const int step = 1 << mSettings.occluderLevel;
+    const int last = static_cast<int>(quads);
+    const unsigned int side = (quads >> mSettings.occluderLevel) + 1;
+    load.occluder.resize(side * side);
+    for (unsigned int cz = 0; cz < side; cz++)
+    {
+        for (unsigned int cx = 0; cx < side; cx++)
+        {
+            const int x = static_cast<int>(cx) * step;
+            const int z = static_cast<int>(cz) * step;
+            float lowest = vertices[z * (quads + 1) + x].position.y;
+            for (int sz = std::max(z - step, 0); sz <= std::min(z + step, last); sz++)
+            {
+                for (int sx = std::max(x - step, 0); sx <= std::min(x + step, last); sx++)
+                {
+                    lowest = std::min(lowest, vertices[sz * (quads + 1) + sx].position.y);
+                }
+            }
+            const XMFLOAT3 &position = vertices[z * (quads + 1) + x].position;
+            load.occluder[cz * side + cx] = XMFLOAT3(position.x, lowest, position.z);
+        }
+    }
+}
+
+bool Terrain::ReadHeights(const std::string &path, std::vector<float> &heights)const
+{
+    const unsigned int samples = mSettings.chunkQuads + 3;
+    std::vector<unsigned char> data;
+    if (!ReadKeyedFile(path, heightFileMagic, heightFileVersion, GetHeightKey(mSettings), data) || data.size() != samples * samples * sizeof(float))
+    {
+        return false;
+    }
+
+    heights.resize(samples * samples);
+    memcpy(heights.data(), data.data(), data.size());
+    return true;
+}
+
+void Terrain::WriteHeights(const std::string &path, const std::vector<float> &heights)const
+{
+    WriteKeyedFile(path, heightFileMagic, heightFileVersion, GetHeightKey(mSettings), heights.data(), heights.size() * sizeof(float));
+}
+
+//Puts a finished chunk into a free slot, or takes over the one holding the farthest chunk out of range
+void Terrain::ApplyLoad(ID3D11DeviceContext *context, const ChunkLoad &load, FXMVECTOR eye)
+{
+    //The camera may have moved on while it loaded
+    if (GetStreamDistance(load.chunk, eye) > mSettings.streamRadius)
+    {
+        return;
+    }
+
+    int target = -1;
+    float farthest = mSettings.streamRadius;
+    for (size_t s = 0; s < mSlots.size(); s++)
+    {
+        const Slot &slot = mSlots[s];
+        if (slot.chunk < 0)
+        {
+            target = static_cast<int>(s);
+            break;
+        }
+
+        const float distance = GetStreamDistance(slot.chunk, eye);
+        if (distance > farthest)
+        {
+            farthest = distance;
+            target = static_cast<int>(s);
+        }
+    }
+
+    //Every slot holds a chunk in range, can't happen while the pool covers the whole window
+    if (target < 0)
+    {
+        return;
+    }
+
+    Slot &slot = mSlots[target];
+    context->UpdateSubresource(slot.buffer, 0, nullptr, load.vertices.data(), 0, 0);
+    std::copy(load.occluder.begin(), load.occluder.end(), slot.occluder.begin());
+
+    const unsigned int chunkX = load.chunk % mSettings.chunksX;
+    const unsigned int chunkZ = load.chunk / mSettings.chunksX;
+    slot.chunk = static_cast<int>(load.chunk);
+    slot.boundsMin = XMFLOAT3((chunkX - mSettings.chunksX * 0.5f) * mChunkSize, load.minHeight, (chunkZ - mSettings.chunksZ * 0.5f) * mChunkSize);
+    slot.boundsMax = XMFLOAT3(slot.boundsMin.x + mChunkSize, load.maxHeight, slot.boundsMin.z + mChunkSize);
+
+    mStats.uploaded++;
+    mStats.streamedChunks++;
+}
+
+//Distance from the eye to the chunk's box
+float Terrain::GetDistance(unsigned int chunk, float minHeight, float maxHeight, FXMVECTOR eye)const
+{
+    const float minX = (chunk % mSettings.chunksX - mSettings.chunksX * 0.5f) * mChunkSize;
+    const float minZ = (chunk / mSettings.chunksX - mSettings.chunksZ * 0.5f) * mChunkSize;
+    const XMVECTOR boxMin = XMVectorSet(minX, minHeight, minZ, 0.0f);
+    const XMVECTOR boxMax = XMVectorSet(minX + mChunkSize, maxHeight, minZ + mChunkSize, 0.0f);
+    const XMVECTOR closest = XMVectorClamp(eye, boxMin, boxMax);
+    return XMVectorGetX(XMVector3Length(eye - closest));
+}
+
+//Whether a chunk is in range is always judged over every height the generator can give, so
+//Update asks for a chunk exactly when ApplyLoad keeps it and the slots hold it
+float Terrain::GetStreamDistance(unsigned int chunk, FXMVECTOR eye)const
+{
+    return GetDistance(chunk, mSettings.baseHeight, mSettings.baseHeight + mSettings.heightScale, eye);
+}
+
+unsigned int Terrain::GetLevel(float distance)const
+{
+    if (distance < mSettings.lodDistance)
+    {
+        return 0;
+    }
+    const unsigned int level = static_cast<unsigned int>(log2f(distance / mSettings.lodDistance)) + 1;
+    return std::min(level, mSettings.levelCount - 1);
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <d3d11.h>
+#include <directxmath.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Assets.h"
+#include "JobSystem.h"
+
+using namespace DirectX;
+
+struct TerrainSettings
+{
+    unsigned int chunksX = 64;              //World size in chunks, centered on the origin
+    unsigned int chunksZ = 64;
+    unsigned int chunkQuads = 32;           //Quads along a chunk side at full detail, a power of two
+    unsigned int levelCount = 5;            //Full detail and four halvings, at most log2(chunkQuads)
+    float quadSize = 0.5f;                  //World units between height samples
+    float lodDistance = 16.0f;              //Full detail this close, every level after that doubles the distance
+    float streamRadius = 110.0f;            //Chunks within this distance of the camera are kept resident
+    unsigned int maxLoadsInFlight = 16;
+    unsigned int occluderLevel = 3;         //Level whose grid is rasterized for occlusion culling, below levelCount
+
+    //Heights for chunks that aren't in the cache yet
+    unsigned int seed = 1;
+    float baseHeight = -1.0f;
+    float heightScale = 10.0f;
+    float featureSize = 48.0f;              //World units across the largest hills
+    float flatRadius = 8.0f;                //Kept at baseHeight around the origin, the scene stands there
+};
+
+//A chunk to draw this frame
+struct TerrainDraw
+{
+    unsigned int slot = 0;                  //Which vertex buffer holds the chunk
+    unsigned int lod = 0;                   //Index range in GetLods(): level * 16 + edges stitched to a coarser neighbour
+    XMFLOAT3 boundsMin = {};                //World space, chunk vertices are stored in world space
+    XMFLOAT3 boundsMax = {};
+};
+
+struct TerrainStats
+{
+    unsigned int slots = 0;
+    unsigned int resident = 0;
+    unsigned int pendingLoads = 0;
+    unsigned int uploaded = 0;              //Chunks that arrived in the last Update
+    unsigned int drawn = 0;
+    unsigned int triangles = 0;
+    unsigned int levelChunks[8] = {};       //Chunks drawn at each level
+    unsigned long long residentBytes = 0;   //Vertex and index buffers, fixed at Init
+    unsigned long long streamedChunks = 0;  //Since start
+    float ms = 0.0f;
+};
+
+//Heightfield terrain cut into square chunks. Chunks within the stream radius are loaded
+//on job system workers from height files in the cache directory, generated there the
+//first time they are needed, and uploaded into a fixed pool of vertex buffers, so memory
+//doesn't grow with the world. Every chunk picks a level from its distance to the camera,
+//neighbours are kept at most one level apart and the finer side of a level change snaps
+//its edge vertices onto the coarser one. All chunks share one index buffer holding every
+//level with each of the 16 combinations of stitched edges. Every slot also keeps a coarse
+//grid of its chunk on the CPU for the occlusion culler, each vertex lowered to the lowest
+//height around it so the grid never pokes out of the surface. All D3D calls happen on the
+//render thread.
+class Terrain
+{
+public:
+    Terrain();
+    ~Terrain();
+
+    void Init(ID3D11Device *device, JobSystem *jobs, const TerrainSettings &settings, const std::string &cacheDirectory);
+    void Shutdown();
+
+    //Apply finished loads, start new ones and pick the level of every resident chunk in range
+    void Update(ID3D11DeviceContext *context, FXMVECTOR eye);
+    const std::vector<TerrainDraw> &GetDraws()const;
+
+    unsigned int GetSlotCount()const;
+    ID3D11Buffer *GetVertexBuffer(unsigned int slot)const;
+    unsigned int GetChunkVertexCount()const;        //In every vertex buffer, which holds one stream per attribute
+    ID3D11Buffer *GetIndexBuffer()const;
+    const std::vector<MeshLod> &GetLods()const;
+
+    //World space occluder grid of the chunk in a slot, refilled with its vertex buffer
+    const std::vector<XMFLOAT3> &GetOccluderPositions(unsigned int slot)const;
+    const std::vector<short> &GetOccluderIndices()const;
+
+    const TerrainStats &GetStats()const;
+
+    //Height of the generated terrain, what a chunk samples before it is cached
+    float GetGeneratedHeight(float x, float z)const;
+
+private:
+    struct Slot
+    {
+        ID3D11Buffer *buffer = nullptr;
+        int chunk = -1;                     //-1 while free
+        XMFLOAT3 boundsMin = {};
+        XMFLOAT3 boundsMax = {};
+        std::vector<XMFLOAT3> occluder;
+    };
+
+    //Result of a worker job, applied by Update
+    struct ChunkLoad
+    {
+        unsigned int chunk = 0;
+        std::vector<unsigned char> vertices;    //Packed in the scene vertex format
+        std::vector<XMFLOAT3> occluder;
+        float minHeight = 0.0f;
+        float maxHeight = 0.0f;
+    };
+
+    void BuildIndices(std::vector<short> &indices);
+    void BuildOccluderIndices();
+    void StartLoad(unsigned int chunk);
+    void LoadChunk(ChunkLoad &load)const;
+    bool ReadHeights(const std::string &path, std::vector<float> &heights)const;
+    void WriteHeights(const std::string &path, const std::vector<float> &heights)const;
+    void ApplyLoad(ID3D11DeviceContext *context, const ChunkLoad &load, FXMVECTOR eye);
+    float GetDistance(unsigned int chunk, float minHeight, float maxHeight, FXMVECTOR eye)const;
+    float GetStreamDistance(unsigned int chunk, FXMVECTOR eye)const;
+    unsigned int GetLevel(float distance)const;
+
+    TerrainSettings mSettings;
+    ID3D11Device *mDevice = nullptr;
+    JobSystem *mJobs = nullptr;
+    JobCounter mLoadJobs;
+    std::string mDirectory;
+    float mChunkSize = 0.0f;
+    int mWindowRadius = 0;                  //Chunks from the camera's chunk to the edge of the stream radius
+
+    ID3D11Buffer *mIndexBuffer = nullptr;
+    std::vector<MeshLod> mLods;
+    std::vector<short> mOccluderIndices;
+    std::vector<Slot> mSlots;
+    std::vector<unsigned int> mLoading;     //Chunks with a load in flight
+
+    //Square of chunks around the camera, rebuilt every Update
+    std::vector<int> mWindowSlots;          //Slot holding the chunk, -1 if it isn't resident or out of range
+    std::vector<unsigned char> mWindowLevels;
+    std::vector<std::pair<float, unsigned int>> mWanted;    //Distance and chunk of missing chunks in range
+
+    std::vector<TerrainDraw> mDraws;
+    TerrainStats mStats;
+
+    std::mutex mLoadLock;
+    std::vector<ChunkLoad> mFinishedLoads;  //Guarded by mLoadLock
+    std::vector<ChunkLoad> mApplying;
+};
@@ -0,0 +1,895 @@
+#include "TextureStreamer.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "AssetArchive.h"
+#include "Assets.h"
+#include "FileCache.h"
+#include "GpuResources.h"
+
+//Mips at or below this size are loaded up front and never evicted
+const unsigned int lowMipSize = 64;
+
+//Bump when the chain file layout changes so old files get rebuilt
+const unsigned int mipChainVersion = 1;
+const unsigned int mipChainMagic = 0x4d544750; //"PGTM"
+
+struct MipChainHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int width;
+    unsigned int height;
+    unsigned int mipCount;
+    unsigned int padding;
+    unsigned long long sourceSize;      //Source size and stamp from GetAssetStamp, a mismatch means it changed
+    unsigned long long sourceTime;
+};
+
+static unsigned int MipDimension(unsigned int size, unsigned int mip)
+{
+    return std::max(1u, size >> mip);
+}
+
+//Most detailed mip that still fits in lowMipSize
+static unsigned int LowMip(unsigned int width, unsigned int height, unsigned int mipCount)
+{
+    unsigned int mip = 0;
+    while (mip + 1 < mipCount && std::max(MipDimension(width, mip), MipDimension(height, mip)) > lowMipSize)
+    {
+        mip++;
+    }
+    return mip;
+}
+
+//Halves an RGBA image with a 2x2 box filter, odd edges repeat the last texel
+static void Downsample(const unsigned char *source, unsigned int width, unsigned int height, std::vector<unsigned char> &target)
+{
+    const unsigned int targetWidth = std::max(1u, width / 2);
+    const unsigned int targetHeight = std::max(1u, height / 2);
+    target.resize(static_cast<size_t>(targetWidth) * targetHeight * 4);
+
+    for (unsigned int y = 0; y < targetHeight; y++)
+    {
+        const unsigned int y0 = std::min(y * 2, height - 1);
+        const unsigned int y1 = std::min(y * 2 + 1, height - 1);
+        for (unsigned int x = 0; x < targetWidth; x++)
+        {
+            const unsigned int x0 = std::min(x * 2, width - 1);
+            const unsigned int x1 = std::min(x * 2 + 1, width - 1);
+            for (unsigned int c = 0; c < 4; c++)
+            {
+                const unsigned int sum = source[(y0 * width + x0) * 4 + c] + source[(y0 * width + x1) * 4 + c] +
+                    source[(y1 * width + x0) * 4 + c] + source[(y1 * width + x1) * 4 + c];
+                target[(static_cast<size_t>(y) * targetWidth + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+//Decodes the source image and writes its full mip chain next to the other cached chains
+static bool BuildMipChain(const std::string &sourcePath, const std::string &chainPath, MipChainHeader &header)
+{
+    TextureData image;
+    if (!LoadTarga(sourcePath.c_str(), image) || image.width <= 0 || image.height <= 0)
+    {
+        return false;
+    }
+
+    header = MipChainHeader();
+    header.magic = mipChainMagic;
+    header.version = mipChainVersion;
+    header.width = static_cast<unsigned int>(image.width);
+    header.height = static_cast<unsigned int>(image.height);
+    header.mipCount = 1;
+    while (MipDimension(header.width, header.mipCount - 1) > 1 || MipDimension(header.height, header.mipCount - 1) > 1)
+    {
+        header.mipCount++;
+    }
+    if (!GetAssetStamp(sourcePath, header.sourceSize, header.sourceTime))
+    {
+        return false;
+    }
+
+    return ReplaceFile(chainPath, [&header, &image](std::ofstream &file)
+    {
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        std::vector<unsigned char> level = std::move(image.pixels);
+        std::vector<unsigned char> next;
+        for (unsigned int mip = 0; mip < header.mipCount; mip++)
+        {
+            file.write(reinterpret_cast<const char*>(level.data()), static_cast<std::streamsize>(level.size()));
+            if (mip + 1 < header.mipCount)
+            {
+                Downsample(level.data(), MipDimension(header.width, mip), MipDimension(header.height, mip), next);
+                level.swap(next);
+            }
+        }
+    });
+}
+
+//Opens a texture's mip chain file just past its header, building it first on first use or
+//when the source changed since it was written
+static bool OpenMipChain(const std::string &sourcePath, const std::string &chainPath, bool rebuildChain, std::ifstream &file, MipChainHeader &header)
+{
+    unsigned long long sourceSize = 0;
+    unsigned long long sourceTime = 0;
+    if (!rebuildChain)
+    {
+        file.open(chainPath, std::ios::binary);
+        GetAssetStamp(sourcePath, sourceSize, sourceTime);
+    }
+
+    if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != mipChainMagic ||
+        header.version != mipChainVersion || header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+    {
+        file.close();
+        if (!BuildMipChain(sourcePath, chainPath, header))
+        {
+            return false;
+        }
+        file.open(chainPath, std::ios::binary);
+        file.seekg(sizeof(header));
+    }
+    return file && header.mipCount > 0;
+}
+
+static unsigned long long LevelBytes(unsigned int width, unsigned int height, unsigned int mip)
+{
+    return 4ull * MipDimension(width, mip) * MipDimension(height, mip);
+}
+
+//Appends mips firstMip up to endMip of an open chain file to levels
+static bool ReadMips(std::ifstream &file, const MipChainHeader &header, unsigned int firstMip, unsigned int endMip, std::vector<std::vector<unsigned char>> &levels)
+{
+    unsigned long long offset = sizeof(header);
+    for (unsigned int mip = 0; mip < firstMip; mip++)
+    {
+        offset += LevelBytes(header.width, header.height, mip);
+    }
+
+    file.seekg(static_cast<std::streamoff>(offset));
+    for (unsigned int mip = firstMip; mip < endMip; mip++)
+    {
+        levels.emplace_back(static_cast<size_t>(LevelBytes(header.width, header.height, mip)));
+        std::vector<unsigned char> &level = levels.back();
+        if (!file.read(reinterpret_cast<char*>(level.data()), static_cast<std::streamsize>(level.size())))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//Every slice and mip of an array texture, viewed as an array even with a single slice
+static HRESULT CreateArrayView(ID3D11Device *device, ID3D11Texture2D *texture, unsigned int mipLevels, unsigned int sliceCount, ID3D11ShaderResourceView **view)
+{
+    D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc = {};
+    viewDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    viewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+    viewDesc.Texture2DArray.MostDetailedMip = 0;
+    viewDesc.Texture2DArray.MipLevels = mipLevels;
+    viewDesc.Texture2DArray.FirstArraySlice = 0;
+    viewDesc.Texture2DArray.ArraySize = sliceCount;
+    return device->CreateShaderResourceView(texture, &viewDesc, view);
+}
+
+TextureStreamer::TextureStreamer()
+{
+}
+
+TextureStreamer::~TextureStreamer()
+{
+}
+
+void TextureStreamer::Init(ID3D11Device *device, JobSystem *jobs, UploadQueue *uploads, unsigned long long budgetBytes, const std::string &cacheDirectory)
+{
+    mDevice = device;
+    mJobs = jobs;
+    mUploads = uploads;
+    mBudget = budgetBytes;
+    mDirectory = cacheDirectory;
+    CreateCacheDirectory(mDirectory);
+
+    //Grey stand in until a texture has its first mips
+    const unsigned int grey = 0xff808080;
+    CD3D11_TEXTURE2D_DESC placeholderDesc(DXGI_FORMAT_R8G8B8A8_UNORM, 1, 1, 1, 1);
+    D3D11_SUBRESOURCE_DATA initialData = {};
+    initialData.pSysMem = &grey;
+    initialData.SysMemPitch = 4;
+
+    HRESULT hr = mDevice->CreateTexture2D(&placeholderDesc, &initialData, &mPlaceholder);
+    assert(SUCCEEDED(hr));
+
+    hr = CreateArrayView(mDevice, mPlaceholder, 1, 1, &mPlaceholderView);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(mPlaceholder, GpuCategoryTexture, "texture placeholder");
+    TrackGpuResource(mPlaceholderView, GpuCategoryView, "texture placeholder");
+}
+
+void TextureStreamer::Shutdown()
+{
+    if (mJobs)
+    {
+        mJobs->Wait(mLoadJobs);
+    }
+    mFinishedLoads.clear();
+
+    for (TextureArray &array : mArrays)
+    {
+        ReleasePending(array);
+        ReleaseArray(array);
+    }
+    mArrays.clear();
+    mTextures.clear();
+
+    if (mPlaceholderView) mPlaceholderView->Release();
+    if (mPlaceholder) mPlaceholder->Release();
+    mPlaceholderView = nullptr;
+    mPlaceholder = nullptr;
+}
+
+TextureHandle TextureStreamer::Register(const std::string &path)
+{
+    //Objects sharing a file share its slice
+    for (size_t i = 0; i < mTextures.size(); i++)
+    {
+        if (mTextures[i].path == path)
+        {
+            return static_cast<TextureHandle>(i);
+        }
+    }
+
+    StreamedTexture texture;
+    texture.path = path;
+    mTextures.push_back(texture);
+
+    const TextureHandle handle = static_cast<TextureHandle>(mTextures.size() - 1);
+    StartTextureLoad(handle, false);
+    return handle;
+}
+
+void TextureStreamer::Reload(const std::string &path)
+{
+    for (size_t i = 0; i < mTextures.size(); i++)
+    {
+        StreamedTexture &texture = mTextures[i];
+        if (texture.path != path)
+        {
+            continue;
+        }
+
+        //Keep showing the old slice until the new low mips are in, a first load already in flight is dropped
+        texture.generation++;
+        StartTextureLoad(static_cast<TextureHandle>(i), true);
+    }
+}
+
+ID3D11ShaderResourceView *TextureStreamer::GetView(TextureHandle handle)const
+{
+    const StreamedTexture &texture = mTextures[handle];
+    return texture.array != NoArray ? mArrays[texture.array].view : mPlaceholderView;
+}
+
+unsigned int TextureStreamer::GetSlice(TextureHandle handle)const
+{
+    const StreamedTexture &texture = mTextures[handle];
+    return texture.array != NoArray ? texture.slice : 0;
+}
+
+void TextureStreamer::Request(TextureHandle handle, float screenPixels)
+{
+    const StreamedTexture &texture = mTextures[handle];
+    if (texture.array == NoArray)
+    {
+        return;
+    }
+
+    TextureArray &array = mArrays[texture.array];
+    array.requestedPixels = std::max(array.requestedPixels, screenPixels);
+    array.lastUsedFrame = mFrame;
+}
+
+float TextureStreamer::ProjectedSize(const Camera &camera, float screenHeight, FXMVECTOR center, float radius)
+{
+    //Once the camera is inside the sphere it covers the screen
+    const float distance = std::max(XMVectorGetX(XMVector3Length(center - camera.GetPositionXM())), radius);
+    if (distance <= 0.0f)
+    {
+        return screenHeight;
+    }
+
+    return radius * screenHeight / (distance * tanf(0.5f * camera.GetFovY()));
+}
+
+void TextureStreamer::Update(ID3D11DeviceContext *context)
+{
+    std::vector<MipLoad> finished;
+    {
+        std::lock_guard<std::mutex> guard(mLoadLock);
+        finished.swap(mFinishedLoads);
+    }
+
+    //Rebuilt arrays whose new mips have all been sent take over from the current ones
+    for (unsigned int i = 0; i < mArrays.size(); i++)
+    {
+        if (mArrays[i].pending.texture && mUploads->IsDone(mArrays[i].pending.upload))
+        {
+            SwapPending(i);
+        }
+    }
+
+    for (MipLoad &load : finished)
+    {
+        if (!load.initial)
+        {
+            ApplyArrayLoad(context, load);
+        }
+    }
+
+    //First loads for an array that is still waiting on its last rebuild get another go next frame
+    std::vector<MipLoad> deferred;
+    ApplyTextureLoads(context, finished, deferred);
+    if (!deferred.empty())
+    {
+        std::lock_guard<std::mutex> guard(mLoadLock);
+        for (MipLoad &load : deferred)
+        {
+            mFinishedLoads.push_back(std::move(load));
+        }
+    }
+
+    //Pick the mip each array needs, one texel per pixel its largest use covers
+    for (TextureArray &array : mArrays)
+    {
+        array.wantedMip = array.lowMip;
+        if (array.requestedPixels > 0.0f)
+        {
+            const float texels = static_cast<float>(std::max(array.width, array.height));
+            const float mip = floorf(log2f(texels / array.requestedPixels));
+            array.wantedMip = mip <= 0.0f ? 0 : std::min(static_cast<unsigned int>(mip), array.lowMip);
+        }
+        array.requestedPixels = 0.0f;
+    }
+
+    //A smaller budget or a reload can leave us over, drop the oldest mips first
+    while (mResidentBytes + mPendingBytes > mBudget && EvictOne(context, mFrame + 1))
+    {
+    }
+
+    for (unsigned int i = 0; i < mArrays.size(); i++)
+    {
+        TextureArray &array = mArrays[i];
+        if (!array.texture || array.loading || array.pending.texture || array.wantedMip >= array.residentMip)
+        {
+            continue;
+        }
+
+        //Make room by evicting mips nobody used this frame, load less detail if that is not enough
+        const unsigned long long sliceCount = array.slices.size();
+        unsigned int firstMip = array.wantedMip;
+        while (firstMip < array.residentMip)
+        {
+            unsigned long long bytes = 0;
+            for (unsigned int mip = firstMip; mip < array.residentMip; mip++)
+            {
+                bytes += MipBytes(array.width, array.height, mip) * sliceCount;
+            }
+
+            if (mResidentBytes + mPendingBytes + bytes <= mBudget)
+            {
+                break;
+            }
+            if (!EvictOne(context, mFrame))
+            {
+                firstMip++;
+            }
+        }
+
+        if (firstMip < array.residentMip)
+        {
+            StartArrayLoad(i, firstMip, array.residentMip);
+        }
+    }
+
+    mFrame++;
+}
+
+void TextureStreamer::SetBudget(unsigned long long budgetBytes)
+{
+    mBudget = budgetBytes;
+}
+
+TextureStreamingStats TextureStreamer::GetStats()const
+{
+    TextureStreamingStats stats;
+    stats.residentBytes = mResidentBytes;
+    stats.budgetBytes = mBudget;
+    stats.streamedBytes = mStreamedBytes;
+    stats.evictedBytes = mEvictedBytes;
+    stats.textures = static_cast<unsigned int>(mTextures.size());
+    stats.arrays = static_cast<unsigned int>(mArrays.size());
+    stats.pendingLoads = mPendingLoads;
+    for (const TextureArray &array : mArrays)
+    {
+        for (unsigned int slice = 0; array.texture && slice < array.sliceCount; slice++)
+        {
+            if (array.slices[slice] != NoTexture)
+            {
+                stats.residentMips += array.mipCount - array.residentMip;
+                stats.wantedMips += array.mipCount - array.wantedMip;
+            }
+        }
+    }
+    return stats;
+}
+
+void TextureStreamer::StartTextureLoad(TextureHandle handle, bool rebuildChain)
+{
+    StreamedTexture &texture = mTextures[handle];
+    texture.loading = true;
+
+    MipLoad request;
+    request.handle = handle;
+    request.generation = texture.generation;
+    request.initial = true;
+    request.textures.push_back(handle);
+    mPendingLoads++;
+
+    const std::string sourcePath = texture.path;
+    const std::string chainPath = GetChainPath(texture.path);
+    mJobs->Run([this, request, rebuildChain, sourcePath, chainPath]()
+    {
+        MipLoad load = request;
+
+        //A first load brings in everything from the low mip down
+        std::ifstream file;
+        MipChainHeader header = {};
+        if (OpenMipChain(sourcePath, chainPath, rebuildChain, file, header))
+        {
+            load.width = header.width;
+            load.height = header.height;
+            load.mipCount = header.mipCount;
+            load.firstMip = LowMip(header.width, header.height, header.mipCount);
+            load.succeeded = ReadMips(file, header, load.firstMip, header.mipCount, load.levels);
+        }
+        if (!load.succeeded)
+        {
+            load.failedPath = sourcePath;
+        }
+
+        std::lock_guard<std::mutex> guard(mLoadLock);
+        mFinishedLoads.push_back(std::move(load));
+    }, &mLoadJobs);
+}
+
+void TextureStreamer::StartArrayLoad(unsigned int index, unsigned int firstMip, unsigned int endMip)
+{
+    TextureArray &array = mArrays[index];
+    array.loading = true;
+
+    MipLoad request;
+    request.array = index;
+    request.generation = array.generation;
+    request.width = array.width;
+    request.height = array.height;
+    request.mipCount = array.mipCount;
+    request.firstMip = firstMip;
+    for (unsigned int mip = firstMip; mip < endMip; mip++)
+    {
+        request.bytes += MipBytes(array.width, array.height, mip) * array.slices.size();
+    }
+
+    std::vector<std::string> sourcePaths;
+    std::vector<std::string> chainPaths;
+    for (TextureHandle handle : array.slices)
+    {
+        if (handle != NoTexture)
+        {
+            request.textures.push_back(handle);
+            sourcePaths.push_back(mTextures[handle].path);
+            chainPaths.push_back(GetChainPath(mTextures[handle].path));
+        }
+    }
+
+    mPendingLoads++;
+    mPendingBytes += request.bytes;
+
+    mJobs->Run([this, request, endMip, sourcePaths, chainPaths]()
+    {
+        MipLoad load = request;
+        load.succeeded = true;
+        for (size_t i = 0; i < sourcePaths.size() && load.succeeded; i++)
+        {
+            //A source edited since its first load can come back at another size, its reload moves it out
+            std::ifstream file;
+            MipChainHeader header = {};
+            load.succeeded = OpenMipChain(sourcePaths[i], chainPaths[i], false, file, header) && header.width == load.width &&
+                header.height == load.height && header.mipCount == load.mipCount && ReadMips(file, header, load.firstMip, endMip, load.levels);
+            if (!load.succeeded)
+            {
+                load.failedPath = sourcePaths[i];
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(mLoadLock);
+        mFinishedLoads.push_back(std::move(load));
+    }, &mLoadJobs);
+}
+
+void TextureStreamer::ApplyArrayLoad(ID3D11DeviceContext *context, MipLoad &load)
+{
+    mPendingLoads--;
+    mPendingBytes -= load.bytes;
+
+    TextureArray &array = mArrays[load.array];
+    if (load.generation != array.generation)
+    {
+        return;
+    }
+    array.loading = false;
+
+    if (!load.succeeded)
+    {
+        const std::string message = "Texture streaming: can't load " + load.failedPath + "\n";
+        OutputDebugStringA(message.c_str());
+        return;
+    }
+
+    //Counted up front, the levels move into the upload queue
+    unsigned long long bytes = 0;
+    for (const std::vector<unsigned char> &level : load.levels)
+    {
+        bytes += level.size();
+    }
+
+    MipLoad *loads[] = { &load };
+    if (Rebuild(context, load.array, load.firstMip, loads, 1))
+    {
+        mStreamedBytes += bytes;
+    }
+}
+
+void TextureStreamer::ApplyTextureLoads(ID3D11DeviceContext *context, std::vector<MipLoad> &loads, std::vector<MipLoad> &deferred)
+{
+    auto findArray = [this](const MipLoad &load)
+    {
+        for (unsigned int i = 0; i < mArrays.size(); i++)
+        {
+            if (mArrays[i].width == load.width && mArrays[i].height == load.height && mArrays[i].mipCount == load.mipCount)
+            {
+                return i;
+            }
+        }
+        return NoArray;
+    };
+
+    std::vector<MipLoad*> joining;
+    for (MipLoad &load : loads)
+    {
+        if (!load.initial)
+        {
+            continue;
+        }
+
+        StreamedTexture &texture = mTextures[load.handle];
+        if (load.generation != texture.generation)
+        {
+            mPendingLoads--;
+            continue;
+        }
+
+        //The array's pending texture was built without this slice, adding it now would lose that work
+        const unsigned int target = load.succeeded ? findArray(load) : NoArray;
+        if (target != NoArray && mArrays[target].pending.texture)
+        {
+            deferred.push_back(std::move(load));
+            continue;
+        }
+
+        mPendingLoads--;
+        texture.loading = false;
+        if (!load.succeeded)
+        {
+            const std::string message = "Texture streaming: can't load " + load.failedPath + "\n";
+            OutputDebugStringA(message.c_str());
+            continue;
+        }
+        joining.push_back(&load);
+    }
+
+    //Every texture takes a slice in the array of its size, a reload at the same size keeps its own
+    std::vector<unsigned int> grown;
+    std::vector<std::vector<TextureHandle>> previousSlices;
+    for (MipLoad *load : joining)
+    {
+        unsigned int target = findArray(*load);
+        if (target == NoArray)
+        {
+            TextureArray array;
+            array.width = load->width;
+            array.height = load->height;
+            array.mipCount = load->mipCount;
+            array.lowMip = load->firstMip;
+            array.residentMip = load->mipCount;
+            array.wantedMip = load->firstMip;
+            mArrays.push_back(array);
+            target = static_cast<unsigned int>(mArrays.size() - 1);
+        }
+
+        if (std::find(grown.begin(), grown.end(), target) == grown.end())
+        {
+            grown.push_back(target);
+            previousSlices.push_back(mArrays[target].slices);
+        }
+
+        //A reload at another size leaves its old slice unused, it keeps being drawn from it until the new one is in
+        bool placed = false;
+        for (unsigned int i = 0; i < mArrays.size(); i++)
+        {
+            for (TextureHandle &slice : mArrays[i].slices)
+            {
+                if (slice == load->handle && i == target)
+                {
+                    placed = true;
+                }
+                else if (slice == load->handle)
+                {
+                    slice = NoTexture;
+                }
+            }
+        }
+        if (!placed)
+        {
+            mArrays[target].slices.push_back(load->handle);
+        }
+        load->array = target;
+    }
+
+    for (size_t g = 0; g < grown.size(); g++)
+    {
+        const unsigned int index = grown[g];
+        std::vector<MipLoad*> arrayLoads;
+        unsigned long long bytes = 0;
+        for (MipLoad *load : joining)
+        {
+            if (load->array == index)
+            {
+                arrayLoads.push_back(load);
+                for (const std::vector<unsigned char> &level : load->levels)
+                {
+                    bytes += level.size();
+                }
+            }
+        }
+
+        //The other slices drop to their low mips with the new ones and stream back in together,
+        //detail loads in flight were asked for the old set of slices
+        TextureArray &array = mArrays[index];
+        array.generation++;
+        array.loading = false;
+        if (Rebuild(context, index, array.lowMip, arrayLoads.data(), arrayLoads.size()))
+        {
+            mStreamedBytes += bytes;
+        }
+        else
+        {
+            array.slices = previousSlices[g];
+            OutputDebugStringA("Texture streaming: can't grow a texture array\n");
+        }
+    }
+}
+
+bool TextureStreamer::Rebuild(ID3D11DeviceContext *context, unsigned int index, unsigned int firstMip, MipLoad *const *loads, size_t loadCount)
+{
+    TextureArray &array = mArrays[index];
+    const unsigned int sliceCount = static_cast<unsigned int>(array.slices.size());
+    const unsigned int mipLevels = array.mipCount - firstMip;
+
+    //Find each slice's new mips in the loads
+    std::vector<MipLoad*> sliceLoads(sliceCount, nullptr);
+    std::vector<size_t> sliceLevels(sliceCount, 0);     //Index of the slice's first level in its load
+    for (size_t l = 0; l < loadCount; l++)
+    {
+        const size_t levelsPerTexture = loads[l]->textures.empty() ? 0 : loads[l]->levels.size() / loads[l]->textures.size();
+        for (size_t t = 0; t < loads[l]->textures.size(); t++)
+        {
+            for (unsigned int slice = 0; slice < sliceCount; slice++)
+            {
+                if (array.slices[slice] == loads[l]->textures[t])
+                {
+                    sliceLoads[slice] = loads[l];
+                    sliceLevels[slice] = t * levelsPerTexture;
+                }
+            }
+        }
+    }
+
+    //Mips that aren't in a load have to come from the current texture
+    for (unsigned int slice = 0; slice < sliceCount; slice++)
+    {
+        const MipLoad *load = sliceLoads[slice];
+        const unsigned int residentMip = slice < array.sliceCount ? array.residentMip : array.mipCount;
+        const unsigned int loadEnd = load ? load->firstMip + static_cast<unsigned int>(load->levels.size() / load->textures.size()) : firstMip;
+        const bool startsLate = load && load->firstMip > firstMip;
+        if (array.slices[slice] != NoTexture && (startsLate || (loadEnd < residentMip && loadEnd < array.mipCount)))
+        {
+            return false;
+        }
+    }
+
+    CD3D11_TEXTURE2D_DESC textureDesc(DXGI_FORMAT_R8G8B8A8_UNORM, MipDimension(array.width, firstMip), MipDimension(array.height, firstMip),
+        sliceCount, mipLevels);
+
+    ID3D11Texture2D *newTexture = nullptr;
+    ID3D11ShaderResourceView *newView = nullptr;
+    HRESULT hr = mDevice->CreateTexture2D(&textureDesc, nullptr, &newTexture);
+    if (SUCCEEDED(hr))
+    {
+        hr = CreateArrayView(mDevice, newTexture, mipLevels, sliceCount, &newView);
+    }
+    if (FAILED(hr))
+    {
+        if (newTexture) newTexture->Release();
+        return false;
+    }
+
+    //All arrays of one size are charged together, the owner is the size
+    char owner[64] = {};
+    snprintf(owner, sizeof(owner), "textures %ux%u", array.width, array.height);
+    TrackGpuResource(newTexture, GpuCategoryTexture, owner);
+    TrackGpuResource(newView, GpuCategoryView, owner);
+
+    //Resident mips are copied on the GPU right away, loaded ones are sent over the next frames
+    UploadTicket upload = 0;
+    unsigned long long uploadBytes = 0;
+    for (unsigned int slice = 0; slice < sliceCount; slice++)
+    {
+        if (array.slices[slice] == NoTexture)
+        {
+            continue;
+        }
+
+        MipLoad *load = sliceLoads[slice];
+        const unsigned int loadEnd = load ? load->firstMip + static_cast<unsigned int>(load->levels.size() / load->textures.size()) : firstMip;
+        for (unsigned int mip = firstMip; mip < array.mipCount; mip++)
+        {
+            const UINT subresource = D3D11CalcSubresource(mip - firstMip, slice, mipLevels);
+            if (load && mip >= load->firstMip && mip < loadEnd)
+            {
+                std::vector<unsigned char> &level = load->levels[sliceLevels[slice] + mip - load->firstMip];
+                uploadBytes += level.size();
+                upload = mUploads->QueueTexture(newTexture, subresource, MipDimension(array.width, mip), MipDimension(array.width, mip) * 4, std::move(level));
+            }
+            else
+            {
+                const UINT source = D3D11CalcSubresource(mip - array.residentMip, slice, array.mipCount - array.residentMip);
+                context->CopySubresourceRegion(newTexture, subresource, 0, 0, 0, array.texture, source, nullptr);
+            }
+        }
+    }
+
+    //The current texture stays in use until the swap
+    ReleasePending(array);
+    PendingArray &pending = array.pending;
+    pending.texture = newTexture;
+    pending.view = newView;
+    pending.slices = array.slices;
+    pending.residentMip = firstMip;
+    pending.bytes = uploadBytes;
+    pending.upload = upload;
+    mPendingBytes += uploadBytes;
+
+    //Evictions only copy, they are done as soon as they are issued
+    if (mUploads->IsDone(upload))
+    {
+        SwapPending(index);
+    }
+    return true;
+}
+
+void TextureStreamer::SwapPending(unsigned int index)
+{
+    TextureArray &array = mArrays[index];
+    PendingArray &pending = array.pending;
+    ReleaseArray(array);
+    mPendingBytes -= pending.bytes;
+
+    array.texture = pending.texture;
+    array.view = pending.view;
+    array.residentMip = pending.residentMip;
+    array.sliceCount = static_cast<unsigned int>(pending.slices.size());
+    for (unsigned int mip = array.residentMip; mip < array.mipCount; mip++)
+    {
+        mResidentBytes += MipBytes(array.width, array.height, mip) * array.sliceCount;
+    }
+
+    //Slices added by this rebuild can be drawn from now, unless their texture moved on since
+    for (unsigned int slice = 0; slice < array.sliceCount; slice++)
+    {
+        const TextureHandle handle = pending.slices[slice];
+        if (handle != NoTexture && slice < array.slices.size() && array.slices[slice] == handle)
+        {
+            mTextures[handle].array = index;
+            mTextures[handle].slice = slice;
+        }
+    }
+    pending = PendingArray();
+}
+
+void TextureStreamer::ReleasePending(TextureArray &array)
+{
+    //Uploads still queued for it hold their own reference
+    PendingArray &pending = array.pending;
+    if (pending.texture)
+    {
+        mPendingBytes -= pending.bytes;
+        pending.texture->Release();
+        pending.view->Release();
+    }
+    pending = PendingArray();
+}
+
+void TextureStreamer::ReleaseArray(TextureArray &array)
+{
+    if (array.texture)
+    {
+        for (unsigned int mip = array.residentMip; mip < array.mipCount; mip++)
+        {
+            mResidentBytes -= MipBytes(array.width, array.height, mip) * array.sliceCount;
+        }
+        array.texture->Release();
+        array.view->Release();
+    }
+    array.texture = nullptr;
+    array.view = nullptr;
+}
+
+//Drops the most detailed mip of the least recently used array that was last used before usedSince
+bool TextureStreamer::EvictOne(ID3D11DeviceContext *context, unsigned long long usedSince)
+{
+    unsigned int oldest = NoArray;
+    for (unsigned int i = 0; i < mArrays.size(); i++)
+    {
+        const TextureArray &array = mArrays[i];
+        if (array.texture && !array.loading && !array.pending.texture && array.residentMip < array.lowMip && array.lastUsedFrame < usedSince &&
+            (oldest == NoArray || array.lastUsedFrame < mArrays[oldest].lastUsedFrame))
+        {
+            oldest = i;
+        }
+    }
+
+    if (oldest == NoArray)
+    {
+        return false;
+    }
+
+    TextureArray &array = mArrays[oldest];
+    const unsigned long long bytes = MipBytes(array.width, array.height, array.residentMip) * array.sliceCount;
+    if (!Rebuild(context, oldest, array.residentMip + 1, nullptr, 0))
+    {
+        return false;
+    }
+
+    mEvictedBytes += bytes;
+    return true;
+}
+
+std::string TextureStreamer::GetChainPath(const std::string &path)const
+{
+    //Named after the source path
+    unsigned long long hash = fnvOffsetBasis;
+    HashFnv1a(hash, path.data(), path.size());
+    return GetCacheFilePath(mDirectory, hash, ".mips");
+}
+
+unsigned long long TextureStreamer::MipBytes(unsigned int width, unsigned int height, unsigned int mip)
+{
+    return LevelBytes(width, height, mip);
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <d3d11.h>
+#include <directxmath.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Camera.h"
+#include "JobSystem.h"
+#include "UploadQueue.h"
+
+using namespace DirectX;
+
+typedef unsigned int TextureHandle;
+
+struct TextureStreamingStats
+{
+    unsigned long long residentBytes = 0;   //GPU memory held by streamed mips right now
+    unsigned long long budgetBytes = 0;
+    unsigned long long streamedBytes = 0;   //Mip data uploaded since start, for bandwidth
+    unsigned long long evictedBytes = 0;    //Mip data dropped to stay in budget since start
+    unsigned int textures = 0;
+    unsigned int arrays = 0;                //Texture arrays the textures are packed into
+    unsigned int residentMips = 0;          //Mip levels resident over all textures
+    unsigned int wantedMips = 0;            //Mip levels the last frame asked for over all textures
+    unsigned int pendingLoads = 0;
+};
+
+//Streams texture mips in and out to stay inside a GPU memory budget. Each texture is
+//decoded once into a mip chain file in the cache directory, after that only the mips
+//a frame needs are read back. Textures of the same size are packed into the slices of
+//one Texture2DArray, so draws using any of them share a view and only differ in the
+//slice they sample. An array is streamed as a whole: the small mips come in first and
+//are never evicted, the larger ones are loaded on job system workers for every slice
+//when something using one of them covers enough of the screen, and the least recently
+//used arrays drop theirs when the budget runs out. All D3D calls happen in Update on the
+//render thread. New mips go through the upload queue, a rebuilt array replaces the
+//current one once they are sent.
+class TextureStreamer
+{
+public:
+    TextureStreamer();
+    ~TextureStreamer();
+
+    void Init(ID3D11Device *device, JobSystem *jobs, UploadQueue *uploads, unsigned long long budgetBytes, const std::string &cacheDirectory);
+    void Shutdown();
+
+    //Start streaming a file, the view is a placeholder until its low mips are in
+    TextureHandle Register(const std::string &path);
+    //Rebuild every texture loaded from path, for when the file changed on disk
+    void Reload(const std::string &path);
+
+    //Array holding the texture and the slice it is in, for a Texture2DArray in the shader
+    ID3D11ShaderResourceView *GetView(TextureHandle handle)const;
+    unsigned int GetSlice(TextureHandle handle)const;
+
+    //Ask for enough detail to cover screenPixels, call for every visible use each frame
+    void Request(TextureHandle handle, float screenPixels);
+
+    //Height in pixels of a bounding sphere on screen
+    static float ProjectedSize(const Camera &camera, float screenHeight, FXMVECTOR center, float radius);
+
+    //Apply finished loads, start new ones and evict down to the budget, call once per frame
+    void Update(ID3D11DeviceContext *context);
+
+    void SetBudget(unsigned long long budgetBytes);
+    TextureStreamingStats GetStats()const;
+
+private:
+    static const unsigned int NoArray = ~0u;
+    static const TextureHandle NoTexture = ~0u;
+
+    struct StreamedTexture
+    {
+        std::string path;
+        unsigned int array = NoArray;       //Where it can be sampled, NoArray until its first mips are in
+        unsigned int slice = 0;
+        unsigned int generation = 0;        //Bumped on reload so stale first loads are dropped
+        bool loading = false;               //First load in flight
+    };
+
+    //A rebuilt array waiting on the upload queue for its new mips
+    struct PendingArray
+    {
+        ID3D11Texture2D *texture = nullptr;
+        ID3D11ShaderResourceView *view = nullptr;
+        std::vector<TextureHandle> slices;  //What it was built with
+        unsigned int residentMip = 0;
+        unsigned long long bytes = 0;       //Of the new mips, counted against the budget until the swap
+        UploadTicket upload = 0;            //Last of its uploads
+    };
+
+    //Textures of one size in the slices of a Texture2DArray
+    struct TextureArray
+    {
+        ID3D11Texture2D *texture = nullptr;
+        ID3D11ShaderResourceView *view = nullptr;
+        unsigned int width = 0;
+        unsigned int height = 0;
+        unsigned int mipCount = 0;
+        unsigned int lowMip = 0;            //First mip that is always resident
+        unsigned int residentMip = 0;       //Most detailed resident mip, mipCount when nothing is resident
+        unsigned int sliceCount = 0;        //Of the current array texture
+        std::vector<TextureHandle> slices;  //Texture of every slice, NoTexture for one left by a reload at another size
+        unsigned int wantedMip = 0;
+        float requestedPixels = 0.0f;       //Largest request for any slice this frame
+        unsigned long long lastUsedFrame = 0;
+        unsigned int generation = 0;        //Bumped when slices are added so stale loads are dropped
+        bool loading = false;
+        PendingArray pending;
+    };
+
+    //Result of a worker job, applied by Update
+    struct MipLoad
+    {
+        TextureHandle handle = 0;           //Texture of a first load
+        unsigned int array = NoArray;       //Array of a detail load
+        unsigned int generation = 0;        //Of the texture or the array
+        unsigned int width = 0;
+        unsigned int height = 0;
+        unsigned int mipCount = 0;
+        unsigned int firstMip = 0;
+        std::vector<TextureHandle> textures;                //Whose mips are in levels
+        std::vector<std::vector<unsigned char>> levels;    //Mips firstMip.. of each texture in turn
+        unsigned long long bytes = 0;                      //Counted against the budget while in flight
+        bool initial = false;                              //Brings in a texture's whole chain from the low mip down
+        bool succeeded = false;
+        std::string failedPath;
+    };
+
+    void StartTextureLoad(TextureHandle handle, bool rebuildChain);
+    void StartArrayLoad(unsigned int array, unsigned int firstMip, unsigned int endMip);
+    void ApplyArrayLoad(ID3D11DeviceContext *context, MipLoad &load);
+    void ApplyTextureLoads(ID3D11DeviceContext *context, std::vector<MipLoad> &loads, std::vector<MipLoad> &deferred);
+    bool Rebuild(ID3D11DeviceContext *context, unsigned int array, unsigned int firstMip, MipLoad *const *loads, size_t loadCount);
+    void SwapPending(unsigned int array);
+    void ReleasePending(TextureArray &array);
+    void ReleaseArray(TextureArray &array);
+    bool EvictOne(ID3D11DeviceContext *context, unsigned long long usedSince);
+    std::string GetChainPath(const std::string &path)const;
+
+    static unsigned long long MipBytes(unsigned int width, unsigned int height, unsigned int mip);
+
+    ID3D11Device *mDevice = nullptr;
+    JobSystem *mJobs = nullptr;
+    UploadQueue *mUploads = nullptr;
+    JobCounter mLoadJobs;
+    std::string mDirectory;
+    ID3D11Texture2D *mPlaceholder = nullptr;
+    ID3D11ShaderResourceView *mPlaceholderView = nullptr;
+
+    std::vector<StreamedTexture> mTextures;
+    std::vector<TextureArray> mArrays;
+    unsigned long long mFrame = 1;
+    unsigned long long mBudget = 0;
+    unsigned long long mResidentBytes = 0;
+    unsigned long long mStreamedBytes = 0;
+    unsigned long long mEvictedBytes = 0;
+    unsigned long long mPendingBytes = 0;
+    unsigned int mPendingLoads = 0;
+
+    std::mutex mLoadLock;
+    std::vector<MipLoad> mFinishedLoads;    //Guarded by mLoadLock
+};
@@ -0,0 +1,344 @@
+#include "TransformHierarchy.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <chrono>
+
+//Depths narrower than this are updated on the calling thread
+const unsigned int minQuadsPerJob = 256;
+const unsigned int maxTransformJobs = 64;
+
+//Four identity transforms, what padding slots hold
+static JointQuad IdentityQuad()
+{
+    JointQuad quad = {};
+    quad.rw = XMFLOAT4A(1.0f, 1.0f, 1.0f, 1.0f);
+    quad.sx = quad.rw;
+    quad.sy = quad.rw;
+    quad.sz = quad.rw;
+    return quad;
+}
+
+TransformHierarchy::TransformHierarchy()
+{
+}
+
+TransformHierarchy::~TransformHierarchy()
+{
+}
+
+void TransformHierarchy::Reserve(unsigned int nodes)
+{
+    mParents.reserve(nodes);
+    mSlots.reserve(nodes);
+    mLocal.reserve((nodes + 3) / 4);
+    mParentSlots.reserve(nodes);
+    mDirty.reserve(nodes);
+    mWorld.reserve(nodes);
+}
+
+void TransformHierarchy::Clear()
+{
+    mParents.clear();
+    mSlots.clear();
+    mLocal.clear();
+    mParentSlots.clear();
+    mDirty.clear();
+    mWorld.clear();
+    mLevelStarts.clear();
+    mReorder = false;
+    mStats = TransformStats();
+}
+
+TransformHandle TransformHierarchy::Add(TransformHandle parent, const JointPose &local)
+{
+    assert(parent == InvalidTransform || parent < mParents.size());
+
+    //Goes on the end of the slots until the next Update puts it in its place
+    const TransformHandle node = static_cast<TransformHandle>(mParents.size());
+    const unsigned int slot = static_cast<unsigned int>(mParentSlots.size());
+    if (slot % 4 == 0)
+    {
+        mLocal.push_back(IdentityQuad());
+    }
+    mParents.push_back(parent);
+    mSlots.push_back(slot);
+    mParentSlots.push_back(-1);
+    mDirty.push_back(1);
+    XMFLOAT4X4A identity;
+    XMStoreFloat4x4A(&identity, XMMatrixIdentity());
+    mWorld.push_back(identity);
+    mReorder = true;
+
+    SetLocal(node, local);
+    return node;
+}
+
+void TransformHierarchy::SetParent(TransformHandle node, TransformHandle parent)
+{
+    assert(node < mParents.size() && (parent == InvalidTransform || parent < mParents.size()));
+    for (TransformHandle above = parent; above != InvalidTransform; above = mParents[above])
+    {
+        assert(above != node && "A node can't be moved below itself");
+    }
+
+    mParents[node] = parent;
+    mDirty[mSlots[node]] = 1;
+    mReorder = true;
+}
+
+TransformHandle TransformHierarchy::GetParent(TransformHandle node)const
+{
+    return mParents[node];
+}
+
+float &TransformHierarchy::Lane(XMFLOAT4A JointQuad::*component, unsigned int slot)
+{
+    return (&(mLocal[slot / 4].*component).x)[slot % 4];
+}
+
+float TransformHierarchy::Lane(XMFLOAT4A JointQuad::*component, unsigned int slot)const
+{
+    return (&(mLocal[slot / 4].*component).x)[slot % 4];
+}
+
+void TransformHierarchy::SetLocal(TransformHandle node, const JointPose &local)
+{
+    SetTranslation(node, local.translation);
+    SetRotation(node, local.rotation);
+    SetScale(node, local.scale);
+}
+
+void TransformHierarchy::SetTranslation(TransformHandle node, const XMFLOAT3 &translation)
+{
+    const unsigned int slot = mSlots[node];
+    Lane(&JointQuad::tx, slot) = translation.x;
+    Lane(&JointQuad::ty, slot) = translation.y;
+    Lane(&JointQuad::tz, slot) = translation.z;
+    mDirty[slot] = 1;
+}
+
+void TransformHierarchy::SetRotation(TransformHandle node, const XMFLOAT4 &rotation)
+{
+    const unsigned int slot = mSlots[node];
+    Lane(&JointQuad::rx, slot) = rotation.x;
+    Lane(&JointQuad::ry, slot) = rotation.y;
+    Lane(&JointQuad::rz, slot) = rotation.z;
+    Lane(&JointQuad::rw, slot) = rotation.w;
+    mDirty[slot] = 1;
+}
+
+void TransformHierarchy::SetScale(TransformHandle node, const XMFLOAT3 &scale)
+{
+    const unsigned int slot = mSlots[node];
+    Lane(&JointQuad::sx, slot) = scale.x;
+    Lane(&JointQuad::sy, slot) = scale.y;
+    Lane(&JointQuad::sz, slot) = scale.z;
+    mDirty[slot] = 1;
+}
+
+JointPose TransformHierarchy::GetLocal(TransformHandle node)const
+{
+    const unsigned int slot = mSlots[node];
+    JointPose local;
+    local.translation = XMFLOAT3(Lane(&JointQuad::tx, slot), Lane(&JointQuad::ty, slot), Lane(&JointQuad::tz, slot));
+    local.rotation = XMFLOAT4(Lane(&JointQuad::rx, slot), Lane(&JointQuad::ry, slot), Lane(&JointQuad::rz, slot), Lane(&JointQuad::rw, slot));
+    local.scale = XMFLOAT3(Lane(&JointQuad::sx, slot), Lane(&JointQuad::sy, slot), Lane(&JointQuad::sz, slot));
+    return local;
+}
+
+//Sorts the slots breadth first, every depth after the roots made of the children of the
+//depth before in the order of their parents, and marks everything dirty
+void TransformHierarchy::Reorder()
+{
+    const unsigned int count = GetCount();
+
+    //Children of every node in the order they were added
+    std::vector<unsigned int> childStarts(count + 1, 0);
+    for (TransformHandle parent : mParents)
+    {
+        if (parent != InvalidTransform)
+        {
+            childStarts[parent + 1]++;
+        }
+    }
+    for (unsigned int i = 0; i < count; i++)
+    {
+        childStarts[i + 1] += childStarts[i];
+    }
+    std::vector<TransformHandle> children(childStarts[count]);
+    std::vector<unsigned int> childCursor(childStarts.begin(), childStarts.end() - 1);
+    std::vector<TransformHandle> order;
+    order.reserve(count);
+    for (TransformHandle node = 0; node < count; node++)
+    {
+        if (mParents[node] == InvalidTransform)
+        {
+            order.push_back(node);
+        }
+        else
+        {
+            children[childCursor[mParents[node]]++] = node;
+        }
+    }
+
+    //Walk one depth at a time, each depth starting on a fresh quad
+    std::vector<JointQuad> oldLocal;
+    oldLocal.swap(mLocal);
+    std::vector<unsigned int> oldSlots(mSlots);
+    const JointQuad identityQuad = IdentityQuad();
+
+    mParentSlots.clear();
+    mLevelStarts.clear();
+    size_t levelBegin = 0;
+    while (levelBegin < order.size())
+    {
+        const size_t levelEnd = order.size();
+        mLevelStarts.push_back(static_cast<unsigned int>(mParentSlots.size()));
+        for (size_t i = levelBegin; i < levelEnd; i++)
+        {
+            const TransformHandle node = order[i];
+            const unsigned int slot = static_cast<unsigned int>(mParentSlots.size());
+            if (slot % 4 == 0)
+            {
+                mLocal.push_back(identityQuad);
+            }
+            mSlots[node] = slot;
+            mParentSlots.push_back(mParents[node] == InvalidTransform ? -1 : static_cast<int>(mSlots[mParents[node]]));
+
+            //Copy the local transform over from where the node was
+            const unsigned int from = oldSlots[node];
+            JointQuad &to = mLocal[slot / 4];
+            const JointQuad &source = oldLocal[from / 4];
+            XMFLOAT4A JointQuad::*components[] = { &JointQuad::tx, &JointQuad::ty, &JointQuad::tz, &JointQuad::rx, &JointQuad::ry,
+                &JointQuad::rz, &JointQuad::rw, &JointQuad::sx, &JointQuad::sy, &JointQuad::sz };
+            for (XMFLOAT4A JointQuad::*component : components)
+            {
+                (&(to.*component).x)[slot % 4] = (&(source.*component).x)[from % 4];
+            }
+
+            order.insert(order.end(), children.begin() + childStarts[node], children.begin() + childStarts[node + 1]);
+        }
+        while (mParentSlots.size() % 4 != 0)
+        {
+            mParentSlots.push_back(-1);
+        }
+        levelBegin = levelEnd;
+    }
+    mLevelStarts.push_back(static_cast<unsigned int>(mParentSlots.size()));
+    assert(order.size() == count && "Every node has to be reachable from a root");
+
+    //Padding is never dirty, so it never counts as recomputed
+    mDirty.assign(mParentSlots.size(), 0);
+    for (TransformHandle node = 0; node < count; node++)
+    {
+        mDirty[mSlots[node]] = 1;
+    }
+    XMFLOAT4X4A identity;
+    XMStoreFloat4x4A(&identity, XMMatrixIdentity());
+    mWorld.assign(mParentSlots.size(), identity);
+    mReorder = false;
+}
+
+void TransformHierarchy::Update(JobSystem *jobs)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    mStats.reordered = mReorder;
+    if (mReorder)
+    {
+        Reorder();
+    }
+
+    //Parents are a depth ahead, so by the time a depth is done its dirty flags are final
+    //for the children to read
+    const unsigned int levels = mLevelStarts.empty() ? 0 : static_cast<unsigned int>(mLevelStarts.size()) - 1;
+    for (unsigned int level = 0; level < levels; level++)
+    {
+        const unsigned int begin = mLevelStarts[level] / 4;
+        const unsigned int end = mLevelStarts[level + 1] / 4;
+        if (jobs && end - begin >= 2 * minQuadsPerJob)
+        {
+            jobs->ParallelFor(end - begin, minQuadsPerJob, maxTransformJobs, [this, begin](unsigned int first, unsigned int last, unsigned int)
+            {
+                UpdateQuads(begin + first, begin + last);
+            });
+        }
+        else
+        {
+            UpdateQuads(begin, end);
+        }
+    }
+
+    unsigned int recomputed = 0;
+    for (unsigned char &dirty : mDirty)
+    {
+        recomputed += dirty;
+        dirty = 0;
+    }
+
+    mStats.nodes = GetCount();
+    mStats.levels = levels;
+    mStats.recomputed = recomputed;
+    mStats.ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void TransformHierarchy::UpdateQuads(unsigned int begin, unsigned int end)
+{
+    for (unsigned int q = begin; q < end; q++)
+    {
+        //A node is dirty when it changed or its parent was recomputed
+        const unsigned int base = q * 4;
+        bool anyDirty = false;
+        for (unsigned int lane = 0; lane < 4; lane++)
+        {
+            const int parent = mParentSlots[base + lane];
+            if (parent >= 0 && mDirty[parent])
+            {
+                mDirty[base + lane] = 1;
+            }
+            anyDirty |= mDirty[base + lane] != 0;
+        }
+        if (!anyDirty)
+        {
+            continue;
+        }
+
+        //Compose all four, the clean ones come out as they were
+        LocalQuad local;
+        ComposeQuad(mLocal[q], local);
+        const XMFLOAT4A *m = local.m;
+        for (unsigned int lane = 0; lane < 4; lane++)
+        {
+            const XMMATRIX matrix(
+                (&m[0].x)[lane], (&m[1].x)[lane], (&m[2].x)[lane], 0.0f,
+                (&m[3].x)[lane], (&m[4].x)[lane], (&m[5].x)[lane], 0.0f,
+                (&m[6].x)[lane], (&m[7].x)[lane], (&m[8].x)[lane], 0.0f,
+                (&m[9].x)[lane], (&m[10].x)[lane], (&m[11].x)[lane], 1.0f);
+
+            const int parent = mParentSlots[base + lane];
+            XMStoreFloat4x4A(&mWorld[base + lane], parent >= 0 ? matrix * XMLoadFloat4x4A(&mWorld[parent]) : matrix);
+        }
+    }
+}
+
+XMMATRIX TransformHierarchy::GetWorld(TransformHandle node)const
+{
+    return XMLoadFloat4x4A(&mWorld[mSlots[node]]);
+}
+
+void TransformHierarchy::GetWorld(TransformHandle node, XMFLOAT4X4 &world)const
+{
+    world = mWorld[mSlots[node]];
+}
+
+unsigned int TransformHierarchy::GetCount()const
+{
+    return static_cast<unsigned int>(mParents.size());
+}
+
+const TransformStats &TransformHierarchy::GetStats()const
+{
+    return mStats;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <directxmath.h>
+#include <vector>
+
+#include "Animation.h"
+#include "JobSystem.h"
+
+using namespace DirectX;
+
+typedef unsigned int TransformHandle;
+const TransformHandle InvalidTransform = 0xffffffff;
+
+//What the last Update did
+struct TransformStats
+{
+    unsigned int nodes = 0;
+    unsigned int levels = 0;
+    unsigned int recomputed = 0;                //Nodes whose world matrix was rebuilt, changed ones and everything below them
+    bool reordered = false;                     //Nodes were added or moved since the Update before
+    float ms = 0.0f;
+};
+
+//Parent and child transforms of scene objects. Nodes are kept in breadth first order,
+//every depth starting on a multiple of four, with the local transforms stored like
+//animation poses so four of them are composed per instruction. Changing a node marks it
+//dirty, Update recomputes the world matrices of dirty nodes and everything below them
+//one depth at a time, each depth split over the job system when it is wide enough.
+//Handles stay valid when the nodes are reordered.
+class TransformHierarchy
+{
+public:
+    TransformHierarchy();
+    ~TransformHierarchy();
+
+    void Reserve(unsigned int nodes);
+    void Clear();
+
+    //A root when parent is InvalidTransform
+    TransformHandle Add(TransformHandle parent = InvalidTransform, const JointPose &local = JointPose());
+
+    //Moves a node and everything below it under another parent, keeping the local transform
+    void SetParent(TransformHandle node, TransformHandle parent);
+    TransformHandle GetParent(TransformHandle node)const;
+
+    void SetLocal(TransformHandle node, const JointPose &local);
+    void SetTranslation(TransformHandle node, const XMFLOAT3 &translation);
+    void SetRotation(TransformHandle node, const XMFLOAT4 &rotation);
+    void SetScale(TransformHandle node, const XMFLOAT3 &scale);
+    JointPose GetLocal(TransformHandle node)const;
+
+    //Brings the world matrices of everything that changed up to date, jobs may be null
+    void Update(JobSystem *jobs);
+
+    //As of the last Update
+    XMMATRIX GetWorld(TransformHandle node)const;
+    void GetWorld(TransformHandle node, XMFLOAT4X4 &world)const;
+
+    unsigned int GetCount()const;
+    const TransformStats &GetStats()const;
+
+private:
+    void Reorder();
+    void UpdateQuads(unsigned int begin, unsigned int end);
+    float &Lane(XMFLOAT4A JointQuad::*component, unsigned int slot);
+    float Lane(XMFLOAT4A JointQuad::*component, unsigned int slot)const;
+
+    //Per handle, in the order nodes were added
+    std::vector<TransformHandle> mParents;
+    std::vector<unsigned int> mSlots;           //Where the node is in the breadth first arrays
+
+    //Per slot, breadth first with every depth padded to a multiple of four
+    std::vector<JointQuad> mLocal;              //Four slots each
+    std::vector<int> mParentSlots;              //-1 for roots and padding
+    std::vector<unsigned char> mDirty;
+    std::vector<XMFLOAT4X4A> mWorld;
+    std::vector<unsigned int> mLevelStarts;     //First slot of every depth, then the slot count
+
+    bool mReorder = false;
+    TransformStats mStats;
+};
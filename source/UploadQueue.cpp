@@ -0,0 +1,265 @@
+#include "UploadQueue.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "GpuResources.h"
+
+//Packing the staging segment is split over the workers in pieces about this big
+const unsigned int stagingPieceBytes = 256 * 1024;
+const unsigned int maxStagingJobs = 16;
+
+UploadQueue::UploadQueue()
+{
+}
+
+UploadQueue::~UploadQueue()
+{
+}
+
+void UploadQueue::Init(ID3D11Device *device, JobSystem *jobs, const UploadQueueSettings &settings)
+{
+    HRESULT hr = S_OK;
+    mDevice = device;
+    mJobs = jobs;
+    mRing.Init(settings.segmentBytes, settings.segmentCount, settings.frameBudget);
+
+    D3D11_BUFFER_DESC stagingDesc = {};
+    stagingDesc.Usage = D3D11_USAGE_STAGING;
+    stagingDesc.ByteWidth = settings.segmentBytes;
+    stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    D3D11_QUERY_DESC fenceDesc = {};
+    fenceDesc.Query = D3D11_QUERY_EVENT;
+
+    mStaging.assign(settings.segmentCount, nullptr);
+    mFences.assign(settings.segmentCount, nullptr);
+    mFenceValues.assign(settings.segmentCount, 0);
+    for (unsigned int i = 0; i < settings.segmentCount; i++)
+    {
+        hr = mDevice->CreateBuffer(&stagingDesc, nullptr, &mStaging[i]);
+        assert(SUCCEEDED(hr));
+        TrackGpuResource(mStaging[i], GpuCategoryStaging, "upload staging");
+        hr = mDevice->CreateQuery(&fenceDesc, &mFences[i]);
+        assert(SUCCEEDED(hr));
+    }
+}
+
+void UploadQueue::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        for (Upload &upload : mUploads)
+        {
+            upload.target->Release();
+        }
+        mUploads.clear();
+    }
+    mRing.Clear();
+
+    for (ID3D11Buffer *staging : mStaging)
+    {
+        if (staging) staging->Release();
+    }
+    for (ID3D11Query *fence : mFences)
+    {
+        if (fence) fence->Release();
+    }
+    mStaging.clear();
+    mFences.clear();
+    mFenceValues.clear();
+}
+
+UploadTicket UploadQueue::QueueBuffer(ID3D11Buffer *target, UINT offset, std::vector<unsigned char> data)
+{
+    //Nothing to send is done right away
+    if (data.empty())
+    {
+        return 0;
+    }
+
+    Upload upload;
+    upload.target = target;
+    upload.offset = offset;
+    upload.data = std::move(data);
+    return Queue(upload, 1, true);
+}
+
+UploadTicket UploadQueue::QueueTexture(ID3D11Texture2D *target, UINT subresource, UINT width, UINT rowPitch, std::vector<unsigned char> data)
+{
+    assert(rowPitch > 0 && data.size() % rowPitch == 0 && "Texture data has to be whole rows");
+    if (data.empty())
+    {
+        return 0;
+    }
+
+    Upload upload;
+    upload.target = target;
+    upload.subresource = subresource;
+    upload.width = width;
+    upload.rowPitch = rowPitch;
+    upload.data = std::move(data);
+    return Queue(upload, rowPitch, false);
+}
+
+UploadTicket UploadQueue::Queue(Upload &upload, unsigned int granularity, bool staged)
+{
+    upload.target->AddRef();
+
+    //Records and ring tickets have to stay in the same order
+    std::lock_guard<std::mutex> guard(mLock);
+    const UploadTicket ticket = mRing.Add(static_cast<unsigned int>(upload.data.size()), granularity, staged);
+    if (mUploads.empty())
+    {
+        mFirstTicket = ticket;
+    }
+    mUploads.push_back(std::move(upload));
+    return ticket;
+}
+
+void UploadQueue::Update(ID3D11DeviceContext *context)
+{
+    Retire(context);
+
+    std::vector<UploadSlice> slices;
+    int segment = -1;
+    mRing.Plan(slices, segment);
+
+    //Only this thread takes records off the front, and adding to the back of a deque keeps
+    //the others where they are, so they can be used without the lock
+    std::vector<Upload*> uploads(slices.size());
+    {
+        std::lock_guard<std::mutex> guard(mLock);
+        for (size_t i = 0; i < slices.size(); i++)
+        {
+            uploads[i] = &mUploads[static_cast<size_t>(slices[i].ticket - mFirstTicket)];
+        }
+    }
+
+    if (segment >= 0)
+    {
+        D3D11_MAPPED_SUBRESOURCE mapped = {};
+        HRESULT hr = context->Map(mStaging[segment], 0, D3D11_MAP_WRITE, 0, &mapped);
+        assert(SUCCEEDED(hr));
+        unsigned char *staging = static_cast<unsigned char*>(mapped.pData);
+
+        struct Piece
+        {
+            unsigned char *target;
+            const unsigned char *source;
+            size_t size;
+        };
+        std::vector<Piece> pieces;
+        for (size_t i = 0; i < slices.size(); i++)
+        {
+            const UploadSlice &slice = slices[i];
+            for (unsigned int done = 0; slice.staged && done < slice.size; done += stagingPieceBytes)
+            {
+                Piece piece;
+                piece.target = staging + slice.stagingOffset + done;
+                piece.source = uploads[i]->data.data() + slice.offset + done;
+                piece.size = std::min(stagingPieceBytes, slice.size - done);
+                pieces.push_back(piece);
+            }
+        }
+
+        auto copyPieces = [&](unsigned int begin, unsigned int end, unsigned int)
+        {
+            for (unsigned int i = begin; i < end; i++)
+            {
+                memcpy(pieces[i].target, pieces[i].source, pieces[i].size);
+            }
+        };
+        const unsigned int count = static_cast<unsigned int>(pieces.size());
+        if (mJobs && count > 1)
+        {
+            mJobs->ParallelFor(count, 1, maxStagingJobs, copyPieces);
+        }
+        else
+        {
+            copyPieces(0, count, 0);
+        }
+
+        context->Unmap(mStaging[segment], 0);
+    }
+
+    for (size_t i = 0; i < slices.size(); i++)
+    {
+        const UploadSlice &slice = slices[i];
+        const Upload &upload = *uploads[i];
+        if (slice.staged)
+        {
+            const D3D11_BOX box = { slice.stagingOffset, 0, 0, slice.stagingOffset + slice.size, 1, 1 };
+            context->CopySubresourceRegion(upload.target, 0, upload.offset + slice.offset, 0, 0, mStaging[segment], 0, &box);
+        }
+        else
+        {
+            const UINT firstRow = slice.offset / upload.rowPitch;
+            const D3D11_BOX box = { 0, firstRow, 0, upload.width, firstRow + slice.size / upload.rowPitch, 1 };
+            context->UpdateSubresource(upload.target, upload.subresource, &box, upload.data.data() + slice.offset, upload.rowPitch, 0);
+        }
+    }
+
+    //The event signals once the GPU is past the copies out of the segment
+    if (segment >= 0)
+    {
+        context->End(mFences[segment]);
+        mFenceValues[segment] = ++mLastFence;
+    }
+    mRing.Submit(segment >= 0 ? mLastFence : 0);
+
+    std::lock_guard<std::mutex> guard(mLock);
+    while (!mUploads.empty() && mRing.IsDone(mFirstTicket))
+    {
+        mUploads.front().target->Release();
+        mUploads.pop_front();
+        mFirstTicket++;
+    }
+}
+
+void UploadQueue::Flush(ID3D11DeviceContext *context)
+{
+    while (!mRing.IsIdle())
+    {
+        const unsigned long long uploaded = mRing.GetStats().uploadedBytes;
+        Update(context);
+        if (mRing.GetStats().uploadedBytes == uploaded)
+        {
+            //Every segment is in flight, make sure the GPU has the work and let it catch up
+            context->Flush();
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool UploadQueue::IsDone(UploadTicket ticket)const
+{
+    return mRing.IsDone(ticket);
+}
+
+UploadRingStats UploadQueue::GetStats()const
+{
+    return mRing.GetStats();
+}
+
+void UploadQueue::Retire(ID3D11DeviceContext *context)
+{
+    //Never waits, a segment whose event hasn't signalled stays busy for another frame
+    unsigned long long completed = 0;
+    for (size_t i = 0; i < mFences.size(); i++)
+    {
+        BOOL done = FALSE;
+        if (mFenceValues[i] != 0 && context->GetData(mFences[i], &done, sizeof(done), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK && done)
+        {
+            completed = std::max(completed, mFenceValues[i]);
+            mFenceValues[i] = 0;
+        }
+    }
+
+    if (completed > 0)
+    {
+        mRing.Retire(completed);
+    }
+}
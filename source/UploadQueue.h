@@ -0,0 +1,75 @@
+#pragma once
+
+#include <d3d11.h>
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "JobSystem.h"
+#include "UploadRing.h"
+
+struct UploadQueueSettings
+{
+    unsigned int segmentBytes = 4 * 1024 * 1024;    //Staging memory one frame can fill
+    unsigned int segmentCount = 3;                  //Frames of staging the GPU may be behind
+    unsigned int frameBudget = 8 * 1024 * 1024;     //Bytes copied per frame, staged and direct
+};
+
+//Moves mesh and texture data into default usage resources without stalling a frame on it.
+//Data can be queued from any thread, Update copies up to the frame budget of it on the
+//render thread, big uploads carry over to the next frames. Buffer data goes through a
+//ring of persistent staging buffers, packed on job system workers and copied on the GPU
+//with CopySubresourceRegion. A segment of the ring is only filled again once the event
+//query ending the frame that used it has signalled. D3D11 can't copy a buffer into a
+//texture, so texture data is sent with UpdateSubresource a band of rows at a time.
+//The scheduling lives in UploadRing.
+class UploadQueue
+{
+public:
+    UploadQueue();
+    ~UploadQueue();
+
+    void Init(ID3D11Device *device, JobSystem *jobs, const UploadQueueSettings &settings = UploadQueueSettings());
+    void Shutdown();
+
+    //Both keep a reference to the target until the data is sent
+    UploadTicket QueueBuffer(ID3D11Buffer *target, UINT offset, std::vector<unsigned char> data);
+    UploadTicket QueueTexture(ID3D11Texture2D *target, UINT subresource, UINT width, UINT rowPitch, std::vector<unsigned char> data);
+
+    //Sends this frame's share of the queue, call once per frame on the immediate context
+    void Update(ID3D11DeviceContext *context);
+    //Sends everything queued, waiting on the GPU for staging when it has to. For loading screens.
+    void Flush(ID3D11DeviceContext *context);
+
+    //All of the upload was sent, draws issued from now on see the data
+    bool IsDone(UploadTicket ticket)const;
+
+    UploadRingStats GetStats()const;
+
+private:
+    struct Upload
+    {
+        ID3D11Resource *target = nullptr;
+        UINT subresource = 0;
+        UINT offset = 0;                    //Into a buffer target
+        UINT width = 0;                     //Texels in a row of a texture target
+        UINT rowPitch = 0;
+        std::vector<unsigned char> data;
+    };
+
+    UploadTicket Queue(Upload &upload, unsigned int granularity, bool staged);
+    void Retire(ID3D11DeviceContext *context);
+
+    ID3D11Device *mDevice = nullptr;
+    JobSystem *mJobs = nullptr;
+    UploadRing mRing;
+    std::vector<ID3D11Buffer*> mStaging;            //One per ring segment
+    std::vector<ID3D11Query*> mFences;              //Event ending the frame that last used each segment
+    std::vector<unsigned long long> mFenceValues;   //0 while the segment isn't in flight
+    unsigned long long mLastFence = 0;
+
+    std::mutex mLock;
+    std::deque<Upload> mUploads;                    //Guarded by mLock, in ticket order
+    UploadTicket mFirstTicket = 1;                  //Ticket of mUploads.front()
+};
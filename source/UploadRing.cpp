@@ -0,0 +1,184 @@
+#include "UploadRing.h"
+
+#include <assert.h>
+
+#include <algorithm>
+
+//Staged slices start on this so the copies into the segment stay aligned
+const unsigned int stagingAlignment = 16;
+
+UploadRing::UploadRing()
+{
+}
+
+UploadRing::~UploadRing()
+{
+}
+
+void UploadRing::Init(unsigned int segmentBytes, unsigned int segmentCount, unsigned int frameBudget)
+{
+    std::lock_guard<std::mutex> guard(mLock);
+    assert(segmentBytes > 0 && segmentCount > 0 && frameBudget > 0);
+    mSegmentBytes = segmentBytes;
+    mFrameBudget = frameBudget;
+    mSegmentFences.assign(segmentCount, 0);
+    mNextSegment = 0;
+    mPlannedSegment = -1;
+}
+
+void UploadRing::Clear()
+{
+    std::lock_guard<std::mutex> guard(mLock);
+    mPending.clear();
+    std::fill(mSegmentFences.begin(), mSegmentFences.end(), 0);
+    mPlannedSegment = -1;
+    mStats = UploadRingStats();
+}
+
+UploadTicket UploadRing::Add(unsigned int size, unsigned int granularity, bool staged)
+{
+    std::lock_guard<std::mutex> guard(mLock);
+    assert(granularity > 0 && (!staged || granularity <= mSegmentBytes) && "A slice has to fit in a segment");
+
+    PendingUpload upload;
+    upload.ticket = mNextTicket++;
+    upload.size = size;
+    upload.granularity = granularity;
+    upload.staged = staged;
+    mPending.push_back(upload);
+
+    mStats.pendingUploads++;
+    mStats.pendingBytes += size;
+    return upload.ticket;
+}
+
+void UploadRing::Retire(unsigned long long completedFence)
+{
+    std::lock_guard<std::mutex> guard(mLock);
+    for (unsigned long long &fence : mSegmentFences)
+    {
+        if (fence != 0 && fence <= completedFence)
+        {
+            fence = 0;
+        }
+    }
+}
+
+void UploadRing::Plan(std::vector<UploadSlice> &slices, int &segment)
+{
+    std::lock_guard<std::mutex> guard(mLock);
+    slices.clear();
+    segment = -1;
+    mPlannedSegment = -1;
+    mStats.slices = 0;
+    mStats.bytes = 0;
+
+    //Segments are filled in turn, so the next one is also the one submitted longest ago
+    const bool segmentFree = !mSegmentFences.empty() && mSegmentFences[mNextSegment] == 0;
+
+    unsigned int budget = mFrameBudget;
+    unsigned int stagingUsed = 0;
+    for (PendingUpload &upload : mPending)
+    {
+        //Every upload has to make progress, a granule bigger than the budget goes out on its own
+        const unsigned int left = upload.size - upload.sent;
+        unsigned int room = budget;
+        if (upload.staged)
+        {
+            if (!segmentFree)
+            {
+                mStats.stalls++;
+                break;
+            }
+            stagingUsed = (stagingUsed + stagingAlignment - 1) / stagingAlignment * stagingAlignment;
+            room = std::min(room, stagingUsed < mSegmentBytes ? mSegmentBytes - stagingUsed : 0u);
+        }
+
+        unsigned int size = left;
+        if (size > room)
+        {
+            size = room / upload.granularity * upload.granularity;
+            if (size == 0)
+            {
+                //Wait for the next frame, unless nothing went out yet and a granule is bigger than
+                //the whole budget. An empty segment always has room for one.
+                if (!slices.empty())
+                {
+                    break;
+                }
+                size = std::min(left, upload.granularity);
+            }
+        }
+
+        UploadSlice slice;
+        slice.ticket = upload.ticket;
+        slice.offset = upload.sent;
+        slice.size = size;
+        slice.staged = upload.staged;
+        slice.last = upload.sent + size == upload.size;
+        if (upload.staged)
+        {
+            slice.stagingOffset = stagingUsed;
+            stagingUsed += size;
+            segment = static_cast<int>(mNextSegment);
+        }
+        slices.push_back(slice);
+
+        upload.sent += size;
+        budget -= std::min(budget, size);
+        mStats.slices++;
+        mStats.bytes += size;
+        if (!slice.last || budget == 0)
+        {
+            break;
+        }
+    }
+    mPlannedSegment = segment;
+    mPlannedBytes = mStats.bytes;
+}
+
+void UploadRing::Submit(unsigned long long fence)
+{
+    std::lock_guard<std::mutex> guard(mLock);
+    if (mPlannedSegment >= 0)
+    {
+        assert(fence != 0 && "Fence 0 means the segment is free");
+        mSegmentFences[mPlannedSegment] = fence;
+        mNextSegment = (mNextSegment + 1) % static_cast<unsigned int>(mSegmentFences.size());
+        mPlannedSegment = -1;
+    }
+
+    //Everything that was planned is out now
+    while (!mPending.empty() && mPending.front().sent == mPending.front().size)
+    {
+        mStats.pendingUploads--;
+        mPending.pop_front();
+    }
+    mStats.pendingBytes -= mPlannedBytes;
+    mStats.uploadedBytes += mPlannedBytes;
+    mPlannedBytes = 0;
+}
+
+bool UploadRing::IsDone(UploadTicket ticket)const
+{
+    //Uploads finish in ticket order
+    std::lock_guard<std::mutex> guard(mLock);
+    return ticket < (mPending.empty() ? mNextTicket : mPending.front().ticket);
+}
+
+bool UploadRing::IsIdle()const
+{
+    std::lock_guard<std::mutex> guard(mLock);
+    return mPending.empty();
+}
+
+UploadRingStats UploadRing::GetStats()const
+{
+    std::lock_guard<std::mutex> guard(mLock);
+    UploadRingStats stats = mStats;
+    for (unsigned long long fence : mSegmentFences)
+    {
+        stats.segmentsInFlight += fence != 0 ? 1 : 0;
+    }
+    return stats;
+}
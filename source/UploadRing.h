@@ -0,0 +1,86 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+//Identifies one queued upload, 0 is never handed out
+typedef unsigned long long UploadTicket;
+
+//Part of an upload that goes out this frame
+struct UploadSlice
+{
+    UploadTicket ticket = 0;
+    unsigned int offset = 0;            //Into the upload's data
+    unsigned int size = 0;
+    unsigned int stagingOffset = 0;     //Into the frame's staging segment, staged uploads only
+    bool staged = false;
+    bool last = false;                  //Finishes the upload
+};
+
+struct UploadRingStats
+{
+    unsigned int pendingUploads = 0;
+    unsigned long long pendingBytes = 0;
+    unsigned int slices = 0;            //In the last Plan
+    unsigned int bytes = 0;             //Planned in the last Plan, staged and direct
+    unsigned int segmentsInFlight = 0;
+    unsigned long long uploadedBytes = 0;   //Since start
+    unsigned long long stalls = 0;      //Frames that had staged work waiting but every segment still in flight
+};
+
+//Scheduling side of the upload queue, with no D3D in it. Uploads are sliced into a fixed
+//number of bytes per frame and go out in the order they were added. Staged uploads are
+//packed into one segment of a ring of staging segments per frame, a segment can be
+//filled again once the fence it was submitted with has completed. Direct uploads only
+//count against the frame budget. Add can be called from any thread, everything else
+//from the thread that submits the copies.
+class UploadRing
+{
+public:
+    UploadRing();
+    ~UploadRing();
+
+    void Init(unsigned int segmentBytes, unsigned int segmentCount, unsigned int frameBudget);
+    void Clear();
+
+    //Slices are whole multiples of granularity, the row pitch of a texture or 1 for a buffer
+    UploadTicket Add(unsigned int size, unsigned int granularity, bool staged);
+
+    //Frees the segments submitted with fences up to completedFence
+    void Retire(unsigned long long completedFence);
+
+    //Slices for this frame, segment is the staging segment the staged ones go to or -1 when
+    //there are none. Follow with Submit.
+    void Plan(std::vector<UploadSlice> &slices, int &segment);
+
+    //The planned slices were issued, the segment stays busy until fence completes
+    void Submit(unsigned long long fence);
+
+    //Every slice of the upload was issued, so draws recorded from now on see the data
+    bool IsDone(UploadTicket ticket)const;
+    bool IsIdle()const;
+
+    UploadRingStats GetStats()const;
+
+private:
+    struct PendingUpload
+    {
+        UploadTicket ticket = 0;
+        unsigned int size = 0;
+        unsigned int granularity = 1;
+        unsigned int sent = 0;          //Bytes already planned
+        bool staged = false;
+    };
+
+    mutable std::mutex mLock;
+    std::deque<PendingUpload> mPending;         //In ticket order
+    std::vector<unsigned long long> mSegmentFences;     //0 while the segment is free
+    unsigned int mSegmentBytes = 0;
+    unsigned int mFrameBudget = 0;
+    unsigned int mNextSegment = 0;
+    int mPlannedSegment = -1;
+    unsigned int mPlannedBytes = 0;
+    UploadTicket mNextTicket = 1;
+    UploadRingStats mStats;
+};
@@ -0,0 +1,379 @@
+#pragma once
+
+#include <d3d11.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <array>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "Assets.h"
+
+//Vertex formats are declared once as a list of attributes, each a field of a vertex struct
+//and how it is stored on the GPU. The format works out its stride and offsets at compile
+//time and generates the input layout, the HLSL input fields and the routines that pack
+//arrays of the struct into it. Every attribute is unrolled into the copy loops, so a compact
+//format costs no branches per vertex.
+//
+//    typedef VertexFormat<VertexAttribute<VertexPosition, VertexFloat3>, ...> MyFormat;
+
+//Fields an attribute can come from, with the shader input they turn into
+struct VertexPosition
+{
+    typedef VERTEX Source;
+    typedef XMFLOAT3 Type;
+    static const char *GetSemantic() { return "POSITION"; }
+    static const char *GetHlslField() { return "float4 position : POSITION;"; }       //w comes in as 1
+    static const Type &Get(const VERTEX &vertex) { return vertex.position; }
+    static void Set(VERTEX &vertex, const Type &value) { vertex.position = value; }
+};
+
+struct VertexNormal
+{
+    typedef VERTEX Source;
+    typedef XMFLOAT3 Type;
+    static const char *GetSemantic() { return "NORMAL"; }
+    static const char *GetHlslField() { return "float3 normal : NORMAL;"; }
+    static const Type &Get(const VERTEX &vertex) { return vertex.normal; }
+    static void Set(VERTEX &vertex, const Type &value) { vertex.normal = value; }
+};
+
+//The normal with the baked occlusion in w, so the occlusion rides along in the normal's
+//padding when the normal is packed into four bytes
+struct VertexNormalOcclusion
+{
+    typedef VERTEX Source;
+    typedef XMFLOAT4 Type;
+    static const char *GetSemantic() { return "NORMAL"; }
+    static const char *GetHlslField() { return "float4 normal : NORMAL;"; }           //w is the occlusion
+    static Type Get(const VERTEX &vertex) { return XMFLOAT4(vertex.normal.x, vertex.normal.y, vertex.normal.z, vertex.occlusion); }
+    static void Set(VERTEX &vertex, const Type &value)
+    {
+        vertex.normal = XMFLOAT3(value.x, value.y, value.z);
+        vertex.occlusion = value.w;
+    }
+};
+
+struct VertexTexcoord
+{
+    typedef VERTEX Source;
+    typedef XMFLOAT2 Type;
+    static const char *GetSemantic() { return "TEXCOORD"; }
+    static const char *GetHlslField() { return "float2 tex : TEXCOORD;"; }
+    static const Type &Get(const VERTEX &vertex) { return vertex.texture; }
+    static void Set(VERTEX &vertex, const Type &value) { vertex.texture = value; }
+};
+
+struct VertexJoints
+{
+    typedef VertexSkin Source;
+    typedef unsigned char Type[4];
+    static const char *GetSemantic() { return "BLENDINDICES"; }
+    static const char *GetHlslField() { return "uint4 joints : BLENDINDICES;"; }
+    static const Type &Get(const VertexSkin &skin) { return skin.joints; }
+    static void Set(VertexSkin &skin, const Type &value) { memcpy(skin.joints, value, sizeof(Type)); }
+};
+
+struct VertexWeights
+{
+    typedef VertexSkin Source;
+    typedef unsigned char Type[4];
+    static const char *GetSemantic() { return "BLENDWEIGHT"; }
+    static const char *GetHlslField() { return "float4 weights : BLENDWEIGHT;"; }
+    static const Type &Get(const VertexSkin &skin) { return skin.weights; }
+    static void Set(VertexSkin &skin, const Type &value) { memcpy(skin.weights, value, sizeof(Type)); }
+};
+
+//GPU storage of an attribute, Encode and Decode go through unaligned memory
+struct VertexFloat3
+{
+    typedef XMFLOAT3 Type;
+    static const unsigned int Size = 12;
+    static const DXGI_FORMAT Format = DXGI_FORMAT_R32G32B32_FLOAT;
+    static void Encode(const Type &value, unsigned char *out) { memcpy(out, &value, Size); }
+    static void Decode(const unsigned char *in, Type &value) { memcpy(&value, in, Size); }
+};
+
+struct VertexFloat4
+{
+    typedef XMFLOAT4 Type;
+    static const unsigned int Size = 16;
+    static const DXGI_FORMAT Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+    static void Encode(const Type &value, unsigned char *out) { memcpy(out, &value, Size); }
+    static void Decode(const unsigned char *in, Type &value) { memcpy(&value, in, Size); }
+};
+
+struct VertexFloat2
+{
+    typedef XMFLOAT2 Type;
+    static const unsigned int Size = 8;
+    static const DXGI_FORMAT Format = DXGI_FORMAT_R32G32_FLOAT;
+    static void Encode(const Type &value, unsigned char *out) { memcpy(out, &value, Size); }
+    static void Decode(const unsigned char *in, Type &value) { memcpy(&value, in, Size); }
+};
+
+//Four values from -1 to 1 in signed bytes, off by at most 1/254 each
+struct VertexSnorm8x4
+{
+    typedef XMFLOAT4 Type;
+    static const unsigned int Size = 4;
+    static const DXGI_FORMAT Format = DXGI_FORMAT_R8G8B8A8_SNORM;
+
+    static signed char ToSnorm8(float value)
+    {
+        const float clamped = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+        const float scaled = clamped * 127.0f;
+        return static_cast<signed char>(scaled < 0.0f ? scaled - 0.5f : scaled + 0.5f);
+    }
+
+    static float FromSnorm8(signed char value)
+    {
+        const float unpacked = value / 127.0f;
+        return unpacked < -1.0f ? -1.0f : unpacked;
+    }
+
+    static void Encode(const Type &value, unsigned char *out)
+    {
+        const signed char packed[Size] = { ToSnorm8(value.x), ToSnorm8(value.y), ToSnorm8(value.z), ToSnorm8(value.w) };
+        memcpy(out, packed, Size);
+    }
+
+    static void Decode(const unsigned char *in, Type &value)
+    {
+        signed char packed[Size];
+        memcpy(packed, in, Size);
+        value = Type(FromSnorm8(packed[0]), FromSnorm8(packed[1]), FromSnorm8(packed[2]), FromSnorm8(packed[3]));
+    }
+};
+
+//Four bytes as they are, read as integers or as 0-1 by the shader
+struct VertexUint8x4
+{
+    typedef unsigned char Type[4];
+    static const unsigned int Size = 4;
+    static const DXGI_FORMAT Format = DXGI_FORMAT_R8G8B8A8_UINT;
+    static void Encode(const Type &value, unsigned char *out) { memcpy(out, value, Size); }
+    static void Decode(const unsigned char *in, Type &value) { memcpy(value, in, Size); }
+};
+
+struct VertexUnorm8x4
+{
+    typedef unsigned char Type[4];
+    static const unsigned int Size = 4;
+    static const DXGI_FORMAT Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    static void Encode(const Type &value, unsigned char *out) { memcpy(out, value, Size); }
+    static void Decode(const unsigned char *in, Type &value) { memcpy(value, in, Size); }
+};
+
+//A field stored in a GPU format, the storage has to hold the field's type
+template<typename Field, typename Storage>
+struct VertexAttribute
+{
+    static_assert(std::is_same<typename Field::Type, typename Storage::Type>::value, "Storage doesn't hold the field's type");
+
+    typedef Field FieldType;
+    typedef Storage StorageType;
+    typedef typename Field::Source Source;
+    static const unsigned int Size = Storage::Size;
+
+    static void Pack(const Source &vertex, unsigned char *out) { Storage::Encode(Field::Get(vertex), out); }
+    static void Unpack(const unsigned char *in, Source &vertex)
+    {
+        typename Storage::Type value;
+        Storage::Decode(in, value);
+        Field::Set(vertex, value);
+    }
+};
+
+//Sum of the sizes of the attributes before the given one
+template<typename... Attributes>
+constexpr unsigned int GetVertexAttributeOffset(unsigned int attribute)
+{
+    const unsigned int sizes[] = { Attributes::Size..., 0 };
+    unsigned int offset = 0;
+    for (unsigned int i = 0; i < attribute && i < sizeof...(Attributes); i++)
+    {
+        offset += sizes[i];
+    }
+    return offset;
+}
+
+template<typename... Attributes>
+class VertexFormat
+{
+public:
+    static const unsigned int AttributeCount = sizeof...(Attributes);
+
+    //Struct the vertices are packed from, every attribute has to read the same one
+    typedef typename std::tuple_element<0, std::tuple<typename Attributes::Source...>>::type Source;
+    static_assert(std::is_same<std::tuple<Source, typename Attributes::Source...>, std::tuple<typename Attributes::Source..., Source>>::value,
+        "Attributes of a format read different structs");
+
+    typedef std::array<D3D11_INPUT_ELEMENT_DESC, AttributeCount> InputLayout;
+
+    //Byte offset of an attribute in the interleaved vertex, and the size of the whole vertex
+    static constexpr unsigned int GetOffset(unsigned int attribute)
+    {
+        return GetVertexAttributeOffset<Attributes...>(attribute);
+    }
+
+    static const unsigned int Stride = GetVertexAttributeOffset<Attributes...>(sizeof...(Attributes));
+
+    static constexpr unsigned int GetSize(unsigned int attribute)
+    {
+        return GetOffset(attribute + 1) - GetOffset(attribute);
+    }
+
+    //Interleaved layout of the format in one vertex buffer slot
+    static InputLayout GetInputLayout(UINT slot = 0)
+    {
+        return GetInputLayout(slot, 0, std::make_integer_sequence<unsigned int, AttributeCount>());
+    }
+
+    //Every attribute in a slot of its own from firstSlot on, for the streams PackStreams writes
+    static InputLayout GetStreamInputLayout(UINT firstSlot = 0)
+    {
+        return GetInputLayout(firstSlot, 1, std::make_integer_sequence<unsigned int, AttributeCount>());
+    }
+
+    //Fields of the shader's vertex input struct, in the same order as the input layout
+    static std::string GetHlslFields()
+    {
+        std::string fields;
+        const char *lines[] = { Attributes::FieldType::GetHlslField()... };
+        for (const char *line : lines)
+        {
+            fields += fields.empty() ? "" : " ";
+            fields += line;
+        }
+        return fields;
+    }
+
+    //Source array to interleaved vertices, destination holds count * Stride bytes
+    static void Pack(const Source *vertices, size_t count, void *destination)
+    {
+        unsigned char *out = static_cast<unsigned char*>(destination);
+        for (size_t i = 0; i < count; i++)
+        {
+            PackVertex(vertices[i], out + i * Stride, std::make_integer_sequence<unsigned int, AttributeCount>());
+        }
+    }
+
+    //Interleaved vertices back to the source, fields the format doesn't hold are left alone
+    static void Unpack(const void *source, size_t count, Source *vertices)
+    {
+        const unsigned char *in = static_cast<const unsigned char*>(source);
+        for (size_t i = 0; i < count; i++)
+        {
+            UnpackVertex(in + i * Stride, vertices[i], std::make_integer_sequence<unsigned int, AttributeCount>());
+        }
+    }
+
+    //Source array to one tightly packed stream per attribute, streams[a] holds count * attribute size bytes
+    static void Deinterleave(const Source *vertices, size_t count, void *const (&streams)[AttributeCount])
+    {
+        Deinterleave(vertices, count, streams, std::make_integer_sequence<unsigned int, AttributeCount>());
+    }
+
+    //The streams of Deinterleave back to back in one buffer of count * Stride bytes, the stream
+    //of attribute a starts at GetStreamOffset(a, count)
+    static void PackStreams(const Source *vertices, size_t count, void *destination)
+    {
+        void *streams[AttributeCount];
+        for (unsigned int a = 0; a < AttributeCount; a++)
+        {
+            streams[a] = static_cast<unsigned char*>(destination) + GetStreamOffset(a, count);
+        }
+        Deinterleave(vertices, count, streams);
+    }
+
+    static size_t GetStreamOffset(unsigned int attribute, size_t count)
+    {
+        return count * GetOffset(attribute);
+    }
+
+private:
+    //Interleaved attributes share the slot at their offsets, streamed ones each get the next slot
+    template<unsigned int... Index>
+    static InputLayout GetInputLayout(UINT slot, UINT slotStep, std::integer_sequence<unsigned int, Index...>)
+    {
+        InputLayout layout = { {
+            { Attributes::FieldType::GetSemantic(), 0, Attributes::StorageType::Format, slot + slotStep * Index, slotStep ? 0 : GetOffset(Index), D3D11_INPUT_PER_VERTEX_DATA, 0 }...
+        } };
+        return layout;
+    }
+
+    template<unsigned int... Index>
+    static void PackVertex(const Source &vertex, unsigned char *out, std::integer_sequence<unsigned int, Index...>)
+    {
+        const int expand[] = { (Attributes::Pack(vertex, out + std::integral_constant<unsigned int, GetOffset(Index)>::value), 0)..., 0 };
+        (void)expand;
+    }
+
+    template<unsigned int... Index>
+    static void UnpackVertex(const unsigned char *in, Source &vertex, std::integer_sequence<unsigned int, Index...>)
+    {
+        const int expand[] = { (Attributes::Unpack(in + std::integral_constant<unsigned int, GetOffset(Index)>::value, vertex), 0)..., 0 };
+        (void)expand;
+    }
+
+    template<unsigned int... Index>
+    static void Deinterleave(const Source *vertices, size_t count, void *const (&streams)[AttributeCount], std::integer_sequence<unsigned int, Index...>)
+    {
+        const int expand[] = { (PackStream<Attributes>(vertices, count, streams[Index]), 0)..., 0 };
+        (void)expand;
+    }
+
+    //One attribute at a time keeps each loop down to a single store pattern
+    template<typename Attribute>
+    static void PackStream(const Source *vertices, size_t count, void *stream)
+    {
+        unsigned char *out = static_cast<unsigned char*>(stream);
+        for (size_t i = 0; i < count; i++)
+        {
+            Attribute::Pack(vertices[i], out + i * Attribute::Size);
+        }
+    }
+};
+
+//Same layout as VERTEX, every field is copied as it is
+typedef VertexFormat<
+    VertexAttribute<VertexPosition, VertexFloat3>,
+    VertexAttribute<VertexNormalOcclusion, VertexFloat4>,
+    VertexAttribute<VertexTexcoord, VertexFloat2>> FullVertexFormat;
+
+static_assert(FullVertexFormat::Stride == sizeof(VERTEX), "FullVertexFormat no longer matches VERTEX");
+static_assert(FullVertexFormat::GetOffset(0) == offsetof(VERTEX, position), "FullVertexFormat position offset");
+static_assert(FullVertexFormat::GetOffset(1) == offsetof(VERTEX, normal), "FullVertexFormat normal offset");
+static_assert(FullVertexFormat::GetOffset(1) + 12 == offsetof(VERTEX, occlusion), "FullVertexFormat occlusion offset");
+static_assert(FullVertexFormat::GetOffset(2) == offsetof(VERTEX, texture), "FullVertexFormat texture offset");
+
+//Normal and occlusion in four bytes, 24 instead of 36 bytes a vertex
+typedef VertexFormat<
+    VertexAttribute<VertexPosition, VertexFloat3>,
+    VertexAttribute<VertexNormalOcclusion, VertexSnorm8x4>,
+    VertexAttribute<VertexTexcoord, VertexFloat2>> CompactVertexFormat;
+
+static_assert(CompactVertexFormat::Stride == 24, "CompactVertexFormat stride");
+static_assert(CompactVertexFormat::GetOffset(1) == 12 && CompactVertexFormat::GetOffset(2) == 16, "CompactVertexFormat offsets");
+
+//How scene meshes are stored in vertex buffers, the input layout and the shader input follow it.
+//Vertex buffers hold one stream per attribute written by PackStreams, so the depth passes can
+//bind the positions alone.
+typedef CompactVertexFormat SceneVertexFormat;
+
+//The first stream of a scene vertex buffer, all the depth pre-pass and the shadow maps read
+typedef VertexFormat<VertexAttribute<VertexPosition, VertexFloat3>> PositionVertexFormat;
+
+static_assert(SceneVertexFormat::GetOffset(0) == 0 && SceneVertexFormat::GetSize(0) == PositionVertexFormat::Stride,
+    "Scene vertex buffers have to start with the position stream");
+
+//Skinning data of a vertex as its own stream, next to one of the formats above
+typedef VertexFormat<
+    VertexAttribute<VertexJoints, VertexUint8x4>,
+    VertexAttribute<VertexWeights, VertexUnorm8x4>> SkinVertexFormat;
+
+static_assert(SkinVertexFormat::Stride == sizeof(VertexSkin), "SkinVertexFormat no longer matches VertexSkin");
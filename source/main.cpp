@@ -3,30 +3,72 @@
 #include <dxgidebug.h>
 #include <d3dcompiler.h>
 #include <directxmath.h>
+#include <DirectXCollision.h>
 #include <stdio.h>
+#include <algorithm>
+#include <cfloat>
+#include <mutex>
+#include <string>
 #include <vector>
 
-#include <assimp\Importer.hpp>
-#include <assimp\scene.h>
-#include <assimp\postprocess.h>
-
+#include "Animation.h"
+#include "AssetArchive.h"
+#include "Assets.h"
 #include "Camera.h"
+#include "CommandRecorder.h"
+#include "FileWatcher.h"
+#include "FrameArena.h"
+#include "GpuResources.h"
+#include "GpuTimer.h"
+#include "JobSystem.h"
+#include "LightClusterer.h"
+#include "LodSelector.h"
+#include "MappedFile.h"
+#include "MemoryTelemetry.h"
+#include "MeshBvh.h"
+#include "MeshSimplifier.h"
+#include "ObjLoader.h"
+#include "ObjectPool.h"
+#include "OcclusionBaker.h"
+#include "OcclusionCuller.h"
+#include "OverdrawMeter.h"
+#include "ResolutionGovernor.h"
+#include "ScratchArena.h"
+#include "ShaderCache.h"
+#include "ShadowCascades.h"
+#include "Terrain.h"
+#include "TextureStreamer.h"
+#include "TransformHierarchy.h"
+#include "UploadQueue.h"
+#include "VertexFormat.h"
 
 using namespace DirectX;
 
 #pragma comment (lib, "d3d11.lib")
 #pragma comment (lib, "dxguid.lib")
 #pragma comment (lib, "d3dcompiler.lib")
+#pragma comment (lib, "version.lib")
 
 struct Object {
-    ID3D11Buffer *pVBuffer = nullptr;                //Pointer to vertex buffer
-    ID3D11Buffer *pIBuffer = nullptr;                //Pointer to index buffer
-    ID3D11Texture2D *pTexture = nullptr;
-    ID3D11ShaderResourceView *pShaderView = nullptr;
+    GpuRef<ID3D11Buffer> pVBuffer;                   //Pointer to vertex buffer
+    GpuRef<ID3D11Buffer> pIBuffer;                   //Pointer to index buffer
+    GpuRef<ID3D11Buffer> pSkinBuffer;                //Joints and weights of a skinned mesh, the second vertex stream
+    TextureHandle texture = 0;                       //Albedo, owned by the texture streamer
     int vertex_count = 0;
     int index_count = 0;
     int vertex_size = 0;
     int index_size = 0;
+    std::vector<MeshLod> lods;                       //Index ranges of the detail levels, most detailed first
+    XMFLOAT3 boundsMin = {};                         //Object space bounding box
+    XMFLOAT3 boundsMax = {};
+    bool isOccluder = false;                         //Rasterized into the occlusion buffer
+    bool isStatic = false;                           //Never moves, cached in the far shadow cascades
+    bool terrainChunk = false;                       //The terrain picks its level together with its neighbours
+    std::vector<XMFLOAT3> occluderPositions;         //CPU copy of the mesh for occlusion culling
+    std::vector<short> occluderIndices;
+    MeshBvh bvh;                                     //CPU copy for picking and collision, empty when nothing can hit it
+    std::string meshPath;                            //Source files, used to find the object again on hot reload
+    std::string texturePath;
 };
 
 //Global declarations
@@ -37,30 +79,126 @@ ID3D11RenderTargetView *backBuffer = nullptr;    //Pointer to the back buffer
 ID3D11InputLayout *pLayout = nullptr;            //Pointer to the input layout
 ID3D11VertexShader *pVS = nullptr;               //Pointer to vertex shader
 ID3D11PixelShader *pPS = nullptr;                //Pointer to pixel shader
+ID3D11PixelShader *pPSSolid = nullptr;           //Pointer to solid color pixel shader
+ID3D11VertexShader *pVSShadow = nullptr;         //Pointer to depth only shadow map vertex shader
+ID3D11VertexShader *pVSSkinned = nullptr;        //Skinning versions of the two vertex shaders above
+ID3D11VertexShader *pVSShadowSkinned = nullptr;
+ID3D11InputLayout *pSkinnedLayout = nullptr;     //Scene vertices plus the joint and weight stream
+ID3D11InputLayout *pDepthLayout = nullptr;       //Position stream alone, for the depth only passes
+ID3D11InputLayout *pDepthSkinnedLayout = nullptr;
 ID3D11Buffer *pConstantBuffer = nullptr;         //Pointer to constant buffer
 ID3D11SamplerState *pSamplerState = nullptr;
-XMMATRIX worldMatrix = {};
 XMMATRIX viewMatrix = {};
 XMMATRIX projectionMatrix = {};
-unsigned char* targaData = nullptr;
 Camera camera;
-Object cube;
-Object ground;
-Object panda;
+ObjectPool<Object> sceneObjects;                //Every object of the scene lives in here
+Object *cube = nullptr;
+Object *panda = nullptr;
 ID3D11Texture2D *depthStencilBuffer = nullptr;
 ID3D11DepthStencilView *depthStencilView = nullptr;
 ID3D11DepthStencilState *depthStencilState = nullptr;
+ID3D11DepthStencilState *depthEqualState = nullptr;  //Shading after the depth pre-pass, only the surface it left passes
 
 IDXGIDebug* debug = nullptr;
 
-const int winWidth = 800;
-const int winHeight = 600;
+//Parallel draw submission
+JobSystem jobSystem;
+ID3D11DeviceContext *deferredContexts[MaxRecordChunks] = {};  //One deferred context per recording chunk
+ID3D11CommandList *commandLists[MaxRecordChunks] = {};
+const unsigned int minDrawsPerChunk = 64;                     //Smaller chunks cost more in FinishCommandList than they save
+
+//Software occlusion culling
+OcclusionCuller occlusionCuller;
+OcclusionStats occlusionTotals;                               //Summed over the frames since the last report
+unsigned int occlusionFrames = 0;
+ULONGLONG occlusionReportTime = 0;
+
+//Level of detail selection
+LodSelector lodSelector;
+const float maxLodPixelError = 1.0f;                          //Simplification error allowed on screen
+unsigned long long lodTriangles = 0;                          //Drawn and full detail triangles since the last report
+unsigned long long fullTriangles = 0;
+ULONGLONG lodReportTime = 0;
+
+//Mesh and texture data on its way to the GPU, sent a few megabytes per frame
+UploadQueue uploadQueue;
+ULONGLONG uploadReportTime = 0;
+unsigned long long uploadReportBytes = 0;                     //Uploaded bytes at the last report
+
+//Texture streaming
+TextureStreamer textureStreamer;
+const unsigned long long textureBudget = 64ull * 1024 * 1024;  //GPU memory for streamed mips
+ULONGLONG streamingReportTime = 0;
+unsigned long long streamingReportBytes = 0;                  //Streamed bytes at the last report
+
+//Clustered point and spot lights
+LightClusterer lightClusterer;
+std::vector<ClusterLight> sceneLights;
+const unsigned int spotLightCount = 8;                        //The last lights in sceneLights, they circle the panda
+ULONGLONG lightReportTime = 0;
+
+//Hot reload: changed files are re-imported on a worker and swapped in at the next frame boundary
+struct PendingReload
+{
+    std::string path;
+    LARGE_INTEGER started = {};     //When the change was picked up, for the reload time report
+    bool isShader = false;
+    MeshData mesh;
+    MeshBvh bvh;                    //Built and the occlusion baked on the worker too
+    Object buffers;                 //Created on the worker, swapped in once upload is done
+    UploadTicket upload = 0;
+    std::vector<std::vector<unsigned char>> shaders;
+};
 
-//Struct for a single vertex
-struct VERTEX {
-    XMFLOAT3 position;
-    XMFLOAT3 normal;
-    XMFLOAT2 texture;
+FileWatcher fileWatcher;
+JobCounter reloadJobs;
+std::mutex reloadLock;
+std::vector<PendingReload> pendingReloads;                    //Guarded by reloadLock
+const char *shaderPath = "source/shader.hlsl";
+
+//Window client area, follows the window when it is resized
+int winWidth = 800;
+int winHeight = 600;
+bool resizePending = false;                                   //WM_SIZE arrived, the swap chain is resized between frames
+bool windowMinimized = false;                                 //Nothing is rendered while minimized
+
+//Dynamic resolution: the scene is rendered into part of an offscreen target and stretched over the back buffer
+ID3D11Texture2D *sceneTexture = nullptr;                      //Window sized, only renderWidth x renderHeight of it is used
+ID3D11RenderTargetView *sceneTarget = nullptr;
+ID3D11ShaderResourceView *sceneView = nullptr;
+ID3D11VertexShader *pVSUpscale = nullptr;
+ID3D11PixelShader *pPSUpscale = nullptr;
+ID3D11SamplerState *pUpscaleSampler = nullptr;
+ID3D11Buffer *pUpscaleBuffer = nullptr;
+ResolutionGovernor resolutionGovernor;                        //Defaults hold 60 fps between half and full resolution
+GpuTimer frameTimer;                                          //GPU time of every frame, fed to the governor
+int renderWidth = 800;
+int renderHeight = 600;
+float gpuFrameMs = 0.0f;                                      //Newest measured GPU frame time
+ULONGLONG resolutionReportTime = 0;
+
+//Depth pre-pass: when pixels are written several times a frame, depth is laid down first with positions
+//only and the shading pass tests EQUAL against it, so the pixel shader runs about once a pixel
+enum PrepassMode
+{
+    PrepassAuto,                    //Follows the measured overdraw
+    PrepassOn,                      //-prepass
+    PrepassOff,                     //-noprepass
+};
+PrepassMode prepassMode = PrepassAuto;
+bool depthPrepass = false;                                    //This frame draws the pre-pass
+OverdrawMeter overdrawMeter;
+OverdrawSample overdrawAverage;                               //Running average over the collected frames
+const float overdrawSmoothing = 0.05f;                        //Weight of the newest frame in the average
+const float prepassEnableAbove = 1.6f;                        //Depth overdraw where the extra pass starts paying for itself
+const float prepassDisableBelow = 1.3f;                       //Lower, so the choice doesn't flip every other frame
+unsigned int prepassChanges = 0;
+ULONGLONG overdrawReportTime = 0;
+
+//Constants of the upscale pass
+struct UpscaleConstants
+{
+    XMFLOAT4 vSourceRect;               //xy: part of the scene texture that was rendered in uv, zw: one texel in uv
 };
 
 //Constant buffer struct for shader
@@ -72,29 +210,172 @@ struct ConstantBuffer
     XMFLOAT4 vLightDir;
     XMFLOAT4 vLightColor;
     XMFLOAT4 vOutputColor;
+    XMFLOAT4 vClusterScale;
+    XMUINT4 vClusterCount;
+    XMMATRIX mShadow[ShadowCascades::CascadeCount];
+    XMFLOAT4 vCascadeSplits;
+    XMFLOAT4 vShadowParams;
+    XMUINT4 vDrawInfo;
+};
+
+//Single draw of an object with its world transform
+struct DrawItem
+{
+    const Object *object = nullptr;
+    XMFLOAT4X4 world = {};
+    unsigned int lod = 0;
+    int character = -1;                 //Crowd character posing a skinned draw
+};
+
+//Per frame memory, dropped at the start of every frame
+FrameArena frameArena;
+const size_t frameArenaSize = 1024 * 1024;                    //Grows on its own if a frame needs more
+FrameVector<DrawItem> drawList;                               //In the frame arena
+
+//Allocation telemetry
+MemoryFrameStats memoryStats;
+MemoryCounter memoryFrameTotals[MemoryTagCount];              //Summed over the frames since the last report
+unsigned long long memoryFrameCount = 0;
+unsigned int memoryReportFrames = 0;
+ULONGLONG memoryReportTime = 0;
+const unsigned long long memoryWarmupFrames = 120;            //Frames before the scene is expected to stop allocating
+bool strictMemory = false;                                    //-strictmemory: heap allocations in steady state frames assert
+
+//GPU memory held by every tracked resource, by category and by owner
+const unsigned long long vertexBudget = 96ull * 1024 * 1024;
+const unsigned long long indexBudget = 32ull * 1024 * 1024;
+const unsigned long long constantBudget = 1ull * 1024 * 1024;
+const unsigned long long textureMemoryBudget = textureBudget * 2;  //A rebuilt array lives next to the one it replaces until the swap
+const unsigned long long targetBudget = 192ull * 1024 * 1024;
+const unsigned int gpuReportOwners = 6;                       //Largest owners listed in the report
+ULONGLONG gpuReportTime = 0;
+
+//Cascaded shadows of the directional light
+ShadowCascades shadowCascades;
+const float shadowDistance = 40.0f;                           //No shadows beyond this view depth
+FrameVector<DrawItem> shadowCasters;                          //Every draw of the frame, before camera culling
+unsigned int shadowCascadesDrawn = 0;                         //Summed over the frames since the last report
+unsigned int shadowRefreshes = 0;
+unsigned int shadowDraws = 0;
+unsigned long long shadowTriangles = 0;
+unsigned int shadowFrames = 0;
+ULONGLONG shadowReportTime = 0;
+
+//Packed assets, mounted at startup when the archive exists
+AssetArchive assetArchive;
+const char *assetArchivePath = "assets.pak";
+bool looseAssets = false;                                     //-looseassets: ignore the archive, the baseline for startup times
+
+//Skeletal animation: a crowd sharing one rigged mesh, posed on the workers and skinned in the vertex shader
+const char *characterPath = "assets/character/character.fbx";   //A generated character stands in when this is missing
+Skeleton characterSkeleton;
+std::vector<AnimationClip> characterClips;
+MeshData characterMesh;                                       //Bind pose vertices and weights for CPU skinning
+AnimationSystem animationSystem;
+Object *character = nullptr;
+std::vector<TransformHandle> crowdTransforms;                 //Where each character stands, below crowdTransform
+const float crowdClipSeconds = 4.0f;                          //How long a character plays a clip before fading to the next
+const float crowdFadeSeconds = 0.4f;
+ID3D11Buffer *paletteBuffer = nullptr;                        //Skinning matrices of every character, three float4 rows per joint
+ID3D11ShaderResourceView *paletteView = nullptr;
+bool cpuSkinning = false;                                     //-cpuskinning: skin on the workers into a vertex buffer per character
+const UINT skinStreamSlot = SceneVertexFormat::AttributeCount; //Joints and weights follow the scene vertex streams
+std::vector<ID3D11Buffer*> cpuSkinnedBuffers;
+ULONGLONG animationReportTime = 0;
+
+//Parent and child transforms of everything that moves
+TransformHierarchy sceneTransforms;
+TransformHandle pandaTransform = InvalidTransform;
+TransformHandle propTransform = InvalidTransform;             //The cube, carried around by the panda
+TransformHandle crowdTransform = InvalidTransform;            //The whole crowd moves with it
+
+//Ray queries against the meshes' BVHs
+struct SceneHit
+{
+    const Object *object = nullptr;
+    RayHit hit;
 };
+const float cameraRadius = 0.25f;                             //How close the camera gets to a mesh or the ground
 
-//Struct for the targa texture file
-struct TargaHeader
+//Chunked terrain in place of the ground, streamed in around the camera
+Terrain terrain;
+std::vector<Object*> terrainObjects;                          //One per terrain vertex buffer slot, the terrain owns the buffers
+ULONGLONG terrainReportTime = 0;
+
+//Every shader variant the app uses, compiled or loaded from the cache together
+enum ShaderVariant
 {
-    unsigned char data1[12];
-    unsigned short width;
-    unsigned short height;
-    unsigned char bpp;
-    unsigned char data2;
+    ShaderVS,
+    ShaderPS,
+    ShaderPSSolid,
+    ShaderVSShadow,
+    ShaderVSUpscale,
+    ShaderPSUpscale,
+    ShaderVSSkinned,
+    ShaderVSShadowSkinned,
+    ShaderVariantCount
 };
 
 //Function declarations:
 LRESULT CALLBACK WindowProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
 void CreateDepthBuffer();           //Creates depth buffer
+void CreateSceneTarget();           //Creates the offscreen target the scene is rendered into
+void ResizeBuffers();               //Resizes the swap chain and every window sized target to the client area
+void UpdateRenderScale();           //Reads back GPU frame times and picks this frame's render size
+void UpdateDepthPrepass();          //Reads back overdraw and decides whether this frame lays down depth first
+void Upscale();                     //Stretches the rendered part of the scene target over the back buffer
+void ReportMemory();                //Closes the frame's allocation counters and reports them
+void ReportGpuMemory();             //Prints live GPU memory by category and the largest owners
 void InitD3D(HWND hWnd);            //Sets up and initializes Direct3D
 void RenderFrame();                 //Renders a single frame
 void CleanD3D();                    //Closes Direct3D and releases memory
 void InitGraphics();                //Creates the shape to render
 void InitPipeline();                //Loads and prepares the shaders
-bool LoadTarga(const char* filename, int& height, int& width);
-Object SetupObject(VERTEX* vertices, UINT vertices_size, short *indices, UINT indices_size, const char *targa);
+bool CompileShader(const std::string &source, const std::string &sourceName, const ShaderPermutation &permutation,
+    std::vector<unsigned char> &bytecode, std::string &errors);
+std::string GetShaderCompilerVersion();     //Names the loaded HLSL compiler for the shader cache key
+bool LoadShaders(std::vector<std::vector<unsigned char>> &bytecodes);
+bool CreateShaders(const std::vector<std::vector<unsigned char>> &bytecodes);
+Object SetupObject(VERTEX* vertices, UINT vertices_size, short *indices, UINT indices_size, const char *targa, const char *name);
 Object LoadModel(const char* filename);
+UploadTicket CreateMeshBuffers(Object &object, const VERTEX *vertices, UINT vertices_size, const short *indices, UINT indices_size, const char *name);
+void ProcessFileChanges();          //Starts background re-imports for files that changed on disk
+void ApplyPendingReloads();         //Swaps finished re-imports in, only call between frames
+void BakeStaticMesh(const char *name, VERTEX *vertices, UINT vertexCount, const short *indices, UINT indexCount, MeshBvh &bvh);
+void BakeStaticMesh(const char *name, MeshData &mesh, MeshBvh &bvh);
+void CullDrawList();                //Removes draws that are off screen or hidden behind occluders
+void SelectLods();                  //Picks a level of detail for every draw
+void StreamTextures();              //Asks for the texture detail the visible draws need
+void SendUploads();                 //Sends this frame's share of the upload queue
+void CreateSceneLights();           //Scatters point lights over the ground and adds the spot lights
+void CreateCrowd();                 //Loads or generates the animated character and places the crowd
+void CreateTerrain();               //Creates an object for every vertex buffer slot of the terrain
+void DrawTerrain();                 //Streams the terrain around the camera and adds the chunks in range to the draw list
+void BuildProceduralCharacter(MeshData &mesh, Skeleton &skeleton, std::vector<AnimationClip> &clips);
+void AnimateCrowd(float t);         //Poses the crowd and hands the result to the GPU, or skins it with -cpuskinning
+void AssignLights(float t);         //Moves the spot lights and sorts all lights into clusters
+void RenderShadows(FXMVECTOR lightDir);     //Fits the shadow cascades to the camera and draws the casters into them
+bool BenchmarkSimplification(const char *filename);
+bool BenchmarkModelImport(const char *filename);
+bool BenchmarkAssetLoading();       //Times loading the scene assets from loose files and from the archive
+bool BenchmarkAnimation();          //Times posing and CPU skinning a large crowd
+bool BenchmarkTransforms();         //Times updating large transform hierarchies of different shapes
+bool BenchmarkRaycasts(const char *filename);   //Times building a mesh's BVH and casting rays at it
+bool BenchmarkOcclusionBake(const char *filename);  //Times baking a mesh's occlusion with more and more threads
+bool RaycastScene(FXMVECTOR origin, FXMVECTOR direction, float maxDistance, SceneHit &hit);
+void PickAtCursor(int x, int y);    //Reports what the cursor is over and how long finding it took
+void CollideCamera(FXMVECTOR previous);     //Stops the camera at meshes in its way and keeps it above the ground
+void BindPipelineState(ID3D11DeviceContext *context);   //Sets all pipeline state a draw needs on a context
+void BindDepthPrepassState(ID3D11DeviceContext *context);   //Same for the depth pre-pass
+void BindVertexStreams(ID3D11DeviceContext *context, const DrawItem &draw, bool positionOnly);
+void RecordDraws(ID3D11DeviceContext *context, const DrawItem *draws, unsigned int count, const ConstantBuffer &frameConstants);
+void RecordDepthDraws(ID3D11DeviceContext *context, const DrawItem *draws, unsigned int count, const ConstantBuffer &frameConstants);
+
+//Compiled shader blobs are kept between runs, the HLSL compiler only runs on a miss
+ShaderCache shaderCache("shadercache", GetShaderCompilerVersion(), CompileShader);
+
+//Baked occlusion of the static meshes, a mesh is only traced again when it changes
+OcclusionBaker occlusionBaker("aocache");
 
 
 int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPSTR lpCmdLine, _In_ int nShowCmd)
@@ -108,6 +389,126 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
     //Windows event messages struct
     MSG msg = {};
 
+    //Startup is timed from here until the scene is loaded
+    LARGE_INTEGER startupBegin = {};
+    QueryPerformanceCounter(&startupBegin);
+
+    //Offline shader build: fill the shader cache and exit without opening a window
+    if (lpCmdLine && strstr(lpCmdLine, "-compileshaders") != nullptr)
+    {
+        jobSystem.Init();
+        std::vector<std::vector<unsigned char>> bytecodes;
+        const bool compiled = LoadShaders(bytecodes);
+        jobSystem.Shutdown();
+        return compiled ? 0 : 1;
+    }
+
+    //Time the LOD chain generation on the panda and exit
+    if (lpCmdLine && strstr(lpCmdLine, "-benchlod") != nullptr)
+    {
+        return BenchmarkSimplification("assets/pandaren_model/pandaren.obj") ? 0 : 1;
+    }
+
+    //Compare the native OBJ importer against Assimp on the panda and exit
+    if (lpCmdLine && strstr(lpCmdLine, "-benchobj") != nullptr)
+    {
+        jobSystem.Init();
+        const bool imported = BenchmarkModelImport("assets/pandaren_model/pandaren.obj");
+        jobSystem.Shutdown();
+        return imported ? 0 : 1;
+    }
+
+    //Pack the asset directory into the archive and exit
+    if (lpCmdLine && strstr(lpCmdLine, "-packassets") != nullptr)
+    {
+        jobSystem.Init();
+        AssetPackStats stats;
+        const bool packed = PackAssetArchive("assets", assetArchivePath, &jobSystem, stats);
+        jobSystem.Shutdown();
+
+        char report[256] = {};
+        sprintf_s(report, packed ? "Packed %u files into %s: %.2f MB -> %.2f MB in %.1f ms\n" : "Packing %u files into %s failed\n",
+            stats.files, assetArchivePath, stats.bytes / (1024.0 * 1024.0), stats.packedBytes / (1024.0 * 1024.0), stats.ms);
+        OutputDebugStringA(report);
+        return packed ? 0 : 1;
+    }
+
+    //Compare loading the scene assets from loose files and from the archive and exit
+    if (lpCmdLine && strstr(lpCmdLine, "-benchassets") != nullptr)
+    {
+        jobSystem.Init();
+        const bool loaded = BenchmarkAssetLoading();
+        jobSystem.Shutdown();
+        return loaded ? 0 : 1;
+    }
+
+    //Read every asset from its own file even when there is an archive
+    if (lpCmdLine && strstr(lpCmdLine, "-looseassets") != nullptr)
+    {
+        looseAssets = true;
+    }
+
+    //Assert on any heap allocation once the frames have settled
+    if (lpCmdLine && strstr(lpCmdLine, "-strictmemory") != nullptr)
+    {
+        strictMemory = true;
+    }
+
+    //Assert when a resource takes its category over the GPU memory budget
+    if (lpCmdLine && strstr(lpCmdLine, "-strictgpu") != nullptr)
+    {
+        SetStrictGpuBudgets(true);
+    }
+
+    //Skin the crowd on the CPU instead of in the vertex shader
+    if (lpCmdLine && strstr(lpCmdLine, "-cpuskinning") != nullptr)
+    {
+        cpuSkinning = true;
+    }
+
+    //Always or never draw the depth pre-pass instead of going by the overdraw, -prepass is part of -noprepass
+    if (lpCmdLine && strstr(lpCmdLine, "-noprepass") != nullptr)
+    {
+        prepassMode = PrepassOff;
+    }
+    else if (lpCmdLine && strstr(lpCmdLine, "-prepass") != nullptr)
+    {
+        prepassMode = PrepassOn;
+    }
+
+    //Time the animation system with one and with all threads and exit
+    if (lpCmdLine && strstr(lpCmdLine, "-benchanimation") != nullptr)
+    {
+        jobSystem.Init();
+        const bool animated = BenchmarkAnimation();
+        jobSystem.Shutdown();
+        return animated ? 0 : 1;
+    }
+
+    //Time transform hierarchy updates with one and with all threads and exit
+    if (lpCmdLine && strstr(lpCmdLine, "-benchtransforms") != nullptr)
+    {
+        jobSystem.Init();
+        const bool updated = BenchmarkTransforms();
+        jobSystem.Shutdown();
+        return updated ? 0 : 1;
+    }
+
+    //Time the BVH build and ray queries on the panda and exit
+    if (lpCmdLine && strstr(lpCmdLine, "-benchraycast") != nullptr)
+    {
+        jobSystem.Init();
+        const bool cast = BenchmarkRaycasts("assets/pandaren_model/pandaren.obj");
+        jobSystem.Shutdown();
+        return cast ? 0 : 1;
+    }
+
+    //Time the occlusion bake on the panda with one thread up to all of them and exit
+    if (lpCmdLine && strstr(lpCmdLine, "-benchocclusion") != nullptr)
+    {
+        return BenchmarkOcclusionBake("assets/pandaren_model/pandaren.obj") ? 0 : 1;
+    }
+
     //GetTickCount() returns milliseconds, when we want seconds
     LARGE_INTEGER frequency = {};
     LARGE_INTEGER prevTime = {};
@@ -150,6 +551,13 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
     //Sets up and initialize Direct3D
     InitD3D(hWnd);
 
+    //Compare against a run with -looseassets, flush the file cache first for cold numbers
+    LARGE_INTEGER startupEnd = {};
+    QueryPerformanceCounter(&startupEnd);
+    char startupReport[128] = {};
+    sprintf_s(startupReport, "Startup: %.1f ms, assets from %s\n", 1000.0 * (startupEnd.QuadPart - startupBegin.QuadPart) / frequency.QuadPart,
+        GetMountedAssetArchive() ? assetArchivePath : "loose files");
+    OutputDebugStringA(startupReport);
 
     //Initialize game stuff (camera)
     camera.SetLens(XM_PI/3, winWidth / static_cast<float>(winHeight), 0.01f, 100.0f);
@@ -188,6 +596,7 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
 
         //Update the frame with camera controls
         // Camera controls
+        const XMVECTOR previousPosition = camera.GetPositionXM();
         if (GetAsyncKeyState('W') & 0x8000)
             camera.Walk(10.0f*deltaTime);
 
@@ -200,9 +609,25 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
         if (GetAsyncKeyState('D') & 0x8000)
             camera.Strafe(10.0f*deltaTime);
 
+        CollideCamera(previousPosition);
         camera.UpdateViewMatrix();
 
+        //Pick up edited assets between frames
+        ProcessFileChanges();
+        ApplyPendingReloads();
+
+        //The swap chain can only be resized while none of its buffers are in use
+        if (resizePending)
+        {
+            ResizeBuffers();
+        }
+
         //Render the frame:
+        if (windowMinimized)
+        {
+            Sleep(10);
+            continue;
+        }
         RenderFrame();
 
     }
@@ -230,6 +655,28 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lPara
         }
         break;
 
+        //Only note the new size here, the swap chain is resized between frames
+        case WM_SIZE:
+        {
+            windowMinimized = wParam == SIZE_MINIMIZED;
+            if (!windowMinimized && LOWORD(lParam) > 0 && HIWORD(lParam) > 0)
+            {
+                winWidth = LOWORD(lParam);
+                winHeight = HIWORD(lParam);
+                resizePending = true;
+            }
+            return 0;
+        }
+        break;
+
+        //Cast a ray through the cursor into the scene
+        case WM_LBUTTONDOWN:
+        {
+            PickAtCursor(static_cast<short>(LOWORD(lParam)), static_cast<short>(HIWORD(lParam)));
+            return 0;
+        }
+        break;
+
         //When escape key is pressed, quit the application
         case WM_KEYUP:
         {
@@ -274,17 +721,27 @@ void InitD3D(HWND hWnd)
         pDXGIGetDebugInterface(IID_PPV_ARGS(&debug));
     }
     
+    //Every resource created from here on is charged to a category, going over its budget is reported
+    SetGpuBudget(GpuCategoryVertex, vertexBudget);
+    SetGpuBudget(GpuCategoryIndex, indexBudget);
+    SetGpuBudget(GpuCategoryConstant, constantBudget);
+    SetGpuBudget(GpuCategoryTexture, textureMemoryBudget);
+    SetGpuBudget(GpuCategoryTarget, targetBudget);
+
     ID3D11Texture2D *pBackBuffer = {};
     swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (LPVOID*)&pBackBuffer);
+    TrackGpuResource(pBackBuffer, GpuCategoryTarget, "swap chain");
 
     //Use the back buffer address to create the render target
     hr = device->CreateRenderTargetView(pBackBuffer, nullptr, &backBuffer);
     assert(SUCCEEDED(hr));
+    TrackGpuResource(backBuffer, GpuCategoryView, "swap chain");
 
     pBackBuffer->Release();
 
-    //Create the depth buffer
+    //Create the depth buffer and the target the scene is rendered into
     CreateDepthBuffer();
+    CreateSceneTarget();
 
     //Set the render target as the back buffer
     deviceContext->OMSetRenderTargets(1, &backBuffer, depthStencilView);
@@ -301,8 +758,42 @@ void InitD3D(HWND hWnd)
 
     deviceContext->RSSetViewports(1, &viewPort);
 
+    //Start the workers and give every recording chunk its own deferred context
+    jobSystem.Init();
+    for (unsigned int i = 0; i < MaxRecordChunks; i++)
+    {
+        hr = device->CreateDeferredContext(0, &deferredContexts[i]);
+        assert(SUCCEEDED(hr));
+    }
+
+    //Everything below loads through the archive when there is one
+    if (!looseAssets && assetArchive.Open(assetArchivePath))
+    {
+        MountAssetArchive(&assetArchive);
+    }
+
+    //Textures start out with their low mips, the rest is streamed in by what is on screen
+    uploadQueue.Init(device, &jobSystem);
+    textureStreamer.Init(device, &jobSystem, &uploadQueue, textureBudget, "texturecache");
+    terrain.Init(device, &jobSystem, TerrainSettings(), "terraincache");
+    lightClusterer.Init(device);
+    shadowCascades.Init(device);
+    frameTimer.Init(device);
+    overdrawMeter.Init(device);
+    frameArena.Init(frameArenaSize);
+
     InitPipeline();
     InitGraphics();
+
+    //The scene's meshes are in place before the first frame
+    uploadQueue.Flush(deviceContext);
+
+    //Watch everything that was just loaded so edits show up without a restart
+    fileWatcher.Watch(shaderPath);
+    fileWatcher.Watch(cube->texturePath);
+    fileWatcher.Watch(panda->texturePath);
+    fileWatcher.Watch(panda->meshPath);
+    fileWatcher.Start();
 }
 
 
@@ -320,8 +811,23 @@ void RenderFrame()
     }
     t = (timeCur - timeStart) / 1000.0f;
 
-    //Animate the cube
-    worldMatrix = XMMatrixRotationY(t);
+    //Last frame's memory is gone, anything allocated from here on only lives for this frame
+    frameArena.Reset();
+    drawList.Begin(frameArena);
+    shadowCasters.Begin(frameArena);
+    ForbidHeapAllocations(strictMemory && memoryFrameCount >= memoryWarmupFrames);
+
+    //Pick the render size from how long the GPU took for the last frames
+    UpdateRenderScale();
+    UpdateDepthPrepass();
+
+    //Turn the panda, the cube it carries spins on its own as well
+    XMFLOAT4 rotation;
+    XMStoreFloat4(&rotation, XMQuaternionRotationRollPitchYaw(0.0f, t, 0.0f));
+    sceneTransforms.SetRotation(pandaTransform, rotation);
+    XMStoreFloat4(&rotation, XMQuaternionRotationRollPitchYaw(2.0f * t, 3.0f * t, 0.0f));
+    sceneTransforms.SetRotation(propTransform, rotation);
+    sceneTransforms.Update(&jobSystem);
 
     float color[4] = { 0.0f, 0.2f, 0.4f, 1.0f };
 
@@ -330,337 +836,1242 @@ void RenderFrame()
     XMStoreFloat4(&LightDir, XMVector4Normalize(XMLoadFloat4(&LightDir)));
     XMFLOAT4 LightColor = { 1.0f, 1.0f, 1.0f, 1.0f };
 
-    //Clear the back buffer to a deep blue
-    deviceContext->ClearRenderTargetView(backBuffer, color);
-    deviceContext->ClearDepthStencilView(depthStencilView, D3D11_CLEAR_DEPTH, 1.0f, 0);
+    //Render the light
+    XMMATRIX light = XMMatrixTranslationFromVector(5.0f * XMLoadFloat4(&LightDir));
+    const XMMATRIX lightScale = XMMatrixScaling(0.2f, 0.2f, 0.2f);
+    light = lightScale * light;
 
-    //deviceContext->OMSetDepthStencilState(depthStencilState, 0);
+    //Build the list of draws for this frame
+    DrawItem item = {};
 
-    //Select which vertex buffer to display
-    UINT stride = sizeof(VERTEX);
-    UINT offset = 0;
+    //Terrain:
+    DrawTerrain();
 
-    //Select which primitive type we are using
-    deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    //Panda:
+    item.object = panda;
+    sceneTransforms.GetWorld(pandaTransform, item.world);
+    drawList.push_back(item);
+
+    //Characters:
+    AnimateCrowd(t);
+    item.object = character;
+    for (size_t i = 0; i < crowdTransforms.size(); i++)
+    {
+        item.character = static_cast<int>(i);
+        sceneTransforms.GetWorld(crowdTransforms[i], item.world);
+        drawList.push_back(item);
+    }
+    item.character = -1;
+
+    //Cube:
+    item.object = cube;
+    sceneTransforms.GetWorld(propTransform, item.world);
+    drawList.push_back(item);
+
+    //Things off screen still cast shadows onto it. Copied before SelectLods, RenderShadows picks the
+    //casters' levels per cascade.
+    shadowCasters.assign(drawList.begin(), drawList.end());
+
+    //Rasterize the occluders on a worker while this thread gets the frame started
+    JobCounter occluderJob;
+    jobSystem.Run([]()
+    {
+        occlusionCuller.BeginFrame(camera.ViewProj());
+        for (const DrawItem &draw : drawList)
+        {
+            if (draw.object->isOccluder)
+            {
+                occlusionCuller.RasterizeOccluder(draw.object->occluderPositions.data(), sizeof(XMFLOAT3), draw.object->occluderIndices.data(),
+                    static_cast<UINT>(draw.object->occluderIndices.size()), XMLoadFloat4x4(&draw.world));
+            }
+        }
+        occlusionCuller.Finalize();
+    }, &occluderJob);
+
+    //Clear the scene target to a deep blue
+    frameTimer.Begin(deviceContext);
+    deviceContext->ClearRenderTargetView(sceneTarget, color);
+    deviceContext->ClearDepthStencilView(depthStencilView, D3D11_CLEAR_DEPTH, 1.0f, 0);
 
-    //Update variables for shader
+    //Update variables for shader, the world matrix is filled in per draw
     ConstantBuffer cb = {};
-    cb.mWorld = XMMatrixTranspose(worldMatrix);
     cb.mView = XMMatrixTranspose(camera.View());
     cb.mProjection = XMMatrixTranspose(camera.Proj());
     cb.vLightDir = LightDir;
     cb.vLightColor = LightColor;
-    deviceContext->UpdateSubresource(pConstantBuffer, 0, nullptr, &cb, 0, 0);
-
-    //Render the light
-    XMMATRIX light = XMMatrixTranslationFromVector(5.0f * XMLoadFloat4(&LightDir));
-    const XMMATRIX lightScale = XMMatrixScaling(0.2f, 0.2f, 0.2f);
-    light = lightScale * light;
-
-    deviceContext->PSSetSamplers(0, 1, &pSamplerState);
-
-
-    //Update world variable to reflect current light
-    //cb.mWorld = XMMatrixTranspose(light);
-    //deviceContext->UpdateSubresource(pConstantBuffer, 0, nullptr, &cb, 0, 0);
 
+    jobSystem.Wait(occluderJob);
+    CullDrawList();
+    SelectLods();
+    StreamTextures();
+    SendUploads();
+    AssignLights(t);
+    RenderShadows(XMLoadFloat4(&LightDir));
+
+    //The cluster grid and cascades are fitted to the camera above
+    cb.vClusterScale = lightClusterer.GetShaderScale(static_cast<float>(renderWidth), static_cast<float>(renderHeight));
+    cb.vClusterCount = { LightClusterer::ClustersX, LightClusterer::ClustersY, LightClusterer::ClustersZ, 0 };
+    shadowCascades.GetShaderConstants(cb.mShadow, cb.vCascadeSplits, cb.vShadowParams);
+    for (XMMATRIX &shadowMatrix : cb.mShadow)
+    {
+        shadowMatrix = XMMatrixTranspose(shadowMatrix);
+    }
 
-    //Draw the vertex buffer to the back buffer
-    //Ground:
-    //deviceContext->IASetVertexBuffers(0, 1, &ground.pVBuffer, &stride, &offset);
-    //deviceContext->IASetIndexBuffer(ground.pIBuffer, DXGI_FORMAT_R16_UINT, 0);
-    //deviceContext->PSSetShaderResources(0, 1, &ground.pShaderView);
-    //deviceContext->DrawIndexed(ground.index_count, 0, 0);
+    //Replays a recorded chunk, both passes go through here
+    auto submitChunk = [](unsigned int chunk)
+    {
+        deviceContext->ExecuteCommandList(commandLists[chunk], FALSE);
+        commandLists[chunk]->Release();
+        commandLists[chunk] = nullptr;
+    };
 
-    //Panda:
-    deviceContext->IASetVertexBuffers(0, 1, &panda.pVBuffer, &stride, &offset);
-    deviceContext->IASetIndexBuffer(panda.pIBuffer, DXGI_FORMAT_R16_UINT, 0);
-    deviceContext->PSSetShaderResources(0, 1, &panda.pShaderView);
-    deviceContext->DrawIndexed(panda.index_count, 0, 0);
+    //Lay down the depth of the whole draw list before anything is shaded
+    overdrawMeter.BeginDepth(deviceContext);
+    if (depthPrepass)
+    {
+        RecordInParallel(jobSystem, static_cast<unsigned int>(drawList.size()), minDrawsPerChunk,
+            [&cb](unsigned int begin, unsigned int end, unsigned int chunk)
+            {
+                ID3D11DeviceContext *context = deferredContexts[chunk];
+                BindDepthPrepassState(context);
+                RecordDepthDraws(context, drawList.data() + begin, end - begin, cb);
+
+                HRESULT hr = context->FinishCommandList(FALSE, &commandLists[chunk]);
+                assert(SUCCEEDED(hr));
+            },
+            submitChunk);
+        overdrawMeter.EndDepth(deviceContext);
+    }
 
-    //Cube:
-    /*deviceContext->IASetVertexBuffers(0, 1, &cube.pVBuffer, &stride, &offset);
-    deviceContext->IASetIndexBuffer(cube.pIBuffer, DXGI_FORMAT_R16_UINT, 0);
-    deviceContext->PSSetShaderResources(0, 1, &cube.pShaderView);
-    deviceContext->DrawIndexed(cube.index_count, 0, 0);*/
+    //Record the draw list in chunks on the deferred contexts, then replay them in order
+    overdrawMeter.BeginShading(deviceContext);
+    RecordInParallel(jobSystem, static_cast<unsigned int>(drawList.size()), minDrawsPerChunk,
+        [&cb](unsigned int begin, unsigned int end, unsigned int chunk)
+        {
+            ID3D11DeviceContext *context = deferredContexts[chunk];
+            BindPipelineState(context);
+            RecordDraws(context, drawList.data() + begin, end - begin, cb);
+
+            HRESULT hr = context->FinishCommandList(FALSE, &commandLists[chunk]);
+            assert(SUCCEEDED(hr));
+        },
+        submitChunk);
+    if (!depthPrepass)
+    {
+        overdrawMeter.EndDepth(deviceContext);
+    }
+    overdrawMeter.EndShading(deviceContext, static_cast<unsigned int>(renderWidth * renderHeight));
 
+    Upscale();
+    frameTimer.End(deviceContext);
 
+    //Presenting may allocate inside the driver, which isn't this frame's to answer for
+    ForbidHeapAllocations(false);
+    ReportMemory();
+    ReportGpuMemory();
 
     //Switch the back buffer and the front buffer to present to screen
     swapChain->Present(1, 0);
 }
 
 
-//Cleans up Direct3D
-void CleanD3D()
+//Removes draws that are off screen or hidden behind occluders and reports the culling rate
+void CullDrawList()
 {
-    //Close and release all existing COM objects
-    pLayout->Release();
-    pVS->Release();
-    pPS->Release();
-    cube.pVBuffer->Release();
-    ground.pVBuffer->Release();
-    cube.pIBuffer->Release();
-    ground.pIBuffer->Release();
-    pConstantBuffer->Release();
-    cube.pTexture->Release();
-    ground.pTexture->Release();
-    cube.pShaderView->Release();
-    ground.pShaderView->Release();
-    depthStencilBuffer->Release();
-    depthStencilView->Release();
-    depthStencilState->Release();
-    pSamplerState->Release();
-    swapChain->Release();
-    backBuffer->Release();
-    device->Release();
-    deviceContext->Release();
-
-    debug->ReportLiveObjects(DXGI_DEBUG_ALL, DXGI_DEBUG_RLO_ALL);
-    debug->Release();
-
-    delete[] targaData;
-    targaData = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < drawList.size(); i++)
+    {
+        const DrawItem &draw = drawList[i];
+        if (occlusionCuller.IsVisible(draw.object->boundsMin, draw.object->boundsMax, XMLoadFloat4x4(&draw.world)))
+        {
+            drawList[kept++] = draw;
+        }
+    }
+    drawList.resize(kept);
+
+    const OcclusionStats &stats = occlusionCuller.GetStats();
+    occlusionTotals.occluderTriangles += stats.occluderTriangles;
+    occlusionTotals.tested += stats.tested;
+    occlusionTotals.frustumCulled += stats.frustumCulled;
+    occlusionTotals.occlusionCulled += stats.occlusionCulled;
+    occlusionTotals.rasterMs += stats.rasterMs;
+    occlusionTotals.testMs += stats.testMs;
+    occlusionFrames++;
+
+    //Print the averages about once a second
+    const ULONGLONG now = GetTickCount64();
+    if (now - occlusionReportTime >= 1000 && occlusionTotals.tested > 0)
+    {
+        const float culled = 100.0f * (occlusionTotals.frustumCulled + occlusionTotals.occlusionCulled) / occlusionTotals.tested;
+        const float occluded = 100.0f * occlusionTotals.occlusionCulled / occlusionTotals.tested;
+
+        char report[256] = {};
+        sprintf_s(report, "Culling: %.1f%% culled (%.1f%% occluded), raster %.3f ms, test %.3f ms per frame%s\n",
+            culled, occluded, occlusionTotals.rasterMs / occlusionFrames, occlusionTotals.testMs / occlusionFrames,
+            occlusionCuller.IsUsingAvx2() ? " [AVX2]" : "");
+        OutputDebugStringA(report);
+
+        occlusionTotals = OcclusionStats();
+        occlusionFrames = 0;
+        occlusionReportTime = now;
+    }
 }
 
-Object SetupObject(VERTEX* vertices, UINT vertices_size, short *indices, UINT indices_size, const char *targa) 
+
+//Picks the coarsest level of every draw whose simplification error stays under a pixel on screen
+void SelectLods()
 {
-    HRESULT hr = S_OK;
-    Object object;
+    lodSelector.SetView(camera, static_cast<float>(renderHeight));
+    lodSelector.SetMaxPixelError(maxLodPixelError);
 
-    //Create the vertex buffer
-    D3D11_BUFFER_DESC vBufferDesc = {};
-    vBufferDesc.Usage = D3D11_USAGE_DYNAMIC;                 //Write access by CPU and GPU
-    vBufferDesc.ByteWidth = vertices_size;                //Size is the VERTEX struct * number of vertices
-    vBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;        //Use as a vertex buffer
-    vBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;     //Allow CPU to write in buffer
+    for (DrawItem &draw : drawList)
+    {
+        const Object &object = *draw.object;
+        if (!object.terrainChunk)
+        {
+            const XMMATRIX world = XMLoadFloat4x4(&draw.world);
 
-    hr = device->CreateBuffer(&vBufferDesc, nullptr, &object.pVBuffer);
-    assert(SUCCEEDED(hr));
+            const XMVECTOR center = XMVector3Transform(0.5f * (XMLoadFloat3(&object.boundsMin) + XMLoadFloat3(&object.boundsMax)), world);
+            const float scale = std::max(XMVectorGetX(XMVector3Length(world.r[0])),
+                std::max(XMVectorGetX(XMVector3Length(world.r[1])), XMVectorGetX(XMVector3Length(world.r[2]))));
 
-    //Copy the vertices into the buffer
-    D3D11_MAPPED_SUBRESOURCE vMappedResource = {};
-    deviceContext->Map(object.pVBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &vMappedResource);    //map the buffer
-    memcpy(vMappedResource.pData, vertices, vertices_size);                        //copy the data
-    deviceContext->Unmap(object.pVBuffer, 0);
+            draw.lod = lodSelector.Select(object.lods, center, scale);
+        }
+        lodTriangles += object.lods[draw.lod].indexCount / 3;
+        fullTriangles += object.lods[0].indexCount / 3;
+    }
 
-    D3D11_BUFFER_DESC iBufferDesc = {};
-    iBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-    iBufferDesc.ByteWidth = indices_size;
-    iBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-    iBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    //Print the share of triangles saved about once a second
+    const ULONGLONG now = GetTickCount64();
+    if (now - lodReportTime >= 1000 && fullTriangles > 0)
+    {
+        char report[128] = {};
+        sprintf_s(report, "LOD: drawing %.1f%% of full detail triangles\n", 100.0 * lodTriangles / fullTriangles);
+        OutputDebugStringA(report);
 
-    //Create index buffer
-    hr = device->CreateBuffer(&iBufferDesc, nullptr, &object.pIBuffer);
-    assert(SUCCEEDED(hr));
+        lodTriangles = 0;
+        fullTriangles = 0;
+        lodReportTime = now;
+    }
+}
 
-    //Copy the indices into the buffer
-    D3D11_MAPPED_SUBRESOURCE iMappedResource = {};
-    deviceContext->Map(object.pIBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &iMappedResource);    //Map the buffer
-    memcpy(iMappedResource.pData, indices, indices_size);                                //Copy the data
-    deviceContext->Unmap(object.pIBuffer, 0);
 
-    int width = 0;
-    int height = 0;
-    //bool result = LoadTarga("assets/stone.tga", height, width);
-    const bool result = LoadTarga(targa, height, width);
-    assert(result == true);
+//Requests texture detail by how big each visible draw is on screen, then lets the streamer catch up
+void StreamTextures()
+{
+    for (const DrawItem &draw : drawList)
+    {
+        const Object &object = *draw.object;
+        const XMMATRIX world = XMLoadFloat4x4(&draw.world);
 
-    CD3D11_TEXTURE2D_DESC textureDesc(DXGI_FORMAT_R8G8B8A8_UNORM, width, height, 1, 1);
+        //Bounding sphere of the world space box
+        const XMVECTOR boundsMin = XMLoadFloat3(&object.boundsMin);
+        const XMVECTOR boundsMax = XMLoadFloat3(&object.boundsMax);
+        const XMVECTOR center = XMVector3Transform(0.5f * (boundsMin + boundsMax), world);
+        const float radius = XMVectorGetX(XMVector3Length(XMVector3TransformNormal(0.5f * (boundsMax - boundsMin), world)));
 
-    D3D11_SUBRESOURCE_DATA initialData = {};
-    initialData.SysMemPitch = 4 * width;
-    initialData.pSysMem = targaData;
+        textureStreamer.Request(object.texture, TextureStreamer::ProjectedSize(camera, static_cast<float>(renderHeight), center, radius));
+    }
 
-    hr = device->CreateTexture2D(&textureDesc, &initialData, &object.pTexture);
-    assert(SUCCEEDED(hr));
+    textureStreamer.Update(deviceContext);
 
-    hr = device->CreateShaderResourceView(object.pTexture, nullptr, &object.pShaderView);
-    assert(SUCCEEDED(hr));
+    //Print residency and bandwidth about once a second
+    const ULONGLONG now = GetTickCount64();
+    if (now - streamingReportTime >= 1000)
+    {
+        const TextureStreamingStats stats = textureStreamer.GetStats();
+        const double seconds = streamingReportTime == 0 ? 1.0 : (now - streamingReportTime) / 1000.0;
 
-    object.vertex_count = vertices_size / sizeof(vertices[0]);
-    object.vertex_size = sizeof(vertices[0]);
-    object.index_count = indices_size / sizeof(indices[0]);
-    object.index_size = sizeof(indices[0]);
+        char report[256] = {};
+        sprintf_s(report, "Textures: %u in %u arrays, %.1f/%.1f MB resident, %u/%u mips, streamed %.2f MB/s, evicted %.1f MB total, %u loads pending\n",
+            stats.textures, stats.arrays, stats.residentBytes / 1048576.0, stats.budgetBytes / 1048576.0, stats.residentMips, stats.wantedMips,
+            (stats.streamedBytes - streamingReportBytes) / 1048576.0 / seconds, stats.evictedBytes / 1048576.0, stats.pendingLoads);
+        OutputDebugStringA(report);
 
-    return object;
+        streamingReportBytes = stats.streamedBytes;
+        streamingReportTime = now;
+    }
 }
 
-Object LoadModel(const char * filename)
-{
-    
-    // Create importer
-    Assimp::Importer importer;
-    importer.SetPropertyBool(AI_CONFIG_PP_PTV_NORMALIZE, true);
-    importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE,
-        aiPrimitiveType_LINE |
-        aiPrimitiveType_POINT);
-    importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS,
-        aiComponent_COLORS |
-        aiComponent_LIGHTS |
-        aiComponent_CAMERAS |
-        aiComponent_BONEWEIGHTS);
-    // Load scene
-    auto const* scene = importer.ReadFile(filename,
-        aiProcess_ConvertToLeftHanded |
-        aiProcess_CalcTangentSpace |
-        aiProcess_Triangulate |
-        aiProcess_JoinIdenticalVertices |
-        aiProcess_TransformUVCoords |
-        aiProcess_GenUVCoords |
-        aiProcess_ValidateDataStructure |
-        aiProcess_GenSmoothNormals |
-        aiProcess_RemoveRedundantMaterials |
-        aiProcess_OptimizeMeshes |
-        aiProcess_FindDegenerates |
-        aiProcess_FindInvalidData |
-        aiProcess_FindInstances |
-        aiProcess_SortByPType);
-    
-    assert(scene != NULL);
-    assert(scene->mNumMeshes > 0);
 
-    //Find number of vertices and indices
-    uint32_t vertex_count = 0;
-    uint32_t index_count = 0;
+//Sends what was queued for the GPU up to the frame's budget
+void SendUploads()
+{
+    uploadQueue.Update(deviceContext);
 
-    for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
-        auto const* const mesh = scene->mMeshes[m];
-        vertex_count += mesh->mNumVertices;
-        index_count += mesh->mNumFaces * 3;
-    }
+    //Print the backlog and bandwidth about once a second
+    const ULONGLONG now = GetTickCount64();
+    if (now - uploadReportTime >= 1000)
+    {
+        const UploadRingStats stats = uploadQueue.GetStats();
+        const double seconds = uploadReportTime == 0 ? 1.0 : (now - uploadReportTime) / 1000.0;
 
-    
-    size_t const vertex_size = sizeof(VERTEX);
-    size_t const index_size = sizeof(uint32_t);
-    // For each model
-    //  for each mesh
-    //      get verices
-    //      get indices
+        char report[256] = {};
+        sprintf_s(report, "Uploads: %.2f MB/s, %u pending (%.1f MB), %u staging segments in flight, %llu stalls total\n",
+            (stats.uploadedBytes - uploadReportBytes) / 1048576.0 / seconds, stats.pendingUploads, stats.pendingBytes / 1048576.0,
+            stats.segmentsInFlight, stats.stalls);
+        OutputDebugStringA(report);
 
-    std::vector<VERTEX> vertices = {};
-    std::vector<short> indices = {};
+        uploadReportBytes = stats.uploadedBytes;
+        uploadReportTime = now;
+    }
+}
 
-    for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
-        auto const* curr_mesh = scene->mMeshes[m];
 
-        size_t vertex_start_offset = vertices.size();
+//Places the spot lights for this frame, assigns every light to the clusters it reaches and uploads the lists
+void AssignLights(float t)
+{
+    //Spot lights circle the panda and shine down at it from above
+    const unsigned int firstSpot = static_cast<unsigned int>(sceneLights.size()) - spotLightCount;
+    for (unsigned int i = 0; i < spotLightCount; i++)
+    {
+        const float angle = 0.5f * t + XM_2PI * i / spotLightCount;
+        ClusterLight &spot = sceneLights[firstSpot + i];
+        spot.position = XMFLOAT3(3.0f * cosf(angle), 4.0f, 3.0f * sinf(angle));
+        XMStoreFloat3(&spot.direction, XMVector3Normalize(XMVectorSet(-spot.position.x, 1.0f - spot.position.y, -spot.position.z, 0.0f)));
+    }
 
-        for (uint32_t i = 0; i < curr_mesh->mNumVertices; i++) {
-            aiVector3D const& pos = curr_mesh->mVertices[i];
-            aiVector3D const& tex = curr_mesh->HasTextureCoords(0) ? curr_mesh->mTextureCoords[0][i] : aiVector3D(0.0f);
-            aiVector3D const& normal = curr_mesh->mNormals[i];
+    lightClusterer.Update(camera, sceneLights.data(), static_cast<unsigned int>(sceneLights.size()), jobSystem);
+    lightClusterer.Upload(deviceContext);
 
-            VERTEX vertex = {
-                { pos.x, pos.y, pos.z },
-                { normal.x, normal.y, normal.z },
-                { tex.x, tex.y }
-            };
+    //Print how the lights spread over the clusters about once a second
+    const ULONGLONG now = GetTickCount64();
+    if (now - lightReportTime >= 1000)
+    {
+        const LightClusterStats &stats = lightClusterer.GetStats();
 
-            vertices.push_back(vertex);
-        }
+        char report[256] = {};
+        sprintf_s(report, "Lights: %u/%u in view, %u clusters lit, %.1f lights per lit cluster (max %u), assign %.3f ms\n",
+            stats.visibleLights, stats.lights, stats.occupiedClusters,
+            stats.occupiedClusters > 0 ? static_cast<float>(stats.lightIndices) / stats.occupiedClusters : 0.0f,
+            stats.maxPerCluster, stats.assignMs);
+        OutputDebugStringA(report);
 
-        for (uint32_t i = 0; i < curr_mesh->mNumFaces; i++) {
-            aiFace const& face = curr_mesh->mFaces[i];
-            //for (int j = 2; j >=0; --j) {
-            for (int j = 0; j < 3; j++) {
-                indices.push_back((uint16_t)face.mIndices[j] + (uint16_t)vertex_start_offset);
-            }
-        }
+        lightReportTime = now;
     }
-
-
-
-    return SetupObject(vertices.data(), static_cast<UINT>(vertices.size() * sizeof(vertices[0])), indices.data(), static_cast<UINT>(indices.size() * sizeof(indices[0])), "assets/pandaren_model/pandaren_Body.tga");
 }
 
 
-void CreateDepthBuffer()
+//Draws the frame's casters into the shadow cascades on the immediate context, before the recorded draws run
+void RenderShadows(FXMVECTOR lightDir)
 {
-    HRESULT hr = S_OK;
+    shadowCascades.Update(camera, lightDir, shadowDistance);
 
-    D3D11_TEXTURE2D_DESC depthStencilDesc = {};
+    deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    deviceContext->VSSetConstantBuffers(0, 1, &pConstantBuffer);
+    deviceContext->VSSetShaderResources(6, 1, &paletteView);
 
-    depthStencilDesc.Width = winWidth;
-    depthStencilDesc.Height = winHeight;
-    depthStencilDesc.MipLevels = 1;
-    depthStencilDesc.ArraySize = 1;
-    depthStencilDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+    shadowCascades.Render(deviceContext, [](ID3D11DeviceContext *context, unsigned int cascade, ShadowCasterSet casters)
+    {
+        bool skinningBound = false;
+        context->IASetInputLayout(pDepthLayout);
+        context->VSSetShader(pVSShadow, 0, 0);
 
-    //No MSAA
-    depthStencilDesc.SampleDesc.Count = 1;
-    depthStencilDesc.SampleDesc.Quality = 0;
+        ConstantBuffer cb = {};
+        cb.mView = XMMatrixTranspose(shadowCascades.GetView(cascade));
+        cb.mProjection = XMMatrixTranspose(shadowCascades.GetProjection(cascade));
 
-    depthStencilDesc.Usage = D3D11_USAGE_DEFAULT;
-    depthStencilDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
-    depthStencilDesc.CPUAccessFlags = 0;
-    depthStencilDesc.MiscFlags = 0;
+        //Casters are copied before the camera LOD pick, each cascade picks its own by its texel size
+        const float texelSize = shadowCascades.GetTexelSize(cascade);
 
-    hr = device->CreateTexture2D(&depthStencilDesc, nullptr, &depthStencilBuffer);
-    assert(SUCCEEDED(hr));
+        for (const DrawItem &draw : shadowCasters)
+        {
+            const Object &object = *draw.object;
+            if ((casters == ShadowCastersStatic && !object.isStatic) || (casters == ShadowCastersDynamic && object.isStatic))
+            {
+                continue;
+            }
 
-    D3D11_DEPTH_STENCIL_VIEW_DESC depthStencilViewDesc = {};
-    depthStencilViewDesc.Format = depthStencilDesc.Format;
-    depthStencilViewDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
-    depthStencilViewDesc.Texture2D.MipSlice = 0;
+            //Bounding sphere of the world space box
+            const XMMATRIX world = XMLoadFloat4x4(&draw.world);
+            const XMVECTOR boundsMin = XMLoadFloat3(&object.boundsMin);
+            const XMVECTOR boundsMax = XMLoadFloat3(&object.boundsMax);
+            const XMVECTOR center = XMVector3Transform(0.5f * (boundsMin + boundsMax), world);
+            const float radius = XMVectorGetX(XMVector3Length(XMVector3TransformNormal(0.5f * (boundsMax - boundsMin), world)));
+            if (!shadowCascades.Intersects(cascade, center, radius))
+            {
+                continue;
+            }
 
-    hr = device->CreateDepthStencilView(depthStencilBuffer, &depthStencilViewDesc, &depthStencilView);
-    assert(SUCCEEDED(hr));
+            const bool gpuSkinned = draw.character >= 0 && !cpuSkinning;
+            if (gpuSkinned != skinningBound)
+            {
+                context->IASetInputLayout(gpuSkinned ? pDepthSkinnedLayout : pDepthLayout);
+                context->VSSetShader(gpuSkinned ? pVSShadowSkinned : pVSShadow, 0, 0);
+                skinningBound = gpuSkinned;
+            }
 
-}
+            cb.mWorld = XMMatrixTranspose(world);
+            cb.vDrawInfo.x = gpuSkinned ? draw.character * animationSystem.GetJointCount() : 0;
+            context->UpdateSubresource(pConstantBuffer, 0, nullptr, &cb, 0, 0);
 
+            //The terrain already picked its level together with the neighbouring chunks
+            unsigned int lodIndex = draw.lod;
+            if (!object.terrainChunk)
+            {
+                const float scale = std::max(XMVectorGetX(XMVector3Length(world.r[0])),
+                    std::max(XMVectorGetX(XMVector3Length(world.r[1])), XMVectorGetX(XMVector3Length(world.r[2]))));
+                lodIndex = lodSelector.SelectForTexelSize(object.lods, scale, texelSize);
+            }
 
+            BindVertexStreams(context, draw, true);
+            context->IASetIndexBuffer(object.pIBuffer, DXGI_FORMAT_R16_UINT, 0);
+            const MeshLod &lod = object.lods[lodIndex];
+            context->DrawIndexed(lod.indexCount, lod.indexOffset, 0);
+            shadowDraws++;
+            shadowTriangles += lod.indexCount / 3;
+        }
+    });
 
-//Creates the shape to render
-void InitGraphics()
-{
-    //Create a triangle using the VERTEX struct
-    //VERTEX vertices[] =
-    //{
-    //    { 0.0f, 0.5f, 0.0f, {1.0f, 0.0f, 0.0f, 1.0f} },
-    //    { 0.45f, -0.5, 0.0f, {0.0f, 1.0f, 0.0f, 1.0f} },
-    //    { -0.45f, -0.5f, 0.0f, {0.0f, 0.0f, 1.0f, 1.0f} }
-    //};
+    const ShadowStats &stats = shadowCascades.GetStats();
+    shadowCascadesDrawn += stats.cascadesRendered;
+    shadowRefreshes += stats.staticRefreshes;
+    shadowFrames++;
 
-    VERTEX cubeVertices[] =
+    //Print how much shadow work the frames did about once a second
+    const ULONGLONG now = GetTickCount64();
+    if (now - shadowReportTime >= 1000)
     {
-        { XMFLOAT3(-1.0f, 1.0f, -1.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(1.0f, 0.0f) },
-        { XMFLOAT3(1.0f, 1.0f, -1.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(0.0f, 0.0f) },
-        { XMFLOAT3(1.0f, 1.0f, 1.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(0.0f, 1.0f) },
-        { XMFLOAT3(-1.0f, 1.0f, 1.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(1.0f, 1.0f) },
-
-        { XMFLOAT3(-1.0f, -1.0f, -1.0f), XMFLOAT3(0.0f, -1.0f, 0.0f), XMFLOAT2(0.0f, 0.0f) },
-        { XMFLOAT3(1.0f, -1.0f, -1.0f), XMFLOAT3(0.0f, -1.0f, 0.0f), XMFLOAT2(1.0f, 0.0f) },
-        { XMFLOAT3(1.0f, -1.0f, 1.0f), XMFLOAT3(0.0f, -1.0f, 0.0f), XMFLOAT2(1.0f, 1.0f) },
-        { XMFLOAT3(-1.0f, -1.0f, 1.0f), XMFLOAT3(0.0f, -1.0f, 0.0f), XMFLOAT2(0.0f, 1.0f) },
-
-        { XMFLOAT3(-1.0f, -1.0f, 1.0f), XMFLOAT3(-1.0f, 0.0f, 0.0f), XMFLOAT2(0.0f, 1.0f) },
-        { XMFLOAT3(-1.0f, -1.0f, -1.0f), XMFLOAT3(-1.0f, 0.0f, 0.0f), XMFLOAT2(1.0f, 1.0f) },
-        { XMFLOAT3(-1.0f, 1.0f, -1.0f), XMFLOAT3(-1.0f, 0.0f, 0.0f), XMFLOAT2(1.0f, 0.0f) },
-        { XMFLOAT3(-1.0f, 1.0f, 1.0f), XMFLOAT3(-1.0f, 0.0f, 0.0f), XMFLOAT2(0.0f, 0.0f) },
-
-        { XMFLOAT3(1.0f, -1.0f, 1.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), XMFLOAT2(1.0f, 1.0f) },
-        { XMFLOAT3(1.0f, -1.0f, -1.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), XMFLOAT2(0.0f, 1.0f) },
-        { XMFLOAT3(1.0f, 1.0f, -1.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), XMFLOAT2(0.0f, 0.0f) },
-        { XMFLOAT3(1.0f, 1.0f, 1.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), XMFLOAT2(1.0f, 0.0f) },
-
-        { XMFLOAT3(-1.0f, -1.0f, -1.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), XMFLOAT2(0.0f, 1.0f) },
-        { XMFLOAT3(1.0f, -1.0f, -1.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), XMFLOAT2(1.0f, 1.0f) },
-        { XMFLOAT3(1.0f, 1.0f, -1.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), XMFLOAT2(1.0f, 0.0f) },
-        { XMFLOAT3(-1.0f, 1.0f, -1.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), XMFLOAT2(0.0f, 0.0f) },
-
-        { XMFLOAT3(-1.0f, -1.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), XMFLOAT2(1.0f, 1.0f) },
-        { XMFLOAT3(1.0f, -1.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), XMFLOAT2(0.0f, 1.0f) },
-        { XMFLOAT3(1.0f, 1.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), XMFLOAT2(0.0f, 0.0f) },
-        { XMFLOAT3(-1.0f, 1.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), XMFLOAT2(1.0f, 0.0f) },
-    };
+        char report[256] = {};
+        sprintf_s(report, "Shadows: %.2f cascades drawn per frame, %u static cache refreshes, %.1f caster draws and %.0f triangles per frame\n",
+            static_cast<float>(shadowCascadesDrawn) / shadowFrames, shadowRefreshes, static_cast<float>(shadowDraws) / shadowFrames,
+            static_cast<double>(shadowTriangles) / shadowFrames);
+        OutputDebugStringA(report);
+
+        shadowCascadesDrawn = 0;
+        shadowRefreshes = 0;
+        shadowDraws = 0;
+        shadowTriangles = 0;
+        shadowFrames = 0;
+        shadowReportTime = now;
+    }
+}
 
-    VERTEX groundVertices[]=
+
+//Feeds every GPU frame time that came back to the resolution governor and sizes this frame's viewport
+void UpdateRenderScale()
+{
+    float ms = 0.0f;
+    while (frameTimer.Collect(deviceContext, ms))
+    {
+        gpuFrameMs = ms;
+        resolutionGovernor.Update(ms);
+    }
+
+    const float scale = resolutionGovernor.GetScale();
+    renderWidth = std::max(1, static_cast<int>(winWidth * scale + 0.5f));
+    renderHeight = std::max(1, static_cast<int>(winHeight * scale + 0.5f));
+
+    //Print the render size and GPU time about once a second
+    const ULONGLONG now = GetTickCount64();
+    if (now - resolutionReportTime >= 1000)
+    {
+        char report[256] = {};
+        sprintf_s(report, "Resolution: %dx%d of %dx%d (%.0f%%), GPU %.2f ms, average %.2f ms, target %.2f ms, %u changes\n",
+            renderWidth, renderHeight, winWidth, winHeight, 100.0f * scale, gpuFrameMs, resolutionGovernor.GetAverageMs(),
+            resolutionGovernor.GetSettings().targetMs, resolutionGovernor.GetChanges());
+        OutputDebugStringA(report);
+
+        resolutionReportTime = now;
+    }
+}
+
+
+//Averages the overdraw that came back and turns the depth pre-pass on or off by it. The depth
+//overdraw counts the same samples whether or not the pre-pass ran, so it can switch either way.
+void UpdateDepthPrepass()
+{
+    OverdrawSample sample;
+    while (overdrawMeter.Collect(deviceContext, sample))
+    {
+        const bool first = overdrawAverage.depth == 0.0f;
+        overdrawAverage.depth = first ? sample.depth : overdrawAverage.depth + overdrawSmoothing * (sample.depth - overdrawAverage.depth);
+        overdrawAverage.shaded = first ? sample.shaded : overdrawAverage.shaded + overdrawSmoothing * (sample.shaded - overdrawAverage.shaded);
+    }
+
+    bool wanted = depthPrepass;
+    if (prepassMode != PrepassAuto)
+    {
+        wanted = prepassMode == PrepassOn;
+    }
+    else if (overdrawAverage.depth > prepassEnableAbove)
+    {
+        wanted = true;
+    }
+    else if (overdrawAverage.depth < prepassDisableBelow)
+    {
+        wanted = false;
+    }
+    if (wanted != depthPrepass)
+    {
+        depthPrepass = wanted;
+        prepassChanges++;
+    }
+
+    //Print the overdraw and what the pre-pass does about it about once a second
+    const ULONGLONG now = GetTickCount64();
+    if (now - overdrawReportTime >= 1000)
+    {
+        char report[256] = {};
+        sprintf_s(report, "Overdraw: depth %.2fx, shaded %.2fx per pixel, pre-pass %s%s, %u changes\n",
+            overdrawAverage.depth, overdrawAverage.shaded, depthPrepass ? "on" : "off", prepassMode == PrepassAuto ? "" : " (forced)", prepassChanges);
+        OutputDebugStringA(report);
+
+        overdrawReportTime = now;
+    }
+}
+
+
+//Stretches the rendered part of the scene target over the whole back buffer with a fullscreen triangle
+void Upscale()
+{
+    UpscaleConstants constants = {};
+    constants.vSourceRect = XMFLOAT4(static_cast<float>(renderWidth) / winWidth, static_cast<float>(renderHeight) / winHeight,
+        1.0f / winWidth, 1.0f / winHeight);
+    deviceContext->UpdateSubresource(pUpscaleBuffer, 0, nullptr, &constants, 0, 0);
+
+    D3D11_VIEWPORT viewPort = {};
+    viewPort.Width = (float)winWidth;
+    viewPort.Height = (float)winHeight;
+    viewPort.MinDepth = 0.0f;
+    viewPort.MaxDepth = 1.0f;
+
+    deviceContext->OMSetRenderTargets(1, &backBuffer, nullptr);
+    deviceContext->RSSetViewports(1, &viewPort);
+
+    //The triangle is made up from the vertex index, no buffers needed
+    deviceContext->IASetInputLayout(nullptr);
+    deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    deviceContext->VSSetShader(pVSUpscale, 0, 0);
+    deviceContext->VSSetConstantBuffers(1, 1, &pUpscaleBuffer);
+    deviceContext->PSSetShader(pPSUpscale, 0, 0);
+    deviceContext->PSSetConstantBuffers(1, 1, &pUpscaleBuffer);
+    deviceContext->PSSetShaderResources(5, 1, &sceneView);
+    deviceContext->PSSetSamplers(2, 1, &pUpscaleSampler);
+    deviceContext->Draw(3, 0);
+
+    //Unbind the scene so it can be a render target again next frame
+    ID3D11ShaderResourceView *noView = nullptr;
+    deviceContext->PSSetShaderResources(5, 1, &noView);
+}
+
+
+//Adds the frame's allocations to the running totals and prints the per frame averages about once a second
+void ReportMemory()
+{
+    EndMemoryFrame(memoryStats);
+    memoryFrameCount++;
+    memoryReportFrames++;
+    for (int i = 0; i < MemoryTagCount; i++)
+    {
+        memoryFrameTotals[i].allocations += memoryStats.frame[i].allocations;
+        memoryFrameTotals[i].bytes += memoryStats.frame[i].bytes;
+    }
+
+    const ULONGLONG now = GetTickCount64();
+    if (now - memoryReportTime >= 1000)
+    {
+        char report[512] = {};
+        int length = sprintf_s(report, "Memory per frame:");
+        for (int i = 0; i < MemoryTagCount; i++)
+        {
+            length += sprintf_s(report + length, sizeof(report) - length, " %s %.1f (%.1f KB),", GetMemoryTagName(static_cast<MemoryTag>(i)),
+                static_cast<double>(memoryFrameTotals[i].allocations) / memoryReportFrames, memoryFrameTotals[i].bytes / 1024.0 / memoryReportFrames);
+        }
+        sprintf_s(report + length, sizeof(report) - length, " frame arena %.1f/%.1f KB, %u scene objects, %llu forbidden heap allocations\n",
+            frameArena.GetHighWater() / 1024.0, frameArena.GetCapacity() / 1024.0, sceneObjects.GetLive(), memoryStats.forbiddenHeapAllocations);
+        OutputDebugStringA(report);
+
+        for (MemoryCounter &counter : memoryFrameTotals)
+        {
+            counter = MemoryCounter();
+        }
+        memoryReportFrames = 0;
+        memoryReportTime = now;
+    }
+}
+
+
+//Prints the live bytes of every category against its budget and the owners holding the most about once a second
+void ReportGpuMemory()
+{
+    const ULONGLONG now = GetTickCount64();
+    if (now - gpuReportTime < 1000)
+    {
+        return;
+    }
+
+    GpuCategoryStats stats[GpuCategoryCount];
+    GetGpuCategoryStats(stats);
+    char report[1024] = {};
+    int length = sprintf_s(report, "GPU memory:");
+    for (int i = 0; i < GpuCategoryCount; i++)
+    {
+        const char *name = GetGpuCategoryName(static_cast<GpuCategory>(i));
+        if (i == GpuCategoryView)
+        {
+            length += sprintf_s(report + length, sizeof(report) - length, " %u views,", stats[i].resources);
+        }
+        else if (stats[i].budgetBytes > 0)
+        {
+            length += sprintf_s(report + length, sizeof(report) - length, " %s %.1f/%.1f MB (%u, peak %.1f),", name, stats[i].bytes / 1048576.0,
+                stats[i].budgetBytes / 1048576.0, stats[i].resources, stats[i].peakBytes / 1048576.0);
+        }
+        else
+        {
+            length += sprintf_s(report + length, sizeof(report) - length, " %s %.1f MB (%u),", name, stats[i].bytes / 1048576.0, stats[i].resources);
+        }
+    }
+
+    GpuOwnerBytes owners[gpuReportOwners];
+    const unsigned int ownerCount = GetGpuOwnerBytes(owners, gpuReportOwners);
+    length += sprintf_s(report + length, sizeof(report) - length, " largest");
+    for (unsigned int i = 0; i < ownerCount; i++)
+    {
+        length += sprintf_s(report + length, sizeof(report) - length, " %s %.1f MB%s", owners[i].owner, owners[i].bytes / 1048576.0, i + 1 < ownerCount ? "," : "");
+    }
+    sprintf_s(report + length, sizeof(report) - length, "\n");
+    OutputDebugStringA(report);
+
+    gpuReportTime = now;
+}
+
+
+//Sets all pipeline state a draw needs, deferred contexts start out with none of it
+void BindPipelineState(ID3D11DeviceContext *context)
+{
+    D3D11_VIEWPORT viewPort = {};
+    viewPort.Width = (float)renderWidth;
+    viewPort.Height = (float)renderHeight;
+    viewPort.MinDepth = 0.0f;
+    viewPort.MaxDepth = 1.0f;
+
+    context->OMSetRenderTargets(1, &sceneTarget, depthStencilView);
+    context->OMSetDepthStencilState(depthPrepass ? depthEqualState : depthStencilState, 0);
+    context->RSSetViewports(1, &viewPort);
+
+    context->IASetInputLayout(pLayout);
+    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+    context->VSSetShader(pVS, 0, 0);
+    context->VSSetConstantBuffers(0, 1, &pConstantBuffer);
+    context->VSSetShaderResources(6, 1, &paletteView);
+    context->PSSetShader(pPS, 0, 0);
+    context->PSSetConstantBuffers(0, 1, &pConstantBuffer);
+    context->PSSetSamplers(0, 1, &pSamplerState);
+
+    ID3D11ShaderResourceView *lightViews[3] = {};
+    lightClusterer.GetViews(lightViews);
+    context->PSSetShaderResources(1, 3, lightViews);
+
+    ID3D11ShaderResourceView *shadowView = shadowCascades.GetShadowMapView();
+    ID3D11SamplerState *shadowSampler = shadowCascades.GetSampler();
+    context->PSSetShaderResources(4, 1, &shadowView);
+    context->PSSetSamplers(1, 1, &shadowSampler);
+}
+
+
+//Depth target alone, the position stream and no pixel shader. The shadow vertex shaders do the same
+//transform as the shading ones, given the camera's view and projection.
+void BindDepthPrepassState(ID3D11DeviceContext *context)
+{
+    D3D11_VIEWPORT viewPort = {};
+    viewPort.Width = (float)renderWidth;
+    viewPort.Height = (float)renderHeight;
+    viewPort.MinDepth = 0.0f;
+    viewPort.MaxDepth = 1.0f;
+
+    context->OMSetRenderTargets(0, nullptr, depthStencilView);
+    context->OMSetDepthStencilState(depthStencilState, 0);
+    context->RSSetViewports(1, &viewPort);
+
+    context->IASetInputLayout(pDepthLayout);
+    context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+    context->VSSetShader(pVSShadow, 0, 0);
+    context->VSSetConstantBuffers(0, 1, &pConstantBuffer);
+    context->VSSetShaderResources(6, 1, &paletteView);
+    context->PSSetShader(nullptr, 0, 0);
+}
+
+
+//Binds the vertex buffer of a draw once per attribute stream, at the offset PackStreams put the
+//stream at, and the joint stream of a GPU skinned draw after them. Depth passes only take positions.
+void BindVertexStreams(ID3D11DeviceContext *context, const DrawItem &draw, bool positionOnly)
+{
+    const Object &object = *draw.object;
+    const bool gpuSkinned = draw.character >= 0 && !cpuSkinning;
+    ID3D11Buffer *vertices = draw.character >= 0 && cpuSkinning ? cpuSkinnedBuffers[draw.character] : object.pVBuffer.Get();
+
+    ID3D11Buffer *buffers[skinStreamSlot + 1] = {};
+    UINT strides[skinStreamSlot + 1] = {};
+    UINT offsets[skinStreamSlot + 1] = {};
+    const UINT streams = positionOnly ? 1 : SceneVertexFormat::AttributeCount;
+    for (UINT a = 0; a < streams; a++)
+    {
+        buffers[a] = vertices;
+        strides[a] = SceneVertexFormat::GetSize(a);
+        offsets[a] = static_cast<UINT>(SceneVertexFormat::GetStreamOffset(a, static_cast<size_t>(object.vertex_count)));
+    }
+    buffers[skinStreamSlot] = object.pSkinBuffer;
+    strides[skinStreamSlot] = SkinVertexFormat::Stride;
+
+    //The slots between the positions and the joints stay empty in a skinned depth pass
+    context->IASetVertexBuffers(0, gpuSkinned ? skinStreamSlot + 1 : streams, buffers, strides, offsets);
+}
+
+
+//Records a range of the draw list on a context
+void RecordDraws(ID3D11DeviceContext *context, const DrawItem *draws, unsigned int count, const ConstantBuffer &frameConstants)
+{
+    bool skinningBound = false;         //BindPipelineState leaves the unskinned shader bound
+    ID3D11ShaderResourceView *boundTexture = nullptr;   //Draws with textures in the same array keep it bound
+
+    ConstantBuffer cb = frameConstants;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const Object &object = *draws[i].object;
+
+        //Characters the CPU already skinned draw like anything else, from their own vertex buffer
+        const int character = draws[i].character;
+        const bool gpuSkinned = character >= 0 && !cpuSkinning;
+        if (gpuSkinned != skinningBound)
+        {
+            context->IASetInputLayout(gpuSkinned ? pSkinnedLayout : pLayout);
+            context->VSSetShader(gpuSkinned ? pVSSkinned : pVS, 0, 0);
+            skinningBound = gpuSkinned;
+        }
+
+        //Update world variable for this object
+        cb.mWorld = XMMatrixTranspose(XMLoadFloat4x4(&draws[i].world));
+        cb.vDrawInfo.x = gpuSkinned ? character * animationSystem.GetJointCount() : 0;
+        cb.vDrawInfo.y = textureStreamer.GetSlice(object.texture);
+        context->UpdateSubresource(pConstantBuffer, 0, nullptr, &cb, 0, 0);
+
+        BindVertexStreams(context, draws[i], false);
+        context->IASetIndexBuffer(object.pIBuffer, DXGI_FORMAT_R16_UINT, 0);
+        ID3D11ShaderResourceView *textureView = textureStreamer.GetView(object.texture);
+        if (textureView != boundTexture)
+        {
+            context->PSSetShaderResources(0, 1, &textureView);
+            boundTexture = textureView;
+        }
+        const MeshLod &lod = object.lods[draws[i].lod];
+        context->DrawIndexed(lod.indexCount, lod.indexOffset, 0);
+    }
+}
+
+
+//Records a range of the draw list into the depth pre-pass, the same draws with the same LODs as the shading pass
+void RecordDepthDraws(ID3D11DeviceContext *context, const DrawItem *draws, unsigned int count, const ConstantBuffer &frameConstants)
+{
+    bool skinningBound = false;         //BindDepthPrepassState leaves the unskinned shader bound
+    ConstantBuffer cb = frameConstants;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const Object &object = *draws[i].object;
+
+        const int character = draws[i].character;
+        const bool gpuSkinned = character >= 0 && !cpuSkinning;
+        if (gpuSkinned != skinningBound)
+        {
+            context->IASetInputLayout(gpuSkinned ? pDepthSkinnedLayout : pDepthLayout);
+            context->VSSetShader(gpuSkinned ? pVSShadowSkinned : pVSShadow, 0, 0);
+            skinningBound = gpuSkinned;
+        }
+
+        cb.mWorld = XMMatrixTranspose(XMLoadFloat4x4(&draws[i].world));
+        cb.vDrawInfo.x = gpuSkinned ? character * animationSystem.GetJointCount() : 0;
+        context->UpdateSubresource(pConstantBuffer, 0, nullptr, &cb, 0, 0);
+
+        BindVertexStreams(context, draws[i], true);
+        context->IASetIndexBuffer(object.pIBuffer, DXGI_FORMAT_R16_UINT, 0);
+        const MeshLod &lod = object.lods[draws[i].lod];
+        context->DrawIndexed(lod.indexCount, lod.indexOffset, 0);
+    }
+}
+
+
+//Cleans up Direct3D
+void CleanD3D()
+{
+    //Let any re-imports in flight finish, then stop the workers before releasing what they record with
+    fileWatcher.Stop();
+    jobSystem.Wait(reloadJobs);
+    textureStreamer.Shutdown();
+    terrain.Shutdown();
+    uploadQueue.Shutdown();
+    lightClusterer.Shutdown();
+    shadowCascades.Shutdown();
+    frameTimer.Shutdown();
+    overdrawMeter.Shutdown();
+    jobSystem.Shutdown();
+    pendingReloads.clear();
+    animationSystem.Shutdown();
+    MountAssetArchive(nullptr);
+    assetArchive.Close();
+
+    //Close and release all existing COM objects
+    for (unsigned int i = 0; i < MaxRecordChunks; i++)
     {
-        { XMFLOAT3(-5.0f, -1.0f, -5.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(1.0f, 0.0f) },
-        { XMFLOAT3(5.0f, -1.0f, -5.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(0.0f, 0.0f) },
-        { XMFLOAT3(-5.0f, -1.0f, 5.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(0.0f, 1.0f) },
-        { XMFLOAT3(5.0f, -1.0f, 5.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(1.0f, 1.0f) },
+        deferredContexts[i]->Release();
+    }
+    pLayout->Release();
+    pVS->Release();
+    pPS->Release();
+    pPSSolid->Release();
+    pVSShadow->Release();
+    pVSSkinned->Release();
+    pVSShadowSkinned->Release();
+    pSkinnedLayout->Release();
+    pDepthLayout->Release();
+    pDepthSkinnedLayout->Release();
+    pVSUpscale->Release();
+    pPSUpscale->Release();
+    pUpscaleSampler->Release();
+    pUpscaleBuffer->Release();
+
+    //Objects release their own buffers
+    sceneObjects.Destroy(cube);
+    for (Object *object : terrainObjects)
+    {
+        sceneObjects.Destroy(object);
+    }
+    terrainObjects.clear();
+    for (ID3D11Buffer *buffer : cpuSkinnedBuffers)
+    {
+        buffer->Release();
+    }
+    cpuSkinnedBuffers.clear();
+    paletteView->Release();
+    paletteBuffer->Release();
+    sceneObjects.Destroy(panda);
+    sceneObjects.Destroy(character);
+    cube = nullptr;
+    panda = nullptr;
+    character = nullptr;
+    frameArena.Shutdown();
+    pConstantBuffer->Release();
+    depthStencilBuffer->Release();
+    depthStencilView->Release();
+    depthStencilState->Release();
+    depthEqualState->Release();
+    sceneView->Release();
+    sceneTarget->Release();
+    sceneTexture->Release();
+    pSamplerState->Release();
+    swapChain->Release();
+    backBuffer->Release();
+    device->Release();
+    deviceContext->Release();
+
+    //Anything still tracked here was leaked, the debug layer below names the D3D objects behind it
+    ReportLiveGpuResources();
+    debug->ReportLiveObjects(DXGI_DEBUG_ALL, DXGI_DEBUG_RLO_ALL);
+    debug->Release();
+}
+
+Object SetupObject(VERTEX* vertices, UINT vertices_size, short *indices, UINT indices_size, const char *targa, const char *name) 
+{
+    Object object;
+    CreateMeshBuffers(object, vertices, vertices_size, indices, indices_size, name);
+
+    //object.texture = textureStreamer.Register("assets/stone.tga");
+    object.texture = textureStreamer.Register(targa);
+    object.texturePath = targa;
+
+    return object;
+}
+
+//Creates the vertex and index buffers of an object and fills in its mesh information. The data
+//goes through the upload queue, the buffers can be drawn once the returned ticket is done.
+//Doesn't touch the device context, so it is safe on a worker. The buffers are charged to name.
+UploadTicket CreateMeshBuffers(Object &object, const VERTEX *vertices, UINT vertices_size, const short *indices, UINT indices_size, const char *name)
+{
+    HRESULT hr = S_OK;
+
+    //Create the vertex buffer
+    const UINT packedCount = vertices_size / sizeof(VERTEX);
+    D3D11_BUFFER_DESC vBufferDesc = {};
+    vBufferDesc.Usage = D3D11_USAGE_DEFAULT;                 //Only the GPU touches it, filled by copies
+    vBufferDesc.ByteWidth = packedCount * SceneVertexFormat::Stride;    //Size is the packed vertex * number of vertices
+    vBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;        //Use as a vertex buffer
+
+    hr = device->CreateBuffer(&vBufferDesc, nullptr, object.pVBuffer.Receive());
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(object.pVBuffer, GpuCategoryVertex, name);
+
+    //Pack the vertices into one stream per attribute and queue them
+    std::vector<unsigned char> packedVertices(vBufferDesc.ByteWidth);
+    SceneVertexFormat::PackStreams(vertices, packedCount, packedVertices.data());
+    uploadQueue.QueueBuffer(object.pVBuffer, 0, std::move(packedVertices));
+
+    D3D11_BUFFER_DESC iBufferDesc = {};
+    iBufferDesc.Usage = D3D11_USAGE_DEFAULT;
+    iBufferDesc.ByteWidth = indices_size;
+    iBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+
+    //Create index buffer
+    hr = device->CreateBuffer(&iBufferDesc, nullptr, object.pIBuffer.Receive());
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(object.pIBuffer, GpuCategoryIndex, name);
+
+    //Queue the indices, uploads finish in order so this ticket covers both buffers
+    const unsigned char *indexBytes = reinterpret_cast<const unsigned char*>(indices);
+    const UploadTicket upload = uploadQueue.QueueBuffer(object.pIBuffer, 0, std::vector<unsigned char>(indexBytes, indexBytes + indices_size));
+
+    //Object space bounds for culling
+    const UINT vertexCount = vertices_size / sizeof(vertices[0]);
+    if (vertexCount > 0)
+    {
+        XMVECTOR boundsMin = XMLoadFloat3(&vertices[0].position);
+        XMVECTOR boundsMax = boundsMin;
+        for (UINT i = 1; i < vertexCount; i++)
+        {
+            const XMVECTOR position = XMLoadFloat3(&vertices[i].position);
+            boundsMin = XMVectorMin(boundsMin, position);
+            boundsMax = XMVectorMax(boundsMax, position);
+        }
+        XMStoreFloat3(&object.boundsMin, boundsMin);
+        XMStoreFloat3(&object.boundsMax, boundsMax);
+    }
+
+    object.vertex_count = vertices_size / sizeof(vertices[0]);
+    object.vertex_size = sizeof(vertices[0]);
+    object.index_count = indices_size / sizeof(indices[0]);
+    object.index_size = sizeof(indices[0]);
+
+    //Callers with a LOD chain replace this
+    object.lods.assign(1, MeshLod());
+    object.lods[0].indexCount = object.index_count;
+    return upload;
+}
+
+//Builds the mesh's BVH and bakes the occlusion of its vertices against it, from the cache when
+//the mesh hasn't changed since the last run
+void BakeStaticMesh(const char *name, VERTEX *vertices, UINT vertexCount, const short *indices, UINT indexCount, MeshBvh &bvh)
+{
+    bvh.Build(vertices, sizeof(VERTEX), indices, indexCount, &jobSystem);
+    const OcclusionBakeStats stats = occlusionBaker.Bake(vertices, vertexCount, indices, indexCount, bvh, &jobSystem);
+
+    char report[256] = {};
+    sprintf_s(report, "Occlusion of %s: %u vertices %s in %.1f ms, %.2f average\n", name, stats.vertices,
+        stats.cached ? "from the cache" : "traced", stats.ms, stats.average);
+    OutputDebugStringA(report);
+}
+
+//Only the most detailed level, the others share its vertices
+void BakeStaticMesh(const char *name, MeshData &mesh, MeshBvh &bvh)
+{
+    const unsigned int indexOffset = mesh.lods.empty() ? 0 : mesh.lods[0].indexOffset;
+    const unsigned int indexCount = mesh.lods.empty() ? static_cast<unsigned int>(mesh.indices.size()) : mesh.lods[0].indexCount;
+    BakeStaticMesh(name, mesh.vertices.data(), static_cast<UINT>(mesh.vertices.size()), mesh.indices.data() + indexOffset, indexCount, bvh);
+}
+
+Object LoadModel(const char * filename)
+{
+    MeshData mesh;
+    const bool result = LoadModelData(filename, mesh, &jobSystem);
+    assert(result == true);
+
+    //Only targa textures can be loaded, fall back to the panda body for anything else
+    const std::string &diffuse = mesh.diffuseTexture;
+    const bool hasTarga = diffuse.size() >= 4 && _stricmp(diffuse.c_str() + diffuse.size() - 4, ".tga") == 0;
+    const char *texture = hasTarga ? diffuse.c_str() : "assets/pandaren_model/pandaren_Body.tga";
+
+    //The occlusion has to be in the vertices before they go into the buffer
+    MeshBvh bvh;
+    BakeStaticMesh(filename, mesh, bvh);
+
+    Object object = SetupObject(mesh.vertices.data(), static_cast<UINT>(mesh.vertices.size() * sizeof(mesh.vertices[0])), mesh.indices.data(), static_cast<UINT>(mesh.indices.size() * sizeof(mesh.indices[0])), texture, filename);
+    object.meshPath = filename;
+    if (!mesh.lods.empty())
+    {
+        object.lods = mesh.lods;
+    }
+
+    object.bvh = std::move(bvh);
+    return object;
+}
+
+
+//Re-runs only the importer for each settled file change, on a worker so the frame loop keeps going
+void ProcessFileChanges()
+{
+    for (const std::string &path : fileWatcher.PollChanges())
+    {
+        //The archive holds the old version, the file on disk wins from now on
+        MarkAssetChanged(path);
+
+        //The texture streamer rebuilds its own mips in the background
+        if (path.size() >= 4 && _stricmp(path.c_str() + path.size() - 4, ".tga") == 0)
+        {
+            textureStreamer.Reload(path);
+            continue;
+        }
+
+        LARGE_INTEGER started = {};
+        QueryPerformanceCounter(&started);
+
+        jobSystem.Run([path, started]()
+        {
+            PendingReload reload;
+            reload.path = path;
+            reload.started = started;
+            reload.isShader = path == shaderPath;
+
+            bool loaded = false;
+            if (reload.isShader)
+            {
+                loaded = LoadShaders(reload.shaders);
+            }
+            else
+            {
+                loaded = LoadModelData(path.c_str(), reload.mesh, &jobSystem);
+                if (loaded)
+                {
+                    BakeStaticMesh(path.c_str(), reload.mesh, reload.bvh);
+                    reload.upload = CreateMeshBuffers(reload.buffers, reload.mesh.vertices.data(), static_cast<UINT>(reload.mesh.vertices.size() * sizeof(VERTEX)),
+                        reload.mesh.indices.data(), static_cast<UINT>(reload.mesh.indices.size() * sizeof(short)), path.c_str());
+                }
+            }
+
+            //Keep using the old version until the file imports cleanly
+            if (!loaded)
+            {
+                const std::string message = "Hot reload failed: " + path + "\n";
+                OutputDebugStringA(message.c_str());
+                return;
+            }
+
+            std::lock_guard<std::mutex> guard(reloadLock);
+            pendingReloads.push_back(std::move(reload));
+        }, &reloadJobs);
+    }
+}
+
+
+//Creates GPU resources for finished re-imports and swaps them into every object using the file
+void ApplyPendingReloads()
+{
+    std::vector<PendingReload> reloads;
+    {
+        //Meshes keep the old buffers until the new ones are uploaded
+        std::lock_guard<std::mutex> guard(reloadLock);
+        std::vector<PendingReload> waiting;
+        for (PendingReload &reload : pendingReloads)
+        {
+            if (uploadQueue.IsDone(reload.upload))
+            {
+                reloads.push_back(std::move(reload));
+            }
+            else
+            {
+                waiting.push_back(std::move(reload));
+            }
+        }
+        pendingReloads.swap(waiting);
+    }
+
+    Object *objects[] = { cube, panda };
+    for (PendingReload &reload : reloads)
+    {
+        if (reload.isShader)
+        {
+            if (!CreateShaders(reload.shaders))
+            {
+                OutputDebugStringA("Hot reload failed: shaders were rejected by the device\n");
+                continue;
+            }
+        }
+
+        for (Object *object : objects)
+        {
+            if (!reload.isShader && object->meshPath == reload.path)
+            {
+                //Objects using the same file share the new buffers
+                const Object &buffers = reload.buffers;
+                object->pVBuffer = buffers.pVBuffer;
+                object->pIBuffer = buffers.pIBuffer;
+                object->vertex_count = buffers.vertex_count;
+                object->vertex_size = buffers.vertex_size;
+                object->index_count = buffers.index_count;
+                object->index_size = buffers.index_size;
+                object->boundsMin = buffers.boundsMin;
+                object->boundsMax = buffers.boundsMax;
+                object->lods = reload.mesh.lods.empty() ? buffers.lods : reload.mesh.lods;
+                object->bvh = reload.bvh;
+
+                //Cached shadows still hold the old shape
+                if (object->isStatic)
+                {
+                    shadowCascades.InvalidateStatic();
+                }
+            }
+        }
+
+        LARGE_INTEGER frequency = {};
+        LARGE_INTEGER now = {};
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&now);
+
+        char report[512] = {};
+        sprintf_s(report, "Hot reload: %s in %.1f ms\n", reload.path.c_str(),
+            1000.0 * (now.QuadPart - reload.started.QuadPart) / frequency.QuadPart);
+        OutputDebugStringA(report);
+    }
+}
+
+
+void CreateDepthBuffer()
+{
+    HRESULT hr = S_OK;
+
+    D3D11_TEXTURE2D_DESC depthStencilDesc = {};
+
+    depthStencilDesc.Width = winWidth;
+    depthStencilDesc.Height = winHeight;
+    depthStencilDesc.MipLevels = 1;
+    depthStencilDesc.ArraySize = 1;
+    depthStencilDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+
+    //No MSAA
+    depthStencilDesc.SampleDesc.Count = 1;
+    depthStencilDesc.SampleDesc.Quality = 0;
+
+    depthStencilDesc.Usage = D3D11_USAGE_DEFAULT;
+    depthStencilDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+    depthStencilDesc.CPUAccessFlags = 0;
+    depthStencilDesc.MiscFlags = 0;
+
+    hr = device->CreateTexture2D(&depthStencilDesc, nullptr, &depthStencilBuffer);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(depthStencilBuffer, GpuCategoryTarget, "depth buffer");
+
+    D3D11_DEPTH_STENCIL_VIEW_DESC depthStencilViewDesc = {};
+    depthStencilViewDesc.Format = depthStencilDesc.Format;
+    depthStencilViewDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+    depthStencilViewDesc.Texture2D.MipSlice = 0;
+
+    hr = device->CreateDepthStencilView(depthStencilBuffer, &depthStencilViewDesc, &depthStencilView);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(depthStencilView, GpuCategoryView, "depth buffer");
+
+}
+
+
+//Window sized color target, the scene only covers its top left renderWidth x renderHeight
+void CreateSceneTarget()
+{
+    HRESULT hr = S_OK;
+
+    D3D11_TEXTURE2D_DESC sceneDesc = {};
+    sceneDesc.Width = winWidth;
+    sceneDesc.Height = winHeight;
+    sceneDesc.MipLevels = 1;
+    sceneDesc.ArraySize = 1;
+    sceneDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    sceneDesc.SampleDesc.Count = 1;
+    sceneDesc.Usage = D3D11_USAGE_DEFAULT;
+    sceneDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+
+    hr = device->CreateTexture2D(&sceneDesc, nullptr, &sceneTexture);
+    assert(SUCCEEDED(hr));
+    hr = device->CreateRenderTargetView(sceneTexture, nullptr, &sceneTarget);
+    assert(SUCCEEDED(hr));
+    hr = device->CreateShaderResourceView(sceneTexture, nullptr, &sceneView);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(sceneTexture, GpuCategoryTarget, "scene target");
+    TrackGpuResource(sceneTarget, GpuCategoryView, "scene target");
+    TrackGpuResource(sceneView, GpuCategoryView, "scene target");
+}
+
+
+//Resizes the swap chain to the client area and recreates every target that has the window's size
+void ResizeBuffers()
+{
+    HRESULT hr = S_OK;
+    resizePending = false;
+
+    DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
+    swapChain->GetDesc(&swapChainDesc);
+    if (swapChainDesc.BufferDesc.Width == static_cast<UINT>(winWidth) && swapChainDesc.BufferDesc.Height == static_cast<UINT>(winHeight))
+    {
+        return;
+    }
+
+    //The swap chain can't resize while anything still references its buffers, bindings included
+    deviceContext->ClearState();
+    backBuffer->Release();
+    depthStencilView->Release();
+    depthStencilBuffer->Release();
+    sceneView->Release();
+    sceneTarget->Release();
+    sceneTexture->Release();
+
+    hr = swapChain->ResizeBuffers(0, winWidth, winHeight, DXGI_FORMAT_UNKNOWN, 0);
+    assert(SUCCEEDED(hr));
+
+    ID3D11Texture2D *pBackBuffer = nullptr;
+    swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (LPVOID*)&pBackBuffer);
+    TrackGpuResource(pBackBuffer, GpuCategoryTarget, "swap chain");
+    hr = device->CreateRenderTargetView(pBackBuffer, nullptr, &backBuffer);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(backBuffer, GpuCategoryView, "swap chain");
+    pBackBuffer->Release();
+
+    CreateDepthBuffer();
+    CreateSceneTarget();
+
+    camera.SetLens(camera.GetFovY(), winWidth / static_cast<float>(winHeight), camera.GetNearZ(), camera.GetFarZ());
+}
+
+
+
+//Creates the shape to render
+void InitGraphics()
+{
+    //Create a triangle using the VERTEX struct
+    //VERTEX vertices[] =
+    //{
+    //    { 0.0f, 0.5f, 0.0f, {1.0f, 0.0f, 0.0f, 1.0f} },
+    //    { 0.45f, -0.5, 0.0f, {0.0f, 1.0f, 0.0f, 1.0f} },
+    //    { -0.45f, -0.5f, 0.0f, {0.0f, 0.0f, 1.0f, 1.0f} }
+    //};
+
+    VERTEX cubeVertices[] =
+    {
+        { XMFLOAT3(-1.0f, 1.0f, -1.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), 1.0f, XMFLOAT2(1.0f, 0.0f) },
+        { XMFLOAT3(1.0f, 1.0f, -1.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), 1.0f, XMFLOAT2(0.0f, 0.0f) },
+        { XMFLOAT3(1.0f, 1.0f, 1.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), 1.0f, XMFLOAT2(0.0f, 1.0f) },
+        { XMFLOAT3(-1.0f, 1.0f, 1.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), 1.0f, XMFLOAT2(1.0f, 1.0f) },
+
+        { XMFLOAT3(-1.0f, -1.0f, -1.0f), XMFLOAT3(0.0f, -1.0f, 0.0f), 1.0f, XMFLOAT2(0.0f, 0.0f) },
+        { XMFLOAT3(1.0f, -1.0f, -1.0f), XMFLOAT3(0.0f, -1.0f, 0.0f), 1.0f, XMFLOAT2(1.0f, 0.0f) },
+        { XMFLOAT3(1.0f, -1.0f, 1.0f), XMFLOAT3(0.0f, -1.0f, 0.0f), 1.0f, XMFLOAT2(1.0f, 1.0f) },
+        { XMFLOAT3(-1.0f, -1.0f, 1.0f), XMFLOAT3(0.0f, -1.0f, 0.0f), 1.0f, XMFLOAT2(0.0f, 1.0f) },
+
+        { XMFLOAT3(-1.0f, -1.0f, 1.0f), XMFLOAT3(-1.0f, 0.0f, 0.0f), 1.0f, XMFLOAT2(0.0f, 1.0f) },
+        { XMFLOAT3(-1.0f, -1.0f, -1.0f), XMFLOAT3(-1.0f, 0.0f, 0.0f), 1.0f, XMFLOAT2(1.0f, 1.0f) },
+        { XMFLOAT3(-1.0f, 1.0f, -1.0f), XMFLOAT3(-1.0f, 0.0f, 0.0f), 1.0f, XMFLOAT2(1.0f, 0.0f) },
+        { XMFLOAT3(-1.0f, 1.0f, 1.0f), XMFLOAT3(-1.0f, 0.0f, 0.0f), 1.0f, XMFLOAT2(0.0f, 0.0f) },
+
+        { XMFLOAT3(1.0f, -1.0f, 1.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), 1.0f, XMFLOAT2(1.0f, 1.0f) },
+        { XMFLOAT3(1.0f, -1.0f, -1.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), 1.0f, XMFLOAT2(0.0f, 1.0f) },
+        { XMFLOAT3(1.0f, 1.0f, -1.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), 1.0f, XMFLOAT2(0.0f, 0.0f) },
+        { XMFLOAT3(1.0f, 1.0f, 1.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), 1.0f, XMFLOAT2(1.0f, 0.0f) },
+
+        { XMFLOAT3(-1.0f, -1.0f, -1.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), 1.0f, XMFLOAT2(0.0f, 1.0f) },
+        { XMFLOAT3(1.0f, -1.0f, -1.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), 1.0f, XMFLOAT2(1.0f, 1.0f) },
+        { XMFLOAT3(1.0f, 1.0f, -1.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), 1.0f, XMFLOAT2(1.0f, 0.0f) },
+        { XMFLOAT3(-1.0f, 1.0f, -1.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), 1.0f, XMFLOAT2(0.0f, 0.0f) },
+
+        { XMFLOAT3(-1.0f, -1.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), 1.0f, XMFLOAT2(1.0f, 1.0f) },
+        { XMFLOAT3(1.0f, -1.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), 1.0f, XMFLOAT2(0.0f, 1.0f) },
+        { XMFLOAT3(1.0f, 1.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), 1.0f, XMFLOAT2(0.0f, 0.0f) },
+        { XMFLOAT3(-1.0f, 1.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), 1.0f, XMFLOAT2(1.0f, 0.0f) },
     };
 
     short cubeIndices[] =
@@ -671,71 +2082,541 @@ void InitGraphics()
         6,4,5,
         7,4,6,
 
-        11,9,8,
-        10,9,11,
+        11,9,8,
+        10,9,11,
+
+        14,12,13,
+        15,12,14,
+
+        19,17,16,
+        18,17,19,
+
+        22,20,21,
+        23,20,22
+    };
+
+    MeshBvh cubeBvh;
+    BakeStaticMesh("cube", cubeVertices, _countof(cubeVertices), cubeIndices, _countof(cubeIndices), cubeBvh);
+    cube = sceneObjects.Create(SetupObject(cubeVertices, sizeof(cubeVertices), cubeIndices, sizeof(cubeIndices), "assets/stone.tga", "cube"));
+    cube->bvh = std::move(cubeBvh);
+    panda = sceneObjects.Create(LoadModel("assets/pandaren_model/pandaren.obj"));
+
+    //The panda carries the cube around at its side
+    JointPose prop;
+    prop.translation = XMFLOAT3(1.5f, 1.0f, 0.0f);
+    prop.scale = XMFLOAT3(0.2f, 0.2f, 0.2f);
+    pandaTransform = sceneTransforms.Add();
+    propTransform = sceneTransforms.Add(pandaTransform, prop);
+
+    CreateTerrain();
+    CreateCrowd();
+    CreateSceneLights();
+}
+
+
+//The terrain fills its vertex buffer slots as chunks stream in, the objects stay tied to their slot
+void CreateTerrain()
+{
+    terrainObjects.clear();
+    for (unsigned int i = 0; i < terrain.GetSlotCount(); i++)
+    {
+        Object object;
+        object.pVBuffer = GpuRef<ID3D11Buffer>::Share(terrain.GetVertexBuffer(i));
+        object.pIBuffer = GpuRef<ID3D11Buffer>::Share(terrain.GetIndexBuffer());
+        object.vertex_count = static_cast<int>(terrain.GetChunkVertexCount());
+        object.vertex_size = SceneVertexFormat::Stride;
+        object.index_size = sizeof(short);
+        object.lods = terrain.GetLods();
+        object.texture = textureStreamer.Register("assets/stone.tga");
+        object.texturePath = "assets/stone.tga";
+        object.isStatic = true;
+        object.terrainChunk = true;
+
+        //The terrain is the only thing big enough to hide much, the chunk's coarse grid goes into the occlusion buffer
+        object.isOccluder = true;
+        object.occluderPositions = terrain.GetOccluderPositions(i);
+        object.occluderIndices = terrain.GetOccluderIndices();
+        terrainObjects.push_back(sceneObjects.Create(object));
+    }
+}
+
+
+//Streams the terrain around the camera and adds every chunk it wants drawn, at the level it picked
+void DrawTerrain()
+{
+    terrain.Update(deviceContext, camera.GetPositionXM());
+
+    DrawItem item = {};
+    XMStoreFloat4x4(&item.world, XMMatrixIdentity());
+    for (const TerrainDraw &draw : terrain.GetDraws())
+    {
+        //Chunk vertices are in world space, so the object's bounds follow whatever chunk its slot holds
+        Object *object = terrainObjects[draw.slot];
+        object->boundsMin = draw.boundsMin;
+        object->boundsMax = draw.boundsMax;
+
+        item.object = object;
+        item.lod = draw.lod;
+        drawList.push_back(item);
+    }
+
+    //Cached shadows don't have the chunks that just arrived, and the occluders of the slots they went into changed.
+    //The grids keep their size, so the copies don't allocate.
+    const TerrainStats &stats = terrain.GetStats();
+    if (stats.uploaded > 0)
+    {
+        shadowCascades.InvalidateStatic();
+        for (unsigned int i = 0; i < terrain.GetSlotCount(); i++)
+        {
+            terrainObjects[i]->occluderPositions = terrain.GetOccluderPositions(i);
+        }
+    }
+
+    //Print residency and levels about once a second
+    const ULONGLONG now = GetTickCount64();
+    if (now - terrainReportTime >= 1000)
+    {
+        char report[256] = {};
+        sprintf_s(report, "Terrain: %u chunks drawn (%u/%u/%u/%u/%u per level), %u triangles, %u/%u slots resident, %u loading, %llu streamed, %.1f MB, %.3f ms\n",
+            stats.drawn, stats.levelChunks[0], stats.levelChunks[1], stats.levelChunks[2], stats.levelChunks[3], stats.levelChunks[4],
+            stats.triangles, stats.resident, stats.slots, stats.pendingLoads, stats.streamedChunks, stats.residentBytes / (1024.0 * 1024.0), stats.ms);
+        OutputDebugStringA(report);
+
+        terrainReportTime = now;
+    }
+}
+
+
+//Closest hit of a world space ray on the meshes that have a BVH
+bool RaycastScene(FXMVECTOR origin, FXMVECTOR direction, float maxDistance, SceneHit &hit)
+{
+    struct Target
+    {
+        const Object *object;
+        TransformHandle transform;
+    };
+    const Target targets[] = { { panda, pandaTransform }, { cube, propTransform } };
+
+    bool found = false;
+    for (const Target &target : targets)
+    {
+        //Into the object's space without normalizing the direction, so distances stay in world units
+        const XMMATRIX toObject = XMMatrixInverse(nullptr, sceneTransforms.GetWorld(target.transform));
+        RayHit objectHit;
+        if (target.object->bvh.Intersect(XMVector3TransformCoord(origin, toObject), XMVector3TransformNormal(direction, toObject), maxDistance, objectHit))
+        {
+            maxDistance = objectHit.distance;
+            hit.object = target.object;
+            hit.hit = objectHit;
+            found = true;
+        }
+    }
+    return found;
+}
+
+
+//Casts a ray from the camera through a pixel of the window and reports the closest hit
+void PickAtCursor(int x, int y)
+{
+    LARGE_INTEGER frequency = {};
+    LARGE_INTEGER start = {};
+    LARGE_INTEGER end = {};
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    XMVECTOR origin;
+    XMVECTOR direction;
+    camera.GetPickingRay(x + 0.5f, y + 0.5f, static_cast<float>(winWidth), static_cast<float>(winHeight), origin, direction);
+    SceneHit hit;
+    const bool found = RaycastScene(origin, direction, camera.GetFarZ(), hit);
+
+    QueryPerformanceCounter(&end);
+    const double us = 1000000.0 * (end.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+    char report[256] = {};
+    if (found)
+    {
+        sprintf_s(report, "Pick: %s triangle %u at %.2f in %.1f us\n", hit.object == panda ? "panda" : "cube", hit.hit.triangle, hit.hit.distance, us);
+    }
+    else
+    {
+        sprintf_s(report, "Pick: nothing under the cursor, %.1f us\n", us);
+    }
+    OutputDebugStringA(report);
+}
+
+
+//Cuts this frame's camera move short where it would run into a mesh, then lifts the camera above the terrain
+void CollideCamera(FXMVECTOR previous)
+{
+    XMVECTOR position = camera.GetPositionXM();
+    const XMVECTOR move = position - previous;
+    const float distance = XMVectorGetX(XMVector3Length(move));
+    SceneHit hit;
+    if (distance > 0.0f && RaycastScene(previous, move / distance, distance + cameraRadius, hit))
+    {
+        position = previous + move / distance * std::max(0.0f, hit.hit.distance - cameraRadius);
+    }
+
+    XMFLOAT3 stopped;
+    XMStoreFloat3(&stopped, position);
+    stopped.y = std::max(stopped.y, terrain.GetGeneratedHeight(stopped.x, stopped.z) + cameraRadius);
+    camera.SetPosition(stopped);
+}
+
+
+//Lays a grid of small colored point lights over the ground, followed by the spot lights
+void CreateSceneLights()
+{
+    const int gridSize = 32;
+    const float spacing = 0.5f;
+    sceneLights.clear();
+    for (int z = 0; z < gridSize; z++)
+    {
+        for (int x = 0; x < gridSize; x++)
+        {
+            //Walk the hue around the color wheel so neighbours differ
+            const float hue = XM_2PI * ((x * 7 + z * 13) % gridSize) / gridSize;
+
+            ClusterLight light;
+            light.position = XMFLOAT3((x - gridSize / 2) * spacing, -0.8f, (z - gridSize / 2) * spacing);
+            light.range = 1.0f;
+            light.color = XMFLOAT3(0.5f + 0.5f * cosf(hue), 0.5f + 0.5f * cosf(hue - XM_2PI / 3), 0.5f + 0.5f * cosf(hue + XM_2PI / 3));
+            sceneLights.push_back(light);
+        }
+    }
+
+    //Placed every frame by AssignLights
+    for (unsigned int i = 0; i < spotLightCount; i++)
+    {
+        ClusterLight spot;
+        spot.range = 8.0f;
+        spot.color = XMFLOAT3(2.0f, 1.8f, 1.5f);
+        spot.spotInnerCos = cosf(XM_PI / 16);
+        spot.spotOuterCos = cosf(XM_PI / 10);
+        sceneLights.push_back(spot);
+    }
+}
+
+
+//Loads the rigged character, or generates one, and stands a crowd of it on the ground around the panda
+void CreateCrowd()
+{
+    HRESULT hr = S_OK;
+
+    if (!LoadSkinnedModelData(characterPath, characterMesh, characterSkeleton, characterClips) || characterClips.empty())
+    {
+        BuildProceduralCharacter(characterMesh, characterSkeleton, characterClips);
+    }
+
+    character = sceneObjects.Create(SetupObject(characterMesh.vertices.data(), static_cast<UINT>(characterMesh.vertices.size() * sizeof(VERTEX)),
+        characterMesh.indices.data(), static_cast<UINT>(characterMesh.indices.size() * sizeof(short)), "assets/stone.tga", "crowd"));
+    if (!characterMesh.lods.empty())
+    {
+        character->lods = characterMesh.lods;
+    }
+
+    //Poses reach outside the bind pose box, pad it so culling doesn't cut off a leaning character
+    const XMVECTOR boundsMin = XMLoadFloat3(&character->boundsMin);
+    const XMVECTOR boundsMax = XMLoadFloat3(&character->boundsMax);
+    const XMVECTOR padding = XMVectorReplicate(0.5f * XMVectorGetX(XMVector3Length(boundsMax - boundsMin)));
+    XMStoreFloat3(&character->boundsMin, boundsMin - padding);
+    XMStoreFloat3(&character->boundsMax, boundsMax + padding);
+
+    //Joints and weights never change, they get their own immutable stream
+    std::vector<unsigned char> skin(characterMesh.skin.size() * SkinVertexFormat::Stride);
+    SkinVertexFormat::Pack(characterMesh.skin.data(), characterMesh.skin.size(), skin.data());
+
+    D3D11_BUFFER_DESC skinDesc = {};
+    skinDesc.Usage = D3D11_USAGE_IMMUTABLE;
+    skinDesc.ByteWidth = static_cast<UINT>(skin.size());
+    skinDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    D3D11_SUBRESOURCE_DATA skinData = {};
+    skinData.pSysMem = skin.data();
+    hr = device->CreateBuffer(&skinDesc, &skinData, character->pSkinBuffer.Receive());
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(character->pSkinBuffer, GpuCategoryVertex, "crowd");
+
+    //A grid over the ground with the middle left to the panda
+    animationSystem.Init(&characterSkeleton, characterClips.data(), static_cast<unsigned int>(characterClips.size()));
+    const int gridSize = 8;
+    const float spacing = 1.2f;
+    JointPose crowdPose;
+    crowdPose.translation = XMFLOAT3(0.0f, -1.0f, 0.0f);
+    crowdTransform = sceneTransforms.Add(InvalidTransform, crowdPose);
+    crowdTransforms.clear();
+    for (int z = 0; z < gridSize; z++)
+    {
+        for (int x = 0; x < gridSize; x++)
+        {
+            JointPose pose;
+            pose.translation = XMFLOAT3((x - (gridSize - 1) * 0.5f) * spacing, 0.0f, (z - (gridSize - 1) * 0.5f) * spacing);
+            if (fabsf(pose.translation.x) < 1.5f && fabsf(pose.translation.z) < 1.5f)
+            {
+                continue;
+            }
+
+            //Different clips, phases and speeds so the crowd doesn't move in lockstep
+            const unsigned int index = static_cast<unsigned int>(crowdTransforms.size());
+            crowdTransforms.push_back(sceneTransforms.Add(crowdTransform, pose));
+            animationSystem.AddCharacter(index % static_cast<unsigned int>(characterClips.size()), 0.37f * index, 0.8f + 0.05f * (index % 8));
+        }
+    }
+
+    //Every character's palette, rewritten each frame
+    static_assert(sizeof(XMFLOAT3X4) == 3 * sizeof(XMFLOAT4), "The shader reads a palette matrix as three float4 rows");
+    const UINT paletteRows = static_cast<UINT>(crowdTransforms.size()) * animationSystem.GetJointCount() * 3;
+
+    D3D11_BUFFER_DESC paletteDesc = {};
+    paletteDesc.Usage = D3D11_USAGE_DYNAMIC;
+    paletteDesc.ByteWidth = paletteRows * sizeof(XMFLOAT4);
+    paletteDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    paletteDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    paletteDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    paletteDesc.StructureByteStride = sizeof(XMFLOAT4);
+    hr = device->CreateBuffer(&paletteDesc, nullptr, &paletteBuffer);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(paletteBuffer, GpuCategoryOther, "crowd palette");
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC paletteViewDesc = {};
+    paletteViewDesc.Format = DXGI_FORMAT_UNKNOWN;
+    paletteViewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+    paletteViewDesc.Buffer.NumElements = paletteRows;
+    hr = device->CreateShaderResourceView(paletteBuffer, &paletteViewDesc, &paletteView);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(paletteView, GpuCategoryView, "crowd palette");
+
+    //With CPU skinning every character needs vertices of its own
+    if (cpuSkinning)
+    {
+        D3D11_BUFFER_DESC vBufferDesc = {};
+        vBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+        vBufferDesc.ByteWidth = static_cast<UINT>(characterMesh.vertices.size()) * SceneVertexFormat::Stride;
+        vBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        vBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+        cpuSkinnedBuffers.resize(crowdTransforms.size());
+        for (ID3D11Buffer *&buffer : cpuSkinnedBuffers)
+        {
+            hr = device->CreateBuffer(&vBufferDesc, nullptr, &buffer);
+            assert(SUCCEEDED(hr));
+            TrackGpuResource(buffer, GpuCategoryVertex, "crowd cpu skinning");
+        }
+    }
+}
+
+
+//A tapering column bent by a chain of joints, with clips that send waves up it. Stands in for
+//a rigged model so the crowd has something to play without an asset.
+void BuildProceduralCharacter(MeshData &mesh, Skeleton &skeleton, std::vector<AnimationClip> &clips)
+{
+    const unsigned int jointCount = 6;
+    const float segment = 0.25f;                //Height moved by each joint
+    const float height = segment * jointCount;
+    const int rings = 24;
+    const int sides = 12;
+
+    skeleton = Skeleton();
+    for (unsigned int j = 0; j < jointCount; j++)
+    {
+        JointPose pose;
+        pose.translation = XMFLOAT3(0.0f, j == 0 ? 0.0f : segment, 0.0f);
+
+        XMFLOAT4X4 inverseBind;
+        XMStoreFloat4x4(&inverseBind, XMMatrixTranslation(0.0f, -segment * j, 0.0f));
+
+        skeleton.names.push_back("joint" + std::to_string(j));
+        skeleton.parents.push_back(static_cast<int>(j) - 1);
+        skeleton.bindPose.push_back(pose);
+        skeleton.inverseBind.push_back(inverseBind);
+    }
+
+    mesh = MeshData();
+    for (int ring = 0; ring <= rings; ring++)
+    {
+        const float y = height * ring / rings;
+        const float radius = 0.2f - 0.1f * ring / rings;
+
+        //Rings follow the joint below them and blend into the next one over the top half of the segment
+        const float along = y / segment;
+        const unsigned int joint = std::min(static_cast<unsigned int>(along), jointCount - 1);
+        const float blend = joint + 1 < jointCount ? std::max(0.0f, (along - joint) * 2.0f - 1.0f) : 0.0f;
+
+        VertexSkin skin = {};
+        skin.joints[0] = static_cast<unsigned char>(joint);
+        skin.joints[1] = static_cast<unsigned char>(std::min(joint + 1, jointCount - 1));
+        skin.weights[1] = static_cast<unsigned char>(blend * 255.0f + 0.5f);
+        skin.weights[0] = static_cast<unsigned char>(255 - skin.weights[1]);
+
+        for (int side = 0; side <= sides; side++)
+        {
+            const float angle = XM_2PI * side / sides;
+            const VERTEX vertex = { XMFLOAT3(radius * cosf(angle), y, radius * sinf(angle)), XMFLOAT3(cosf(angle), 0.0f, sinf(angle)), 1.0f,
+                XMFLOAT2(static_cast<float>(side) / sides, 1.0f - y / height) };
+            mesh.vertices.push_back(vertex);
+            mesh.skin.push_back(skin);
+        }
+    }
+
+    for (int ring = 0; ring < rings; ring++)
+    {
+        for (int side = 0; side < sides; side++)
+        {
+            const short a = static_cast<short>(ring * (sides + 1) + side);
+            const short b = static_cast<short>(a + sides + 1);
+            const short quad[] = { a, b, static_cast<short>(a + 1), static_cast<short>(a + 1), b, static_cast<short>(b + 1) };
+            mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+    }
 
-        14,12,13,
-        15,12,14,
+    //Cap the top, the bottom stands on the ground
+    const short top = static_cast<short>(mesh.vertices.size());
+    const short topRing = static_cast<short>(rings * (sides + 1));
+    const VERTEX center = { XMFLOAT3(0.0f, height, 0.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), 1.0f, XMFLOAT2(0.5f, 0.0f) };
+    mesh.vertices.push_back(center);
+    mesh.skin.push_back(mesh.skin.back());
+    for (int side = 0; side < sides; side++)
+    {
+        const short fan[] = { top, static_cast<short>(topRing + side + 1), static_cast<short>(topRing + side) };
+        mesh.indices.insert(mesh.indices.end(), fan, fan + 3);
+    }
 
-        19,17,16,
-        18,17,19,
+    BuildLodChain(mesh);
 
-        22,20,21,
-        23,20,22
+    //Sway, bow and twist, each a wave running up the chain
+    struct ClipShape
+    {
+        const char *name;
+        float duration;
+        XMFLOAT3 axis;
+        float amplitude;                        //Radians per joint
+        float lag;                              //Phase delay from one joint to the next
     };
-
-    short groundIndices[] =
+    const ClipShape shapes[] =
     {
-        1,0,2,
-        1,2,3
+        { "sway", 2.0f, XMFLOAT3(0.0f, 0.0f, 1.0f), 0.25f, 0.6f },
+        { "bow", 3.0f, XMFLOAT3(1.0f, 0.0f, 0.0f), 0.3f, 0.3f },
+        { "twist", 2.5f, XMFLOAT3(0.0f, 1.0f, 0.0f), 0.4f, 0.8f },
     };
 
-    cube = SetupObject(cubeVertices, sizeof(cubeVertices), cubeIndices, sizeof(cubeIndices), "assets/stone.tga");
-    ground = SetupObject(groundVertices, sizeof(groundVertices), groundIndices, sizeof(groundIndices), "assets/stone.tga");
-    panda = LoadModel("assets/pandaren_model/pandaren.obj");
+    clips.clear();
+    for (const ClipShape &shape : shapes)
+    {
+        AnimationClip clip;
+        clip.name = shape.name;
+        InitClip(clip, skeleton, shape.duration, clip.sampleRate);
+        for (unsigned int frame = 0; frame < clip.frameCount; frame++)
+        {
+            const float phase = XM_2PI * std::min(frame / clip.sampleRate, shape.duration) / shape.duration;
+            for (unsigned int j = 1; j < jointCount; j++)
+            {
+                JointPose pose = skeleton.bindPose[j];
+                XMStoreFloat4(&pose.rotation, XMQuaternionRotationAxis(XMLoadFloat3(&shape.axis), shape.amplitude * sinf(phase - shape.lag * j)));
+                SetClipPose(clip, frame, j, pose);
+            }
+        }
+        clips.push_back(std::move(clip));
+    }
 }
 
 
-//Loads and prepares the shaders
-void InitPipeline()
+//Advances the crowd, then uploads the palettes for the skinning shader or, with -cpuskinning,
+//skins every character on the workers straight into its vertex buffer
+void AnimateCrowd(float t)
 {
-    HRESULT hr = S_OK;
+    static float lastT = 0.0f;
+    const float deltaTime = t - lastT;
+    lastT = t;
+
+    //Every character fades to the next clip every few seconds, staggered so the fades spread out
+    const unsigned int count = animationSystem.GetCharacterCount();
+    const unsigned int clipCount = static_cast<unsigned int>(characterClips.size());
+    for (CharacterHandle c = 0; c < count; c++)
+    {
+        const float offset = 0.25f * c;
+        if (floorf((t + offset) / crowdClipSeconds) != floorf((t - deltaTime + offset) / crowdClipSeconds))
+        {
+            animationSystem.Play(c, (animationSystem.GetClip(c) + 1) % clipCount, crowdFadeSeconds);
+        }
+    }
 
-    //Load and compile the two shaders
-    ID3D10Blob *VS = nullptr;
-    ID3D10Blob *PS = nullptr;
-    ID3DBlob *pErrorBlob = nullptr;
-    hr = D3DCompileFromFile(L"source/shader.hlsl", nullptr, nullptr, "VShader", "vs_5_0", D3D10_SHADER_ENABLE_STRICTNESS, 0,
-        &VS, &pErrorBlob);
+    animationSystem.Update(deltaTime, &jobSystem);
 
+    LARGE_INTEGER uploadStart = {};
+    LARGE_INTEGER uploadEnd = {};
+    QueryPerformanceCounter(&uploadStart);
 
-    if (pErrorBlob)
+    if (!cpuSkinning)
     {
-        OutputDebugStringA(static_cast<const char*>(pErrorBlob->GetBufferPointer()));
-        pErrorBlob->Release();
+        D3D11_MAPPED_SUBRESOURCE mapped = {};
+        HRESULT hr = deviceContext->Map(paletteBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+        assert(SUCCEEDED(hr));
+        memcpy(mapped.pData, animationSystem.GetPalettes(), count * animationSystem.GetJointCount() * sizeof(XMFLOAT3X4));
+        deviceContext->Unmap(paletteBuffer, 0);
+    }
+    else
+    {
+        //Only the mapping has to happen on this thread
+        void **mapped = frameArena.AllocateArray<void*>(count);
+        for (unsigned int c = 0; c < count; c++)
+        {
+            D3D11_MAPPED_SUBRESOURCE resource = {};
+            HRESULT hr = deviceContext->Map(cpuSkinnedBuffers[c], 0, D3D11_MAP_WRITE_DISCARD, 0, &resource);
+            assert(SUCCEEDED(hr));
+            mapped[c] = resource.pData;
+        }
+
+        jobSystem.ParallelFor(count, 1, MaxRecordChunks, [mapped](unsigned int begin, unsigned int end, unsigned int)
+        {
+            const size_t vertexCount = characterMesh.vertices.size();
+            ScratchScope scratch;
+            VERTEX *skinned = scratch.GetArena().AllocateArray<VERTEX>(vertexCount);
+            for (unsigned int c = begin; c < end; c++)
+            {
+                SkinVertices(characterMesh.vertices.data(), characterMesh.skin.data(), vertexCount, animationSystem.GetPalette(c), skinned);
+                SceneVertexFormat::PackStreams(skinned, vertexCount, mapped[c]);
+            }
+        });
+
+        for (unsigned int c = 0; c < count; c++)
+        {
+            deviceContext->Unmap(cpuSkinnedBuffers[c], 0);
+        }
     }
-    assert(SUCCEEDED(hr));
 
-    hr = D3DCompileFromFile(L"source/shader.hlsl", nullptr, nullptr, "PShader", "ps_5_0", D3D10_SHADER_ENABLE_STRICTNESS, 0,
-        &PS, &pErrorBlob);
+    QueryPerformanceCounter(&uploadEnd);
 
-    if (pErrorBlob)
+    //Print what posing the crowd costs about once a second
+    const ULONGLONG now = GetTickCount64();
+    if (now - animationReportTime >= 1000)
     {
-        OutputDebugStringA(static_cast<const char*>(pErrorBlob->GetBufferPointer()));
-        pErrorBlob->Release();
+        LARGE_INTEGER frequency = {};
+        QueryPerformanceFrequency(&frequency);
+        const AnimationStats &stats = animationSystem.GetStats();
+
+        char report[256] = {};
+        sprintf_s(report, "Animation: %u characters, %u joints, %u cross fading, posed in %.3f ms (%.1f characters/ms), %s %.3f ms\n",
+            stats.characters, animationSystem.GetJointCount(), stats.blending, stats.ms, stats.ms > 0.0f ? stats.characters / stats.ms : 0.0f,
+            cpuSkinning ? "CPU skinning" : "palette upload", 1000.0 * (uploadEnd.QuadPart - uploadStart.QuadPart) / frequency.QuadPart);
+        OutputDebugStringA(report);
+
+        animationReportTime = now;
     }
-    assert(SUCCEEDED(hr));
+}
 
-    //Encapsulate both shaders into the shader objects
-    hr = device->CreateVertexShader(VS->GetBufferPointer(), VS->GetBufferSize(), nullptr, &pVS);
-    assert(SUCCEEDED(hr));
 
-    hr = device->CreatePixelShader(PS->GetBufferPointer(), PS->GetBufferSize(), nullptr, &pPS);
-    assert(SUCCEEDED(hr));
+//Loads and prepares the shaders
+void InitPipeline()
+{
+    HRESULT hr = S_OK;
 
+    //Load the shaders from the cache, anything missing is compiled in parallel
+    std::vector<std::vector<unsigned char>> bytecodes;
+    const bool loaded = LoadShaders(bytecodes);
+    assert(loaded);
 
-    //Initialize the world matrix
-    worldMatrix = XMMatrixIdentity();
+    const bool created = CreateShaders(bytecodes);
+    assert(created);
 
     //Create the constant buffer
     D3D11_BUFFER_DESC cBufferDesc = {};
@@ -745,6 +2626,7 @@ void InitPipeline()
     cBufferDesc.CPUAccessFlags = 0;
     hr = device->CreateBuffer(&cBufferDesc, nullptr, &pConstantBuffer);
     assert(SUCCEEDED(hr));
+    TrackGpuResource(pConstantBuffer, GpuCategoryConstant, "frame constants");
 
     //Initialize the view matrix
     XMVECTOR eye = XMVectorSet(0.0f, 1.0f, -5.0f, 0.0f);
@@ -761,19 +2643,6 @@ void InitPipeline()
     deviceContext->VSSetConstantBuffers(0, 1, &pConstantBuffer);
     deviceContext->PSSetConstantBuffers(0, 1, &pConstantBuffer);
     deviceContext->PSSetShader(pPS, 0, 0);
-    deviceContext->PSSetShaderResources(0, 1, &cube.pShaderView);
-    deviceContext->PSSetShaderResources(1, 1, &cube.pShaderView);
-
-    //Create the input layout object
-    D3D11_INPUT_ELEMENT_DESC elementDesc[] = 
-    {
-        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-        { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-        { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-    };
-
-    hr = device->CreateInputLayout(elementDesc, _countof(elementDesc), VS->GetBufferPointer(), VS->GetBufferSize(), &pLayout);
-    assert(SUCCEEDED(hr));
 
     deviceContext->IASetInputLayout(pLayout);
 
@@ -789,6 +2658,19 @@ void InitPipeline()
     hr = device->CreateSamplerState(&samplerDesc, &pSamplerState);
     assert(SUCCEEDED(hr));
 
+    //The upscale pass filters between scene texels and must not wrap into the unused part of the target
+    samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+    samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+    samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+    hr = device->CreateSamplerState(&samplerDesc, &pUpscaleSampler);
+    assert(SUCCEEDED(hr));
+
+    cBufferDesc.ByteWidth = sizeof(UpscaleConstants);
+    hr = device->CreateBuffer(&cBufferDesc, nullptr, &pUpscaleBuffer);
+    assert(SUCCEEDED(hr));
+    TrackGpuResource(pUpscaleBuffer, GpuCategoryConstant, "upscale");
+
     D3D11_DEPTH_STENCIL_DESC depthStencilDesc = {};
     depthStencilDesc.DepthEnable = TRUE;
     depthStencilDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
@@ -798,97 +2680,730 @@ void InitPipeline()
     hr = device->CreateDepthStencilState(&depthStencilDesc, &depthStencilState);
     assert(SUCCEEDED(hr));
 
+    //After the pre-pass the depth buffer is complete, draws only need to find their own surface in it
+    depthStencilDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+    depthStencilDesc.DepthFunc = D3D11_COMPARISON_EQUAL;
+    hr = device->CreateDepthStencilState(&depthStencilDesc, &depthEqualState);
+    assert(SUCCEEDED(hr));
+
 }
 
 
-bool LoadTarga(const char* filename, int& height, int& width)
+//Creates the shader objects and input layout from compiled bytecode and replaces the current ones
+bool CreateShaders(const std::vector<std::vector<unsigned char>> &bytecodes)
 {
-    FILE* filePtr = nullptr;
-    size_t count = 0;
-    TargaHeader targaFileHeader = {};
-    unsigned char* targaImage = nullptr;
-
+    HRESULT hr = S_OK;
 
-    // Open the targa file for reading in binary.
-    int error = fopen_s(&filePtr, filename, "rb");
-    if (error != 0 || filePtr == nullptr)
+    const std::vector<unsigned char> &VS = bytecodes[ShaderVS];
+    const std::vector<unsigned char> &PS = bytecodes[ShaderPS];
+    const std::vector<unsigned char> &PSSolid = bytecodes[ShaderPSSolid];
+    const std::vector<unsigned char> &VSShadow = bytecodes[ShaderVSShadow];
+    const std::vector<unsigned char> &VSUpscale = bytecodes[ShaderVSUpscale];
+    const std::vector<unsigned char> &PSUpscale = bytecodes[ShaderPSUpscale];
+    const std::vector<unsigned char> &VSSkinned = bytecodes[ShaderVSSkinned];
+    const std::vector<unsigned char> &VSShadowSkinned = bytecodes[ShaderVSShadowSkinned];
+
+    //Encapsulate the shaders into the shader objects, nothing is replaced unless all of them work
+    ID3D11VertexShader *newVS = nullptr;
+    ID3D11PixelShader *newPS = nullptr;
+    ID3D11PixelShader *newPSSolid = nullptr;
+    ID3D11VertexShader *newVSShadow = nullptr;
+    ID3D11VertexShader *newVSUpscale = nullptr;
+    ID3D11PixelShader *newPSUpscale = nullptr;
+    ID3D11VertexShader *newVSSkinned = nullptr;
+    ID3D11VertexShader *newVSShadowSkinned = nullptr;
+    ID3D11InputLayout *newLayout = nullptr;
+    ID3D11InputLayout *newSkinnedLayout = nullptr;
+    ID3D11InputLayout *newDepthLayout = nullptr;
+    ID3D11InputLayout *newDepthSkinnedLayout = nullptr;
+
+    hr = device->CreateVertexShader(VS.data(), VS.size(), nullptr, &newVS);
+    if (SUCCEEDED(hr)) hr = device->CreatePixelShader(PS.data(), PS.size(), nullptr, &newPS);
+    if (SUCCEEDED(hr)) hr = device->CreatePixelShader(PSSolid.data(), PSSolid.size(), nullptr, &newPSSolid);
+    if (SUCCEEDED(hr)) hr = device->CreateVertexShader(VSShadow.data(), VSShadow.size(), nullptr, &newVSShadow);
+    if (SUCCEEDED(hr)) hr = device->CreateVertexShader(VSUpscale.data(), VSUpscale.size(), nullptr, &newVSUpscale);
+    if (SUCCEEDED(hr)) hr = device->CreatePixelShader(PSUpscale.data(), PSUpscale.size(), nullptr, &newPSUpscale);
+    if (SUCCEEDED(hr)) hr = device->CreateVertexShader(VSSkinned.data(), VSSkinned.size(), nullptr, &newVSSkinned);
+    if (SUCCEEDED(hr)) hr = device->CreateVertexShader(VSShadowSkinned.data(), VSShadowSkinned.size(), nullptr, &newVSShadowSkinned);
+
+    //Create the input layout object, every attribute comes from a stream of its own
+    const SceneVertexFormat::InputLayout elementDesc = SceneVertexFormat::GetStreamInputLayout();
+
+    if (SUCCEEDED(hr)) hr = device->CreateInputLayout(elementDesc.data(), static_cast<UINT>(elementDesc.size()), VS.data(), VS.size(), &newLayout);
+
+    //Skinned meshes read their joints and weights from a second vertex buffer
+    const SkinVertexFormat::InputLayout skinDesc = SkinVertexFormat::GetInputLayout(skinStreamSlot);
+    std::vector<D3D11_INPUT_ELEMENT_DESC> skinnedDesc(elementDesc.begin(), elementDesc.end());
+    skinnedDesc.insert(skinnedDesc.end(), skinDesc.begin(), skinDesc.end());
+    if (SUCCEEDED(hr)) hr = device->CreateInputLayout(skinnedDesc.data(), static_cast<UINT>(skinnedDesc.size()), VSSkinned.data(), VSSkinned.size(), &newSkinnedLayout);
+
+    //The depth passes only fetch the position stream
+    const PositionVertexFormat::InputLayout positionDesc = PositionVertexFormat::GetInputLayout();
+    if (SUCCEEDED(hr)) hr = device->CreateInputLayout(positionDesc.data(), static_cast<UINT>(positionDesc.size()), VSShadow.data(), VSShadow.size(), &newDepthLayout);
+
+    std::vector<D3D11_INPUT_ELEMENT_DESC> depthSkinnedDesc(positionDesc.begin(), positionDesc.end());
+    depthSkinnedDesc.insert(depthSkinnedDesc.end(), skinDesc.begin(), skinDesc.end());
+    if (SUCCEEDED(hr)) hr = device->CreateInputLayout(depthSkinnedDesc.data(), static_cast<UINT>(depthSkinnedDesc.size()),
+        VSShadowSkinned.data(), VSShadowSkinned.size(), &newDepthSkinnedLayout);
+
+    if (FAILED(hr))
     {
+        if (newVS) newVS->Release();
+        if (newPS) newPS->Release();
+        if (newPSSolid) newPSSolid->Release();
+        if (newVSShadow) newVSShadow->Release();
+        if (newVSUpscale) newVSUpscale->Release();
+        if (newPSUpscale) newPSUpscale->Release();
+        if (newVSSkinned) newVSSkinned->Release();
+        if (newVSShadowSkinned) newVSShadowSkinned->Release();
+        if (newLayout) newLayout->Release();
+        if (newSkinnedLayout) newSkinnedLayout->Release();
+        if (newDepthLayout) newDepthLayout->Release();
+        if (newDepthSkinnedLayout) newDepthSkinnedLayout->Release();
         return false;
     }
 
-    // Read in the file header.
-    count = fread(&targaFileHeader, sizeof(TargaHeader), 1, filePtr);
-    if (count != 1)
+    if (pVS) pVS->Release();
+    if (pPS) pPS->Release();
+    if (pPSSolid) pPSSolid->Release();
+    if (pVSShadow) pVSShadow->Release();
+    if (pVSUpscale) pVSUpscale->Release();
+    if (pPSUpscale) pPSUpscale->Release();
+    if (pVSSkinned) pVSSkinned->Release();
+    if (pVSShadowSkinned) pVSShadowSkinned->Release();
+    if (pLayout) pLayout->Release();
+    if (pSkinnedLayout) pSkinnedLayout->Release();
+    if (pDepthLayout) pDepthLayout->Release();
+    if (pDepthSkinnedLayout) pDepthSkinnedLayout->Release();
+    pVS = newVS;
+    pPS = newPS;
+    pPSSolid = newPSSolid;
+    pVSShadow = newVSShadow;
+    pVSUpscale = newVSUpscale;
+    pPSUpscale = newPSUpscale;
+    pVSSkinned = newVSSkinned;
+    pVSShadowSkinned = newVSShadowSkinned;
+    pLayout = newLayout;
+    pSkinnedLayout = newSkinnedLayout;
+    pDepthLayout = newDepthLayout;
+    pDepthSkinnedLayout = newDepthSkinnedLayout;
+
+    return true;
+}
+
+
+//Loads every shader variant through the shader cache, misses are compiled in parallel
+bool LoadShaders(std::vector<std::vector<unsigned char>> &bytecodes)
+{
+    std::vector<ShaderPermutation> permutations(ShaderVariantCount);
+    permutations[ShaderVS].entryPoint = "VShader";
+    permutations[ShaderVS].profile = "vs_5_0";
+    permutations[ShaderPS].entryPoint = "PShader";
+    permutations[ShaderPS].profile = "ps_5_0";
+    permutations[ShaderPSSolid].entryPoint = "PSSolid";
+    permutations[ShaderPSSolid].profile = "ps_5_0";
+    permutations[ShaderVSShadow].entryPoint = "VShadow";
+    permutations[ShaderVSShadow].profile = "vs_5_0";
+    permutations[ShaderVSUpscale].entryPoint = "VUpscale";
+    permutations[ShaderVSUpscale].profile = "vs_5_0";
+    permutations[ShaderPSUpscale].entryPoint = "PUpscale";
+    permutations[ShaderPSUpscale].profile = "ps_5_0";
+    permutations[ShaderVSSkinned].entryPoint = "VSkinned";
+    permutations[ShaderVSSkinned].profile = "vs_5_0";
+    permutations[ShaderVSShadowSkinned].entryPoint = "VShadowSkinned";
+    permutations[ShaderVSShadowSkinned].profile = "vs_5_0";
+    //The vertex input structs are generated from the vertex formats
+    const ShaderDefine vertexInput = { "VERTEX_INPUT", SceneVertexFormat::GetHlslFields() };
+    const ShaderDefine positionInput = { "POSITION_INPUT", PositionVertexFormat::GetHlslFields() };
+    const ShaderDefine skinInput = { "SKIN_INPUT", SkinVertexFormat::GetHlslFields() };
+    for (ShaderPermutation &permutation : permutations)
     {
-        return false;
+        permutation.flags = D3D10_SHADER_ENABLE_STRICTNESS;
+        permutation.defines.push_back(vertexInput);
+        permutation.defines.push_back(positionInput);
+        permutation.defines.push_back(skinInput);
+    }
+
+    std::string errors;
+    const bool loaded = shaderCache.GetAll(jobSystem, shaderPath, permutations, bytecodes, errors);
+    if (!errors.empty())
+    {
+        OutputDebugStringA(errors.c_str());
     }
 
-    // Get the important information from the header.
-    height = (int)targaFileHeader.height;
-    width = (int)targaFileHeader.width;
-    const int bpp = (int)targaFileHeader.bpp;
+    char report[128] = {};
+    sprintf_s(report, "Shader cache: %u hits, %u compiled\n", shaderCache.GetHits(), shaderCache.GetMisses());
+    OutputDebugStringA(report);
+
+    return loaded;
+}
+
 
-    // Check that it is 32 bit and not 24 bit.
-    if (bpp != 32)
+//Builds the LOD chain of a model several times and reports how fast the simplifier runs
+bool BenchmarkSimplification(const char *filename)
+{
+    MeshData mesh;
+    if (!LoadModelData(filename, mesh) || mesh.lods.empty())
     {
         return false;
     }
 
-    // Calculate the size of the 32 bit image data.
-    int imageSize = width * height * 4;
+    //Start over from the full detail level every run
+    mesh.indices.resize(mesh.lods[0].indexCount);
+    const std::vector<short> fullIndices = mesh.indices;
+
+    const int runs = 10;
+    LARGE_INTEGER frequency = {};
+    LARGE_INTEGER start = {};
+    LARGE_INTEGER end = {};
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    for (int i = 0; i < runs; i++)
+    {
+        mesh.indices = fullIndices;
+        BuildLodChain(mesh);
+    }
+    QueryPerformanceCounter(&end);
+
+    const double ms = 1000.0 * (end.QuadPart - start.QuadPart) / frequency.QuadPart / runs;
+    const double triangles = fullIndices.size() / 3.0;
+
+    char report[256] = {};
+    sprintf_s(report, "LOD benchmark: %s, %zu vertices, %.0f triangles, %.2f ms per chain, %.2f M input triangles/s\n",
+        filename, mesh.vertices.size(), triangles, ms, triangles / ms / 1000.0);
+    OutputDebugStringA(report);
+
+    for (size_t i = 0; i < mesh.lods.size(); i++)
+    {
+        sprintf_s(report, "  LOD %zu: %u triangles, error %.5f\n", i, mesh.lods[i].indexCount / 3, mesh.lods[i].error);
+        OutputDebugStringA(report);
+    }
+
+    return true;
+}
+
 
-    // Allocate memory for the targa image data.
-    targaImage = new unsigned char[imageSize];
-    if (!targaImage)
+//Imports an OBJ file several times with the native importer and with Assimp and reports both speeds
+bool BenchmarkModelImport(const char *filename)
+{
+    MappedFile file;
+    if (!file.Open(filename))
     {
         return false;
     }
+    const double megabytes = file.GetSize() / (1024.0 * 1024.0);
+    file.Close();
+
+    const int runs = 5;
+    LARGE_INTEGER frequency = {};
+    LARGE_INTEGER start = {};
+    LARGE_INTEGER end = {};
+    QueryPerformanceFrequency(&frequency);
+
+    MeshData native;
+    QueryPerformanceCounter(&start);
+    for (int i = 0; i < runs; i++)
+    {
+        if (!LoadObj(filename, native, &jobSystem))
+        {
+            return false;
+        }
+    }
+    QueryPerformanceCounter(&end);
+    const double nativeMs = 1000.0 * (end.QuadPart - start.QuadPart) / frequency.QuadPart / runs;
+
+    MeshData assimp;
+    QueryPerformanceCounter(&start);
+    for (int i = 0; i < runs; i++)
+    {
+        if (!LoadModelDataAssimp(filename, assimp))
+        {
+            return false;
+        }
+    }
+    QueryPerformanceCounter(&end);
+    const double assimpMs = 1000.0 * (end.QuadPart - start.QuadPart) / frequency.QuadPart / runs;
+
+    char report[256] = {};
+    sprintf_s(report, "OBJ benchmark: %s, %.2f MB, %u threads\n", filename, megabytes, jobSystem.GetWorkerCount() + 1);
+    OutputDebugStringA(report);
+    sprintf_s(report, "  native: %.2f ms, %.1f MB/s, %zu vertices, %zu triangles\n",
+        nativeMs, megabytes * 1000.0 / nativeMs, native.vertices.size(), native.indices.size() / 3);
+    OutputDebugStringA(report);
+    sprintf_s(report, "  assimp: %.2f ms, %.1f MB/s, %zu vertices, %zu triangles\n",
+        assimpMs, megabytes * 1000.0 / assimpMs, assimp.vertices.size(), assimp.indices.size() / 3);
+    OutputDebugStringA(report);
+    sprintf_s(report, "  %.1fx faster, output %s\n", assimpMs / nativeMs,
+        native.vertices.size() == assimp.vertices.size() && native.indices.size() == assimp.indices.size() ? "matches" : "DIFFERS");
+    OutputDebugStringA(report);
+
+    return true;
+}
+
 
-    // Read in the targa image data.
-    count = fread(targaImage, 1, imageSize, filePtr);
-    if (count != imageSize)
+//Loads the panda and the textures of the scene several times from loose files and from the archive,
+//then unpacks the whole archive, and reports all three. Files stay in the OS cache between runs,
+//so this measures parsing and decompression rather than the disk.
+bool BenchmarkAssetLoading()
+{
+    if (!assetArchive.Open(assetArchivePath))
     {
+        OutputDebugStringA("Asset benchmark: no archive, run with -packassets first\n");
         return false;
     }
 
-    // Close the file.
-    error = fclose(filePtr);
-    if (error != 0)
+    const char *model = "assets/pandaren_model/pandaren.obj";
+    const int runs = 5;
+    LARGE_INTEGER frequency = {};
+    LARGE_INTEGER start = {};
+    LARGE_INTEGER end = {};
+    QueryPerformanceFrequency(&frequency);
+
+    double loadMs[2] = {};
+    for (int pass = 0; pass < 2; pass++)
+    {
+        MountAssetArchive(pass == 0 ? nullptr : &assetArchive);
+
+        QueryPerformanceCounter(&start);
+        for (int i = 0; i < runs; i++)
+        {
+            MeshData mesh;
+            TextureData body;
+            TextureData stone;
+            bool loaded = LoadObj(model, mesh, &jobSystem);
+            const bool hasTarga = mesh.diffuseTexture.size() >= 4 && _stricmp(mesh.diffuseTexture.c_str() + mesh.diffuseTexture.size() - 4, ".tga") == 0;
+            loaded = loaded && LoadTarga(hasTarga ? mesh.diffuseTexture.c_str() : "assets/pandaren_model/pandaren_Body.tga", body);
+            loaded = loaded && LoadTarga("assets/stone.tga", stone);
+            if (!loaded)
+            {
+                MountAssetArchive(nullptr);
+                return false;
+            }
+        }
+        QueryPerformanceCounter(&end);
+        loadMs[pass] = 1000.0 * (end.QuadPart - start.QuadPart) / frequency.QuadPart / runs;
+    }
+    MountAssetArchive(nullptr);
+
+    //Every entry, blocks split over the workers
+    unsigned long long bytes = 0;
+    std::vector<unsigned char> buffer;
+    QueryPerformanceCounter(&start);
+    for (unsigned int i = 0; i < assetArchive.GetEntryCount(); i++)
+    {
+        const int entry = static_cast<int>(i);
+        buffer.resize(assetArchive.GetSize(entry));
+        if (!assetArchive.Read(entry, buffer.data(), &jobSystem, false))
+        {
+            return false;
+        }
+        bytes += buffer.size();
+    }
+    QueryPerformanceCounter(&end);
+    const double unpackMs = 1000.0 * (end.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+    char report[256] = {};
+    sprintf_s(report, "Asset benchmark: %u entries, %u threads\n", assetArchive.GetEntryCount(), jobSystem.GetWorkerCount() + 1);
+    OutputDebugStringA(report);
+    sprintf_s(report, "  scene from loose files: %.2f ms\n", loadMs[0]);
+    OutputDebugStringA(report);
+    sprintf_s(report, "  scene from archive: %.2f ms, %.2fx\n", loadMs[1], loadMs[0] / loadMs[1]);
+    OutputDebugStringA(report);
+    sprintf_s(report, "  unpack everything: %.2f ms, %.1f MB/s\n", unpackMs, bytes / (1024.0 * 1024.0) * 1000.0 / unpackMs);
+    OutputDebugStringA(report);
+
+    assetArchive.Close();
+    return true;
+}
+
+
+//Poses a large crowd with one thread and with all of them, then skins part of it on the CPU, and
+//reports the rates. A quarter of the crowd is cross fading, which samples two clips.
+bool BenchmarkAnimation()
+{
+    MeshData mesh;
+    Skeleton skeleton;
+    std::vector<AnimationClip> clips;
+    if (!LoadSkinnedModelData(characterPath, mesh, skeleton, clips) || clips.empty())
+    {
+        BuildProceduralCharacter(mesh, skeleton, clips);
+    }
+
+    const unsigned int characters = 10000;
+    const unsigned int clipCount = static_cast<unsigned int>(clips.size());
+    AnimationSystem animation;
+    animation.Init(&skeleton, clips.data(), clipCount);
+    for (unsigned int c = 0; c < characters; c++)
+    {
+        animation.AddCharacter(c % clipCount, 0.37f * c, 0.8f + 0.05f * (c % 8));
+    }
+    for (unsigned int c = 0; c < characters; c += 4)
+    {
+        animation.Play(c, (c / 4 + 1) % clipCount, 1000.0f);
+    }
+
+    const int runs = 20;
+    LARGE_INTEGER frequency = {};
+    LARGE_INTEGER start = {};
+    LARGE_INTEGER end = {};
+    QueryPerformanceFrequency(&frequency);
+
+    double updateMs[2] = {};
+    for (int pass = 0; pass < 2; pass++)
+    {
+        JobSystem *jobs = pass == 0 ? nullptr : &jobSystem;
+        animation.Update(1.0f / 60.0f, jobs);
+
+        QueryPerformanceCounter(&start);
+        for (int i = 0; i < runs; i++)
+        {
+            animation.Update(1.0f / 60.0f, jobs);
+        }
+        QueryPerformanceCounter(&end);
+        updateMs[pass] = 1000.0 * (end.QuadPart - start.QuadPart) / frequency.QuadPart / runs;
+    }
+
+    //Software skinning on one thread
+    const unsigned int skinnedCharacters = 100;
+    std::vector<VERTEX> skinned(mesh.vertices.size());
+    QueryPerformanceCounter(&start);
+    for (unsigned int c = 0; c < skinnedCharacters; c++)
+    {
+        SkinVertices(mesh.vertices.data(), mesh.skin.data(), mesh.vertices.size(), animation.GetPalette(c), skinned.data());
+    }
+    QueryPerformanceCounter(&end);
+    const double skinMs = 1000.0 * (end.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+    char report[256] = {};
+    sprintf_s(report, "Animation benchmark: %u characters, %u joints, %u clips, %u threads\n",
+        characters, skeleton.GetJointCount(), clipCount, jobSystem.GetWorkerCount() + 1);
+    OutputDebugStringA(report);
+    sprintf_s(report, "  1 thread: %.3f ms per update, %.1f characters/ms\n", updateMs[0], characters / updateMs[0]);
+    OutputDebugStringA(report);
+    sprintf_s(report, "  %u threads: %.3f ms per update, %.1f characters/ms, %.2fx\n",
+        jobSystem.GetWorkerCount() + 1, updateMs[1], characters / updateMs[1], updateMs[0] / updateMs[1]);
+    OutputDebugStringA(report);
+    sprintf_s(report, "  CPU skinning: %zu vertices per character, %.1f k vertices/ms\n",
+        mesh.vertices.size(), skinnedCharacters * mesh.vertices.size() / skinMs / 1000.0);
+    OutputDebugStringA(report);
+
+    return true;
+}
+
+
+//Builds hierarchies of 100k nodes and times updating all of them, a scattered 1% of them
+//with everything below, and none, on one thread and on all of them
+bool BenchmarkTransforms()
+{
+    typedef TransformHandle (*ParentOf)(unsigned int node);
+    struct Shape
+    {
+        const char *name;
+        ParentOf parent;
+    };
+    const Shape shapes[] =
+    {
+        { "1000 objects with 99 children each", [](unsigned int node) { return node < 1000 ? InvalidTransform : node % 1000; } },
+        { "1000 chains 100 deep", [](unsigned int node) { return node < 1000 ? InvalidTransform : node - 1000; } },
+        { "one tree with 4 children per node", [](unsigned int node) { return node == 0 ? InvalidTransform : (node - 1) / 4; } },
+    };
+    const unsigned int nodes = 100000;
+    const int runs = 20;
+    const float frameBudget = 1000.0f / 60.0f;
+
+    char report[256] = {};
+    sprintf_s(report, "Transform benchmark: %u nodes, %u threads, %.1f ms frame budget\n", nodes, jobSystem.GetWorkerCount() + 1, frameBudget);
+    OutputDebugStringA(report);
+
+    TransformHierarchy hierarchy;
+    for (const Shape &shape : shapes)
+    {
+        hierarchy.Clear();
+        hierarchy.Reserve(nodes);
+        for (unsigned int node = 0; node < nodes; node++)
+        {
+            JointPose local;
+            local.translation = XMFLOAT3(0.1f * (node % 7), 0.2f, 0.1f * (node % 5));
+            hierarchy.Add(shape.parent(node), local);
+        }
+        hierarchy.Update(nullptr);
+
+        sprintf_s(report, "  %s, %u levels, reordered in %.3f ms\n", shape.name, hierarchy.GetStats().levels, hierarchy.GetStats().ms);
+        OutputDebugStringA(report);
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            JobSystem *jobs = pass == 0 ? nullptr : &jobSystem;
+
+            //Every node changed, one in a hundred changed and nothing changed
+            const unsigned int strides[] = { 1, 100, 0 };
+            float ms[3] = {};
+            unsigned int recomputed[3] = {};
+            for (int c = 0; c < 3; c++)
+            {
+                for (int run = 0; run < runs; run++)
+                {
+                    XMFLOAT4 rotation;
+                    XMStoreFloat4(&rotation, XMQuaternionRotationRollPitchYaw(0.0f, 0.01f * run, 0.0f));
+                    for (unsigned int node = 0; strides[c] > 0 && node < nodes; node += strides[c])
+                    {
+                        hierarchy.SetRotation(node, rotation);
+                    }
+                    hierarchy.Update(jobs);
+                    ms[c] += hierarchy.GetStats().ms / runs;
+                }
+                recomputed[c] = hierarchy.GetStats().recomputed;
+            }
+
+            sprintf_s(report, "    %u threads: all %.3f ms (%.0f%% of a frame, %.1f M nodes/s), 1%% dirty %.3f ms (%u recomputed), clean %.3f ms\n",
+                jobs ? jobSystem.GetWorkerCount() + 1 : 1, ms[0], 100.0f * ms[0] / frameBudget, nodes / ms[0] / 1000.0f,
+                ms[1], recomputed[1], ms[2]);
+            OutputDebugStringA(report);
+        }
+    }
+
+    return true;
+}
+
+
+//Builds the BVH of a model on one and on all threads, checks closest hits against testing every
+//triangle and measures rays per second at four and eight triangles per test
+bool BenchmarkRaycasts(const char *filename)
+{
+    MeshData mesh;
+    if (!LoadModelData(filename, mesh, &jobSystem))
     {
         return false;
     }
+    const short *indices = mesh.indices.data() + (mesh.lods.empty() ? 0 : mesh.lods[0].indexOffset);
+    const unsigned int indexCount = mesh.lods.empty() ? static_cast<unsigned int>(mesh.indices.size()) : mesh.lods[0].indexCount;
+
+    MeshBvh bvh;
+    bvh.Build(mesh.vertices.data(), sizeof(VERTEX), indices, indexCount, nullptr);
+    const float serialBuildMs = bvh.GetStats().buildMs;
+    bvh.Build(mesh.vertices.data(), sizeof(VERTEX), indices, indexCount, &jobSystem);
+    const BvhStats &stats = bvh.GetStats();
+
+    char report[256] = {};
+    sprintf_s(report, "Raycast benchmark: %u triangles, %u nodes, %u leaves, %.2f MB\n",
+        stats.triangles, stats.nodes, stats.leaves, stats.bytes / (1024.0 * 1024.0));
+    OutputDebugStringA(report);
+    sprintf_s(report, "  Build: %.2f ms on 1 thread, %.2f ms on %u threads\n", serialBuildMs, stats.buildMs, jobSystem.GetWorkerCount() + 1);
+    OutputDebugStringA(report);
+
+    //Rays from a sphere around the model towards random points inside its bounds
+    XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+    XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+    for (const VERTEX &vertex : mesh.vertices)
+    {
+        boundsMin = XMVectorMin(boundsMin, XMLoadFloat3(&vertex.position));
+        boundsMax = XMVectorMax(boundsMax, XMLoadFloat3(&vertex.position));
+    }
+    const XMVECTOR center = 0.5f * (boundsMin + boundsMax);
+    const float radius = XMVectorGetX(XMVector3Length(boundsMax - boundsMin));
+
+    const unsigned int rayCount = 200000;
+    std::vector<XMFLOAT3> origins(rayCount);
+    std::vector<XMFLOAT3> directions(rayCount);
+    unsigned int seed = 1;
+    auto random = [&seed]()
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) / 16777216.0f;
+    };
+    for (unsigned int i = 0; i < rayCount; i++)
+    {
+        const XMVECTOR around = XMVector3Normalize(XMVectorSet(random() - 0.5f, random() - 0.5f, random() - 0.5f, 0.0f));
+        const XMVECTOR origin = center + radius * around;
+        const XMVECTOR target = XMVectorLerpV(boundsMin, boundsMax, XMVectorSet(random(), random(), random(), 0.0f));
+        XMStoreFloat3(&origins[i], origin);
+        XMStoreFloat3(&directions[i], XMVector3Normalize(target - origin));
+    }
+
+    //Every triangle against the first rays
+    const unsigned int checkedRays = 500;
+    unsigned int mismatches = 0;
+    for (unsigned int i = 0; i < checkedRays; i++)
+    {
+        const XMVECTOR origin = XMLoadFloat3(&origins[i]);
+        const XMVECTOR direction = XMLoadFloat3(&directions[i]);
+        float closest = FLT_MAX;
+        for (unsigned int t = 0; t + 2 < indexCount; t += 3)
+        {
+            float distance = 0.0f;
+            if (TriangleTests::Intersects(origin, direction, XMLoadFloat3(&mesh.vertices[indices[t]].position),
+                XMLoadFloat3(&mesh.vertices[indices[t + 1]].position), XMLoadFloat3(&mesh.vertices[indices[t + 2]].position), distance))
+            {
+                closest = std::min(closest, distance);
+            }
+        }
+
+        RayHit hit;
+        const bool found = bvh.Intersect(origin, direction, FLT_MAX, hit);
+        if (found != (closest < FLT_MAX) || (found && fabsf(hit.distance - closest) > 1e-3f * std::max(1.0f, closest)))
+        {
+            mismatches++;
+        }
+    }
+    sprintf_s(report, "  %u of %u closest hits differ from testing every triangle\n", mismatches, checkedRays);
+    OutputDebugStringA(report);
+
+    LARGE_INTEGER frequency = {};
+    LARGE_INTEGER start = {};
+    LARGE_INTEGER end = {};
+    QueryPerformanceFrequency(&frequency);
+    const bool hasAvx2 = bvh.IsUsingAvx2();
+    for (int pass = 0; pass < (hasAvx2 ? 2 : 1); pass++)
+    {
+        bvh.UseAvx2(pass == 1);
+
+        double ms[3] = {};
+        unsigned int hits = 0;
+        for (int query = 0; query < 2; query++)
+        {
+            QueryPerformanceCounter(&start);
+            for (unsigned int i = 0; i < rayCount; i++)
+            {
+                RayHit hit;
+                const XMVECTOR origin = XMLoadFloat3(&origins[i]);
+                const XMVECTOR direction = XMLoadFloat3(&directions[i]);
+                const bool found = query == 0 ? bvh.Intersect(origin, direction, FLT_MAX, hit) : bvh.IntersectAny(origin, direction, FLT_MAX);
+                hits += found && query == 0 ? 1 : 0;
+            }
+            QueryPerformanceCounter(&end);
+            ms[query] = 1000.0 * (end.QuadPart - start.QuadPart) / frequency.QuadPart;
+        }
+
+        QueryPerformanceCounter(&start);
+        jobSystem.ParallelFor(rayCount, 1024, 64, [&bvh, &origins, &directions](unsigned int begin, unsigned int last, unsigned int)
+        {
+            for (unsigned int i = begin; i < last; i++)
+            {
+                RayHit hit;
+                bvh.Intersect(XMLoadFloat3(&origins[i]), XMLoadFloat3(&directions[i]), FLT_MAX, hit);
+            }
+        });
+        QueryPerformanceCounter(&end);
+        ms[2] = 1000.0 * (end.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+        sprintf_s(report, "  %s: closest %.2f M rays/s (%.2f us per ray, %.0f%% hit), any %.2f M rays/s, %u threads %.2f M rays/s\n",
+            pass == 1 ? "8 wide AVX2" : "4 wide", rayCount / ms[0] / 1000.0, 1000.0 * ms[0] / rayCount, 100.0 * hits / rayCount,
+            rayCount / ms[1] / 1000.0, jobSystem.GetWorkerCount() + 1, rayCount / ms[2] / 1000.0);
+        OutputDebugStringA(report);
+    }
+
+    return true;
+}
 
-    // Allocate memory for the targa destination data.
-    targaData = new unsigned char[imageSize];
+//Traces the whole mesh with 1, 2, 4 ... threads up to one per hardware thread, never through the cache
+bool BenchmarkOcclusionBake(const char *filename)
+{
+    jobSystem.Init();
+    MeshData mesh;
+    const bool loaded = LoadModelData(filename, mesh, &jobSystem);
+    const unsigned int maxThreads = jobSystem.GetWorkerCount() + 1;
+    jobSystem.Shutdown();
+    if (!loaded)
+    {
+        return false;
+    }
+    const short *indices = mesh.indices.data() + (mesh.lods.empty() ? 0 : mesh.lods[0].indexOffset);
+    const unsigned int indexCount = mesh.lods.empty() ? static_cast<unsigned int>(mesh.indices.size()) : mesh.lods[0].indexCount;
 
-    // Initialize the index into the targa destination data array.
-    int index = 0;
+    MeshBvh bvh;
+    bvh.Build(mesh.vertices.data(), sizeof(VERTEX), indices, indexCount, nullptr);
 
-    // Initialize the index into the targa image data.
-    int k = (width * height * 4) - (width * 4);
+    char report[256] = {};
+    sprintf_s(report, "Occlusion bake benchmark: %u vertices, %u triangles, %u rays per vertex\n", static_cast<unsigned int>(mesh.vertices.size()),
+        indexCount / 3, occlusionBaker.GetSettings().rays);
+    OutputDebugStringA(report);
 
-    // Now copy the targa image data into the targa destination array in the correct order since the targa format is stored upside down.
-    for (int j = 0; j<height; j++)
+    float serialMs = 0.0f;
+    for (unsigned int threads = 1; ; threads = std::min(threads * 2, maxThreads))
     {
-        for (int i = 0; i<width; i++)
+        //The calling thread works too, so one thread means no workers at all
+        if (threads > 1)
         {
-            targaData[index + 0] = targaImage[k + 2];  // Red.
-            targaData[index + 1] = targaImage[k + 1];  // Green.
-            targaData[index + 2] = targaImage[k + 0];  // Blue
-            targaData[index + 3] = targaImage[k + 3];  // Alpha
+            jobSystem.Init(threads - 1);
+        }
+        const OcclusionBakeStats stats = occlusionBaker.Trace(mesh.vertices.data(), mesh.vertices.size(), bvh, threads > 1 ? &jobSystem : nullptr);
+        jobSystem.Shutdown();
 
-                                                         // Increment the indexes into the targa data.
-            k += 4;
-            index += 4;
+        serialMs = threads == 1 ? stats.ms : serialMs;
+        sprintf_s(report, "  %2u threads: %8.1f ms, %6.2f M rays/s, %4.2fx, %.2f average\n", threads, stats.ms,
+            stats.rays / stats.ms / 1000.0, serialMs / stats.ms, stats.average);
+        OutputDebugStringA(report);
+
+        if (threads == maxThreads)
+        {
+            break;
         }
+    }
+
+    return true;
+}
 
-        // Set the targa image data index back to the preceding row at the beginning of the column since its reading it in upside down.
-        k -= (width * 8);
+
+//Compiles one shader permutation with the HLSL compiler, only runs on a shader cache miss
+bool CompileShader(const std::string &source, const std::string &sourceName, const ShaderPermutation &permutation,
+    std::vector<unsigned char> &bytecode, std::string &errors)
+{
+    std::vector<D3D_SHADER_MACRO> macros;
+    for (const ShaderDefine &define : permutation.defines)
+    {
+        macros.push_back({ define.name.c_str(), define.value.c_str() });
+    }
+    macros.push_back({ nullptr, nullptr });
+
+    ID3DBlob *code = nullptr;
+    ID3DBlob *pErrorBlob = nullptr;
+    const HRESULT hr = D3DCompile(source.data(), source.size(), sourceName.c_str(), macros.data(), nullptr,
+        permutation.entryPoint.c_str(), permutation.profile.c_str(), permutation.flags, 0, &code, &pErrorBlob);
+
+    if (pErrorBlob)
+    {
+        errors.assign(static_cast<const char*>(pErrorBlob->GetBufferPointer()), pErrorBlob->GetBufferSize());
+        pErrorBlob->Release();
     }
 
-    // Release the targa image data now that it was copied into the destination array.
-    delete[] targaImage;
-    targaImage = 0;
+    if (FAILED(hr))
+    {
+        return false;
+    }
 
+    const unsigned char *bytes = static_cast<const unsigned char*>(code->GetBufferPointer());
+    bytecode.assign(bytes, bytes + code->GetBufferSize());
+    code->Release();
     return true;
-}
\ No newline at end of file
+}
+
+
+//The compiler version the headers declare plus the file version of the DLL that is actually
+//loaded, which moves with SDK and Windows updates while the header version stays at 47
+std::string GetShaderCompilerVersion()
+{
+    char version[64] = {};
+    sprintf_s(version, "d3dcompiler %d", D3D_COMPILER_VERSION);
+    std::string result = version;
+
+    char path[MAX_PATH] = {};
+    const HMODULE compiler = GetModuleHandleA(D3DCOMPILER_DLL_A);
+    if (!compiler || GetModuleFileNameA(compiler, path, MAX_PATH) == 0)
+    {
+        return result;
+    }
+
+    DWORD handle = 0;
+    const DWORD infoSize = GetFileVersionInfoSizeA(path, &handle);
+    std::vector<unsigned char> info(infoSize);
+    VS_FIXEDFILEINFO *fileInfo = nullptr;
+    UINT fileInfoSize = 0;
+    if (infoSize > 0 && GetFileVersionInfoA(path, 0, infoSize, info.data()) &&
+        VerQueryValueA(info.data(), "\\", reinterpret_cast<void**>(&fileInfo), &fileInfoSize) && fileInfo)
+    {
+        sprintf_s(version, " %u.%u.%u.%u", HIWORD(fileInfo->dwFileVersionMS), LOWORD(fileInfo->dwFileVersionMS),
+            HIWORD(fileInfo->dwFileVersionLS), LOWORD(fileInfo->dwFileVersionLS));
+        result += version;
+    }
+    return result;
+}
@@ -6,13 +6,48 @@ cbuffer ConstantBuffer : register(b0)
     float4 lightDir;
     float4 lightColor;
     float4 outputColor;
+    float4 clusterScale;    //Pixels to tiles in xy, log(view depth) to a depth slice in zw
+    uint4 clusterCount;     //Tiles across, tiles down, depth slices
+    matrix shadowMatrices[4];   //World to shadow map texture space per cascade
+    float4 cascadeSplits;   //View depth where each cascade ends
+    float4 shadowParams;    //x: size of a shadow map texel
+    uint4 drawInfo;         //x: first palette joint of the character being drawn, y: albedo array slice
 }
 
+//Point or spot light, point lights have spotScale 0 and spotOffset 1
+struct Light
+{
+    float3 position;
+    float range;
+    float3 color;
+    float spotScale;
+    float3 direction;
+    float spotOffset;
+};
+
+//Fields come from the application's vertex format, which defines VERTEX_INPUT when compiling
 struct VINPUT
 {
-    float4 position : POSITION;
-    float3 normal : NORMAL;
-    float2 tex : TEXCOORD;
+    VERTEX_INPUT
+};
+
+//Animated characters add a second stream with their joints and weights, SKIN_INPUT
+struct VSKININPUT
+{
+    VERTEX_INPUT
+    SKIN_INPUT
+};
+
+//The depth passes only read the position stream, POSITION_INPUT
+struct DINPUT
+{
+    POSITION_INPUT
+};
+
+struct DSKININPUT
+{
+    POSITION_INPUT
+    SKIN_INPUT
 };
 
 struct PINPUT
@@ -20,42 +55,160 @@ struct PINPUT
     float4 position : SV_POSITION;
     float3 normal : TEXCOORD0;
     float2 tex : TEXCOORD1;
+    float3 worldPos : TEXCOORD2;
+    float viewDepth : TEXCOORD3;
+    float occlusion : TEXCOORD4;
 };
 
-//Albedo means surface color :)
-Texture2D albedo : register(t0);
+//Albedo means surface color :) Textures of the same size share an array, drawInfo.y picks the slice
+Texture2DArray albedo : register(t0);
+
+//Lights sorted into clusters on the CPU every frame
+StructuredBuffer<Light> lights : register(t1);
+StructuredBuffer<uint2> clusterRanges : register(t2);          //Offset and count into clusterLightIndices
+StructuredBuffer<uint> clusterLightIndices : register(t3);
+
+//Directional light depth, one slice per cascade
+Texture2DArray shadowMap : register(t4);
+SamplerComparisonState shadowSampler : register(s1);
+
+//Skinning matrices of every character, three float4 rows of a 3x4 matrix per joint
+StructuredBuffer<float4> skinPalette : register(t6);
 
 SamplerState samplerState : register(s0);
 
-PINPUT VShader(VINPUT input)
+//World to clip space for every pass. The shading pass tests EQUAL against the depth the pre-pass
+//left, so precise keeps the compiler from doing the math differently in the two shaders.
+float4 ClipPosition(float4 worldPosition)
+{
+    precise float4 position = mul(worldPosition, view);
+    position = mul(position, projection);
+    return position;
+}
+
+PINPUT TransformVertex(float4 position, float3 normal, float occlusion, float2 tex)
 {
     PINPUT output = (PINPUT)0;
 
-    output.position = mul(input.position, world);
-    output.position = mul(output.position, view);
-    output.position = mul(output.position, projection);
+    precise float4 worldPosition = mul(position, world);
+    output.worldPos = worldPosition.xyz;
+    output.position = ClipPosition(worldPosition);
+    output.viewDepth = mul(worldPosition, view).z;
 
-    output.normal = mul(float4(input.normal, 1), world).xyz;
+    output.normal = mul(float4(normal, 0), world).xyz;
+    output.occlusion = occlusion;
 
-    output.tex = input.tex;
+    output.tex = tex;
 
     return output;
 }
 
+//Weighted sum of the palette matrices of up to four joints
+float3x4 SkinMatrix(uint4 joints, float4 weights)
+{
+    float3x4 skin = 0;
+    [unroll] for (int i = 0; i < 4; i++)
+    {
+        uint row = (drawInfo.x + joints[i]) * 3;
+        skin += weights[i] * float3x4(skinPalette[row], skinPalette[row + 1], skinPalette[row + 2]);
+    }
+    return skin;
+}
+
+PINPUT VShader(VINPUT input)
+{
+    return TransformVertex(input.position, input.normal.xyz, input.normal.w, input.tex);
+}
+
+//--------------------------------------------------------------------------------------
+// VSkinned - moves the vertex by its joints before the world transform
+//--------------------------------------------------------------------------------------
+PINPUT VSkinned(VSKININPUT input)
+{
+    float3x4 skin = SkinMatrix(input.joints, input.weights);
+    return TransformVertex(float4(mul(skin, input.position), 1), mul((float3x3)skin, input.normal.xyz), input.normal.w, input.tex);
+}
+
+
+//--------------------------------------------------------------------------------------
+// VShadow - depth only, view and projection are the light's or, for the pre-pass, the camera's
+//--------------------------------------------------------------------------------------
+float4 VShadow(DINPUT input) : SV_POSITION
+{
+    precise float4 position = mul(input.position, world);
+    return ClipPosition(position);
+}
+
+float4 VShadowSkinned(DSKININPUT input) : SV_POSITION
+{
+    float3x4 skin = SkinMatrix(input.joints, input.weights);
+    precise float4 position = mul(float4(mul(skin, input.position), 1), world);
+    return ClipPosition(position);
+}
+
+
+//How much of the directional light reaches a point, 3x3 PCF in the cascade it falls in
+float ShadowFactor(float3 worldPos, float viewDepth)
+{
+    if (viewDepth > cascadeSplits.w)
+    {
+        return 1;
+    }
+
+    uint cascade = (uint)(viewDepth > cascadeSplits.x) + (uint)(viewDepth > cascadeSplits.y) + (uint)(viewDepth > cascadeSplits.z);
+    float4 shadowPos = mul(float4(worldPos, 1), shadowMatrices[cascade]);
+
+    float lit = 0;
+    [unroll] for (int y = -1; y <= 1; y++)
+    {
+        [unroll] for (int x = -1; x <= 1; x++)
+        {
+            float2 uv = shadowPos.xy + float2(x, y) * shadowParams.x;
+            lit += shadowMap.SampleCmpLevelZero(shadowSampler, float3(uv, cascade), shadowPos.z);
+        }
+    }
+    return lit / 9;
+}
+
 
 float4 PShader(PINPUT input) : SV_TARGET
 {
     float4 finalColor = 0;
 
-    float4 surfaceColor = albedo.Sample(samplerState, input.tex);
+    float4 surfaceColor = albedo.Sample(samplerState, float3(input.tex, drawInfo.y));
 
-    //Do NdotL lighting for light
-    float ambient = 0.6;
-    float nDotL = saturate(dot((float3) - lightDir, normalize(input.normal)));
-    float diffuse = nDotL * (1 - ambient);
+    float3 normal = normalize(input.normal);
+
+    //Do NdotL lighting for light, the ambient part darkened where the mesh blocks its own sky
+    float ambientShare = 0.6;
+    float ambient = ambientShare * input.occlusion;
+    float nDotL = saturate(dot((float3) - lightDir, normal));
+    float diffuse = nDotL * (1 - ambientShare) * ShadowFactor(input.worldPos, input.viewDepth);
     finalColor += diffuse * lightColor * surfaceColor;
     finalColor += ambient * lightColor * surfaceColor;
 
+    //Point and spot lights, only the ones assigned to the cluster this pixel is in
+    uint3 cluster;
+    cluster.xy = min(uint2(input.position.xy * clusterScale.xy), clusterCount.xy - 1);
+    cluster.z = (uint)clamp(log(input.viewDepth) * clusterScale.z + clusterScale.w, 0.0, clusterCount.z - 1.0);
+    uint2 range = clusterRanges[(cluster.z * clusterCount.y + cluster.y) * clusterCount.x + cluster.x];
+
+    float3 localLight = 0;
+    for (uint i = 0; i < range.y; i++)
+    {
+        Light light = lights[clusterLightIndices[range.x + i]];
+        float3 toLight = light.position - input.worldPos;
+        float distance = length(toLight);
+        toLight /= max(distance, 0.0001);
+
+        //Inverse square falloff windowed to reach zero at the light's range
+        float window = saturate(1 - pow(distance / light.range, 4));
+        float attenuation = window * window / (distance * distance + 1);
+        float spot = saturate(dot(-toLight, light.direction) * light.spotScale + light.spotOffset);
+        localLight += light.color * (saturate(dot(toLight, normal)) * attenuation * spot);
+    }
+    finalColor.rgb += localLight * surfaceColor.rgb;
+
     finalColor.a = 1;
     return finalColor;
 }
@@ -67,4 +220,39 @@ float4 PShader(PINPUT input) : SV_TARGET
 float4 PSSolid(PINPUT input) : SV_Target
 {
     return outputColor;
-}
\ No newline at end of file
+}
+
+//--------------------------------------------------------------------------------------
+// Upscale - stretches the scene, rendered at a fraction of the window size, over the back buffer
+//--------------------------------------------------------------------------------------
+cbuffer UpscaleBuffer : register(b1)
+{
+    float4 sourceRect;      //xy: rendered part of the scene texture in uv, zw: one scene texel in uv
+}
+
+Texture2D sceneColor : register(t5);
+SamplerState upscaleSampler : register(s2);
+
+struct UPSCALEINPUT
+{
+    float4 position : SV_POSITION;
+    float2 tex : TEXCOORD0;
+};
+
+UPSCALEINPUT VUpscale(uint vertexId : SV_VertexID)
+{
+    //One triangle twice the size of the screen, the part outside is clipped
+    float2 corner = float2((vertexId << 1) & 2, vertexId & 2);
+
+    UPSCALEINPUT output;
+    output.position = float4(corner * float2(2, -2) + float2(-1, 1), 0, 1);
+    output.tex = corner * sourceRect.xy;
+    return output;
+}
+
+float4 PUpscale(UPSCALEINPUT input) : SV_TARGET
+{
+    //Keep the bilinear footprint inside the rendered part, past it is last frame's content
+    float2 uv = min(input.tex, sourceRect.xy - 0.5 * sourceRect.zw);
+    return float4(sceneColor.SampleLevel(upscaleSampler, uv, 0).rgb, 1);
+}